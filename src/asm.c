@@ -0,0 +1,1089 @@
+// asm.c - incremental mips assembler
+// each line keeps the words it assembled to (see asm_line) until its text
+// changes. Assembling walks the document once to parse any changed lines
+// and lay everything out, then again to patch in label addresses, but
+// only lines that are new, moved (branches are pc relative) or whose
+// target moved get patched.
+#include "headers/main.h"
+#include "headers/util.h"
+#include "headers/lexmask.h"
+#include "headers/parse.h"
+#include "headers/symbols.h"
+#include "headers/trace.h"
+#include "headers/asm.h"
+#include "headers/macro.h"
+
+#define MAX_MNEMONIC_LENGTH 12
+#define MAX_OPCODES 100
+#define MAX_OPERANDS 4
+#define MAX_OPERAND_PATTERN 8
+
+// registers we use for pseudoinstructions
+#define REG_ZERO 0
+#define REG_AT 1
+
+typedef struct opcode
+{
+	char name[MAX_MNEMONIC_LENGTH];
+	uint32_t base;
+	char pattern[MAX_OPERAND_PATTERN];	// one letter per operand, see opcodes.dat
+} opcode;
+
+static opcode opcodes[MAX_OPCODES];
+static int num_opcodes = 0;
+static unsigned long next_call_id = 0;
+
+static int compare_opcodes(const void* a, const void* b);
+static asm_line* reset_line(docline* line);
+static void parse_asm_line(docline* line);
+static void parse_directive(asm_line* a, char* name, char* rest);
+static void parse_instruction(asm_line* a, char* name, char* rest);
+static bool encode_pseudo(asm_line* a, const char* name, char** ops, int n);
+static bool encode_operand(asm_line* a, char kind, char* op, uint32_t* word);
+static void set_error(asm_line* a, const char* fmt, ...);
+static int split_operands(char* p, char** ops);
+static char* strip_comment_and_labels(char* buf);
+static int parse_register(const char* s);
+static bool parse_number(const char* s, long* value);
+static bool is_label_name(const char* s);
+static bool add_data(asm_line* a, const char* bytes, size_t len);
+static void expand_call(doc* document, docline* line, asm_line* a);
+static void forget_expansion(asm_line* a);
+static void place_line(assembler* as, docline* line, asm_line* a, bool* in_data,
+	uint32_t* text_addr, uint32_t* data_addr);
+static bool link_and_check(assembler* as, asm_line* a);
+static void describe(asm_line* a, char* msg, size_t size);
+static void link_line(assembler* as, asm_line* a);
+static const char* range_error(const asm_line* a, unsigned long target);
+static void append_line(assembler* as, docline* line, asm_line* a);
+static bool append_word(assembler* as, docline* line, uint32_t word);
+static inline void put_word(unsigned char* p, uint32_t word);
+
+int init_assembler()
+{
+	FILE* fptr = fopen("dat/opcodes.dat", "r");
+	if (!fptr)
+		return -1;
+	char line_buf[64];
+	num_opcodes = 0;
+	while (fgets(line_buf, sizeof(line_buf), fptr) && num_opcodes < MAX_OPCODES)
+	{
+		opcode* op = &opcodes[num_opcodes];
+		unsigned int base;
+		if (line_buf[0] == '#')
+			continue;
+		if (sscanf(line_buf, "%11s %x %7s", op->name, &base, op->pattern) != 3)
+			continue;
+		op->base = base;
+		if (strcmp(op->pattern, "-") == 0)
+			op->pattern[0] = '\0';
+		else
+		{
+			// drop the commas, they're just there for people
+			char* out = op->pattern;
+			for (char* p = op->pattern; *p; ++p)
+				if (*p != ',')
+					*out++ = *p;
+			*out = '\0';
+		}
+		++num_opcodes;
+	}
+	fclose(fptr);
+	qsort(opcodes, num_opcodes, sizeof(opcode), compare_opcodes);
+	return 0;
+}
+
+int asm_assemble(doc* document)
+{
+	// bring the text and data images up to date with the document,
+	// returns how many lines have errors
+	assembler* as = document->assembly;
+	if (num_opcodes == 0 && init_assembler() == -1)
+		return -1;
+	if (as == NULL)
+	{
+		as = calloc(1, sizeof(assembler));
+		if (as == NULL)
+			return -1;
+		as->addresses = symtab_new();
+		document->assembly = as;
+	}
+	TRACE_BEGIN(TR_ASSEMBLE, document->number_of_lines);
+	symtab_clear(as->addresses);
+	as->reencoded = 0;
+	as->relinked = 0;
+
+	// lay out every line, parsing the ones that changed
+	uint32_t text_addr = TEXT_BASE, data_addr = DATA_BASE;
+	bool in_data = false, in_macro = false;
+	for (docline* line = document->head; line; line = line->nextline)
+	{
+		if (line->asm_info == NULL || line->asm_info->dirty)
+		{
+			parse_asm_line(line);
+			++as->reencoded;
+		}
+		asm_line* a = line->asm_info;
+		if (a == NULL)
+			continue;
+		a->link_error = NULL;
+		a->placed = !in_macro;
+		if (a->kind == ASM_MACRO_BEGIN)
+			in_macro = true;
+		else if (a->kind == ASM_MACRO_END)
+			in_macro = false;
+		if (!a->placed)
+			continue;
+		if (a->kind == ASM_UNKNOWN || a->kind == ASM_MACRO_CALL)
+			expand_call(document, line, a);
+		place_line(as, line, a, &in_data, &text_addr, &data_addr);
+		for (int i = 0; i < a->expansion_lines; ++i)
+		{
+			docline* child = &a->expansion[i];
+			child->asm_info->link_error = NULL;
+			child->asm_info->placed = true;
+			place_line(as, child, child->asm_info, &in_data, &text_addr, &data_addr);
+		}
+	}
+
+	// patch in addresses and rebuild the images
+	unsigned long main_addr;
+	as->entry = symtab_value(as->addresses, "main", &main_addr) ? main_addr : TEXT_BASE;
+	as->text_words = 0;
+	as->data_size = data_addr - DATA_BASE;
+	if (as->data_size > as->data_capacity)
+	{
+		unsigned char* bigger = realloc(as->data, as->data_size);
+		if (bigger)
+		{
+			as->data = bigger;
+			as->data_capacity = as->data_size;
+		}
+		else
+			as->data_size = 0;
+	}
+	if (as->data_size)
+		memset(as->data, 0, as->data_size);
+	as->errors = 0;
+	as->first_error = NULL;
+	size_t line_number = 1;
+	for (docline* line = document->head; line; line = line->nextline, ++line_number)
+	{
+		asm_line* a = line->asm_info;
+		if (a == NULL || !a->placed)
+			continue;
+		bool ok = link_and_check(as, a);
+		for (int i = 0; i < a->expansion_lines; ++i)
+			ok &= link_and_check(as, a->expansion[i].asm_info);
+		if (!ok)
+		{
+			if (as->errors++ == 0)
+			{
+				as->first_error = line;
+				as->first_error_line = line_number;
+			}
+			continue;
+		}
+		append_line(as, line, a);
+		// a macro's words all belong to the line that called it
+		for (int i = 0; i < a->expansion_lines; ++i)
+			append_line(as, line, a->expansion[i].asm_info);
+	}
+	++as->version;
+	as->doc_version = document->version;
+	TRACE_END(TR_ASSEMBLE, as->reencoded);
+	return as->errors;
+}
+
+void asm_line_changed(docline* line)
+{
+	if (line->asm_info)
+		line->asm_info->dirty = true;
+}
+
+void asm_forget_line(docline* line)
+{
+	if (line->asm_info == NULL)
+		return;
+	forget_expansion(line->asm_info);
+	free(line->asm_info->data);
+	free(line->asm_info->error);
+	free(line->asm_info);
+	line->asm_info = NULL;
+}
+
+void asm_free(doc* document)
+{
+	assembler* as = document->assembly;
+	if (as == NULL)
+		return;
+	symtab_free(as->addresses);
+	free(as->text);
+	free(as->text_lines);
+	free(as->data);
+	free(as);
+	document->assembly = NULL;
+}
+
+void asm_describe_line(docline* line, char* msg, size_t size)
+{
+	// what went wrong assembling line, or "" if nothing did
+	asm_line* a = line->asm_info;
+	msg[0] = '\0';
+	// macro bodies only get assembled where they're called
+	if (a == NULL || !a->placed)
+		return;
+	describe(a, msg, size);
+	for (int i = 0; i < a->expansion_lines && msg[0] == '\0'; ++i)
+	{
+		char inner[MAX_DEBUG_MSG];
+		describe(a->expansion[i].asm_info, inner, sizeof(inner));
+		if (inner[0])
+			snprintf(msg, size, "In %s, line %d: %s", a->target, i + 1, inner);
+	}
+}
+
+static void describe(asm_line* a, char* msg, size_t size)
+{
+	msg[0] = '\0';
+	if (a->error)
+		snprintf(msg, size, "%s", a->error);
+	else if (a->link_error && a->kind == ASM_UNKNOWN)
+		snprintf(msg, size, "%s '%s'", a->link_error, a->target);
+	else if (a->link_error)
+		snprintf(msg, size, "%s", a->link_error);
+}
+
+static void expand_call(doc* document, docline* line, asm_line* a)
+{
+	// give a macro call the lines it expands to, if the macro changed
+	// since we last did it
+	uint32_t version = macro_call_version(document, line->line);
+	if (version == 0)
+	{
+		// not (or no longer) a call
+		forget_expansion(a);
+		a->kind = ASM_UNKNOWN;
+		return;
+	}
+	if (a->kind == ASM_MACRO_CALL && a->macro_version == version)
+		return;
+	forget_expansion(a);
+	free(a->error);
+	a->error = NULL;
+	a->kind = ASM_MACRO_CALL;
+	a->macro_version = version;
+	a->target[strcspn(a->target, "(")] = '\0';
+	if (a->call_id == 0)
+		a->call_id = ++next_call_id;
+
+	char error[MAX_DEBUG_MSG];
+	int lines;
+	char* text = macro_expand(document, line->line, a->call_id, &lines, error, sizeof(error));
+	if (text == NULL)
+	{
+		set_error(a, "%s", error[0] ? error : "Can't expand macro");
+		return;
+	}
+	a->expansion = calloc(max(lines, 1), sizeof(docline));
+	if (a->expansion == NULL)
+	{
+		free(text);
+		set_error(a, "Out of memory");
+		return;
+	}
+	char* p = text;
+	for (int i = 0; i < lines; ++i)
+	{
+		docline* child = &a->expansion[i];
+		char* end = strchr(p, '\n');
+		*end = '\0';
+		if (end - p >= LINE_LENGTH)
+			set_error(a, "Line %d of %s is too long once expanded", i + 1, a->target);
+		strncpy(child->line, p, LINE_LENGTH - 1);
+		p = end + 1;
+
+		// the labels it defines, packed like parse.c does it
+		char defs[LINE_LENGTH + 2];
+		size_t n = 0;
+		char* q = child->line;
+		for (;;)
+		{
+			while (*q == ' ' || *q == '\t')
+				++q;
+			char* start = q;
+			while (*q && *q != ' ' && *q != '\t' && *q != ':' && *q != '\"')
+				++q;
+			if (*q != ':' || q == start)
+				break;
+			defs[n++] = DEF_LABEL;
+			memcpy(defs + n, start, q - start);
+			n += q - start;
+			defs[n++] = '\0';
+			++q;
+		}
+		defs[n++] = '\0';
+		if (n > 1 && (child->defs = malloc(n)))
+			memcpy(child->defs, defs, n);
+		parse_asm_line(child);
+		++a->expansion_lines;
+	}
+	free(text);
+}
+
+static void forget_expansion(asm_line* a)
+{
+	for (int i = 0; i < a->expansion_lines; ++i)
+	{
+		free(a->expansion[i].defs);
+		asm_forget_line(&a->expansion[i]);
+	}
+	free(a->expansion);
+	a->expansion = NULL;
+	a->expansion_lines = 0;
+}
+
+static void place_line(assembler* as, docline* line, asm_line* a, bool* in_data,
+	uint32_t* text_addr, uint32_t* data_addr)
+{
+	// give a line its address and note the labels it defines
+	if (a->kind == ASM_TEXT)
+		*in_data = false;
+	else if (a->kind == ASM_DATA)
+		*in_data = true;
+	else if (a->kind == ASM_INSTRUCTION && *in_data)
+		a->link_error = "Instruction outside of .text";
+	else if (a->kind == ASM_BYTES && !*in_data)
+		a->link_error = "Data outside of .data";
+	else if (a->kind == ASM_UNKNOWN)
+		a->link_error = "Unknown instruction";
+
+	uint32_t* addr = *in_data ? data_addr : text_addr;
+	if (a->align > 1)
+		*addr = (*addr + a->align - 1) & ~(uint32_t)(a->align - 1);
+	if (a->addr != *addr)
+	{
+		a->addr = *addr;
+		a->moved = true;
+	}
+	if (a->link_error == NULL)
+		*addr += a->size;
+	for (const char* p = line->defs; p && *p; p += strlen(p) + 1)
+	{
+		// the first definition wins, diagnostics complain about the rest
+		if (p[0] == DEF_LABEL && !symtab_contains(as->addresses, p + 1))
+			symtab_set_value(as->addresses, p + 1, a->addr);
+	}
+}
+
+static bool link_and_check(assembler* as, asm_line* a)
+{
+	// patch in a's target, returns false if the line has a problem
+	if (a->fixup != FIX_NONE && a->link_error == NULL && a->error == NULL)
+		link_line(as, a);
+	a->moved = false;
+	return a->error == NULL && a->link_error == NULL;
+}
+
+static void link_line(assembler* as, asm_line* a)
+{
+	unsigned long target;
+	if (!symtab_value(as->addresses, a->target, &target))
+	{
+		a->link_error = "Undefined label";
+		return;
+	}
+	// every assemble clears link_error, so this is checked even when
+	// the words are already patched
+	a->link_error = range_error(a, target);
+	// branches move with us, everything else only cares about the target
+	if (target == a->resolved && !(a->moved && a->fixup == FIX_BRANCH))
+		return;
+	a->resolved = target;
+	uint32_t before[MAX_EXPANSION];
+	memcpy(before, a->words, sizeof(before));
+
+	uint32_t* w = a->words + (a->fixup == FIX_WORD ? 0 : a->fix_index);
+	switch (a->fixup)
+	{
+	case FIX_BRANCH:
+	{
+		long offset = ((long)target - (long)(a->addr + 4 * a->fix_index + 4)) >> 2;
+		w[0] = (w[0] & 0xffff0000) | (offset & 0xffff);
+		break;
+	}
+	case FIX_JUMP:
+		w[0] = (w[0] & 0xfc000000) | ((target >> 2) & 0x03ffffff);
+		break;
+	case FIX_HI_LO:
+		w[0] = (w[0] & 0xffff0000) | (target >> 16);
+		w[1] = (w[1] & 0xffff0000) | (target & 0xffff);
+		break;
+	case FIX_HI_LO_SIGNED:
+		w[0] = (w[0] & 0xffff0000) | (((target + 0x8000) >> 16) & 0xffff);
+		w[1] = (w[1] & 0xffff0000) | (target & 0xffff);
+		break;
+	case FIX_WORD:
+		put_word(a->data + 4 * a->fix_index, target);
+		++as->relinked;
+		return;
+	}
+	// a branch that moved along with its target didn't really change
+	if (memcmp(before, a->words, sizeof(before)) != 0)
+		++as->relinked;
+}
+
+static const char* range_error(const asm_line* a, unsigned long target)
+{
+	// can a's branch or jump reach target?
+	if (a->fixup == FIX_BRANCH)
+	{
+		long offset = ((long)target - (long)(a->addr + 4 * a->fix_index + 4)) >> 2;
+		if (offset < -32768 || offset > 32767)
+			return "Branch target out of range";
+	}
+	else if (a->fixup == FIX_JUMP && (target & 0xf0000000) != ((a->addr + 4) & 0xf0000000))
+		return "Jump target out of range";
+	return NULL;
+}
+
+static void append_line(assembler* as, docline* line, asm_line* a)
+{
+	if (a->kind == ASM_BYTES)
+	{
+		if (a->data && a->addr - DATA_BASE + a->size <= as->data_size)
+			memcpy(as->data + (a->addr - DATA_BASE), a->data, a->size);
+		return;
+	}
+	if (a->kind == ASM_ALIGN && a->addr < DATA_BASE)
+	{
+		// .align in .text, nops up to where the next instruction goes so
+		// text[(pc - TEXT_BASE) / 4] is still the word at pc
+		while (as->text_words < (a->addr - TEXT_BASE) / 4)
+			if (!append_word(as, line, 0))
+				return;
+		return;
+	}
+	if (a->kind != ASM_INSTRUCTION)
+		return;
+	for (int i = 0; i < a->num_words; ++i)
+		if (!append_word(as, line, a->words[i]))
+			return;
+}
+
+static bool append_word(assembler* as, docline* line, uint32_t word)
+{
+	if (as->text_words == as->text_capacity)
+	{
+		size_t capacity = max(as->text_capacity * 2, (size_t)1024);
+		uint32_t* text = realloc(as->text, capacity * sizeof(uint32_t));
+		if (text == NULL)
+			return false;
+		as->text = text;
+		docline** lines = realloc(as->text_lines, capacity * sizeof(docline*));
+		if (lines == NULL)
+			return false;
+		as->text_lines = lines;
+		as->text_capacity = capacity;
+	}
+	as->text[as->text_words] = word;
+	as->text_lines[as->text_words++] = line;
+	return true;
+}
+
+static asm_line* reset_line(docline* line)
+{
+	// an empty asm_line for line, reusing the old one
+	asm_line* a = line->asm_info;
+	if (a == NULL)
+	{
+		a = calloc(1, sizeof(asm_line));
+		line->asm_info = a;
+		return a;
+	}
+	uint32_t addr = a->addr;
+	unsigned long call_id = a->call_id;
+	forget_expansion(a);
+	free(a->data);
+	free(a->error);
+	memset(a, 0, sizeof(asm_line));
+	a->addr = addr;
+	a->call_id = call_id;
+	return a;
+}
+
+static void parse_asm_line(docline* line)
+{
+	char buf[LINE_LENGTH + 1];
+	asm_line* a = reset_line(line);
+	if (a == NULL)
+		return;
+	a->align = 1;
+	strncpy(buf, line->line, LINE_LENGTH);
+	buf[LINE_LENGTH] = '\0';
+
+	char* p = strip_comment_and_labels(buf);
+	if (*p == '\0')
+		return;
+	char* name = p;
+	while (*p && *p != ' ' && *p != '\t')
+		++p;
+	if (*p)
+		*p++ = '\0';
+	if (name[0] == '.')
+		parse_directive(a, name, p);
+	else
+		parse_instruction(a, name, p);
+	// words for lines with a target are finished off in link_line
+	a->resolved = ~0UL;
+}
+
+static void parse_directive(asm_line* a, char* name, char* rest)
+{
+	char* ops[LINE_LENGTH];
+	long value;
+	if (strcmp(name, ".text") == 0)
+		a->kind = ASM_TEXT;
+	else if (strcmp(name, ".data") == 0)
+		a->kind = ASM_DATA;
+	else if (strcmp(name, ".macro") == 0)
+		a->kind = ASM_MACRO_BEGIN;
+	else if (strcmp(name, ".end_macro") == 0)
+		a->kind = ASM_MACRO_END;
+	else if (strcmp(name, ".globl") == 0 || strcmp(name, ".global") == 0 ||
+	         strcmp(name, ".extern") == 0 || strcmp(name, ".ent") == 0 ||
+	         strcmp(name, ".end") == 0 || strcmp(name, ".set") == 0)
+		a->kind = ASM_EMPTY;
+	else if (strcmp(name, ".align") == 0)
+	{
+		a->kind = ASM_ALIGN;
+		if (split_operands(rest, ops) != 1 || !parse_number(ops[0], &value) || value < 0 || value > 3)
+			set_error(a, ".align takes 0, 1, 2 or 3");
+		else
+			a->align = 1 << value;
+	}
+	else if (strcmp(name, ".space") == 0)
+	{
+		a->kind = ASM_BYTES;
+		if (split_operands(rest, ops) != 1 || !parse_number(ops[0], &value) || value < 0 || value > 0x100000)
+			set_error(a, ".space takes a size in bytes");
+		else
+			a->size = value;
+	}
+	else if (strcmp(name, ".byte") == 0 || strcmp(name, ".half") == 0 || strcmp(name, ".word") == 0)
+	{
+		int width = name[1] == 'b' ? 1 : name[1] == 'h' ? 2 : 4;
+		int n = split_operands(rest, ops);
+		a->kind = ASM_BYTES;
+		a->align = width;
+		if (n == 0)
+			set_error(a, "%s needs at least one value", name);
+		for (int i = 0; i < n && a->error == NULL; ++i)
+		{
+			unsigned char bytes[4];
+			if (width == 4 && is_label_name(ops[i]))
+			{
+				if (a->fixup != FIX_NONE)
+				{
+					set_error(a, "Only one label per line");
+					break;
+				}
+				a->fixup = FIX_WORD;
+				a->fix_index = i;
+				strncpy(a->target, ops[i], MAX_SYMBOL_LENGTH - 1);
+				value = 0;
+			}
+			else if (!parse_number(ops[i], &value))
+			{
+				set_error(a, "Bad value '%s'", ops[i]);
+				break;
+			}
+			else if (width < 4 && (value < -(1L << (8 * width - 1)) || value >= 1L << 8 * width))
+			{
+				// signed or unsigned, as long as it fits
+				set_error(a, "Value '%s' out of range", ops[i]);
+				break;
+			}
+			put_word(bytes, value);
+			add_data(a, (const char*)bytes, width);
+		}
+	}
+	else if (strcmp(name, ".ascii") == 0 || strcmp(name, ".asciiz") == 0)
+	{
+		char str[LINE_LENGTH];
+		size_t len = 0;
+		a->kind = ASM_BYTES;
+		while (*rest == ' ' || *rest == '\t')
+			++rest;
+		if (*rest++ != '\"')
+		{
+			set_error(a, "%s needs a quoted string", name);
+			return;
+		}
+		for (; *rest && *rest != '\"'; ++rest)
+		{
+			char ch = *rest;
+			if (ch == '\\' && rest[1])
+			{
+				++rest;
+				ch = *rest == 'n' ? '\n' : *rest == 't' ? '\t' : *rest == '0' ? '\0' : *rest;
+			}
+			str[len++] = ch;
+		}
+		if (*rest != '\"')
+		{
+			set_error(a, "Unterminated string");
+			return;
+		}
+		if (name[6] == 'z')
+			str[len++] = '\0';
+		add_data(a, str, len);
+	}
+	else
+		set_error(a, "Unsupported directive %s", name);
+}
+
+static void parse_instruction(asm_line* a, char* name, char* rest)
+{
+	char upper[MAX_MNEMONIC_LENGTH];
+	char* ops[LINE_LENGTH];
+	a->kind = ASM_INSTRUCTION;
+	if (strlen(name) >= MAX_MNEMONIC_LENGTH)
+	{
+		a->kind = ASM_UNKNOWN;
+		strncpy(a->target, name, MAX_SYMBOL_LENGTH - 1);
+		return;
+	}
+	for (int i = 0; ; ++i)
+	{
+		upper[i] = toupper((unsigned char)name[i]);
+		if (name[i] == '\0')
+			break;
+	}
+	int n = split_operands(rest, ops);
+	if (n > MAX_OPERANDS && !is_keyword(name))
+	{
+		// too many for an instruction, but fine for a macro
+		a->kind = ASM_UNKNOWN;
+		strncpy(a->target, name, MAX_SYMBOL_LENGTH - 1);
+		return;
+	}
+	if (n > MAX_OPERANDS)
+	{
+		set_error(a, "Too many operands");
+		return;
+	}
+	if (encode_pseudo(a, upper, ops, n))
+		return;
+
+	const opcode* op = bsearch(upper, opcodes, num_opcodes, sizeof(opcode), compare_opcodes);
+	if (op == NULL)
+	{
+		if (is_keyword(name))
+			set_error(a, "%s isn't supported by the assembler", upper);
+		else
+		{
+			// might be a macro, that depends on the rest of the document
+			a->kind = ASM_UNKNOWN;
+			strncpy(a->target, name, MAX_SYMBOL_LENGTH - 1);
+		}
+		return;
+	}
+	int wanted = strlen(op->pattern);
+	if (n != wanted)
+	{
+		set_error(a, "%s takes %d operand%s", upper, wanted, wanted == 1 ? "" : "s");
+		return;
+	}
+	a->num_words = 1;
+	a->words[0] = op->base;
+	for (int i = 0; i < n; ++i)
+	{
+		if (!encode_operand(a, op->pattern[i], ops[i], &a->words[0]))
+			return;
+	}
+	a->size = 4 * a->num_words;
+}
+
+static bool encode_operand(asm_line* a, char kind, char* op, uint32_t* word)
+{
+	// fill in one operand of word, or set an error and return false
+	long value;
+	int reg;
+	switch (kind)
+	{
+	case 'd':
+	case 's':
+	case 't':
+	case 'D':
+		reg = parse_register(op);
+		if (reg < 0)
+		{
+			set_error(a, "Expected a register, not '%s'", op);
+			return false;
+		}
+		if (kind == 'D')
+			*word |= reg << 11 | reg << 16;
+		else
+			*word |= reg << (kind == 'd' ? 11 : kind == 's' ? 21 : 16);
+		return true;
+	case 'h':
+		if (!parse_number(op, &value) || value < 0 || value > 31)
+		{
+			set_error(a, "Shift amount must be 0 to 31");
+			return false;
+		}
+		*word |= value << 6;
+		return true;
+	case 'i':
+	case 'u':
+		if (!parse_number(op, &value) || value < (kind == 'i' ? -32768 : 0) ||
+		        value > (kind == 'i' ? 32767 : 65535))
+		{
+			set_error(a, "Immediate '%s' out of range", op);
+			return false;
+		}
+		*word |= value & 0xffff;
+		return true;
+	case 'o':
+	{
+		// offset(base), (base), or a label we load through $at
+		char* paren = strchr(op, '(');
+		if (paren == NULL && is_label_name(op))
+		{
+			a->words[1] = *word | (REG_AT << 21);
+			a->words[0] = 0x3c000000 | (REG_AT << 16);		// lui $at, hi
+			a->num_words = 2;
+			a->fixup = FIX_HI_LO_SIGNED;
+			strncpy(a->target, op, MAX_SYMBOL_LENGTH - 1);
+			return true;
+		}
+		value = 0;
+		reg = REG_ZERO;
+		if (paren)
+		{
+			char* close = strchr(paren, ')');
+			*paren = '\0';
+			if (close)
+				*close = '\0';
+			reg = parse_register(paren + 1);
+			if (close == NULL || close[1] != '\0' || reg < 0)
+			{
+				set_error(a, "Expected offset($register)");
+				return false;
+			}
+		}
+		if (op[0] != '\0' && (!parse_number(op, &value) || value < -32768 || value > 32767))
+		{
+			set_error(a, "Bad offset '%s'", op);
+			return false;
+		}
+		*word |= (reg << 21) | (value & 0xffff);
+		return true;
+	}
+	case 'b':
+	case 'j':
+		if (is_label_name(op))
+		{
+			a->fixup = kind == 'b' ? FIX_BRANCH : FIX_JUMP;
+			a->fix_index = word - a->words;
+			strncpy(a->target, op, MAX_SYMBOL_LENGTH - 1);
+			return true;
+		}
+		if (!parse_number(op, &value))
+		{
+			set_error(a, "Expected a label, not '%s'", op);
+			return false;
+		}
+		*word |= kind == 'b' ? (value & 0xffff) : ((value >> 2) & 0x03ffffff);
+		return true;
+	}
+	return false;
+}
+
+static bool encode_pseudo(asm_line* a, const char* name, char** ops, int n)
+{
+	// expand the pseudoinstructions we know into real ones, false if
+	// name isn't one (or is a real instruction used normally)
+	uint32_t* w = a->words;
+	int r[MAX_OPERANDS];
+	long value = 0;
+	// how each pseudoinstruction's operands look, and what it turns into
+	static const struct
+	{
+		const char* name;
+		const char* pattern;
+	} pseudos[] = {
+		{"B", "b"}, {"BAL", "b"}, {"BEQZ", "rb"}, {"BNEZ", "rb"},
+		{"BGE", "rrb"}, {"BGEU", "rrb"}, {"BGT", "rrb"}, {"BGTU", "rrb"},
+		{"BLE", "rrb"}, {"BLEU", "rrb"}, {"BLT", "rrb"}, {"BLTU", "rrb"},
+		{"CLEAR", "r"}, {"DIV", "rrr"}, {"DIVU", "rrr"}, {"LA", "rl"},
+		{"LI", "rn"}, {"MOVE", "rr"}, {"NEG", "rr"}, {"NEGU", "rr"},
+		{"NOT", "rr"}, {"REM", "rrr"}, {"REMU", "rrr"}
+	};
+	int which = -1;
+	for (size_t i = 0; i < sizeof(pseudos) / sizeof(pseudos[0]); ++i)
+	{
+		// div and divu are only pseudoinstructions with three operands
+		if (strcmp(name, pseudos[i].name) == 0 && (name[0] != 'D' || n == 3))
+		{
+			which = i;
+			break;
+		}
+	}
+	if (which == -1)
+		return false;
+
+	const char* pattern = pseudos[which].pattern;
+	if (n != (int)strlen(pattern))
+	{
+		set_error(a, "%s takes %d operand%s", name, (int)strlen(pattern), strlen(pattern) == 1 ? "" : "s");
+		return true;
+	}
+	for (int i = 0; i < n; ++i)
+	{
+		if (pattern[i] == 'r' && (r[i] = parse_register(ops[i])) < 0)
+		{
+			set_error(a, "Expected a register, not '%s'", ops[i]);
+			return true;
+		}
+		if (pattern[i] == 'n' && !parse_number(ops[i], &value))
+		{
+			set_error(a, "Expected a number, not '%s'", ops[i]);
+			return true;
+		}
+		if ((pattern[i] == 'l' || pattern[i] == 'b') && !is_label_name(ops[i]))
+		{
+			set_error(a, "Expected a label, not '%s'", ops[i]);
+			return true;
+		}
+	}
+
+	a->kind = ASM_INSTRUCTION;
+	a->num_words = 1;
+	if (pattern[n - 1] == 'b' || pattern[n - 1] == 'l')
+		strncpy(a->target, ops[n - 1], MAX_SYMBOL_LENGTH - 1);
+	if (strcmp(name, "B") == 0)
+		w[0] = 0x10000000;									// beq $0, $0
+	else if (strcmp(name, "BAL") == 0)
+		w[0] = 0x04110000;									// bgezal $0
+	else if (strcmp(name, "BEQZ") == 0)
+		w[0] = 0x10000000 | r[0] << 21;
+	else if (strcmp(name, "BNEZ") == 0)
+		w[0] = 0x14000000 | r[0] << 21;
+	else if (name[0] == 'B')
+	{
+		// compare into $at then branch on it
+		bool swap = name[2] == 'T' ? name[1] == 'G' : name[1] == 'L';
+		bool is_unsigned = name[3] == 'U';
+		int lhs = swap ? r[1] : r[0], rhs = swap ? r[0] : r[1];
+		w[0] = (is_unsigned ? 0x0000002b : 0x0000002a) | lhs << 21 | rhs << 16 | REG_AT << 11;
+		w[1] = (name[2] == 'T' ? 0x14000000 : 0x10000000) | REG_AT << 21;
+		a->num_words = 2;
+		a->fix_index = 1;
+	}
+	else if (strcmp(name, "CLEAR") == 0)
+		w[0] = 0x00000021 | r[0] << 11;						// addu rd, $0, $0
+	else if (strcmp(name, "MOVE") == 0)
+		w[0] = 0x00000021 | r[1] << 21 | r[0] << 11;		// addu rd, rs, $0
+	else if (strcmp(name, "NEG") == 0 || strcmp(name, "NEGU") == 0)
+		w[0] = (name[3] ? 0x00000023 : 0x00000022) | r[1] << 16 | r[0] << 11;
+	else if (strcmp(name, "NOT") == 0)
+		w[0] = 0x00000027 | r[1] << 21 | r[0] << 11;		// nor rd, rs, $0
+	else if (name[0] == 'D' || name[0] == 'R')
+	{
+		// div/rem then pick the quotient or remainder up
+		bool is_unsigned = name[strlen(name) - 1] == 'U';
+		w[0] = (is_unsigned ? 0x0000001b : 0x0000001a) | r[1] << 21 | r[2] << 16;
+		w[1] = (name[0] == 'D' ? 0x00000012 : 0x00000010) | r[0] << 11;
+		a->num_words = 2;
+	}
+	else if (strcmp(name, "LA") == 0)
+	{
+		w[0] = 0x3c000000 | REG_AT << 16;					// lui $at, hi
+		w[1] = 0x34000000 | REG_AT << 21 | r[0] << 16;		// ori rd, $at, lo
+		a->num_words = 2;
+		a->fixup = FIX_HI_LO;
+	}
+	else if (strcmp(name, "LI") == 0)
+	{
+		if (value < -2147483648L || value > 4294967295L)
+		{
+			set_error(a, "Immediate '%s' out of range", ops[1]);
+			return true;
+		}
+		if (value >= -32768 && value <= 32767)
+			w[0] = 0x24000000 | r[0] << 16 | (value & 0xffff);	// addiu rd, $0, imm
+		else if (value >= 0 && value <= 0xffff)
+			w[0] = 0x34000000 | r[0] << 16 | value;				// ori rd, $0, imm
+		else
+		{
+			w[0] = 0x3c000000 | REG_AT << 16 | ((value >> 16) & 0xffff);
+			w[1] = 0x34000000 | REG_AT << 21 | r[0] << 16 | (value & 0xffff);
+			a->num_words = 2;
+		}
+	}
+	if (pattern[n - 1] == 'b')
+		a->fixup = FIX_BRANCH;
+	a->size = 4 * a->num_words;
+	return true;
+}
+
+static void set_error(asm_line* a, const char* fmt, ...)
+{
+	char msg[MAX_DEBUG_MSG];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	free(a->error);
+	a->error = strdup(msg);
+	a->size = 0;
+	a->num_words = 0;
+	a->fixup = FIX_NONE;
+}
+
+static int split_operands(char* p, char** ops)
+{
+	// split p in place on commas outside of quotes and parens, trimming
+	// each operand, returns how many there were
+	int n = 0, depth = 0;
+	bool in_quotes = false;
+	while (*p == ' ' || *p == '\t')
+		++p;
+	if (*p == '\0')
+		return 0;
+	char* start = p;
+	for (;; ++p)
+	{
+		if (*p == '\'' || *p == '\"')
+			in_quotes = !in_quotes;
+		else if (!in_quotes && *p == '(')
+			++depth;
+		else if (!in_quotes && *p == ')')
+			--depth;
+		if (*p == '\0' || (*p == ',' && depth <= 0 && !in_quotes))
+		{
+			bool last = *p == '\0';
+			char* e = p;
+			while (*start == ' ' || *start == '\t')
+				++start;
+			while (e > start && (e[-1] == ' ' || e[-1] == '\t'))
+				--e;
+			*e = '\0';
+			ops[n++] = start;
+			if (last)
+				return n;
+			start = p + 1;
+		}
+	}
+}
+
+static char* strip_comment_and_labels(char* buf)
+{
+	// drop the comment and any leading "label:"s, returning what's left
+	line_masks m;
+	uint64_t quoted[MASK_WORDS];
+	bool unterminated;
+	classify_line(buf, &m);
+	buf[mask_quotes(&m, buf, quoted, &unterminated)] = '\0';
+	char* p = buf;
+	for (;;)
+	{
+		while (*p == ' ' || *p == '\t')
+			++p;
+		char* start = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != ':' && *p != '\"')
+			++p;
+		if (*p != ':' || p == start)
+			return start;
+		++p;
+	}
+}
+
+static int parse_register(const char* s)
+{
+	// $0..$31 or $name, -1 if s isn't a register
+	if (s[0] != '$')
+		return -1;
+	++s;
+	if (isdigit((unsigned char)s[0]))
+	{
+		char* end;
+		long reg = strtol(s, &end, 10);
+		return (*end == '\0' && reg >= 0 && reg < 32) ? reg : -1;
+	}
+	if (strcmp(s, "s8") == 0)
+		return 30;
+	for (int i = 0; i < 32; ++i)
+	{
+		if (strcmp(s, register_names[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static bool parse_number(const char* s, long* value)
+{
+	// decimal, hex, octal or a 'c'haracter
+	if (s[0] == '\'')
+	{
+		if (s[1] == '\\' && s[2] && s[3] == '\'' && s[4] == '\0')
+		{
+			*value = s[2] == 'n' ? '\n' : s[2] == 't' ? '\t' : s[2] == '0' ? '\0' : s[2];
+			return true;
+		}
+		if (s[1] && s[2] == '\'' && s[3] == '\0')
+		{
+			*value = (unsigned char)s[1];
+			return true;
+		}
+		return false;
+	}
+	if (s[0] == '\0')
+		return false;
+	char* end;
+	*value = strtol(s, &end, 0);
+	return *end == '\0';
+}
+
+static bool is_label_name(const char* s)
+{
+	if (!(isalpha((unsigned char)s[0]) || s[0] == '_'))
+		return false;
+	for (; *s; ++s)
+	{
+		if (!(isalnum((unsigned char)*s) || *s == '_' || *s == '.'))
+			return false;
+	}
+	return true;
+}
+
+static bool add_data(asm_line* a, const char* bytes, size_t len)
+{
+	unsigned char* data = realloc(a->data, a->size + len);
+	if (data == NULL)
+	{
+		set_error(a, "Out of memory");
+		return false;
+	}
+	memcpy(data + a->size, bytes, len);
+	a->data = data;
+	a->size += len;
+	return true;
+}
+
+static inline void put_word(unsigned char* p, uint32_t word)
+{
+	// the images are little endian, like spim on x86
+	p[0] = word;
+	p[1] = word >> 8;
+	p[2] = word >> 16;
+	p[3] = word >> 24;
+}
+
+static int compare_opcodes(const void* a, const void* b)
+{
+	// works for both a key string and another opcode, name comes first
+	return strcmp((const char*)a, ((const opcode*)b)->name);
+}
@@ -0,0 +1,242 @@
+// changes.c - which lines differ from the file as it was last loaded or
+// saved, for the marks in the gutter. we keep a hash of every saved line,
+// and every line remembers which saved line it matched (if any) and a
+// hash of what it reads now, redone as it's edited. a line that matched
+// and hasn't been touched since is an anchor, and an edit only dirties
+// the run of lines between the anchors either side of it, so working the
+// marks out again is a diff of just those lines against the saved lines
+// between the same two anchors, see changes_update
+#include "headers/main.h"
+#include "headers/util.h"
+#include "headers/diff.h"
+#include "headers/changes.h"
+
+static changes* start(doc* document, size_t count);
+static void mark_dirty(changes* c, docline* line);
+static void diff_region(changes* c, docline* first, docline* below);
+static inline bool is_anchor(const docline* line);
+
+void changes_saved(doc* document)
+{
+	// the document as it is now is what's on disk
+	size_t count = 0;
+	for (docline* l = document->head; l != NULL; l = l->nextline)
+		++count;
+	changes* c = start(document, count);
+	if (c == NULL)
+		return;
+	size_t n = 0;
+	for (docline* l = document->head; l != NULL; l = l->nextline)
+	{
+		l->line_hash = fnv_hash(l->line);
+		c->saved[n++] = l->line_hash;
+		l->saved_line = n;
+		l->change = 0;
+	}
+}
+
+void changes_saved_lines(doc* document, char (*lines)[LINE_LENGTH], size_t count)
+{
+	// lines are what's on disk, and the document might not read the
+	// same (it came back from a journal), so everything's dirty
+	changes* c = start(document, count);
+	if (c == NULL)
+		return;
+	for (size_t i = 0; i < count; ++i)
+		c->saved[i] = fnv_hash(lines[i]);
+	for (docline* l = document->head; l != NULL; l = l->nextline)
+	{
+		l->line_hash = fnv_hash(l->line);
+		l->saved_line = 0;
+		l->change = 0;
+	}
+	c->all_dirty = true;
+}
+
+void changes_free(doc* document)
+{
+	changes* c = document->changes;
+	if (c == NULL)
+		return;
+	free(c->saved);
+	free(c->dirty);
+	free(c);
+	document->changes = NULL;
+}
+
+void changes_line_edited(doc* document, docline* line)
+{
+	// line's text changed, or it's new
+	if (document->changes == NULL)
+		return;
+	line->line_hash = fnv_hash(line->line);
+	mark_dirty(document->changes, line);
+}
+
+void changes_line_removed(doc* document, docline* line)
+{
+	// line's about to come out, whatever's next to it has a gap now
+	changes* c = document->changes;
+	if (c == NULL)
+		return;
+	if (line->change & CHANGE_DIRTY)
+	{
+		for (size_t i = 0; i < c->num_dirty; ++i)
+		{
+			if (c->dirty[i] != line)
+				continue;
+			c->dirty[i] = c->dirty[--c->num_dirty];
+			break;
+		}
+	}
+	line->change = 0;
+	docline* neighbour = line->nextline ? line->nextline : line->prevline;
+	if (neighbour)
+		mark_dirty(c, neighbour);
+}
+
+void changes_update(doc* document)
+{
+	// work the marks out again for the lines that have been edited
+	changes* c = document->changes;
+	if (c == NULL || (c->num_dirty == 0 && !c->all_dirty))
+		return;
+	if (c->all_dirty)
+		diff_region(c, document->head, NULL);
+	else
+	{
+		for (size_t i = 0; i < c->num_dirty; ++i)
+		{
+			docline* line = c->dirty[i];
+			if (!(line->change & CHANGE_DIRTY))
+				continue;		// a region before this one took it in
+			docline* first = line;
+			while (first->prevline && !is_anchor(first->prevline))
+				first = first->prevline;
+			docline* last = line;
+			while (last->nextline && !is_anchor(last->nextline))
+				last = last->nextline;
+			diff_region(c, first, last->nextline);
+		}
+	}
+	c->num_dirty = 0;
+	c->all_dirty = false;
+}
+
+static changes* start(doc* document, size_t count)
+{
+	// an empty set of saved lines with room for count
+	changes* c = document->changes;
+	if (c == NULL)
+	{
+		c = calloc(1, sizeof(changes));
+		if (c == NULL)
+			return NULL;
+		c->dirty = malloc(CHANGES_MAX_DIRTY * sizeof(docline*));
+		if (c->dirty == NULL)
+		{
+			free(c);
+			return NULL;
+		}
+		document->changes = c;
+	}
+	free(c->saved);
+	c->saved = malloc(max(count, (size_t)1) * sizeof(uint32_t));
+	if (c->saved == NULL)
+	{
+		changes_free(document);
+		return NULL;
+	}
+	c->num_saved = count;
+	c->num_dirty = 0;
+	c->all_dirty = false;
+	c->removed_at_end = false;
+	return c;
+}
+
+static void mark_dirty(changes* c, docline* line)
+{
+	if (line->change & CHANGE_DIRTY)
+		return;
+	line->change |= CHANGE_DIRTY;
+	if (c->num_dirty == CHANGES_MAX_DIRTY)
+		c->all_dirty = true;
+	else
+		c->dirty[c->num_dirty++] = line;
+}
+
+static void diff_region(changes* c, docline* first, docline* below)
+{
+	// the lines from first up to the anchor below (or the end) against
+	// the saved lines between the anchor above and below. below gets
+	// the mark if saved lines are missing at the end
+	docline* above = first->prevline;
+	size_t saved_start = above ? above->saved_line : 0;
+	size_t saved_end = below ? below->saved_line - 1 : c->num_saved;
+	if (saved_end < saved_start)
+		saved_end = saved_start;
+	size_t count = 0;
+	for (docline* l = first; l != below; l = l->nextline, ++count)
+		l->change = 0;
+	uint32_t* now = malloc(max(count, (size_t)1) * sizeof(uint32_t));
+	diff_hunk* hunks = NULL;
+	int num_hunks = -1;
+	if (now)
+	{
+		size_t i = 0;
+		for (docline* l = first; l != below; l = l->nextline)
+			now[i++] = l->line_hash;
+		num_hunks = diff_hashes(c->saved + saved_start, saved_end - saved_start,
+			now, count, &hunks);
+	}
+	free(now);
+	diff_hunk everything = { 0, saved_end - saved_start, 0, count };
+	if (num_hunks < 0)
+	{
+		// out of memory, call the whole region changed
+		free(hunks);
+		hunks = &everything;
+		num_hunks = 1;
+	}
+
+	// lines before a hunk match the saved lines before it one for one,
+	// a hunk's lines take the place of its saved lines then are extra.
+	// the marks were cleared as we counted
+	if (below)
+		below->change &= ~CHANGE_REMOVED;
+	else
+		c->removed_at_end = false;
+	docline* l = first;
+	size_t b = 0;
+	size_t a = 0;
+	for (int h = 0; h <= num_hunks; ++h)
+	{
+		const diff_hunk* hunk = h < num_hunks ? &hunks[h] : NULL;
+		size_t same_until = hunk ? hunk->b_start : count;
+		for (; b < same_until; ++b, ++a, l = l->nextline)
+			l->saved_line = saved_start + a + 1;
+		if (hunk == NULL)
+			break;
+		for (size_t j = 0; j < hunk->b_len; ++j, ++b, l = l->nextline)
+		{
+			l->saved_line = 0;
+			l->change |= j < hunk->a_len ? CHANGE_EDITED : CHANGE_ADDED;
+		}
+		a = hunk->a_start + hunk->a_len;
+		if (hunk->a_len > hunk->b_len)
+		{
+			// l is below once we're past last
+			if (l)
+				l->change |= CHANGE_REMOVED;
+			else
+				c->removed_at_end = true;
+		}
+	}
+	if (hunks != &everything)
+		free(hunks);
+}
+
+static inline bool is_anchor(const docline* line)
+{
+	return line->saved_line != 0 && !(line->change & (CHANGE_DIRTY | CHANGE_ADDED | CHANGE_EDITED));
+}
@@ -0,0 +1,93 @@
+// complete.c - completion as you type. the instructions and registers
+// every document shares go in one trie made at startup, each document's
+// labels and macros are kept in tries by its symbol tables as they
+// appear and disappear, see symtab_index_prefixes. a lookup is a walk
+// down the prefix and out along the names under it, it never looks at
+// a name that doesn't match
+#include "headers/main.h"
+#include "headers/util.h"
+#include "headers/parse.h"
+#include "headers/symbols.h"
+#include "headers/complete.h"
+
+static trie* words = NULL;
+
+static int complete_from(const trie* t, const char* prefix, trie_match* out, int max,
+	unsigned char kind);
+
+int init_completion()
+{
+	// fill the shared trie, once init_parser has read its tables
+	if (words == NULL)
+		words = trie_new();
+	else
+		trie_clear(words);
+	if (words == NULL)
+		return -1;
+	bool pseudo;
+	const char* word;
+	for (int i = 0; (word = parser_word(i, &pseudo)) != NULL; ++i)
+		trie_add(words, word, pseudo ? COMPLETE_PSEUDO : COMPLETE_INSTRUCTION);
+	for (int i = 0; i < 32; ++i)
+	{
+		// the same case as the instructions, $ZERO and so on
+		char name[8] = "$";
+		for (int j = 0; register_names[i][j]; ++j)
+			name[j + 1] = toupper((unsigned char)register_names[i][j]);
+		trie_add(words, name, COMPLETE_REGISTER);
+	}
+	return 0;
+}
+
+int complete_word(doc* document, const char* prefix, trie_match* out, int max)
+{
+	// up to max names starting with prefix, the document's labels and
+	// macros first. instructions and registers match in either case and
+	// come back in the case the prefix was typed in
+	int found = 0;
+	if (document->labels)
+		found += complete_from(document->labels->prefixes, prefix, out + found, max - found, COMPLETE_LABEL);
+	if (document->macros)
+		found += complete_from(document->macros->prefixes, prefix, out + found, max - found, COMPLETE_MACRO);
+	if (words == NULL || found == max)
+		return found;
+
+	char upper[MAX_SYMBOL_LENGTH];
+	bool lower = true, seen_letter = false;
+	size_t i;
+	for (i = 0; prefix[i] && i < MAX_SYMBOL_LENGTH - 1; ++i)
+	{
+		if (isalpha((unsigned char)prefix[i]) && !seen_letter)
+		{
+			lower = islower((unsigned char)prefix[i]);
+			seen_letter = true;
+		}
+		upper[i] = toupper((unsigned char)prefix[i]);
+	}
+	upper[i] = '\0';
+	if (prefix[i])
+		return found;
+	int n = complete_from(words, upper, out + found, max - found, 0);
+	for (int j = found; j < found + n && lower; ++j)
+		for (char* c = out[j].name; *c; ++c)
+			*c = tolower((unsigned char)*c);
+	return found + n;
+}
+
+bool is_completion_char(char c)
+{
+	// can c be part of a word we'd complete?
+	return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static int complete_from(const trie* t, const char* prefix, trie_match* out, int max,
+	unsigned char kind)
+{
+	// kind 0 keeps the tags the trie has
+	if (t == NULL || max <= 0)
+		return 0;
+	int n = trie_complete(t, prefix, out, max);
+	for (int i = 0; i < n && kind; ++i)
+		out[i].tag = kind;
+	return n;
+}
@@ -0,0 +1,335 @@
+// diag.c - diagnostics that need more than a single line to work out
+// each line remembers the label it branches/jumps to and whether its
+// operand count is wrong, the document keeps running totals. Whether a
+// line's label is undefined (or its own label is a duplicate) is looked
+// up in the symbol tables when asked, so editing one line never means
+// revisiting every line that mentions the same label.
+#include "headers/main.h"
+#include "headers/parse.h"
+#include "headers/symbols.h"
+#include "headers/diag.h"
+
+#define MAX_MNEMONIC_LENGTH 12
+#define MAX_OPERAND_RULES 200
+
+typedef struct operand_rule
+{
+	char name[MAX_MNEMONIC_LENGTH];
+	unsigned char min;
+	unsigned char max;
+	bool label;				// last operand may be a label
+} operand_rule;
+
+typedef struct line_analysis
+{
+	const operand_rule* rule;	// NULL if this isn't an instruction we know
+	int operands;
+	bool empty_operand;			// ie. "add $t0, , $t1" or a trailing comma
+	char target[MAX_SYMBOL_LENGTH];
+} line_analysis;
+
+static operand_rule rules[MAX_OPERAND_RULES];
+static int num_rules = 0;
+
+static int compare_rules(const void* a, const void* b);
+static void analyze_line(const char* text, line_analysis* a);
+static bool is_identifier(const char* s);
+static void add_ref(doc* document, const char* name);
+static void remove_ref(doc* document, const char* name);
+static inline size_t duplicate_weight(int count);
+
+int init_diagnostics()
+{
+	FILE* fptr = fopen("dat/operands.dat", "r");
+	if (!fptr)
+		return -1;
+	char line_buf[64];
+	num_rules = 0;
+	while (fgets(line_buf, sizeof(line_buf), fptr) && num_rules < MAX_OPERAND_RULES)
+	{
+		if (line_buf[0] == '#')
+			continue;
+		char name[MAX_MNEMONIC_LENGTH];
+		char flag[4] = {0};
+		int min, max;
+		if (sscanf(line_buf, "%11s %d %d %3s", name, &min, &max, flag) < 3)
+			continue;
+		strcpy(rules[num_rules].name, name);
+		rules[num_rules].min = min;
+		rules[num_rules].max = max;
+		rules[num_rules].label = flag[0] == 'L';
+		++num_rules;
+	}
+	fclose(fptr);
+	qsort(rules, num_rules, sizeof(operand_rule), compare_rules);
+	return 0;
+}
+
+void diag_reset(doc* document)
+{
+	if (document->diags == NULL)
+	{
+		document->diags = calloc(1, sizeof(diagnostics));
+		if (document->diags == NULL)
+			return;
+		document->diags->refs = symtab_new();
+	}
+	else
+	{
+		symtab_clear(document->diags->refs);
+	}
+	document->diags->undefined = 0;
+	document->diags->duplicates = 0;
+	document->diags->bad_operands = 0;
+}
+
+void diag_free(doc* document)
+{
+	if (document->diags == NULL)
+		return;
+	symtab_free(document->diags->refs);
+	free(document->diags);
+	document->diags = NULL;
+}
+
+void diag_line_changed(doc* document, docline* line)
+{
+	line_analysis a;
+	if (document->diags == NULL)
+		return;
+	analyze_line(line->line, &a);
+
+	unsigned char flags = 0;
+	if (a.rule && (a.empty_operand || a.operands < a.rule->min || a.operands > a.rule->max))
+		flags |= DIAG_OPERANDS;
+	if ((flags & DIAG_OPERANDS) && !(line->diag & DIAG_OPERANDS))
+		++document->diags->bad_operands;
+	else if (!(flags & DIAG_OPERANDS) && (line->diag & DIAG_OPERANDS))
+		--document->diags->bad_operands;
+	line->diag = flags;
+
+	const char* old = line->label_ref ? line->label_ref : "";
+	if (strcmp(old, a.target) == 0)
+		return;
+	if (line->label_ref)
+		remove_ref(document, line->label_ref);
+	free(line->label_ref);
+	line->label_ref = NULL;
+	if (a.target[0] != '\0')
+	{
+		line->label_ref = strdup(a.target);
+		add_ref(document, a.target);
+	}
+}
+
+void diag_forget_line(doc* document, docline* line)
+{
+	// line is leaving the document
+	if (document->diags == NULL)
+		return;
+	if (line->diag & DIAG_OPERANDS)
+		--document->diags->bad_operands;
+	line->diag = 0;
+	if (line->label_ref)
+		remove_ref(document, line->label_ref);
+	free(line->label_ref);
+	line->label_ref = NULL;
+}
+
+void diag_label_changed(doc* document, const char* name, int old_count, int new_count)
+{
+	// called whenever the number of lines defining a label changes
+	diagnostics* diags = document->diags;
+	if (diags == NULL || old_count == new_count)
+		return;
+	size_t refs = symtab_count(diags->refs, name);
+	if (old_count == 0)
+		diags->undefined -= refs;
+	else if (new_count == 0)
+		diags->undefined += refs;
+	diags->duplicates += duplicate_weight(new_count) - duplicate_weight(old_count);
+}
+
+unsigned char diag_line_flags(doc* document, docline* line)
+{
+	unsigned char flags = line->diag;
+	if (line->label_ref && !symtab_contains(document->labels, line->label_ref))
+		flags |= DIAG_UNDEFINED;
+	for (const char* p = line->defs; p && *p; p += strlen(p) + 1)
+	{
+		if (p[0] == DEF_LABEL && symtab_count(document->labels, p + 1) > 1)
+		{
+			flags |= DIAG_DUPLICATE;
+			break;
+		}
+	}
+	return flags;
+}
+
+void diag_describe_line(doc* document, docline* line, char* msg, size_t size)
+{
+	// human readable version of what's wrong with line, or "" if nothing
+	unsigned char flags = diag_line_flags(document, line);
+	msg[0] = '\0';
+	if (flags & DIAG_UNDEFINED)
+	{
+		snprintf(msg, size, "Undefined label '%s'", line->label_ref);
+	}
+	else if (flags & DIAG_DUPLICATE)
+	{
+		for (const char* p = line->defs; p && *p; p += strlen(p) + 1)
+		{
+			int count = symtab_count(document->labels, p + 1);
+			if (p[0] == DEF_LABEL && count > 1)
+			{
+				snprintf(msg, size, "Label '%s' defined %d times", p + 1, count);
+				break;
+			}
+		}
+	}
+	else if (flags & DIAG_OPERANDS)
+	{
+		line_analysis a;
+		analyze_line(line->line, &a);
+		if (a.rule == NULL)
+			return;
+		if (a.empty_operand)
+			snprintf(msg, size, "%s has an empty operand", a.rule->name);
+		else if (a.rule->min == a.rule->max)
+			snprintf(msg, size, "%s takes %d operand%s, not %d", a.rule->name,
+				a.rule->min, a.rule->min == 1 ? "" : "s", a.operands);
+		else
+			snprintf(msg, size, "%s takes %d to %d operands, not %d", a.rule->name,
+				a.rule->min, a.rule->max, a.operands);
+	}
+}
+
+static void analyze_line(const char* text, line_analysis* a)
+{
+	char buf[LINE_LENGTH + 1];
+	char mnemonic[MAX_MNEMONIC_LENGTH];
+	memset(a, 0, sizeof(line_analysis));
+	strncpy(buf, text, LINE_LENGTH);
+	buf[LINE_LENGTH] = '\0';
+
+	// drop any comment
+	bool in_quotes = false;
+	for (char* p = buf; *p; ++p)
+	{
+		if (*p == '\"')
+			in_quotes = !in_quotes;
+		else if (*p == '#' && !in_quotes)
+		{
+			*p = '\0';
+			break;
+		}
+	}
+
+	// skip over any labels, the next token is the instruction
+	char* p = buf;
+	char* start;
+	for (;;)
+	{
+		while (*p == ' ' || *p == '\t')
+			++p;
+		start = p;
+		while (*p && *p != ' ' && *p != '\t')
+			++p;
+		if (p == start)
+			return;
+		if (p[-1] != ':')
+			break;
+	}
+	if (start[0] == '.' || p - start >= MAX_MNEMONIC_LENGTH)
+		return;		// directive, or too long to be anything we know
+	for (int i = 0; i < p - start; ++i)
+		mnemonic[i] = toupper((unsigned char)start[i]);
+	mnemonic[p - start] = '\0';
+	a->rule = bsearch(mnemonic, rules, num_rules, sizeof(operand_rule), compare_rules);
+	if (a->rule == NULL)
+		return;
+
+	// split the rest on commas that aren't in quotes or parens
+	while (*p == ' ' || *p == '\t')
+		++p;
+	if (*p == '\0')
+		return;
+	char* operand = p;
+	char* last = p;
+	int depth = 0;
+	in_quotes = false;
+	a->operands = 1;
+	for (;; ++p)
+	{
+		if (*p == '\"' || *p == '\'')
+			in_quotes = !in_quotes;
+		else if (!in_quotes && *p == '(')
+			++depth;
+		else if (!in_quotes && *p == ')')
+			--depth;
+		if (*p == '\0' || (*p == ',' && depth <= 0 && !in_quotes))
+		{
+			// trim, and check there's something in this operand
+			char* e = p;
+			while (operand < e && (*operand == ' ' || *operand == '\t'))
+				++operand;
+			while (e > operand && (e[-1] == ' ' || e[-1] == '\t'))
+				--e;
+			if (e == operand)
+				a->empty_operand = true;
+			last = operand;
+			if (*p == '\0')
+			{
+				*e = '\0';
+				break;
+			}
+			++a->operands;
+			operand = p + 1;
+		}
+	}
+
+	if (a->rule->label && is_identifier(last))
+	{
+		strncpy(a->target, last, MAX_SYMBOL_LENGTH - 1);
+		a->target[MAX_SYMBOL_LENGTH - 1] = '\0';
+	}
+}
+
+static bool is_identifier(const char* s)
+{
+	// could this operand be a label? (not a register, number, %param...)
+	if (!(isalpha((unsigned char)s[0]) || s[0] == '_'))
+		return false;
+	for (; *s; ++s)
+	{
+		if (!(isalnum((unsigned char)*s) || *s == '_' || *s == '.'))
+			return false;
+	}
+	return true;
+}
+
+static void add_ref(doc* document, const char* name)
+{
+	if (!symtab_contains(document->labels, name))
+		++document->diags->undefined;
+	symtab_add(document->diags->refs, name);
+}
+
+static void remove_ref(doc* document, const char* name)
+{
+	symtab_remove(document->diags->refs, name);
+	if (!symtab_contains(document->labels, name))
+		--document->diags->undefined;
+}
+
+static inline size_t duplicate_weight(int count)
+{
+	// every definition of a label counts once it isn't unique
+	return count > 1 ? count : 0;
+}
+
+static int compare_rules(const void* a, const void* b)
+{
+	// works for both a key string and another rule, name comes first
+	return strcmp((const char*)a, ((const operand_rule*)b)->name);
+}
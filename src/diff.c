@@ -0,0 +1,214 @@
+// diff.c - line level diffs, see diff_lines
+// myers' O(ND) shortest edit over the lines between what the two sides
+// start and end with, lines are compared by hash first
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "headers/util.h"
+#include "headers/diff.h"
+
+static int shortest_edit(const uint32_t* a_hash, const char* const* a, long a_len,
+	const uint32_t* b_hash, const char* const* b, long b_len, diff_hunk** hunks);
+static inline bool same(const uint32_t* a_hash, const char* const* a, long x,
+	const uint32_t* b_hash, const char* const* b, long y);
+static int add_hunk(diff_hunk** hunks, int* count, int* capacity, long a_start, long a_len,
+	long b_start, long b_len);
+
+static inline bool same(const uint32_t* a_hash, const char* const* a, long x,
+	const uint32_t* b_hash, const char* const* b, long y)
+{
+	return a_hash[x] == b_hash[y] && (a == NULL || b == NULL || strcmp(a[x], b[y]) == 0);
+}
+
+static int add_hunk(diff_hunk** hunks, int* count, int* capacity, long a_start, long a_len,
+	long b_start, long b_len)
+{
+	if (*count == *capacity)
+	{
+		int size = *capacity ? *capacity * 2 : 16;
+		diff_hunk* bigger = realloc(*hunks, size * sizeof(diff_hunk));
+		if (bigger == NULL)
+			return -1;
+		*hunks = bigger;
+		*capacity = size;
+	}
+	(*hunks)[*count] = (diff_hunk){ a_start, a_len, b_start, b_len };
+	++*count;
+	return 0;
+}
+
+int diff_lines(const char* const* a, size_t a_len, const char* const* b, size_t b_len,
+	diff_hunk** hunks)
+{
+	// the hunks that turn a into b, in order, returns how many (with
+	// *hunks to free) or -1 if we ran out of memory
+	*hunks = NULL;
+	size_t prefix = 0;
+	while (prefix < a_len && prefix < b_len && strcmp(a[prefix], b[prefix]) == 0)
+		++prefix;
+	size_t suffix = 0;
+	while (suffix < a_len - prefix && suffix < b_len - prefix &&
+		strcmp(a[a_len - 1 - suffix], b[b_len - 1 - suffix]) == 0)
+		++suffix;
+	a += prefix;
+	b += prefix;
+	long n = a_len - prefix - suffix;
+	long m = b_len - prefix - suffix;
+	if (n == 0 && m == 0)
+		return 0;
+	uint32_t* a_hash = malloc((n + 1) * sizeof(uint32_t));
+	uint32_t* b_hash = malloc((m + 1) * sizeof(uint32_t));
+	int count = -1;
+	if (a_hash && b_hash)
+	{
+		for (long i = 0; i < n; ++i)
+			a_hash[i] = fnv_hash(a[i]);
+		for (long i = 0; i < m; ++i)
+			b_hash[i] = fnv_hash(b[i]);
+		count = shortest_edit(a_hash, a, n, b_hash, b, m, hunks);
+		for (int i = 0; i < count; ++i)
+		{
+			(*hunks)[i].a_start += prefix;
+			(*hunks)[i].b_start += prefix;
+		}
+	}
+	free(a_hash);
+	free(b_hash);
+	return count;
+}
+
+int diff_hashes(const uint32_t* a, size_t a_len, const uint32_t* b, size_t b_len,
+	diff_hunk** hunks)
+{
+	// the same as diff_lines for lines we only have the hashes of,
+	// two lines with the same hash are taken to be the same
+	return shortest_edit(a, NULL, a_len, b, NULL, b_len, hunks);
+}
+
+static int shortest_edit(const uint32_t* a_hash, const char* const* a, long a_len,
+	const uint32_t* b_hash, const char* const* b, long b_len, diff_hunk** hunks)
+{
+	// myers' walk between a and b, comparing the text as well as the
+	// hashes when we have it
+	int count = 0;
+	int capacity = 0;
+	*hunks = NULL;
+
+	long prefix = 0;
+	while (prefix < a_len && prefix < b_len && same(a_hash, a, prefix, b_hash, b, prefix))
+		++prefix;
+	long suffix = 0;
+	while (suffix < a_len - prefix && suffix < b_len - prefix &&
+		same(a_hash, a, a_len - 1 - suffix, b_hash, b, b_len - 1 - suffix))
+		++suffix;
+	a_hash += prefix;
+	b_hash += prefix;
+	if (a)
+		a += prefix;
+	if (b)
+		b += prefix;
+	long n = a_len - prefix - suffix;
+	long m = b_len - prefix - suffix;
+	if (n == 0 && m == 0)
+		return 0;
+	if (n == 0 || m == 0)
+		return add_hunk(hunks, &count, &capacity, prefix, n, prefix, m) ? -1 : count;
+
+	long max_d = n + m < DIFF_MAX_EDITS ? n + m : DIFF_MAX_EDITS;
+	long offset = max_d + 1;
+	long* v = calloc(2 * max_d + 3, sizeof(long));
+	// v for each d, d = 0 starts at 0 and d's takes 2d + 1 after d * d
+	long* trace = NULL;
+	long d;
+	bool found = false;
+	if (v == NULL)
+		goto fail;
+
+	for (d = 0; d <= max_d && !found; ++d)
+	{
+		long* bigger = realloc(trace, (d + 1) * (d + 1) * sizeof(long));
+		if (bigger == NULL)
+			goto fail;
+		trace = bigger;
+		for (long k = -d; k <= d; k += 2)
+		{
+			// furthest we can get on diagonal k, from below or the left
+			long x;
+			if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+				x = v[offset + k + 1];
+			else
+				x = v[offset + k - 1] + 1;
+			long y = x - k;
+			while (x < n && y < m && same(a_hash, a, x, b_hash, b, y))
+			{
+				++x;
+				++y;
+			}
+			v[offset + k] = x;
+			if (x >= n && y >= m)
+				found = true;
+		}
+		memcpy(trace + d * d, v + offset - d, (2 * d + 1) * sizeof(long));
+	}
+
+	if (!found)
+	{
+		// too different to be worth it
+		if (add_hunk(hunks, &count, &capacity, prefix, n, prefix, m))
+			goto fail;
+	}
+	else
+	{
+		// walk back from the end, each step off a diagonal is one line
+		// deleted or inserted, steps next to each other share a hunk
+		long x = n;
+		long y = m;
+		for (--d; d > 0; --d)
+		{
+			long* prev_v = trace + (d - 1) * (d - 1) + (d - 1);
+			long k = x - y;
+			long prev_k = (k == -d || (k != d && prev_v[k - 1] < prev_v[k + 1])) ? k + 1 : k - 1;
+			long prev_x = prev_v[prev_k];
+			long prev_y = prev_x - prev_k;
+			while (x > prev_x && y > prev_y)
+			{
+				--x;
+				--y;
+			}
+			diff_hunk* last = count ? &(*hunks)[count - 1] : NULL;
+			if (last && (long)last->a_start == x && (long)last->b_start == y)
+			{
+				last->a_start = prev_x;
+				last->a_len += x - prev_x;
+				last->b_start = prev_y;
+				last->b_len += y - prev_y;
+			}
+			else if (add_hunk(hunks, &count, &capacity, prev_x, x - prev_x, prev_y, y - prev_y))
+				goto fail;
+			x = prev_x;
+			y = prev_y;
+		}
+		for (int i = 0; i < count / 2; ++i)
+		{
+			diff_hunk tmp = (*hunks)[i];
+			(*hunks)[i] = (*hunks)[count - 1 - i];
+			(*hunks)[count - 1 - i] = tmp;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			(*hunks)[i].a_start += prefix;
+			(*hunks)[i].b_start += prefix;
+		}
+	}
+	free(v);
+	free(trace);
+	return count;
+
+fail:
+	free(v);
+	free(trace);
+	free(*hunks);
+	*hunks = NULL;
+	return -1;
+}
@@ -2,11 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "headers/main.h"
 #include "headers/fileio.h"
+#include "headers/trace.h"
 
 extern char* current_filename;
 static const char* get_filename_from_path(const char* filename);
+static bool split_char(char* line, int* linelen, int ch);
+static bool read_line(FILE* fptr, char* line, int* linelen);
+static void* save_writer(void* arg);
+static void* load_reader(void* arg);
 
 static const char* get_filename_from_path(const char* filename)
 {
@@ -19,21 +28,59 @@ static const char* get_filename_from_path(const char* filename)
 	return ++p;
 }
 
+static bool split_char(char* line, int* linelen, int ch)
+{
+	// add ch to the line we're reading the way we keep it, tabs become
+	// spaces and long lines wrap, true if it ends the line instead
+	if (ch == '\n' || *linelen >= 79)
+	{
+		line[*linelen] = '\0';
+		return true;
+	}
+	else if (ch == '\t')
+	{
+		int tab_target = TAB_DISTANCE - (*linelen % TAB_DISTANCE);
+		for (int i = 0; i < tab_target && *linelen < LINE_LENGTH - 1; ++i)
+			line[(*linelen)++] = ' ';
+	}
+	else
+	{
+		line[(*linelen)++] = ch;
+	}
+	return false;
+}
+
+static bool read_line(FILE* fptr, char* line, int* linelen)
+{
+	// read the next line, returns false if the file ended this line
+	int ch;
+	*linelen = 0;
+	while ((ch = fgetc(fptr)) != EOF)
+	{
+		if (split_char(line, linelen, ch))
+			return true;
+	}
+	line[*linelen] = '\0';
+	return false;
+}
+
 // this should only take a filename and a doc, since we're
 // just filling in information in the doc, such as head and tail
 int load_doc(const char* filename, doc* document)
 {
 	int num_lines = 1;
+	TRACE_BEGIN(TR_LOAD, 0);
 	FILE *fptr = fopen(filename, "r");
 	if (fptr == NULL)
 	{
+		TRACE_END(TR_LOAD, -1);
 		return -1;
 	}
+	TRACE_INSTANT(TR_LOAD, 1);		// opened, start reading
 	if (current_filename)
 		free(current_filename);
 	current_filename = strdup(get_filename_from_path(filename));
 	docline* lastline = NULL;
-	char ch;
 	int linelen = 0;
 	document->number_of_lines = 1;
 	document->number_of_chars = 0;
@@ -41,50 +88,200 @@ int load_doc(const char* filename, doc* document)
 	if (currline == NULL)
 	{
 		// problem with calloc'ing
+		fclose(fptr);
+		TRACE_END(TR_LOAD, -1);
 		return -1;
 	}
 	currline->prevline = NULL;
 	currline->nextline = NULL;
 	document->head = currline;
 
-	for (;;)
+	while (read_line(fptr, currline->line, &linelen))
 	{
-		ch = fgetc(fptr);
-		if (feof(fptr))
+		// create a newline
+		document->number_of_chars += linelen;
+		lastline = currline;
+		currline = calloc(1, sizeof(docline));
+		currline->prevline = lastline;
+		lastline->nextline = currline;
+		++num_lines;
+		++document->number_of_lines;
+	}
+	// end of document
+	document->number_of_chars += linelen;
+	document->tail = currline;
+
+	fclose(fptr);
+	TRACE_END(TR_LOAD, num_lines);
+	return 0;
+}
+
+static void* load_reader(void* arg)
+{
+	// read lines into a chain of our own and hand it over in batches
+	load_job* job = arg;
+	TRACE_BEGIN(TR_LOAD, 0);
+	FILE* fptr = fopen(job->filename, "r");
+	if (fptr == NULL)
+	{
+		pthread_mutex_lock(&job->lock);
+		job->error = errno;
+		job->finished = true;
+		pthread_mutex_unlock(&job->lock);
+		TRACE_END(TR_LOAD, -1);
+		return NULL;
+	}
+	TRACE_INSTANT(TR_LOAD, 1);		// opened, start reading
+	docline* head = NULL;
+	docline* tail = NULL;
+	size_t count = 0;
+	size_t batch = LOAD_FIRST_BATCH;
+	size_t total = 0;
+	int linelen;
+	bool more = true;
+	while (more && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+	{
+		docline* line = calloc(1, sizeof(docline));
+		if (line == NULL)
 		{
-			// end of document
-			document->tail = currline;
+			job->error = ENOMEM;
 			break;
 		}
-		else if (ch == '\n' || linelen >= 79)
+		more = read_line(fptr, line->line, &linelen);
+		line->prevline = tail;
+		if (tail)
+			tail->nextline = line;
+		else
+			head = line;
+		tail = line;
+		if (++count < batch && more)
+			continue;
+		pthread_mutex_lock(&job->lock);
+		if (job->tail)
 		{
-			// create a newline
-			linelen = 0;
-			lastline = currline;
-			currline = calloc(1, sizeof(docline));
-			currline->prevline = lastline;
-			lastline->nextline = currline;
-			++num_lines;
-			++document->number_of_lines;
+			job->tail->nextline = head;
+			head->prevline = job->tail;
 		}
-		else if (ch == '\t')
+		else
+			job->head = head;
+		job->tail = tail;
+		job->lines += count;
+		pthread_mutex_unlock(&job->lock);
+		__atomic_store_n(&job->read, ftello(fptr), __ATOMIC_RELAXED);
+		total += count;
+		head = tail = NULL;
+		count = 0;
+		batch = LOAD_BATCH_LINES;
+	}
+	// only left over if we stopped early
+	docline* next;
+	for (; head; head = next)
+	{
+		next = head->nextline;
+		free(head);
+	}
+	fclose(fptr);
+	pthread_mutex_lock(&job->lock);
+	job->finished = true;
+	pthread_mutex_unlock(&job->lock);
+	TRACE_END(TR_LOAD, total);
+	return NULL;
+}
+
+load_job* load_doc_async(const char* filename)
+{
+	// start reading filename on another thread, load_take hands the
+	// lines over as they come in, returns NULL if we can't start
+	struct stat st;
+	load_job* job = calloc(1, sizeof(load_job));
+	if (job == NULL)
+		return NULL;
+	job->filename = strdup(filename);
+	if (job->filename == NULL)
+	{
+		free(job);
+		return NULL;
+	}
+	if (stat(filename, &st) == 0)
+		job->size = st.st_size;
+	pthread_mutex_init(&job->lock, NULL);
+	if (pthread_create(&job->reader, NULL, load_reader, job) != 0)
+	{
+		pthread_mutex_destroy(&job->lock);
+		free(job->filename);
+		free(job);
+		return NULL;
+	}
+	if (current_filename)
+		free(current_filename);
+	current_filename = strdup(get_filename_from_path(filename));
+	return job;
+}
+
+docline* load_take(load_job* job, docline** last, size_t* count, bool* finished)
+{
+	// the lines read since last time (first to *last, *count of them)
+	// or NULL if there aren't any yet, *finished once that's all of them
+	pthread_mutex_lock(&job->lock);
+	docline* first = job->head;
+	*last = job->tail;
+	*count = job->lines;
+	*finished = job->finished;
+	job->head = job->tail = NULL;
+	job->lines = 0;
+	pthread_mutex_unlock(&job->lock);
+	return first;
+}
+
+int load_finish(load_job* job)
+{
+	// stop reading (if we haven't finished) and throw away whatever
+	// wasn't taken, returns 0 or the errno the read failed with
+	__atomic_store_n(&job->cancel, true, __ATOMIC_RELAXED);
+	pthread_join(job->reader, NULL);
+	int error = job->error;
+	docline* next;
+	for (docline* line = job->head; line; line = next)
+	{
+		next = line->nextline;
+		free(line);
+	}
+	pthread_mutex_destroy(&job->lock);
+	free(job->filename);
+	free(job);
+	return error;
+}
+
+int read_lines(const char* filename, char (**lines)[LINE_LENGTH], size_t* count)
+{
+	// filename's lines as load_doc would split them, without
+	// touching any document, *lines is for the caller to free
+	FILE* fptr = fopen(filename, "r");
+	size_t size = 256;
+	int linelen;
+	bool more = true;
+	*count = 0;
+	*lines = NULL;
+	if (fptr == NULL)
+		return -1;
+	while (more)
+	{
+		if (*count == 0 || *count == size)
 		{
-			int tab_target = TAB_DISTANCE - (linelen % TAB_DISTANCE);
-			for (int i = 0; i < tab_target; ++i)
+			size = *count ? size * 2 : size;
+			char (*bigger)[LINE_LENGTH] = realloc(*lines, size * LINE_LENGTH);
+			if (bigger == NULL)
 			{
-				currline->line[linelen] = ' ';
-				++linelen;
-				++document->number_of_chars;
+				free(*lines);
+				*lines = NULL;
+				fclose(fptr);
+				return -1;
 			}
+			*lines = bigger;
 		}
-		else
-		{
-			currline->line[linelen] = ch;
-			++document->number_of_chars;
-			++linelen;
-		}
+		more = read_line(fptr, (*lines)[*count], &linelen);
+		++*count;
 	}
-
 	fclose(fptr);
 	return 0;
 }
@@ -115,7 +312,14 @@ void save_doc(const char* filename, doc* document)
 {
 	// save a document
 	// go through line by line and write them out to a filename
+	TRACE_BEGIN(TR_SAVE, 0);
 	FILE* fptr = fopen(filename, "w");
+	if (fptr == NULL)
+	{
+		TRACE_END(TR_SAVE, -1);
+		return;
+	}
+	TRACE_INSTANT(TR_SAVE, 1);		// opened, start writing
 	docline* cur = document->head;
 	bool first = true;
 	do
@@ -126,5 +330,171 @@ void save_doc(const char* filename, doc* document)
 		fprintf(fptr, "%s", cur->line);
 		cur = cur->nextline;
 	} while (cur != NULL);
+	TRACE_INSTANT(TR_SAVE, 2);		// written, closing
 	fclose(fptr);
+	TRACE_END(TR_SAVE, document->number_of_lines);
+}
+
+static void* save_writer(void* arg)
+{
+	save_job* job = arg;
+	TRACE_BEGIN(TR_SAVE, 0);
+	FILE* fptr = fopen(job->filename, "w");
+	if (fptr == NULL)
+	{
+		job->error = errno;
+		TRACE_END(TR_SAVE, -1);
+		__atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+		return NULL;
+	}
+	TRACE_INSTANT(TR_SAVE, 1);		// opened, start writing
+	while (job->written < job->len)
+	{
+		size_t chunk = min((size_t)SAVE_CHUNK_SIZE, job->len - job->written);
+		if (fwrite(job->text + job->written, 1, chunk, fptr) != chunk)
+		{
+			job->error = errno;
+			break;
+		}
+		__atomic_store_n(&job->written, job->written + chunk, __ATOMIC_RELAXED);
+	}
+	TRACE_INSTANT(TR_SAVE, 2);		// written, closing
+	if (fclose(fptr) != 0 && job->error == 0)
+		job->error = errno;
+	TRACE_END(TR_SAVE, job->error ? -1 : (long)job->len);
+	__atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+save_job* save_doc_async(const char* filename, doc* document)
+{
+	// copy the text out now, so the document can keep changing
+	// while a thread writes it, returns NULL if we can't start
+	size_t len = 0;
+	for (docline* cur = document->head; cur != NULL; cur = cur->nextline)
+		len += strlen(cur->line) + 1;
+	save_job* job = calloc(1, sizeof(save_job));
+	if (job == NULL)
+		return NULL;
+	job->text = malloc(len);
+	job->filename = strdup(filename);
+	if (job->text == NULL || job->filename == NULL)
+	{
+		save_free(job);
+		return NULL;
+	}
+	char* p = job->text;
+	for (docline* cur = document->head; cur != NULL; cur = cur->nextline)
+	{
+		if (cur != document->head)
+			*p++ = '\n';
+		size_t line_len = strlen(cur->line);
+		memcpy(p, cur->line, line_len);
+		p += line_len;
+	}
+	job->len = p - job->text;
+	job->version = document->version;
+	if (pthread_create(&job->writer, NULL, save_writer, job) != 0)
+	{
+		save_free(job);
+		return NULL;
+	}
+	return job;
+}
+
+bool save_done(save_job* job)
+{
+	return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+int save_finish(save_job* job)
+{
+	// wait for the writer, returns 0 or the errno it failed with
+	pthread_join(job->writer, NULL);
+	free(job->text);
+	job->text = NULL;
+	return job->error;
+}
+
+void save_free(save_job* job)
+{
+	free(job->text);
+	free(job->filename);
+	free(job);
+}
+
+int follow_open(follow_state* follow, const char* filename)
+{
+	// start following filename from the beginning, follow_read
+	// takes it from there
+	follow_close(follow);
+	follow->fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (follow->fd < 0)
+		return -1;
+	follow->filename = strdup(filename);
+	follow->offset = 0;
+	if (current_filename)
+		free(current_filename);
+	current_filename = strdup(get_filename_from_path(filename));
+	return 0;
+}
+
+ssize_t follow_read(follow_state* follow, doc* document, int* new_lines)
+{
+	// add what's been written to the end of the file since last time
+	// onto document's last line, and new lines after it. returns how
+	// many bytes that was, or -1 if the file shrank or was replaced
+	// and has to be read again from the top
+	char buf[FOLLOW_CHUNK_SIZE];
+	struct stat st;
+	struct stat now;
+	ssize_t got;
+	ssize_t total = 0;
+	*new_lines = 0;
+	if (follow->fd < 0 || fstat(follow->fd, &st) != 0)
+		return -1;
+	if (stat(follow->filename, &now) == 0 && now.st_ino != st.st_ino)
+		return -1;
+	if (st.st_size < follow->offset)
+		return -1;
+	if (st.st_size == follow->offset)
+		return 0;
+	TRACE_BEGIN(TR_LOAD, follow->offset);
+	docline* tail = document->tail;
+	int linelen = strlen(tail->line);
+	while ((got = pread(follow->fd, buf, sizeof(buf), follow->offset)) > 0)
+	{
+		for (ssize_t i = 0; i < got; ++i)
+		{
+			int before = linelen;
+			if (!split_char(tail->line, &linelen, buf[i]))
+			{
+				document->number_of_chars += linelen - before;
+				continue;
+			}
+			docline* newline = calloc(1, sizeof(docline));
+			if (newline == NULL)
+				break;
+			newline->prevline = tail;
+			tail->nextline = newline;
+			document->tail = tail = newline;
+			++document->number_of_lines;
+			++*new_lines;
+			linelen = 0;
+		}
+		tail->line[linelen] = '\0';
+		follow->offset += got;
+		total += got;
+	}
+	TRACE_END(TR_LOAD, *new_lines);
+	return total;
+}
+
+void follow_close(follow_state* follow)
+{
+	if (follow->fd >= 0)
+		close(follow->fd);
+	free(follow->filename);
+	follow->fd = -1;
+	follow->filename = NULL;
 }
@@ -0,0 +1,278 @@
+// find.c - fuzzy finding lines as a query is typed, see find_query
+// a line matches if the query's characters are all in it in order, in
+// either case, and scores higher the closer together they are and the
+// more of them start a word. lines that define a label or macro come
+// first. adding a character to the query can only lose lines, so each
+// length of query remembers the lines that still match and the next
+// only looks through those. long documents are split between threads,
+// each keeping its own best few, and where each query character sits
+// in a line comes out of a vector compare per 16 columns, like lexmask.c
+#include "headers/main.h"
+#include "headers/lexmask.h"
+#include "headers/find.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define FIND_CHAR_SCORE 16
+#define FIND_RUN_BONUS 12		// follows on from the character before
+#define FIND_WORD_BONUS 10		// starts a word
+#define FIND_MAX_GAP 8			// most a gap between two characters costs
+#define FIND_DEFINES_BONUS 24	// the line defines a label or macro
+
+// one thread's share of a scan
+typedef struct find_work
+{
+	finder* f;
+	const uint32_t* in;		// the lines to look through, all of them if NULL
+	uint32_t begin;
+	uint32_t end;
+	uint32_t* out;			// matching lines go from out + begin on
+	uint32_t kept;
+	int level;
+	find_hit top[FIND_TOP];
+	int num_top;
+} find_work;
+
+static int scan(finder* f, int level);
+static void* scan_range(void* arg);
+static bool match_line(const docline* line, const char* query, int n, find_hit* hit);
+static void char_columns(const char* line, char c, uint64_t* mask);
+static int last_set_before(const uint64_t* mask, int from, int limit);
+static void keep_hit(find_hit* top, int* num_top, const find_hit* hit);
+
+finder* find_start(doc* document)
+{
+	finder* f = calloc(1, sizeof(finder));
+	if (f == NULL)
+		return NULL;
+	for (docline* line = document->head; line; line = line->nextline)
+		++f->num_lines;
+	f->lines = malloc(max(f->num_lines, 1u) * sizeof(docline*));
+	if (f->lines == NULL)
+	{
+		free(f);
+		return NULL;
+	}
+	uint32_t i = 0;
+	for (docline* line = document->head; line; line = line->nextline)
+		f->lines[i++] = line;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	f->threads = cpus < 1 ? 1 : min(cpus, FIND_MAX_THREADS);
+	return f;
+}
+
+void find_end(finder* f)
+{
+	if (f == NULL)
+		return;
+	for (int i = 0; i <= FIND_MAX_QUERY; ++i)
+		free(f->survivors[i]);
+	free(f->lines);
+	free(f);
+}
+
+int find_query(finder* f, const char* query)
+{
+	// the best lines for query go in f->top, returns how many there
+	// are or -1 if we ran out of memory. only the lines that matched
+	// the start of the query that hasn't changed are looked at again
+	int n = min((int)strlen(query), FIND_MAX_QUERY);
+	int same = 0;
+	while (same < f->levels && same < n && f->query[same] == query[same])
+		++same;
+	memcpy(f->query, query, n);
+	f->query[n] = '\0';
+	f->num_top = 0;
+	if (n == 0)
+	{
+		f->levels = 0;
+		return 0;
+	}
+	// the last level is always scanned again, that's where the scores come from
+	f->levels = min(same, n - 1);
+	while (f->levels < n)
+	{
+		if (scan(f, f->levels + 1) != 0)
+		{
+			f->num_top = 0;
+			return -1;
+		}
+		++f->levels;
+	}
+	return f->num_top;
+}
+
+static int scan(finder* f, int level)
+{
+	// work out survivors[level] from the level before, and the best of them
+	const uint32_t* in = level > 1 ? f->survivors[level - 1] : NULL;
+	uint32_t count = level > 1 ? f->num_survivors[level - 1] : f->num_lines;
+	uint32_t* out = malloc(max(count, 1u) * sizeof(uint32_t));
+	if (out == NULL)
+		return -1;
+	int threads = min(f->threads, (int)(count / FIND_LINES_PER_THREAD) + 1);
+	find_work work[FIND_MAX_THREADS];
+	pthread_t ids[FIND_MAX_THREADS];
+	bool started[FIND_MAX_THREADS] = { false };
+	for (int t = 0; t < threads; ++t)
+	{
+		work[t] = (find_work){ f, in, (uint64_t)count * t / threads,
+			(uint64_t)count * (t + 1) / threads, out, 0, level, { { 0 } }, 0 };
+		if (t > 0)
+			started[t] = pthread_create(&ids[t], NULL, scan_range, &work[t]) == 0;
+	}
+	// this thread takes the first share, and any a thread couldn't start for
+	scan_range(&work[0]);
+	for (int t = 1; t < threads; ++t)
+	{
+		if (started[t])
+			pthread_join(ids[t], NULL);
+		else
+			scan_range(&work[t]);
+	}
+
+	// the shares in order, so earlier lines win ties
+	uint32_t kept = 0;
+	f->num_top = 0;
+	for (int t = 0; t < threads; ++t)
+	{
+		memmove(out + kept, out + work[t].begin, work[t].kept * sizeof(uint32_t));
+		kept += work[t].kept;
+		for (int i = 0; i < work[t].num_top; ++i)
+			keep_hit(f->top, &f->num_top, &work[t].top[i]);
+	}
+	free(f->survivors[level]);
+	f->survivors[level] = out;
+	f->num_survivors[level] = kept;
+	return 0;
+}
+
+static void* scan_range(void* arg)
+{
+	find_work* w = arg;
+	find_hit hit;
+	for (uint32_t i = w->begin; i < w->end; ++i)
+	{
+		uint32_t index = w->in ? w->in[i] : i;
+		if (!match_line(w->f->lines[index], w->f->query, w->level, &hit))
+			continue;
+		hit.index = index;
+		w->out[w->begin + w->kept++] = index;
+		keep_hit(w->top, &w->num_top, &hit);
+	}
+	return NULL;
+}
+
+static bool match_line(const docline* line, const char* query, int n, find_hit* hit)
+{
+	// do the first n characters of query match line, and how well
+	uint64_t columns[FIND_MAX_QUERY][MASK_WORDS];
+	int pos[FIND_MAX_QUERY];
+	int len = strnlen(line->line, LINE_LENGTH);
+	for (int i = 0; i < n; ++i)
+	{
+		char_columns(line->line, query[i], columns[i]);
+		bool any = false;
+		for (int w = 0; w < MASK_WORDS; ++w)
+			any |= columns[i][w] != 0;
+		if (!any)
+			return false;
+	}
+	// each character as early as it can go after the one before...
+	int at = -1;
+	for (int i = 0; i < n; ++i)
+	{
+		at = mask_next_set(columns[i], at + 1, len);
+		if (at == len)
+			return false;
+		pos[i] = at;
+	}
+	// ...then each pulled up as late as it can go before the next,
+	// so they end up as close together as they can be
+	for (int i = n - 2; i >= 0; --i)
+		pos[i] = last_set_before(columns[i], pos[i], pos[i + 1]);
+
+	int score = 0;
+	memset(hit->columns, 0, sizeof(hit->columns));
+	for (int i = 0; i < n; ++i)
+	{
+		int p = pos[i];
+		score += FIND_CHAR_SCORE;
+		if (i > 0 && p == pos[i - 1] + 1)
+			score += FIND_RUN_BONUS;
+		else if (i > 0)
+			score -= min(p - pos[i - 1] - 1, FIND_MAX_GAP);
+		if (p == 0 || strchr(" \t,()$:.#", line->line[p - 1]))
+			score += FIND_WORD_BONUS;
+		if (line->line[p] == query[i])
+			++score;
+		hit->columns[p >> 6] |= 1ULL << (p & 63);
+	}
+	if (line->defs && line->defs[0])
+		score += FIND_DEFINES_BONUS;
+	hit->score = score;
+	return true;
+}
+
+static void char_columns(const char* line, char c, uint64_t* mask)
+{
+	// the columns of line holding c, in either case. it looks at the
+	// whole line, match_line never picks anything past the end of the text
+	char lower = tolower((unsigned char)c);
+	char upper = toupper((unsigned char)c);
+	int col = 0;
+	memset(mask, 0, MASK_WORDS * sizeof(uint64_t));
+#if defined(__SSE2__)
+	__m128i lo = _mm_set1_epi8(lower);
+	__m128i up = _mm_set1_epi8(upper);
+	for (; col + 16 <= LINE_LENGTH; col += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(line + col));
+		unsigned bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lo), _mm_cmpeq_epi8(v, up)));
+		mask[col >> 6] |= (uint64_t)bits << (col & 63);
+	}
+#endif
+	for (; col < LINE_LENGTH; ++col)
+		if (line[col] == lower || line[col] == upper)
+			mask[col >> 6] |= 1ULL << (col & 63);
+}
+
+static int last_set_before(const uint64_t* mask, int from, int limit)
+{
+	// index of the last set bit in [from, limit), from is always set
+	for (int w = (limit - 1) >> 6; w >= from >> 6; --w)
+	{
+		uint64_t bits = mask[w];
+		if (w == (limit - 1) >> 6 && (limit & 63))
+			bits &= (1ULL << (limit & 63)) - 1;
+		if (bits)
+		{
+			int i = (w << 6) + 63 - __builtin_clzll(bits);
+			return i >= from ? i : from;
+		}
+	}
+	return from;
+}
+
+static void keep_hit(find_hit* top, int* num_top, const find_hit* hit)
+{
+	// top is best first, hits arrive in line order and stay behind
+	// any earlier line with the same score
+	int i;
+	if (*num_top < FIND_TOP)
+		i = (*num_top)++;
+	else if (hit->score > top[FIND_TOP - 1].score)
+		i = FIND_TOP - 1;
+	else
+		return;
+	while (i > 0 && top[i - 1].score < hit->score)
+	{
+		top[i] = top[i - 1];
+		--i;
+	}
+	top[i] = *hit;
+}
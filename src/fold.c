@@ -0,0 +1,211 @@
+// fold.c - hiding a .macro body or a routine behind its first line
+// a fold is held by the lines it starts and ends on rather than by line
+// numbers, so edits anywhere else never have to move it. every line in
+// it points back at it, which lets the screen and the cursors step over
+// the whole thing at once, see next_visible. adding or taking away lines
+// inside a fold opens it, see fold_line_added and fold_line_removed
+#include "headers/main.h"
+#include "headers/fold.h"
+
+#define FOLD_WORD 16		// longest directive we look for, and then some
+
+enum line_kind
+{
+	LINE_CODE,
+	LINE_BLANK,				// nothing but maybe a comment
+	LINE_LABEL,
+	LINE_MACRO,
+	LINE_END_MACRO,
+	LINE_SECTION
+};
+
+static enum line_kind classify(const char* text);
+static docline* macro_end(docline* line);
+static docline* routine_end(docline* line);
+
+fold* fold_lines(doc* document, docline* first, docline* last)
+{
+	// hide the lines after first up to and including last, folds
+	// already in there are opened first. NULL if there's nothing to hide
+	if (first == NULL || last == NULL || first == last)
+		return NULL;
+	fold* f = calloc(1, sizeof(fold));
+	if (f == NULL)
+		return NULL;
+	for (docline* l = first; ; l = l->nextline)
+	{
+		if (l->fold)
+			unfold(document, l->fold);
+		if (l == last)
+			break;
+	}
+	f->first = first;
+	f->last = last;
+	for (docline* l = first; ; l = l->nextline)
+	{
+		l->fold = f;
+		if (l == last)
+			break;
+		++f->hidden;
+	}
+	f->next = document->folds;
+	if (document->folds)
+		document->folds->prev = f;
+	document->folds = f;
+	return f;
+}
+
+void unfold(doc* document, fold* f)
+{
+	for (docline* l = f->first; ; l = l->nextline)
+	{
+		l->fold = NULL;
+		if (l == f->last)
+			break;
+	}
+	if (f->prev)
+		f->prev->next = f->next;
+	else
+		document->folds = f->next;
+	if (f->next)
+		f->next->prev = f->prev;
+	free(f);
+}
+
+void unfold_all(doc* document)
+{
+	while (document->folds)
+		unfold(document, document->folds);
+}
+
+fold* fold_toggle(doc* document, docline* line)
+{
+	// open the fold line starts, or fold the block line is in: a .macro
+	// up to its .end_macro, or a label down to just before the next
+	// label, leaving off blank lines and comments at the end. NULL if
+	// that opened a fold or there was nothing to fold
+	if (line->fold)
+	{
+		unfold(document, line->fold);
+		return NULL;
+	}
+	bool closing = classify(line->line) == LINE_END_MACRO;
+	for (docline* l = line; l != NULL; l = l->prevline)
+	{
+		if (l != line && l->fold)
+			return NULL;
+		switch (classify(l->line))
+		{
+		case LINE_MACRO:
+			return fold_lines(document, l, macro_end(l));
+		case LINE_LABEL:
+			if (!closing)
+				return fold_lines(document, l, routine_end(l));
+			break;
+		case LINE_END_MACRO:
+			if (l != line)
+				return NULL;
+			break;
+		case LINE_SECTION:
+			return NULL;
+		default:
+			break;
+		}
+	}
+	return NULL;
+}
+
+int fold_all(doc* document)
+{
+	// fold every macro and routine, how many we folded
+	int folded = 0;
+	docline* line = document->head;
+	while (line)
+	{
+		docline* last = NULL;
+		enum line_kind kind = classify(line->line);
+		if (kind == LINE_MACRO)
+			last = macro_end(line);
+		else if (kind == LINE_LABEL)
+			last = routine_end(line);
+		if (fold_lines(document, line, last))
+		{
+			++folded;
+			line = last->nextline;
+		}
+		else
+			line = line->nextline;
+	}
+	return folded;
+}
+
+void fold_line_added(doc* document, docline* line)
+{
+	// line's just gone in, if that's inside a fold open it up
+	docline* prev = line->prevline;
+	if (prev && prev->fold && prev != prev->fold->last)
+		unfold(document, prev->fold);
+}
+
+void fold_line_removed(doc* document, docline* line)
+{
+	// line's about to come out, if it's in a fold open it up
+	if (line->fold)
+		unfold(document, line->fold);
+}
+
+static enum line_kind classify(const char* text)
+{
+	const char* p = text;
+	while (*p == ' ' || *p == '\t')
+		++p;
+	if (*p == '\0' || *p == '#')
+		return LINE_BLANK;
+	const char* start = p;
+	while (isalnum((unsigned char)*p) || *p == '_' || *p == '.' || *p == '$')
+		++p;
+	if (*p == ':' && p != start)
+		return LINE_LABEL;
+	char word[FOLD_WORD];
+	size_t len = min((size_t)(p - start), sizeof(word) - 1);
+	memcpy(word, start, len);
+	word[len] = '\0';
+	if (strcmp(word, ".macro") == 0)
+		return LINE_MACRO;
+	if (strcmp(word, ".end_macro") == 0)
+		return LINE_END_MACRO;
+	if (strcmp(word, ".text") == 0 || strcmp(word, ".data") == 0 ||
+		strcmp(word, ".ktext") == 0 || strcmp(word, ".kdata") == 0)
+		return LINE_SECTION;
+	return LINE_CODE;
+}
+
+static docline* macro_end(docline* line)
+{
+	// the .end_macro closing the .macro on line, macros don't nest
+	for (docline* l = line->nextline; l != NULL; l = l->nextline)
+	{
+		enum line_kind kind = classify(l->line);
+		if (kind == LINE_END_MACRO)
+			return l;
+		if (kind == LINE_MACRO)
+			break;
+	}
+	return NULL;
+}
+
+static docline* routine_end(docline* line)
+{
+	// the last line of code before whatever comes after the label on line
+	docline* end = line;
+	for (docline* l = line->nextline; l != NULL; l = l->nextline)
+	{
+		enum line_kind kind = classify(l->line);
+		if (kind == LINE_BLANK)
+			continue;
+		if (kind != LINE_CODE)
+			break;
+		end = l;
+	}
+	return end;
+}
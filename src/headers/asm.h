@@ -0,0 +1,95 @@
+#ifndef MIPSZE_ASM
+#define MIPSZE_ASM
+
+#include <stdint.h>
+#include "symbols.h"
+
+// where the segments start, same as spim/mars
+#define TEXT_BASE 0x00400000
+#define DATA_BASE 0x10010000
+
+// most words a single (pseudo)instruction turns into
+#define MAX_EXPANSION 2
+
+// what a line turned out to be
+enum asm_kind
+{
+	ASM_EMPTY,			// blank, comment, labels or a directive we ignore
+	ASM_TEXT,			// .text
+	ASM_DATA,			// .data
+	ASM_INSTRUCTION,
+	ASM_BYTES,			// .word .byte .ascii .space ...
+	ASM_ALIGN,			// .align, allowed in either segment
+	ASM_MACRO_BEGIN,
+	ASM_MACRO_END,
+	ASM_UNKNOWN,		// not an instruction we know, see target
+	ASM_MACRO_CALL		// assembled from its expansion, see macro.c
+};
+
+// how a line's words depend on the address of its target label
+enum asm_fixup
+{
+	FIX_NONE,
+	FIX_BRANCH,			// 16 bit word offset from the next instruction
+	FIX_JUMP,			// 26 bit word address
+	FIX_HI_LO,			// lui/ori pair, ie. la
+	FIX_HI_LO_SIGNED,	// lui + load/store, the low half is sign extended
+	FIX_WORD			// a .word holding the address
+};
+
+// everything assembling one line gives us, kept on the docline until its
+// text changes so we only re-encode lines that were edited, or whose
+// label moved
+typedef struct asm_line
+{
+	bool dirty;						// text changed since we last looked
+	bool moved;						// laid out at a different address this time
+	bool placed;					// false inside a macro body
+	unsigned char kind;
+	unsigned char fixup;
+	unsigned char fix_index;		// word of words (or data) that gets patched
+	unsigned char align;			// in bytes
+	unsigned char num_words;
+	uint32_t size;					// in bytes, not counting alignment
+	uint32_t addr;
+	unsigned long resolved;			// target's address last time we patched
+	uint32_t words[MAX_EXPANSION];
+	unsigned char* data;			// NULL means size zero bytes
+	char target[MAX_SYMBOL_LENGTH];
+	char* error;					// found on just this line
+	const char* link_error;			// found when laying out or linking
+	struct docline* expansion;		// a macro call's lines, each with its own asm_line
+	int expansion_lines;
+	unsigned long call_id;			// makes the call's local labels unique
+	uint32_t macro_version;			// of the macro when we expanded it
+} asm_line;
+
+typedef struct assembler
+{
+	symtab* addresses;				// label name to address
+	uint32_t* text;
+	docline** text_lines;			// line each word of text came from
+	size_t text_words;
+	size_t text_capacity;
+	unsigned char* data;
+	size_t data_size;
+	size_t data_capacity;
+	uint32_t entry;					// main, or the start of .text
+	int errors;
+	docline* first_error;
+	size_t first_error_line;
+	unsigned long version;			// bumped whenever the images change
+	unsigned long doc_version;		// of the document we last assembled
+	int reencoded;					// lines parsed and encoded last time
+	int relinked;					// lines only patched for a new address
+	bool live;						// keep reassembling as we type
+} assembler;
+
+int init_assembler();
+int asm_assemble(doc* document);
+void asm_line_changed(docline* line);
+void asm_forget_line(docline* line);
+void asm_free(doc* document);
+void asm_describe_line(docline* line, char* msg, size_t size);
+
+#endif
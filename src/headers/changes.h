@@ -0,0 +1,34 @@
+#ifndef MIPSZE_CHANGES
+#define MIPSZE_CHANGES
+
+#include <stdint.h>
+#include "main.h"
+
+// what a line's gutter mark says, see docline->change
+#define CHANGE_ADDED 0x01		// isn't in the saved file
+#define CHANGE_EDITED 0x02		// took the place of a saved line that read differently
+#define CHANGE_REMOVED 0x04		// saved lines are missing just above it
+#define CHANGE_DIRTY 0x80		// edited since we last worked the marks out
+
+// past this many edited lines between looks we just diff everything
+#define CHANGES_MAX_DIRTY 4096
+
+// the document as it was last loaded or saved, one hash per line
+typedef struct changes
+{
+	uint32_t* saved;
+	size_t num_saved;
+	docline** dirty;			// lines edited since changes_update
+	size_t num_dirty;
+	bool all_dirty;
+	bool removed_at_end;		// saved lines are missing after the last line
+} changes;
+
+void changes_saved(doc* document);
+void changes_saved_lines(doc* document, char (*lines)[LINE_LENGTH], size_t count);
+void changes_free(doc* document);
+void changes_line_edited(doc* document, docline* line);
+void changes_line_removed(doc* document, docline* line);
+void changes_update(doc* document);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef MIPSZE_COMPLETE
+#define MIPSZE_COMPLETE
+
+#include "trie.h"
+
+// what a completion is, in trie_match->tag
+enum completion_kind
+{
+	COMPLETE_LABEL = 1,
+	COMPLETE_MACRO,
+	COMPLETE_INSTRUCTION,
+	COMPLETE_PSEUDO,
+	COMPLETE_REGISTER
+};
+
+int init_completion();
+int complete_word(doc* document, const char* prefix, trie_match* out, int max);
+bool is_completion_char(char c);
+
+#endif
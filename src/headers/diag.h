@@ -0,0 +1,26 @@
+#ifndef MIPSZE_DIAG
+#define MIPSZE_DIAG
+
+// flags for what's wrong with a line
+#define DIAG_OPERANDS 0x01		// wrong number of operands for the instruction
+#define DIAG_UNDEFINED 0x02		// branches/jumps to a label that doesn't exist
+#define DIAG_DUPLICATE 0x04		// defines a label that's defined elsewhere too
+
+typedef struct diagnostics
+{
+	struct symtab* refs;		// how many lines reference each label
+	size_t undefined;			// references to labels that don't exist
+	size_t duplicates;			// label definitions that aren't unique
+	size_t bad_operands;		// lines with the wrong number of operands
+} diagnostics;
+
+int init_diagnostics();
+void diag_reset(doc* document);
+void diag_free(doc* document);
+void diag_line_changed(doc* document, docline* line);
+void diag_forget_line(doc* document, docline* line);
+void diag_label_changed(doc* document, const char* name, int old_count, int new_count);
+unsigned char diag_line_flags(doc* document, docline* line);
+void diag_describe_line(doc* document, docline* line, char* msg, size_t size);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef MIPSZE_DIFF
+#define MIPSZE_DIFF
+
+#include <stddef.h>
+#include <stdint.h>
+
+// past this many inserted/deleted lines we stop looking for the
+// shortest edit and just replace everything between the common ends
+#define DIFF_MAX_EDITS 1024
+
+// lines a[a_start, a_start + a_len) become b[b_start, b_start + b_len)
+typedef struct diff_hunk
+{
+	size_t a_start;
+	size_t a_len;
+	size_t b_start;
+	size_t b_len;
+} diff_hunk;
+
+int diff_lines(const char* const* a, size_t a_len, const char* const* b, size_t b_len,
+	diff_hunk** hunks);
+int diff_hashes(const uint32_t* a, size_t a_len, const uint32_t* b, size_t b_len,
+	diff_hunk** hunks);
+
+#endif
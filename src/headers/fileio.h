@@ -1,8 +1,69 @@
 #ifndef MIPSZE_FILEIO
 #define MIPSZE_FILEIO
 
+#include <pthread.h>
+#include <sys/types.h>
+
+// how much the background save writes between progress updates
+#define SAVE_CHUNK_SIZE (64 * 1024)
+
+// a save running in the background, see save_doc_async
+typedef struct save_job
+{
+	pthread_t writer;
+	char* filename;
+	char* text;				// the document as it was when the save started
+	size_t len;
+	size_t written;			// progress, updated by the writer
+	unsigned long version;	// document->version the text came from
+	int error;				// errno if the save failed
+	bool done;
+} save_job;
+
+// the first batch is about a screenful so it can be drawn right away
+#define LOAD_FIRST_BATCH 128
+#define LOAD_BATCH_LINES 4096
+
+// a file being read in the background, see load_doc_async
+typedef struct load_job
+{
+	pthread_t reader;
+	pthread_mutex_t lock;
+	char* filename;
+	docline* head;			// lines read but not taken yet, under lock
+	docline* tail;
+	size_t lines;
+	off_t size;
+	off_t read;				// progress, updated by the reader
+	bool finished;			// under lock
+	bool cancel;
+	int error;
+} load_job;
+
+// how much --follow reads from the file at a time
+#define FOLLOW_CHUNK_SIZE (64 * 1024)
+
+// a file we keep reading the end of as it grows, see --follow
+typedef struct follow_state
+{
+	int fd;
+	char* filename;
+	off_t offset;			// how much of it we've read
+} follow_state;
+
 int load_doc(const char* filename, doc* document);
+load_job* load_doc_async(const char* filename);
+docline* load_take(load_job* job, docline** last, size_t* count, bool* finished);
+int load_finish(load_job* job);
+int read_lines(const char* filename, char (**lines)[LINE_LENGTH], size_t* count);
 void save_doc(const char* filename, doc* document);
+save_job* save_doc_async(const char* filename, doc* document);
+bool save_done(save_job* job);
+int save_finish(save_job* job);
+void save_free(save_job* job);
 int check_file_exists(const char* filename);
+int follow_open(follow_state* follow, const char* filename);
+ssize_t follow_read(follow_state* follow, doc* document, int* new_lines);
+void follow_close(follow_state* follow);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef MIPSZE_FIND
+#define MIPSZE_FIND
+
+#include <stdint.h>
+#include "lexmask.h"
+
+#define FIND_MAX_QUERY 32
+#define FIND_TOP 16						// best matches we keep
+#define FIND_MAX_THREADS 16
+#define FIND_LINES_PER_THREAD 16384		// any fewer and a thread costs more than it saves
+
+// a line that matched, see match_line
+typedef struct find_hit
+{
+	uint32_t index;					// into finder->lines, its line number - 1
+	int score;
+	uint64_t columns[MASK_WORDS];	// where the query's characters matched
+} find_hit;
+
+// a search through one document while the query's being typed. it
+// holds the document's lines as they were when it started, so nothing
+// can edit the document until find_end
+typedef struct finder
+{
+	docline** lines;
+	uint32_t num_lines;
+	// lines that match the first n characters of query, for 0 < n <= levels
+	uint32_t* survivors[FIND_MAX_QUERY + 1];
+	uint32_t num_survivors[FIND_MAX_QUERY + 1];
+	int levels;
+	char query[FIND_MAX_QUERY + 1];
+	find_hit top[FIND_TOP];			// best first
+	int num_top;
+	int threads;
+} finder;
+
+finder* find_start(doc* document);
+int find_query(finder* f, const char* query);
+void find_end(finder* f);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef MIPSZE_FOLD
+#define MIPSZE_FOLD
+
+#include "main.h"
+
+// lines from first to last shown as just first. every line in it points
+// back here with its fold field, so getting past one is a single step
+typedef struct fold
+{
+	docline* first;			// stays on the screen
+	docline* last;
+	size_t hidden;			// lines after first, up to and including last
+	struct fold* prev;		// the rest of the document's folds, see doc->folds
+	struct fold* next;
+} fold;
+
+fold* fold_lines(doc* document, docline* first, docline* last);
+void unfold(doc* document, fold* f);
+void unfold_all(doc* document);
+fold* fold_toggle(doc* document, docline* line);
+int fold_all(doc* document);
+
+void fold_line_added(doc* document, docline* line);
+void fold_line_removed(doc* document, docline* line);
+
+static inline bool is_hidden(const docline* line)
+{
+	return line->fold && line->fold->first != line;
+}
+
+static inline size_t fold_span(const docline* line)
+{
+	// how many lines of the document this line shows for
+	return line->fold && line->fold->first == line ? line->fold->hidden + 1 : 1;
+}
+
+static inline docline* next_visible(docline* line)
+{
+	return line->fold && line->fold->first == line ? line->fold->last->nextline : line->nextline;
+}
+
+static inline docline* prev_visible(docline* line)
+{
+	docline* prev = line->prevline;
+	return prev && prev->fold ? prev->fold->first : prev;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef MIPSZE_HIGHLIGHT
+#define MIPSZE_HIGHLIGHT
+
+// what a run of characters on a line was lexed as, hl_attr turns
+// these into the curses attributes we draw them with
+enum hl_class
+{
+	HL_PLAIN,
+	HL_PUNC,
+	HL_COMMENT,
+	HL_QUOTE,
+	HL_UNTERMINATED,	// last char of a line with an open quote
+	HL_ERROR,			// a token we don't recognise
+	HL_SECTION,
+	HL_REGISTER,
+	HL_MACRO_PARAM,
+	HL_MACRO,
+	HL_LABEL_DEF,
+	HL_LABEL,
+	HL_PSEUDO,
+	HL_KEYWORD,
+	HL_NUM,
+	HL_NUM_CLASSES
+};
+
+// a run of characters on a line that all draw the same way
+typedef struct hl_span
+{
+	unsigned char start;
+	unsigned char length;
+	unsigned char cls;
+} hl_span;
+
+// must fit in docline->hl_first
+#define HL_ARENA_SPANS 16384
+
+// every line's spans live in one block per document. Spans are only
+// ever appended, when the block fills up we start again from the
+// beginning and bump the generation, which invalidates every line at
+// once, the visible ones just get lexed again next time they're drawn
+typedef struct hl_arena
+{
+	hl_span spans[HL_ARENA_SPANS];
+	unsigned int used;
+	unsigned int generation;		// never 0, so new lines start out invalid
+	unsigned long symbols_version;	// label/macro tables the spans were coloured with
+} hl_arena;
+
+hl_arena* hl_arena_new();
+void hl_arena_free(hl_arena* arena);
+void hl_invalidate(hl_arena* arena);
+void hl_store(hl_arena* arena, docline* line, const unsigned char* classes, int len);
+attr_t hl_attr(enum hl_class cls);
+
+static inline bool hl_valid(const hl_arena* arena, const docline* line)
+{
+	return line->hl_generation == arena->generation;
+}
+
+static inline const hl_span* hl_spans(const hl_arena* arena, const docline* line)
+{
+	return arena->spans + line->hl_first;
+}
+
+#endif
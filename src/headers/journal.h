@@ -0,0 +1,62 @@
+#ifndef MIPSZE_JOURNAL
+#define MIPSZE_JOURNAL
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// how long the writer waits for more edits before writing a batch
+#define JOURNAL_BATCH_MS 200
+// once the log gets this big it's folded into a new snapshot
+#define JOURNAL_COMPACT_BYTES (256 * 1024)
+#define JOURNAL_PATH_LENGTH 4096
+
+// the writer's own copy of the document, so it never has to
+// touch the real one
+typedef struct journal_line
+{
+	unsigned int id;
+	char text[LINE_LENGTH];
+	struct journal_line* prevline;
+	struct journal_line* nextline;
+	struct journal_line* chain;		// next in the same index bucket
+} journal_line;
+
+typedef struct journal
+{
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running;
+	bool stop;
+	bool discard;				// delete the files once the writer stops
+	int error;					// errno from the last write that failed
+	char* pending;				// records the editor has queued, under lock
+	size_t pending_len;
+	size_t pending_size;
+
+	// only the editor touches these
+	unsigned int next_id;
+	unsigned long seq;
+
+	// only the writer touches these
+	char snap_path[JOURNAL_PATH_LENGTH];
+	char log_path[JOURNAL_PATH_LENGTH];
+	FILE* log;
+	size_t log_bytes;
+	unsigned long applied;		// seq of the last record applied
+	journal_line* head;
+	journal_line* tail;
+	journal_line** index;
+	size_t index_size;
+	size_t num_lines;
+} journal;
+
+bool journal_exists(const char* filename);
+int journal_recover(const char* filename, doc* document);
+void journal_start(doc* document, const char* filename, bool clean);
+void journal_line_edited(doc* document, docline* line);
+void journal_line_removed(doc* document, docline* line);
+int journal_error(doc* document);
+void journal_close(doc* document, bool discard);
+
+#endif
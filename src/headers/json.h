@@ -0,0 +1,53 @@
+#ifndef MIPSZE_JSON
+#define MIPSZE_JSON
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// arrays and objects nested deeper than this don't parse
+#define JSON_MAX_DEPTH 64
+
+enum json_type
+{
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+};
+
+// a parsed value, arrays and objects keep their elements as a list
+// of children, object members have a key as well
+typedef struct json
+{
+	enum json_type type;
+	char* key;
+	char* string;			// unescaped, may hold '\0's, see length
+	size_t length;
+	double number;
+	bool boolean;
+	struct json* child;
+	struct json* next;
+} json;
+
+// text we're building up to send, failed if we ran out of memory
+typedef struct json_out
+{
+	char* text;
+	size_t length;
+	size_t capacity;
+	bool failed;
+} json_out;
+
+json* json_parse(const char* text, size_t length);
+void json_free(json* value);
+json* json_get(const json* object, const char* key);
+const char* json_string(const json* value);
+long json_long(const json* value, long fallback);
+
+void json_printf(json_out* out, const char* format, ...);
+void json_write_string(json_out* out, const char* s, size_t length);
+void json_write(json_out* out, const json* value);
+
+#endif
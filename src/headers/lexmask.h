@@ -0,0 +1,34 @@
+#ifndef MIPSZE_LEXMASK
+#define MIPSZE_LEXMASK
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// one bit per column of a docline, LINE_LENGTH rounded up to 64
+#define MASK_WORDS 2
+
+typedef struct line_masks
+{
+	int length;						// same as strlen(line)
+	uint64_t space[MASK_WORDS];		// ' ', '\t', '\n'
+	uint64_t paren[MASK_WORDS];		// '(', ')'
+	uint64_t comma[MASK_WORDS];		// ','
+	uint64_t comment[MASK_WORDS];	// '#'
+	uint64_t dquote[MASK_WORDS];	// '"'
+	uint64_t squote[MASK_WORDS];	// '\''
+	uint64_t dollar[MASK_WORDS];	// '$'
+	uint64_t percent[MASK_WORDS];	// '%'
+	uint64_t dot[MASK_WORDS];		// '.'
+} line_masks;
+
+void classify_line(const char* line, line_masks* masks);
+int mask_next_set(const uint64_t* mask, int from, int limit);
+int mask_next_clear(const uint64_t* mask, int from, int limit);
+int mask_quotes(const line_masks* m, const char* line, uint64_t* quoted, bool* unterminated);
+
+static inline bool mask_test(const uint64_t* mask, int i)
+{
+	return (mask[i >> 6] >> (i & 63)) & 1;
+}
+
+#endif
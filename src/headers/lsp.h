@@ -0,0 +1,17 @@
+#ifndef MIPSZE_LSP
+#define MIPSZE_LSP
+
+#define LSP_MAX_DOCUMENTS 64
+#define LSP_MAX_MESSAGE (64 * 1024 * 1024)
+#define LSP_MAX_COMPLETIONS 256
+
+// json-rpc error codes we send back
+#define LSP_PARSE_ERROR -32700
+#define LSP_INVALID_REQUEST -32600
+#define LSP_METHOD_NOT_FOUND -32601
+#define LSP_INTERNAL_ERROR -32603
+#define LSP_REQUEST_FAILED -32803
+
+int lsp_run();
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef MIPSZE_MACRO
+#define MIPSZE_MACRO
+
+#include <stdint.h>
+#include "symbols.h"
+
+#define MAX_MACRO_PARAMS 16
+// calls inside macro bodies can go this deep
+#define MAX_MACRO_DEPTH 16
+#define MACRO_MEMO_BUCKETS 256
+#define MAX_MACRO_MEMO 4096
+
+// a .macro NAME (%a, %b) ... .end_macro in the document
+typedef struct macro_def
+{
+	char name[MAX_SYMBOL_LENGTH];
+	char params[MAX_MACRO_PARAMS][MAX_SYMBOL_LENGTH];	// without the %
+	int num_params;
+	docline* body;				// first line after the .macro
+	int num_lines;
+	uint32_t body_hash;
+	uint32_t version;			// body_hash mixed with the versions of macros it calls
+	bool visiting;
+} macro_def;
+
+// an expansion we've already worked out, local labels are left with a
+// marker where the call's number goes
+typedef struct macro_memo
+{
+	struct macro_memo* next;
+	uint32_t hash;
+	uint32_t version;
+	char* key;					// name, then each argument, '\0' separated
+	size_t key_len;
+	char* expansion;			// lines separated by '\n'
+	int lines;
+} macro_memo;
+
+typedef struct macro_table
+{
+	macro_def* defs;
+	int num_defs;
+	int capacity;
+	symtab* index;				// name to position in defs
+	bool dirty;					// document changed since we found the defs
+	macro_memo* memo[MACRO_MEMO_BUCKETS];
+	size_t memo_entries;
+	unsigned long hits;
+	unsigned long misses;
+} macro_table;
+
+void macro_line_changed(doc* document);
+void macro_free(doc* document);
+uint32_t macro_call_version(doc* document, const char* text);
+char* macro_expand(doc* document, const char* text, unsigned long call_id,
+	int* lines, char* error, size_t size);
+
+#endif
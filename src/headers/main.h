@@ -9,6 +9,7 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <errno.h>
 
 #define MAJOR_VERSION 0
 #define MINOR_VERSION 1
@@ -16,11 +17,29 @@
 
 #define TAB_DISTANCE 4
 #define LINE_LENGTH 80
-#define MAX_DEBUG_MSG 24
+#define MAX_DEBUG_MSG 80
 #define DISPLAY_DEBUG_TIME 10
 #define MAX_RESPONSE_SIZE 36
 #define MAX_FILE_NAME 36
 #define MAX_CURSORS 8
+#define MAX_BUFFERS 64
+#define MAX_WINDOWS 16
+#define MIN_WINDOW_ROWS 3
+#define MIN_WINDOW_COLS 20
+#define MAX_COMPLETIONS 8
+
+// bracketed paste, see insert_text
+#define BRACKETED_PASTE_ON "\033[?2004h"
+#define BRACKETED_PASTE_OFF "\033[?2004l"
+#define PASTE_START 200
+#define PASTE_END 201
+#define PASTE_TIMEOUT_MS 1000
+#define ESCAPE_TIMEOUT_MS 50
+
+// frame pacing, see the main loop
+#define FRAME_INTERVAL_MS 16		// don't redraw more than ~60 times a second
+#define STATUS_INTERVAL_MS 250		// how often the status bar ticks over
+#define MAX_KEYS_PER_FRAME 256		// draw at least this often while keys flood in
 
 // maybe a system has already defined these?
 #ifndef CTRL
@@ -36,10 +55,34 @@
 	__typeof__ (b) _b = (b);     \
 	_a < _b ? _a : _b; }          )
 
+#define max(a,b)               \
+	({ __typeof__ (a) _a = (a); \
+	__typeof__ (b) _b = (b);     \
+	_a > _b ? _a : _b; }          )
+
 typedef struct docline 
 {
 	char line[LINE_LENGTH];				// text content of a line
-	attr_t formatting[LINE_LENGTH];		// use this to store color
+	unsigned int hl_generation;			// highlight spans, see highlight.c
+	unsigned short hl_first;
+	unsigned char hl_count;
+	unsigned char hl_state;				// lexer state the spans were made from
+	unsigned char hl_end_state;
+	char* defs;							// labels/macros defined here, see parse.c
+	char* label_ref;					// label this line branches to, see diag.c
+	struct asm_line* asm_info;			// what this line assembles to, see asm.c
+	unsigned char checkpoint;			// lexer state at the start of this line
+	unsigned char diag;					// problems found on just this line
+	unsigned char stalls;				// pipeline stalls before this line runs, see pipeline.c
+	unsigned char hazards;
+	unsigned char hazard_reg;
+	unsigned short block_cycles;		// estimate for the block starting here
+	unsigned int block_hash;			// what block_cycles was worked out from
+	unsigned int journal_id;			// how the journal knows this line, see journal.c
+	struct fold* fold;					// the fold this line shows or hides in, see fold.c
+	unsigned int line_hash;				// of the text, see changes.c
+	unsigned int saved_line;			// which line of the saved file this is, 0 if none
+	unsigned char change;				// how it differs from the saved file
 	struct docline* prevline;
 	struct docline* nextline;
 } docline;
@@ -48,6 +91,8 @@ typedef struct display
 {
 	size_t width;
 	size_t height;
+	size_t screen_y;		// where its first line of text goes on the screen
+	size_t screen_x;
 	docline* topline;
 	size_t top_line_number;
 	size_t left_char_number;
@@ -69,6 +114,16 @@ typedef struct doc
 	size_t number_of_lines;
 	size_t number_of_chars;
 	bool unsaved_changes;
+	unsigned long version;				// goes up with every edit, see save_document
+	struct symtab* labels;
+	struct symtab* macros;
+	struct hl_arena* highlights;
+	struct assembler* assembly;
+	struct macro_table* expansions;
+	struct diagnostics* diags;
+	struct journal* journal;
+	struct fold* folds;
+	struct changes* changes;
 } doc;
 
 
@@ -86,6 +141,9 @@ typedef struct doc
 #define ERROR_BLOCK_PAIR 12
 #define LINE_NO_PAIR 13
 #define MACRO_PARAM_PAIR 14
+#define ADDED_PAIR 15
+#define EDITED_PAIR 16
+#define REMOVED_PAIR 17
 
 // allow other function to set debug messages
 void set_debug_msg(const char* msg, ...);
@@ -1,10 +1,32 @@
 #ifndef MIPSZE_PARSE
 #define MIPSZE_PARSE
 
+// lexer state carried from the end of one line to the start of the next
+typedef unsigned char lex_state;
+#define LEX_GRAB_MACRO_NAME 0x01	// next token names a macro
+#define LEX_IN_MACRO 0x02			// between .macro and .end_macro
+#define LEX_CHECKPOINT 0x80			// set in docline->checkpoint when it's valid
+
+// every this many lines we remember the lexer state, so we can start
+// lexing anywhere in a document without going back to the top
+#define CHECKPOINT_INTERVAL 64
+
+// docline->defs is a packed list of kind, name, '\0' ... ending in '\0'
+#define DEF_LABEL 'L'
+#define DEF_MACRO 'M'
+
 int init_parser();
-void parse_line(docline* line);
-void clear_labels();
-void clear_macros();
-void find_labels(docline* line);
+lex_state parse_line(doc* document, docline* line, lex_state state);
+lex_state lex_state_at(docline* line);
+void init_symbols(doc* document);
+void free_symbols(doc* document);
+void drop_highlights(doc* document);
+void find_labels(doc* document);
+void line_changed(doc* document, docline* line);
+void lines_changed(doc* document, docline* first, docline* last);
+void forget_line(doc* document, docline* line);
+bool is_keyword(const char* token);
+bool is_pseudoinstruction(const char* token);
+const char* parser_word(int index, bool* pseudo);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,32 @@
+#ifndef MIPSZE_PIPELINE
+#define MIPSZE_PIPELINE
+
+// flags for the hazards a line runs into
+#define HAZ_LOAD_USE 0x01		// uses a register loaded by the instruction before
+#define HAZ_DATA 0x02			// waits on an alu result that isn't forwarded
+#define HAZ_BRANCH_DATA 0x04	// branch compares a register that isn't ready yet
+#define HAZ_HI_LO 0x08			// waits on the multiply/divide unit
+#define HAZ_DELAY_SLOT 0x10		// branch's delay slot holds a real instruction
+#define HAZ_STALE 0x80			// edited since its block was estimated
+
+// columns the estimates take up in the gutter
+#define PIPE_GUTTER 5
+
+// a classic IF ID EX MEM WB pipeline, branches are resolved in ID
+typedef struct pipeline_model
+{
+	const char* name;
+	bool forwarding;			// EX/MEM and MEM/WB results bypass the register file
+	bool delay_slot;			// the instruction after a branch always runs
+	unsigned char taken_penalty;	// cycles lost on a taken branch or jump
+	unsigned char mult_latency;	// until hi/lo can be read
+	unsigned char div_latency;
+} pipeline_model;
+
+int pipe_set_model(const char* name);
+const pipeline_model* pipe_model();
+int pipe_analyze(doc* document);
+void pipe_line_changed(docline* line);
+void pipe_describe_line(docline* line, char* msg, size_t size);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef MIPSZE_PROFILE
+#define MIPSZE_PROFILE
+
+#include <stdbool.h>
+
+// stages of a single frame we keep timings for
+enum prof_stage
+{
+	PROF_INPUT,
+	PROF_LABELS,
+	PROF_PARSE,
+	PROF_DRAW,
+	PROF_REFRESH,
+	PROF_NUM_STAGES
+};
+
+bool prof_toggle();
+bool prof_is_enabled();
+void prof_frame_begin();
+void prof_frame_end();
+void prof_begin(enum prof_stage stage);
+void prof_end(enum prof_stage stage);
+void prof_draw_overlay(int y, int width);
+
+#endif
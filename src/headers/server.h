@@ -0,0 +1,43 @@
+#ifndef MIPSZE_SERVER
+#define MIPSZE_SERVER
+
+#include <stdbool.h>
+#include <limits.h>
+
+#define SERVER_SOCKET_NAME "mipsze.sock"
+#define SERVER_TERM_LENGTH 64
+#define SERVER_POLL_MS 250		// how often a waiting client checks for a resize
+
+// what a client sends when it attaches, its terminal comes with it
+typedef struct server_request
+{
+	char term[SERVER_TERM_LENGTH];
+	char path[PATH_MAX];		// the file to open, absolute, or empty
+} server_request;
+
+// a client attached to the daemon, while one is its terminal is
+// our stdin and stdout, see server_accept
+typedef struct client
+{
+	int sock;
+	int listener;				// where anyone else trying to attach turns up
+	server_request request;
+} client;
+
+// what server_poll found
+enum server_event
+{
+	SERVER_QUIET,
+	SERVER_RESIZE,
+	SERVER_GONE
+};
+
+int server_start();
+void server_ready(bool ok);
+int server_accept(int listener, client* c);
+enum server_event server_poll(client* c);
+bool server_window_size(int* rows, int* cols);
+void server_detach(client* c);
+int client_attach(const char* self, const char* filename);
+
+#endif
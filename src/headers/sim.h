@@ -0,0 +1,29 @@
+#ifndef MIPSZE_SIM
+#define MIPSZE_SIM
+
+#include <stdint.h>
+
+// memory the simulated program gets, data and heap share one region
+// that sbrk grows into, the stack grows down from SIM_STACK_TOP
+#define SIM_DATA_SIZE (16 * 1024 * 1024)
+#define SIM_STACK_SIZE (1024 * 1024)
+#define SIM_STACK_TOP 0x80000000u
+#define SIM_STACK_BASE (SIM_STACK_TOP - SIM_STACK_SIZE)
+#define SIM_INITIAL_SP 0x7fffeffcu
+#define SIM_INITIAL_GP 0x10008000u
+
+// most instructions we predecode into a single block
+#define SIM_MAX_BLOCK 64
+
+typedef struct sim_result
+{
+	int exit_code;
+	const char* error;			// NULL if the program exited normally
+	uint32_t error_pc;
+	unsigned long long executed;	// instructions
+	long long elapsed_ms;
+} sim_result;
+
+int sim_run(struct assembler* as, sim_result* result);
+
+#endif
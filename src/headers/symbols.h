@@ -0,0 +1,44 @@
+#ifndef MIPSZE_SYMBOLS
+#define MIPSZE_SYMBOLS
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_SYMBOL_LENGTH 36
+
+// a set of names (labels or macros) where each name remembers how many
+// lines define it, so lines can add and remove their definitions
+// without rescanning the whole document
+typedef struct symbol
+{
+	char name[MAX_SYMBOL_LENGTH];
+	int count;			// 0 means this slot is free to reuse
+	unsigned long value;	// whatever the owner wants, ie. an address
+} symbol;
+
+typedef struct symtab
+{
+	symbol* slots;
+	size_t capacity;	// always a power of two
+	size_t used;		// slots that have ever held a name
+	size_t live;		// names with count > 0
+	unsigned long version;	// bumped whenever a name appears or disappears
+	struct trie* prefixes;	// the live names by prefix, if we were asked to keep them
+} symtab;
+
+symtab* symtab_new();
+void symtab_free(symtab* table);
+void symtab_clear(symtab* table);
+void symtab_add(symtab* table, const char* name);
+void symtab_remove(symtab* table, const char* name);
+int symtab_count(const symtab* table, const char* name);
+void symtab_set_value(symtab* table, const char* name, unsigned long value);
+bool symtab_value(const symtab* table, const char* name, unsigned long* value);
+int symtab_index_prefixes(symtab* table);
+
+static inline bool symtab_contains(const symtab* table, const char* name)
+{
+	return symtab_count(table, name) > 0;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef MIPSZE_TRACE
+#define MIPSZE_TRACE
+
+#include <stdbool.h>
+
+enum trace_event
+{
+	TR_KEY,
+	TR_LEX,
+	TR_LABELS,
+	TR_LOAD,
+	TR_SAVE,
+	TR_REDRAW,
+	TR_PASTE,
+	TR_ASSEMBLE,
+	TR_SIMULATE,
+	TR_JOURNAL,
+	TR_NUM_EVENTS
+};
+
+// only ever written by trace_start/trace_stop, checking this
+// is the only cost of a trace point when tracing is off
+extern bool trace_enabled;
+
+#define TRACE_BEGIN(ev, arg) \
+	do { if (trace_enabled) trace_record((ev), 'B', (arg)); } while (0)
+#define TRACE_END(ev, arg) \
+	do { if (trace_enabled) trace_record((ev), 'E', (arg)); } while (0)
+#define TRACE_INSTANT(ev, arg) \
+	do { if (trace_enabled) trace_record((ev), 'i', (arg)); } while (0)
+
+int trace_start(const char* filename);
+void trace_stop();
+void trace_record(enum trace_event ev, char phase, long arg);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MIPSZE_TRIE
+#define MIPSZE_TRIE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "symbols.h"
+
+// a prefix tree over a set of names, so everything starting with what's
+// been typed so far can be found without looking at anything else.
+// nodes live in one block and refer to each other by index, a node
+// whose names have all gone stays behind (with live 0) for the next
+// name that passes through it
+typedef struct trie_node
+{
+	unsigned int child;		// first child, 0 for none since the root is 0
+	unsigned int sibling;	// next child of our parent, in character order
+	unsigned int live;		// names ending at or below here
+	unsigned short ends;	// how many times the name ending here was added
+	unsigned char tag;		// whatever the owner wants, ie. what kind of name
+	char c;
+} trie_node;
+
+typedef struct trie
+{
+	trie_node* nodes;
+	size_t used;
+	size_t capacity;
+} trie;
+
+// a name trie_complete found
+typedef struct trie_match
+{
+	char name[MAX_SYMBOL_LENGTH];
+	unsigned char tag;
+} trie_match;
+
+trie* trie_new();
+void trie_free(trie* t);
+void trie_clear(trie* t);
+bool trie_add(trie* t, const char* name, unsigned char tag);
+void trie_remove(trie* t, const char* name);
+int trie_complete(const trie* t, const char* prefix, trie_match* out, int max);
+
+#endif
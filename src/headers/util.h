@@ -1,6 +1,19 @@
 #ifndef MIPSZE_UTIL
 #define MIPSZE_UTIL
 
+#include <stddef.h>
+#include <stdint.h>
+
+// fnv-1a, for the hashes that only need to be quick
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// by number, without the $
+extern const char* const register_names[32];
+
 double cpu_info();
+long long monotonic_ms();
+uint32_t fnv_hash(const char* s);
+uint32_t fnv_hash_bytes(uint32_t hash, const void* data, size_t len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,11 @@
+#ifndef MIPSZE_WATCH
+#define MIPSZE_WATCH
+
+#include <stdbool.h>
+
+int watch_file(const char* filename);
+bool watch_changed();
+void watch_sync();
+const char* watch_path();
+
+#endif
@@ -0,0 +1,83 @@
+// highlight.c - run-length highlight spans for each line, kept in
+// a per-document arena instead of an attribute for every column
+#include "headers/main.h"
+#include "headers/highlight.h"
+
+static const attr_t class_attrs[HL_NUM_CLASSES] = {
+	[HL_PLAIN] = 0,
+	[HL_PUNC] = COLOR_PAIR(PUNC_PAIR),
+	[HL_COMMENT] = COLOR_PAIR(COMMENT_PAIR),
+	[HL_QUOTE] = COLOR_PAIR(QUOTE_PAIR),
+	[HL_UNTERMINATED] = COLOR_PAIR(ERROR_BLOCK_PAIR),
+	[HL_ERROR] = COLOR_PAIR(ERROR_PAIR),
+	[HL_SECTION] = COLOR_PAIR(SECTION_PAIR),
+	[HL_REGISTER] = COLOR_PAIR(REG_PAIR) | A_BOLD,
+	[HL_MACRO_PARAM] = COLOR_PAIR(MACRO_PARAM_PAIR),
+	[HL_MACRO] = COLOR_PAIR(MACRO_PARAM_PAIR),
+	[HL_LABEL_DEF] = COLOR_PAIR(LABEL_PAIR) | A_BOLD,
+	[HL_LABEL] = COLOR_PAIR(LABEL_PAIR),
+	[HL_PSEUDO] = A_BOLD,
+	[HL_KEYWORD] = COLOR_PAIR(KEYWORD_PAIR),
+	[HL_NUM] = COLOR_PAIR(NUM_PAIR),
+};
+
+// shared by every arena, so a line can't be mistaken for valid in an
+// arena made after its document's last one was dropped
+static unsigned int next_generation = 1;
+
+static unsigned int new_generation()
+{
+	unsigned int generation = next_generation++;
+	if (next_generation == 0)
+		next_generation = 1;
+	return generation;
+}
+
+hl_arena* hl_arena_new()
+{
+	hl_arena* arena = malloc(sizeof(hl_arena));
+	if (arena == NULL)
+		return NULL;
+	arena->used = 0;
+	arena->generation = new_generation();
+	arena->symbols_version = 0;
+	return arena;
+}
+
+void hl_arena_free(hl_arena* arena)
+{
+	free(arena);
+}
+
+void hl_invalidate(hl_arena* arena)
+{
+	// forget every line's spans
+	arena->used = 0;
+	arena->generation = new_generation();
+}
+
+void hl_store(hl_arena* arena, docline* line, const unsigned char* classes, int len)
+{
+	// run-length encode one class per column into spans for line
+	if (arena->used + len > HL_ARENA_SPANS)
+		hl_invalidate(arena);
+	line->hl_first = arena->used;
+	line->hl_count = 0;
+	for (int i = 0; i < len; )
+	{
+		int start = i;
+		while (i < len && classes[i] == classes[start])
+			++i;
+		hl_span* span = &arena->spans[arena->used++];
+		span->start = start;
+		span->length = i - start;
+		span->cls = classes[start];
+		++line->hl_count;
+	}
+	line->hl_generation = arena->generation;
+}
+
+attr_t hl_attr(enum hl_class cls)
+{
+	return class_attrs[cls];
+}
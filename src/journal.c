@@ -0,0 +1,602 @@
+// journal.c - crash recovery, see journal_start
+// every edit is queued as a line level record (set, insert or delete a
+// line, by an id we give each line) and a background thread writes them
+// out in batches to an append only log next to the file. the writer
+// keeps its own copy of the document from the same records, and once
+// the log gets big it writes that copy out as a snapshot and starts the
+// log again. queueing a record is a copy into a buffer under a lock the
+// writer only ever holds long enough to swap buffers, so the keystroke
+// path never waits on the disk.
+//
+// records are one per line, the text always goes last:
+//   S seq id text			line id now reads text
+//   I seq id after text	new line id goes after line after (0 for the top)
+//   D seq id				line id is gone
+//   R seq clean n path		start over for path from the n lines after it
+// the n lines after an R are just the document's text, the writer numbers
+// them 1 to n (seq goes up by one for each) so all journal_start has to
+// do is copy them. R and its lines are never logged.
+// a snapshot is a "mipsze journal 1 seq" header then "id text" per line,
+// recovery loads it and replays the log records newer than seq. a torn
+// record at the end of the log has no newline and is ignored.
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "headers/main.h"
+#include "headers/journal.h"
+#include "headers/trace.h"
+
+#define JOURNAL_VERSION 1
+#define JOURNAL_RECORD_LENGTH (LINE_LENGTH + 64)
+
+static void journal_paths(const char* filename, char* snap_path, char* log_path);
+static journal_line* find_line(journal* j, unsigned int id);
+static void index_line(journal* j, journal_line* l);
+static void unindex_line(journal* j, journal_line* l);
+static void add_line(journal* j, journal_line* after, unsigned int id, const char* text);
+static void clear_lines(journal* j);
+static char apply_record(journal* j, char* record);
+static char* reserve(journal* j, size_t len);
+static void enqueue(journal* j, const char* records, size_t len);
+static int write_snapshot(journal* j);
+static void open_log(journal* j);
+static void close_log(journal* j, bool remove_files);
+static unsigned long reset_writer(journal* j, char* record, bool* snapshot_due);
+static void write_batch(journal* j, char* batch, size_t len);
+static void* writer_main(void* arg);
+
+static void journal_paths(const char* filename, char* snap_path, char* log_path)
+{
+	// dir/foo.asm keeps its journal in dir/.foo.asm.journal
+	const char* name = filename && filename[0] ? filename : "untitled";
+	const char* base = strrchr(name, '/');
+	int dir_len = base ? base - name + 1 : 0;
+	base = base ? base + 1 : name;
+	snprintf(snap_path, JOURNAL_PATH_LENGTH, "%.*s.%s.journal", dir_len, name, base);
+	snprintf(log_path, JOURNAL_PATH_LENGTH, "%s.log", snap_path);
+}
+
+static journal_line* find_line(journal* j, unsigned int id)
+{
+	if (j->index_size == 0)
+		return NULL;
+	journal_line* l = j->index[id & (j->index_size - 1)];
+	while (l && l->id != id)
+		l = l->chain;
+	return l;
+}
+
+static void index_line(journal* j, journal_line* l)
+{
+	// keep about one line per bucket
+	if (j->num_lines >= j->index_size)
+	{
+		size_t size = j->index_size ? j->index_size * 2 : 1024;
+		journal_line** index = calloc(size, sizeof(journal_line*));
+		if (index == NULL)
+			return;
+		for (size_t i = 0; i < j->index_size; ++i)
+		{
+			journal_line* next;
+			for (journal_line* m = j->index[i]; m; m = next)
+			{
+				next = m->chain;
+				m->chain = index[m->id & (size - 1)];
+				index[m->id & (size - 1)] = m;
+			}
+		}
+		free(j->index);
+		j->index = index;
+		j->index_size = size;
+	}
+	journal_line** bucket = &j->index[l->id & (j->index_size - 1)];
+	l->chain = *bucket;
+	*bucket = l;
+	++j->num_lines;
+}
+
+static void unindex_line(journal* j, journal_line* l)
+{
+	journal_line** p = &j->index[l->id & (j->index_size - 1)];
+	while (*p != l)
+		p = &(*p)->chain;
+	*p = l->chain;
+	--j->num_lines;
+}
+
+static void add_line(journal* j, journal_line* after, unsigned int id, const char* text)
+{
+	journal_line* l = calloc(1, sizeof(journal_line));
+	if (l == NULL)
+		return;
+	l->id = id;
+	strncpy(l->text, text, LINE_LENGTH - 1);
+	l->prevline = after;
+	l->nextline = after ? after->nextline : j->head;
+	if (l->nextline)
+		l->nextline->prevline = l;
+	else
+		j->tail = l;
+	if (after)
+		after->nextline = l;
+	else
+		j->head = l;
+	index_line(j, l);
+}
+
+static void clear_lines(journal* j)
+{
+	journal_line* next;
+	for (journal_line* l = j->head; l; l = next)
+	{
+		next = l->nextline;
+		free(l);
+	}
+	free(j->index);
+	j->head = j->tail = NULL;
+	j->index = NULL;
+	j->index_size = 0;
+	j->num_lines = 0;
+}
+
+static char apply_record(journal* j, char* record)
+{
+	// apply one record (without its newline) to the writer's copy,
+	// returns its op or 0 if it doesn't make sense
+	char op = record[0];
+	char* p;
+	unsigned long seq = strtoul(record + 1, &p, 10);
+	unsigned int id = strtoul(p, &p, 10);
+	unsigned int after = 0;
+	if (op == 'I')
+		after = strtoul(p, &p, 10);
+	if (*p == ' ')
+		++p;
+	journal_line* l = find_line(j, id);
+	switch (op)
+	{
+	case 'S':
+		if (l == NULL)
+			return 0;
+		memset(l->text, 0, LINE_LENGTH);
+		strncpy(l->text, p, LINE_LENGTH - 1);
+		break;
+	case 'I':
+		if (l != NULL)
+			return 0;
+		add_line(j, after ? find_line(j, after) : NULL, id, p);
+		break;
+	case 'D':
+		if (l == NULL)
+			return 0;
+		if (l->prevline)
+			l->prevline->nextline = l->nextline;
+		else
+			j->head = l->nextline;
+		if (l->nextline)
+			l->nextline->prevline = l->prevline;
+		else
+			j->tail = l->prevline;
+		unindex_line(j, l);
+		free(l);
+		break;
+	case 'R':
+		clear_lines(j);
+		break;
+	default:
+		return 0;
+	}
+	j->applied = seq;
+	return op;
+}
+
+static char* reserve(journal* j, size_t len)
+{
+	// room for len more bytes of records, with the lock held
+	if (j->pending_len + len > j->pending_size)
+	{
+		size_t size = max(j->pending_size * 2, j->pending_len + len + 4096);
+		char* bigger = realloc(j->pending, size);
+		if (bigger == NULL)
+		{
+			__atomic_store_n(&j->error, ENOMEM, __ATOMIC_RELAXED);
+			return NULL;
+		}
+		j->pending = bigger;
+		j->pending_size = size;
+	}
+	char* p = j->pending + j->pending_len;
+	j->pending_len += len;
+	return p;
+}
+
+static void enqueue(journal* j, const char* records, size_t len)
+{
+	pthread_mutex_lock(&j->lock);
+	char* p = reserve(j, len);
+	if (p)
+	{
+		memcpy(p, records, len);
+		pthread_cond_signal(&j->wake);
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+static int write_snapshot(journal* j)
+{
+	// write to the side and rename over, so there's always a whole snapshot
+	char tmp_path[JOURNAL_PATH_LENGTH + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", j->snap_path);
+	FILE* f = fopen(tmp_path, "w");
+	if (f == NULL)
+		return -1;
+	fprintf(f, "mipsze journal %d %lu\n", JOURNAL_VERSION, j->applied);
+	for (journal_line* l = j->head; l; l = l->nextline)
+		fprintf(f, "%u %s\n", l->id, l->text);
+	if (fflush(f) != 0 || fsync(fileno(f)) != 0)
+	{
+		fclose(f);
+		remove(tmp_path);
+		return -1;
+	}
+	fclose(f);
+	return rename(tmp_path, j->snap_path);
+}
+
+static void open_log(journal* j)
+{
+	// everything so far goes in the snapshot, the log starts empty
+	if (write_snapshot(j) != 0 || (j->log = fopen(j->log_path, "w")) == NULL)
+	{
+		__atomic_store_n(&j->error, errno, __ATOMIC_RELAXED);
+		return;
+	}
+	j->log_bytes = 0;
+}
+
+static void close_log(journal* j, bool remove_files)
+{
+	if (j->log)
+		fclose(j->log);
+	j->log = NULL;
+	if (remove_files && j->snap_path[0])
+	{
+		remove(j->snap_path);
+		remove(j->log_path);
+	}
+}
+
+static unsigned long reset_writer(journal* j, char* record, bool* snapshot_due)
+{
+	// R seq clean n path, the old journal isn't needed any more,
+	// returns n
+	char* p;
+	strtoul(record + 1, &p, 10);
+	bool clean = strtoul(p, &p, 10) != 0;
+	unsigned long base_lines = strtoul(p, &p, 10);
+	if (*p == ' ')
+		++p;
+	char snap_path[JOURNAL_PATH_LENGTH];
+	char log_path[JOURNAL_PATH_LENGTH];
+	journal_paths(p, snap_path, log_path);
+	close_log(j, clean || strcmp(snap_path, j->snap_path) != 0);
+	strcpy(j->snap_path, snap_path);
+	strcpy(j->log_path, log_path);
+	// a clean start has nothing worth recovering until the first edit,
+	// otherwise the base needs to be on disk right away (it replaces
+	// the old snapshot when it's written)
+	if (clean)
+		close_log(j, true);
+	*snapshot_due = !clean;
+	return base_lines;
+}
+
+static void write_batch(journal* j, char* batch, size_t len)
+{
+	TRACE_BEGIN(TR_JOURNAL, len);
+	bool snapshot_due = false;
+	char* end = batch + len;
+	for (char* p = batch; p < end; )
+	{
+		char* nl = memchr(p, '\n', end - p);
+		*nl = '\0';
+		char op = p[0];
+		if (op == 'S' || op == 'I' || op == 'D')
+		{
+			if (j->log == NULL && __atomic_load_n(&j->error, __ATOMIC_RELAXED) == 0)
+				open_log(j);
+			if (apply_record(j, p) && j->log)
+			{
+				*nl = '\n';
+				fwrite(p, 1, nl - p + 1, j->log);
+				j->log_bytes += nl - p + 1;
+			}
+		}
+		else if (op == 'R')
+		{
+			unsigned long base_lines = reset_writer(j, p, &snapshot_due);
+			apply_record(j, p);
+			// journal_start queues them all at once, so they're here
+			for (unsigned int id = 1; id <= base_lines && nl + 1 < end; ++id)
+			{
+				p = nl + 1;
+				nl = memchr(p, '\n', end - p);
+				*nl = '\0';
+				add_line(j, j->tail, id, p);
+				++j->applied;
+			}
+		}
+		else
+			apply_record(j, p);
+		p = nl + 1;
+	}
+	if (snapshot_due && j->log == NULL)
+		open_log(j);
+	if (j->log)
+	{
+		if (fflush(j->log) != 0 || fdatasync(fileno(j->log)) != 0)
+			__atomic_store_n(&j->error, errno, __ATOMIC_RELAXED);
+		else if (j->log_bytes > JOURNAL_COMPACT_BYTES)
+		{
+			// fold the log into a new snapshot
+			close_log(j, false);
+			open_log(j);
+		}
+	}
+	TRACE_END(TR_JOURNAL, j->log_bytes);
+}
+
+static void* writer_main(void* arg)
+{
+	journal* j = arg;
+	char* batch = NULL;
+	size_t batch_size = 0;
+	pthread_mutex_lock(&j->lock);
+	for (;;)
+	{
+		while (j->pending_len == 0 && !j->stop)
+			pthread_cond_wait(&j->wake, &j->lock);
+		if (j->pending_len == 0)
+			break;
+
+		// let some more edits pile up so they go out together
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += JOURNAL_BATCH_MS * 1000000L;
+		until.tv_sec += until.tv_nsec / 1000000000L;
+		until.tv_nsec %= 1000000000L;
+		while (!j->stop && pthread_cond_timedwait(&j->wake, &j->lock, &until) != ETIMEDOUT)
+			;
+
+		char* full = j->pending;
+		size_t full_size = j->pending_size;
+		size_t len = j->pending_len;
+		j->pending = batch;
+		j->pending_size = batch_size;
+		j->pending_len = 0;
+		batch = full;
+		batch_size = full_size;
+		pthread_mutex_unlock(&j->lock);
+		write_batch(j, batch, len);
+		pthread_mutex_lock(&j->lock);
+	}
+	bool discard = j->discard;
+	pthread_mutex_unlock(&j->lock);
+	close_log(j, discard);
+	free(batch);
+	return NULL;
+}
+
+bool journal_exists(const char* filename)
+{
+	char snap_path[JOURNAL_PATH_LENGTH];
+	char log_path[JOURNAL_PATH_LENGTH];
+	journal_paths(filename, snap_path, log_path);
+	return access(snap_path, R_OK) == 0;
+}
+
+int journal_recover(const char* filename, doc* document)
+{
+	// rebuild the document from the snapshot and the log after it,
+	// filling in document the same way load_doc does
+	journal j = { 0 };
+	char record[JOURNAL_RECORD_LENGTH];
+	int version = 0;
+	unsigned long snapshot_seq = 0;
+	journal_paths(filename, j.snap_path, j.log_path);
+	FILE* f = fopen(j.snap_path, "r");
+	if (f == NULL)
+		return -1;
+	if (fgets(record, sizeof(record), f) == NULL ||
+		sscanf(record, "mipsze journal %d %lu", &version, &snapshot_seq) != 2 ||
+		version != JOURNAL_VERSION)
+	{
+		fclose(f);
+		return -1;
+	}
+	while (fgets(record, sizeof(record), f))
+	{
+		char* nl = strchr(record, '\n');
+		char* text;
+		if (nl == NULL)
+			break;
+		*nl = '\0';
+		unsigned int id = strtoul(record, &text, 10);
+		if (*text == ' ')
+			++text;
+		add_line(&j, j.tail, id, text);
+	}
+	fclose(f);
+
+	f = fopen(j.log_path, "r");
+	if (f)
+	{
+		while (fgets(record, sizeof(record), f))
+		{
+			char* nl = strchr(record, '\n');
+			if (nl == NULL)
+				break;
+			*nl = '\0';
+			if (strtoul(record + 1, NULL, 10) > snapshot_seq)
+				apply_record(&j, record);
+		}
+		fclose(f);
+	}
+
+	document->head = document->tail = NULL;
+	document->number_of_lines = 0;
+	document->number_of_chars = 0;
+	for (journal_line* l = j.head; l; l = l->nextline)
+	{
+		docline* line = calloc(1, sizeof(docline));
+		if (line == NULL)
+			break;
+		strcpy(line->line, l->text);
+		line->prevline = document->tail;
+		if (document->tail)
+			document->tail->nextline = line;
+		else
+			document->head = line;
+		document->tail = line;
+		++document->number_of_lines;
+		document->number_of_chars += strlen(l->text);
+	}
+	clear_lines(&j);
+	if (document->head == NULL)
+	{
+		document->head = document->tail = calloc(1, sizeof(docline));
+		document->number_of_lines = 1;
+	}
+	return 0;
+}
+
+void journal_start(doc* document, const char* filename, bool clean)
+{
+	// start journaling document as it is now, for filename (or NULL
+	// if it hasn't got one yet). clean means it matches what's on disk,
+	// so there's nothing to write until it's edited
+	journal* j = document->journal;
+	if (j == NULL)
+	{
+		j = calloc(1, sizeof(journal));
+		if (j == NULL)
+			return;
+		pthread_mutex_init(&j->lock, NULL);
+		pthread_cond_init(&j->wake, NULL);
+		if (pthread_create(&j->writer, NULL, writer_main, j) != 0)
+		{
+			pthread_cond_destroy(&j->wake);
+			pthread_mutex_destroy(&j->lock);
+			free(j);
+			set_debug_msg("Can't start the journal, there's no crash recovery");
+			return;
+		}
+		j->running = true;
+		document->journal = j;
+	}
+
+	// number the lines the way the writer will, and see how much text
+	// there is to hand over
+	size_t text_len = 0;
+	j->next_id = 0;
+	for (docline* l = document->head; l; l = l->nextline)
+	{
+		l->journal_id = ++j->next_id;
+		text_len += strnlen(l->line, LINE_LENGTH - 1) + 1;
+	}
+	char header[JOURNAL_PATH_LENGTH + 64];
+	size_t header_len = snprintf(header, sizeof(header), "R %lu %d %u %s\n", ++j->seq, clean,
+		j->next_id, filename ? filename : "");
+	if (header_len >= sizeof(header))
+		return;
+	j->seq += j->next_id;
+
+	// the text goes straight into the queue, the writer makes its copy
+	// of the document from it
+	pthread_mutex_lock(&j->lock);
+	char* p = reserve(j, header_len + text_len);
+	if (p)
+	{
+		memcpy(p, header, header_len);
+		p += header_len;
+		for (docline* l = document->head; l; l = l->nextline)
+		{
+			size_t n = strnlen(l->line, LINE_LENGTH - 1);
+			memcpy(p, l->line, n);
+			p[n] = '\n';
+			p += n + 1;
+		}
+		pthread_cond_signal(&j->wake);
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+void journal_line_edited(doc* document, docline* line)
+{
+	journal* j = document->journal;
+	char records[JOURNAL_RECORD_LENGTH];
+	int len;
+	if (j == NULL)
+		return;
+	if (line->journal_id != 0)
+	{
+		len = snprintf(records, sizeof(records), "S %lu %u %.*s\n", ++j->seq,
+			line->journal_id, LINE_LENGTH - 1, line->line);
+		enqueue(j, records, len);
+		return;
+	}
+	// a new line, and maybe some before it we haven't heard about,
+	// they go in after the nearest line we have
+	docline* first = line;
+	while (first->prevline && first->prevline->journal_id == 0)
+		first = first->prevline;
+	for (docline* l = first; l != line->nextline; l = l->nextline)
+	{
+		l->journal_id = ++j->next_id;
+		len = snprintf(records, sizeof(records), "I %lu %u %u %.*s\n", ++j->seq,
+			l->journal_id, l->prevline ? l->prevline->journal_id : 0,
+			LINE_LENGTH - 1, l->line);
+		enqueue(j, records, len);
+	}
+}
+
+void journal_line_removed(doc* document, docline* line)
+{
+	journal* j = document->journal;
+	char records[JOURNAL_RECORD_LENGTH];
+	if (j == NULL || line->journal_id == 0)
+		return;
+	int len = snprintf(records, sizeof(records), "D %lu %u\n", ++j->seq, line->journal_id);
+	enqueue(j, records, len);
+	line->journal_id = 0;
+}
+
+int journal_error(doc* document)
+{
+	if (document->journal == NULL)
+		return 0;
+	return __atomic_load_n(&document->journal->error, __ATOMIC_RELAXED);
+}
+
+void journal_close(doc* document, bool discard)
+{
+	// write out whatever's queued and stop the writer, discard
+	// throws the journal away too
+	journal* j = document->journal;
+	if (j == NULL)
+		return;
+	pthread_mutex_lock(&j->lock);
+	j->stop = true;
+	j->discard = discard;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+	if (j->running)
+		pthread_join(j->writer, NULL);
+	clear_lines(j);
+	free(j->pending);
+	pthread_mutex_destroy(&j->lock);
+	pthread_cond_destroy(&j->wake);
+	free(j);
+	document->journal = NULL;
+}
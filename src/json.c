@@ -0,0 +1,410 @@
+// json.c - just enough json for the language server, see lsp.c
+// json_parse turns a message into a tree of values, json_out builds
+// up the text of a reply
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "headers/json.h"
+
+typedef struct json_reader
+{
+	const char* at;
+	const char* end;
+} json_reader;
+
+static json* parse_value(json_reader* r, int depth);
+static bool parse_string(json_reader* r, char** s, size_t* length);
+static bool parse_hex(json_reader* r, unsigned int* code);
+static void skip_space(json_reader* r);
+static bool match(json_reader* r, const char* word);
+static size_t put_utf8(char* out, unsigned int code);
+static bool reserve(json_out* out, size_t more);
+
+json* json_parse(const char* text, size_t length)
+{
+	// NULL unless text is exactly one value, give or take whitespace
+	json_reader r = { text, text + length };
+	json* value = parse_value(&r, 0);
+	skip_space(&r);
+	if (value && r.at != r.end)
+	{
+		json_free(value);
+		return NULL;
+	}
+	return value;
+}
+
+void json_free(json* value)
+{
+	while (value)
+	{
+		json* next = value->next;
+		json_free(value->child);
+		free(value->key);
+		free(value->string);
+		free(value);
+		value = next;
+	}
+}
+
+json* json_get(const json* object, const char* key)
+{
+	// the member of object called key, NULL if there isn't one
+	// or object isn't an object
+	if (object == NULL || object->type != JSON_OBJECT)
+		return NULL;
+	for (json* member = object->child; member; member = member->next)
+		if (strcmp(member->key, key) == 0)
+			return member;
+	return NULL;
+}
+
+const char* json_string(const json* value)
+{
+	return value && value->type == JSON_STRING ? value->string : NULL;
+}
+
+long json_long(const json* value, long fallback)
+{
+	return value && value->type == JSON_NUMBER ? (long)value->number : fallback;
+}
+
+static json* parse_value(json_reader* r, int depth)
+{
+	skip_space(r);
+	if (r->at == r->end || depth > JSON_MAX_DEPTH)
+		return NULL;
+	json* value = calloc(1, sizeof(json));
+	if (value == NULL)
+		return NULL;
+	char c = *r->at;
+	if (c == '{' || c == '[')
+	{
+		char close = c == '{' ? '}' : ']';
+		json** tail = &value->child;
+		value->type = c == '{' ? JSON_OBJECT : JSON_ARRAY;
+		++r->at;
+		skip_space(r);
+		if (r->at < r->end && *r->at == close)
+		{
+			++r->at;
+			return value;
+		}
+		for (;;)
+		{
+			char* key = NULL;
+			if (value->type == JSON_OBJECT)
+			{
+				size_t key_length;
+				skip_space(r);
+				if (!parse_string(r, &key, &key_length))
+					break;
+				skip_space(r);
+				if (r->at == r->end || *r->at != ':')
+				{
+					free(key);
+					break;
+				}
+				++r->at;
+			}
+			json* element = parse_value(r, depth + 1);
+			if (element == NULL)
+			{
+				free(key);
+				break;
+			}
+			element->key = key;
+			*tail = element;
+			tail = &element->next;
+			skip_space(r);
+			if (r->at < r->end && *r->at == ',')
+			{
+				++r->at;
+				continue;
+			}
+			if (r->at < r->end && *r->at == close)
+			{
+				++r->at;
+				return value;
+			}
+			break;
+		}
+		json_free(value);
+		return NULL;
+	}
+	if (c == '"')
+	{
+		value->type = JSON_STRING;
+		if (parse_string(r, &value->string, &value->length))
+			return value;
+	}
+	else if (c == '-' || (c >= '0' && c <= '9'))
+	{
+		// strtod wants a terminated string and ours isn't, numbers
+		// we care about are short
+		char number[64];
+		size_t n = 0;
+		while (r->at + n < r->end && n < sizeof(number) - 1 &&
+			strchr("+-.eE0123456789", r->at[n]))
+		{
+			number[n] = r->at[n];
+			++n;
+		}
+		number[n] = '\0';
+		char* stop;
+		value->type = JSON_NUMBER;
+		value->number = strtod(number, &stop);
+		if (stop == number + n)
+		{
+			r->at += n;
+			return value;
+		}
+	}
+	else if (match(r, "true") || match(r, "false"))
+	{
+		value->type = JSON_BOOL;
+		value->boolean = c == 't';
+		return value;
+	}
+	else if (match(r, "null"))
+	{
+		value->type = JSON_NULL;
+		return value;
+	}
+	json_free(value);
+	return NULL;
+}
+
+static bool parse_string(json_reader* r, char** s, size_t* length)
+{
+	// a quoted string at r, unescaped into a new buffer. escapes only
+	// ever get shorter so the quoted length is always enough room
+	if (r->at == r->end || *r->at != '"')
+		return false;
+	++r->at;
+	const char* close = r->at;
+	while (close < r->end && *close != '"')
+		close += (*close == '\\' && close + 1 < r->end) ? 2 : 1;
+	if (close >= r->end)
+		return false;
+	char* out = malloc(close - r->at + 1);
+	if (out == NULL)
+		return false;
+	size_t n = 0;
+	while (r->at < close)
+	{
+		char c = *r->at++;
+		if (c != '\\')
+		{
+			out[n++] = c;
+			continue;
+		}
+		c = *r->at++;
+		switch (c)
+		{
+		case 'b': out[n++] = '\b'; break;
+		case 'f': out[n++] = '\f'; break;
+		case 'n': out[n++] = '\n'; break;
+		case 'r': out[n++] = '\r'; break;
+		case 't': out[n++] = '\t'; break;
+		case 'u':
+		{
+			unsigned int code, low;
+			if (!parse_hex(r, &code))
+				goto bad;
+			// a utf-16 surrogate pair is one character
+			if (code >= 0xd800 && code < 0xdc00 && r->at + 1 < close &&
+				r->at[0] == '\\' && r->at[1] == 'u')
+			{
+				r->at += 2;
+				if (!parse_hex(r, &low) || low < 0xdc00 || low >= 0xe000)
+					goto bad;
+				code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+			}
+			n += put_utf8(out + n, code);
+			break;
+		}
+		default:
+			out[n++] = c;
+			break;
+		}
+	}
+	out[n] = '\0';
+	r->at = close + 1;
+	*s = out;
+	*length = n;
+	return true;
+bad:
+	free(out);
+	return false;
+}
+
+static bool parse_hex(json_reader* r, unsigned int* code)
+{
+	*code = 0;
+	for (int i = 0; i < 4; ++i, ++r->at)
+	{
+		if (r->at == r->end)
+			return false;
+		char c = *r->at;
+		*code <<= 4;
+		if (c >= '0' && c <= '9')
+			*code |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			*code |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			*code |= c - 'A' + 10;
+		else
+			return false;
+	}
+	return true;
+}
+
+static size_t put_utf8(char* out, unsigned int code)
+{
+	// never longer than the \uXXXX (or pair of them) it came from
+	if (code < 0x80)
+	{
+		out[0] = code;
+		return 1;
+	}
+	if (code < 0x800)
+	{
+		out[0] = 0xc0 | (code >> 6);
+		out[1] = 0x80 | (code & 0x3f);
+		return 2;
+	}
+	if (code < 0x10000)
+	{
+		out[0] = 0xe0 | (code >> 12);
+		out[1] = 0x80 | ((code >> 6) & 0x3f);
+		out[2] = 0x80 | (code & 0x3f);
+		return 3;
+	}
+	out[0] = 0xf0 | (code >> 18);
+	out[1] = 0x80 | ((code >> 12) & 0x3f);
+	out[2] = 0x80 | ((code >> 6) & 0x3f);
+	out[3] = 0x80 | (code & 0x3f);
+	return 4;
+}
+
+static void skip_space(json_reader* r)
+{
+	while (r->at < r->end && (*r->at == ' ' || *r->at == '\t' || *r->at == '\n' || *r->at == '\r'))
+		++r->at;
+}
+
+static bool match(json_reader* r, const char* word)
+{
+	size_t n = strlen(word);
+	if ((size_t)(r->end - r->at) < n || memcmp(r->at, word, n) != 0)
+		return false;
+	r->at += n;
+	return true;
+}
+
+static bool reserve(json_out* out, size_t more)
+{
+	if (out->failed)
+		return false;
+	if (out->length + more + 1 <= out->capacity)
+		return true;
+	size_t size = out->capacity ? out->capacity : 256;
+	while (size < out->length + more + 1)
+		size *= 2;
+	char* bigger = realloc(out->text, size);
+	if (bigger == NULL)
+	{
+		out->failed = true;
+		return false;
+	}
+	out->text = bigger;
+	out->capacity = size;
+	return true;
+}
+
+void json_printf(json_out* out, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (n < 0 || !reserve(out, n))
+		return;
+	va_start(args, format);
+	vsnprintf(out->text + out->length, n + 1, format, args);
+	va_end(args);
+	out->length += n;
+}
+
+void json_write_string(json_out* out, const char* s, size_t length)
+{
+	// s quoted, anything json won't take as is escaped
+	if (!reserve(out, length * 6 + 2))
+		return;
+	char* p = out->text + out->length;
+	*p++ = '"';
+	for (size_t i = 0; i < length; ++i)
+	{
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+		{
+			*p++ = '\\';
+			*p++ = c;
+		}
+		else if (c == '\n')
+		{
+			*p++ = '\\';
+			*p++ = 'n';
+		}
+		else if (c < 0x20)
+			p += sprintf(p, "\\u%04x", c);
+		else
+			*p++ = c;
+	}
+	*p++ = '"';
+	*p = '\0';
+	out->length = p - out->text;
+}
+
+void json_write(json_out* out, const json* value)
+{
+	// value as text again, how we echo request ids back
+	if (value == NULL)
+	{
+		json_printf(out, "null");
+		return;
+	}
+	switch (value->type)
+	{
+	case JSON_NULL:
+		json_printf(out, "null");
+		break;
+	case JSON_BOOL:
+		json_printf(out, value->boolean ? "true" : "false");
+		break;
+	case JSON_NUMBER:
+		json_printf(out, "%.17g", value->number);
+		break;
+	case JSON_STRING:
+		json_write_string(out, value->string, value->length);
+		break;
+	case JSON_ARRAY:
+	case JSON_OBJECT:
+		json_printf(out, value->type == JSON_ARRAY ? "[" : "{");
+		for (json* element = value->child; element; element = element->next)
+		{
+			if (value->type == JSON_OBJECT)
+			{
+				json_write_string(out, element->key, strlen(element->key));
+				json_printf(out, ":");
+			}
+			json_write(out, element);
+			if (element->next)
+				json_printf(out, ",");
+		}
+		json_printf(out, value->type == JSON_ARRAY ? "]" : "}");
+		break;
+	}
+}
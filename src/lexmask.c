@@ -0,0 +1,191 @@
+// lexmask.c - classify every character of a line at once
+// instead of walking a line a byte at a time and branching on every
+// delimiter, we build bitmasks (one bit per column) for each class of
+// character the lexers care about, then parse_line and find_labels pull
+// tokens straight out of the masks.
+#include "headers/main.h"
+#include "headers/lexmask.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if LINE_LENGTH > MASK_WORDS * 64
+#error "line masks are too small for LINE_LENGTH"
+#endif
+
+static bool escaped(const char* line, int open, int i);
+
+// classify 16 columns starting at col, shared by the sse2 and avx2 paths
+#if defined(__SSE2__)
+static inline void classify_16(const char* line, int col, line_masks* m, uint64_t* nul)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)(line + col));
+	#define EQ(c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+	#define BITS(x) ((uint64_t)(unsigned)_mm_movemask_epi8(x) << (col & 63))
+	int w = col >> 6;
+	m->space[w] |= BITS(_mm_or_si128(_mm_or_si128(EQ(' '), EQ('\t')), EQ('\n')));
+	m->paren[w] |= BITS(_mm_or_si128(EQ('('), EQ(')')));
+	m->comma[w] |= BITS(EQ(','));
+	m->comment[w] |= BITS(EQ('#'));
+	m->dquote[w] |= BITS(EQ('\"'));
+	m->squote[w] |= BITS(EQ('\''));
+	m->dollar[w] |= BITS(EQ('$'));
+	m->percent[w] |= BITS(EQ('%'));
+	m->dot[w] |= BITS(EQ('.'));
+	nul[w] |= BITS(EQ('\0'));
+	#undef EQ
+	#undef BITS
+}
+#endif
+
+#if defined(__AVX2__)
+static inline void classify_32(const char* line, int col, line_masks* m, uint64_t* nul)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i*)(line + col));
+	#define EQ(c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+	#define BITS(x) ((uint64_t)(unsigned)_mm256_movemask_epi8(x) << (col & 63))
+	int w = col >> 6;
+	m->space[w] |= BITS(_mm256_or_si256(_mm256_or_si256(EQ(' '), EQ('\t')), EQ('\n')));
+	m->paren[w] |= BITS(_mm256_or_si256(EQ('('), EQ(')')));
+	m->comma[w] |= BITS(EQ(','));
+	m->comment[w] |= BITS(EQ('#'));
+	m->dquote[w] |= BITS(EQ('\"'));
+	m->squote[w] |= BITS(EQ('\''));
+	m->dollar[w] |= BITS(EQ('$'));
+	m->percent[w] |= BITS(EQ('%'));
+	m->dot[w] |= BITS(EQ('.'));
+	nul[w] |= BITS(EQ('\0'));
+	#undef EQ
+	#undef BITS
+}
+#endif
+
+void classify_line(const char* line, line_masks* m)
+{
+	uint64_t nul[MASK_WORDS] = {0};
+	memset(m, 0, sizeof(line_masks));
+	int col = 0;
+#if defined(__AVX2__)
+	for (; col + 32 <= LINE_LENGTH; col += 32)
+		classify_32(line, col, m, nul);
+#endif
+#if defined(__SSE2__)
+	for (; col + 16 <= LINE_LENGTH; col += 16)
+		classify_16(line, col, m, nul);
+#endif
+	// scalar fallback, and whatever is left over if LINE_LENGTH
+	// isn't a multiple of the vector width
+	for (; col < LINE_LENGTH; ++col)
+	{
+		uint64_t bit = 1ULL << (col & 63);
+		int w = col >> 6;
+		switch (line[col])
+		{
+		case ' ': case '\t': case '\n': m->space[w] |= bit; break;
+		case '(': case ')': m->paren[w] |= bit; break;
+		case ',': m->comma[w] |= bit; break;
+		case '#': m->comment[w] |= bit; break;
+		case '\"': m->dquote[w] |= bit; break;
+		case '\'': m->squote[w] |= bit; break;
+		case '$': m->dollar[w] |= bit; break;
+		case '%': m->percent[w] |= bit; break;
+		case '.': m->dot[w] |= bit; break;
+		case '\0': nul[w] |= bit; break;
+		default: break;
+		}
+	}
+
+	// first nul is the end of the line, throw away anything after it
+	m->length = mask_next_set(nul, 0, LINE_LENGTH);
+	for (int w = 0; w < MASK_WORDS; ++w)
+	{
+		int lo = w * 64;
+		uint64_t keep;
+		if (m->length <= lo)
+			keep = 0;
+		else if (m->length >= lo + 64)
+			keep = ~0ULL;
+		else
+			keep = (1ULL << (m->length - lo)) - 1;
+		m->space[w] &= keep;
+		m->paren[w] &= keep;
+		m->comma[w] &= keep;
+		m->comment[w] &= keep;
+		m->dquote[w] &= keep;
+		m->squote[w] &= keep;
+		m->dollar[w] &= keep;
+		m->percent[w] &= keep;
+		m->dot[w] &= keep;
+	}
+}
+
+int mask_next_set(const uint64_t* mask, int from, int limit)
+{
+	// index of the first set bit at or after from, or limit if none
+	for (int w = from >> 6; w < MASK_WORDS && (w << 6) < limit; ++w)
+	{
+		uint64_t bits = mask[w];
+		if (w == from >> 6)
+			bits &= ~0ULL << (from & 63);
+		if (bits)
+		{
+			int i = (w << 6) + __builtin_ctzll(bits);
+			return i < limit ? i : limit;
+		}
+	}
+	return limit;
+}
+
+int mask_next_clear(const uint64_t* mask, int from, int limit)
+{
+	uint64_t inverted[MASK_WORDS];
+	for (int w = 0; w < MASK_WORDS; ++w)
+		inverted[w] = ~mask[w];
+	return mask_next_set(inverted, from, limit);
+}
+
+int mask_quotes(const line_masks* m, const char* line, uint64_t* quoted, bool* unterminated)
+{
+	// mark every "string" and 'c'haracter in quoted, quotes and all, and
+	// return where the comment starts (the length if there isn't one).
+	// a # inside quotes isn't a comment and a \ inside escapes whatever
+	// follows. the lexers and the assembler all go by this
+	uint64_t special[MASK_WORDS];
+	for (int w = 0; w < MASK_WORDS; ++w)
+	{
+		special[w] = m->comment[w] | m->dquote[w] | m->squote[w];
+		quoted[w] = 0;
+	}
+	*unterminated = false;
+	int len = m->length;
+	int pos = mask_next_set(special, 0, len);
+	while (pos < len)
+	{
+		if (line[pos] == '#')
+			return pos;
+		const uint64_t* same = line[pos] == '\"' ? m->dquote : m->squote;
+		int close = pos;
+		do
+			close = mask_next_set(same, close + 1, len);
+		while (close < len && escaped(line, pos, close));
+		for (int i = pos; i <= close && i < len; ++i)
+			quoted[i >> 6] |= 1ULL << (i & 63);
+		if (close == len)
+		{
+			*unterminated = true;
+			return len;
+		}
+		pos = mask_next_set(special, close + 1, len);
+	}
+	return len;
+}
+
+static bool escaped(const char* line, int open, int i)
+{
+	// is line[i] after an odd run of backslashes, inside the quote at open?
+	int n = 0;
+	while (i - n - 1 > open && line[i - n - 1] == '\\')
+		++n;
+	return n & 1;
+}
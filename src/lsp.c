@@ -0,0 +1,758 @@
+// lsp.c - a language server on stdin and stdout, so other editors get
+// the same highlighting, diagnostics and labels our parser works out.
+// every open file is a doc like the editor's, edits arrive as ranges
+// and only the lines they touch are scanned again, see apply_change.
+// semantic tokens are the parse_line spans, once a client has had them
+// it can ask for just what changed since, see send_tokens.
+// positions are bytes into a line, which is what utf-16 offsets are as
+// long as the file is ascii. a line only holds LINE_LENGTH - 1 characters
+// and cutting one short would put every position after it in the wrong
+// place, so a document with a longer line isn't analysed at all until
+// the client sends all of it again, see show_too_long
+#include "headers/main.h"
+#include "headers/parse.h"
+#include "headers/symbols.h"
+#include "headers/diag.h"
+#include "headers/highlight.h"
+#include "headers/json.h"
+#include "headers/complete.h"
+#include "headers/lsp.h"
+#include <strings.h>
+
+#define LSP_TOKEN_INTS 5		// line, start, length, type, modifiers
+#define LSP_DECLARATION 0x01	// the only token modifier we use
+
+// completion item kinds, from the protocol
+#define LSP_KIND_FUNCTION 3
+#define LSP_KIND_VARIABLE 6
+#define LSP_KIND_KEYWORD 14
+#define LSP_KIND_REFERENCE 18
+
+typedef struct lsp_document
+{
+	char* uri;
+	doc document;
+	unsigned int* tokens;		// the semantic tokens we sent last
+	size_t num_tokens;
+	unsigned long result_id;	// what the client knows them as
+	bool had_diagnostics;		// so we only clear them once
+	bool too_long;				// a line didn't fit, nothing we say about it is right
+} lsp_document;
+
+// what we call each hl class in the protocol, -1 for the ones that
+// aren't worth sending
+static const char* token_types[] =
+{
+	"comment", "string", "namespace", "variable", "parameter",
+	"macro", "label", "keyword", "number"
+};
+static const int token_type_of[HL_NUM_CLASSES] =
+{
+	[HL_PLAIN] = -1,
+	[HL_PUNC] = -1,
+	[HL_COMMENT] = 0,
+	[HL_QUOTE] = 1,
+	[HL_UNTERMINATED] = 1,
+	[HL_ERROR] = -1,
+	[HL_SECTION] = 2,
+	[HL_REGISTER] = 3,
+	[HL_MACRO_PARAM] = 4,
+	[HL_MACRO] = 5,
+	[HL_LABEL_DEF] = 6,
+	[HL_LABEL] = 6,
+	[HL_PSEUDO] = 7,
+	[HL_KEYWORD] = 7,
+	[HL_NUM] = 8
+};
+
+static lsp_document* documents[LSP_MAX_DOCUMENTS];
+static int num_documents = 0;
+static bool shutting_down = false;
+static unsigned long next_result_id = 1;
+
+static bool read_message(char** body, size_t* length);
+static void send(json_out* out);
+static void reply_start(json_out* out, const json* id);
+static void reply_null(const json* id);
+static void reply_error(const json* id, int code, const char* message);
+static bool handle(const json* message);
+static void initialize(const json* id);
+static lsp_document* find_document(const json* params);
+static void open_document(const json* params);
+static void close_document(const json* params);
+static void free_document(lsp_document* ld);
+static void set_text(lsp_document* ld, const char* text, size_t length);
+static void apply_change(lsp_document* ld, const json* change);
+static docline* add_text(lsp_document* ld, docline* line, const char* text, size_t length);
+static void show_too_long(lsp_document* ld);
+static void drop_line(doc* document, docline* line);
+static docline* line_at(doc* document, long number);
+static bool word_at(docline* line, long character, bool whole, char* word);
+static void publish_diagnostics(lsp_document* ld);
+static size_t make_tokens(doc* document, unsigned int** tokens);
+static void send_tokens(const json* id, lsp_document* ld, const char* previous);
+static void write_ints(json_out* out, const unsigned int* ints, size_t count);
+static void find_definition(const json* id, lsp_document* ld, const json* position);
+static void complete(const json* id, lsp_document* ld, const json* position);
+static void add_item(json_out* out, bool first, const char* label, int kind, const char* detail);
+
+int lsp_run()
+{
+	// serve until the client says exit or hangs up
+	if (init_parser() < 0)
+	{
+		fprintf(stderr, "mipsze: can't read the parser tables in dat/\n");
+		return EXIT_FAILURE;
+	}
+	char* body;
+	size_t length;
+	bool done = false;
+	while (!done && read_message(&body, &length))
+	{
+		json* message = json_parse(body, length);
+		free(body);
+		if (message == NULL)
+		{
+			reply_error(NULL, LSP_PARSE_ERROR, "Can't parse message");
+			continue;
+		}
+		done = handle(message);
+		json_free(message);
+	}
+	for (int i = 0; i < num_documents; ++i)
+		free_document(documents[i]);
+	num_documents = 0;
+	return shutting_down ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool read_message(char** body, size_t* length)
+{
+	// the next message's content, false once there aren't any more
+	char header[256];
+	long content_length = -1;
+	for (;;)
+	{
+		if (fgets(header, sizeof(header), stdin) == NULL)
+			return false;
+		if (strcmp(header, "\r\n") == 0 || strcmp(header, "\n") == 0)
+		{
+			if (content_length >= 0)
+				break;
+			continue;
+		}
+		if (strncasecmp(header, "Content-Length:", 15) == 0)
+			content_length = strtol(header + 15, NULL, 10);
+	}
+	if (content_length > LSP_MAX_MESSAGE)
+	{
+		fprintf(stderr, "mipsze: %ld byte message is too big\n", content_length);
+		return false;
+	}
+	*body = malloc(content_length + 1);
+	if (*body == NULL)
+		return false;
+	if (fread(*body, 1, content_length, stdin) != (size_t)content_length)
+	{
+		free(*body);
+		return false;
+	}
+	(*body)[content_length] = '\0';
+	*length = content_length;
+	return true;
+}
+
+static void send(json_out* out)
+{
+	if (!out->failed)
+	{
+		printf("Content-Length: %zu\r\n\r\n", out->length);
+		fwrite(out->text, 1, out->length, stdout);
+		fflush(stdout);
+	}
+	free(out->text);
+	*out = (json_out){ 0 };
+}
+
+static void reply_start(json_out* out, const json* id)
+{
+	// the caller adds the result and the closing brace
+	json_printf(out, "{\"jsonrpc\":\"2.0\",\"id\":");
+	json_write(out, id);
+	json_printf(out, ",\"result\":");
+}
+
+static void reply_null(const json* id)
+{
+	json_out out = { 0 };
+	reply_start(&out, id);
+	json_printf(&out, "null}");
+	send(&out);
+}
+
+static void reply_error(const json* id, int code, const char* message)
+{
+	json_out out = { 0 };
+	json_printf(&out, "{\"jsonrpc\":\"2.0\",\"id\":");
+	json_write(&out, id);
+	json_printf(&out, ",\"error\":{\"code\":%d,\"message\":", code);
+	json_write_string(&out, message, strlen(message));
+	json_printf(&out, "}}");
+	send(&out);
+}
+
+static bool handle(const json* message)
+{
+	// do what message asks, true if it's time to stop
+	const char* method = json_string(json_get(message, "method"));
+	const json* id = json_get(message, "id");
+	const json* params = json_get(message, "params");
+	// no method is a reply, and we never ask the client anything
+	if (method == NULL)
+		return false;
+	if (strcmp(method, "exit") == 0)
+		return true;
+	if (shutting_down && id)
+	{
+		reply_error(id, LSP_INVALID_REQUEST, "Shutting down");
+		return false;
+	}
+
+	if (strcmp(method, "initialize") == 0)
+		initialize(id);
+	else if (strcmp(method, "shutdown") == 0)
+	{
+		shutting_down = true;
+		reply_null(id);
+	}
+	else if (strcmp(method, "textDocument/didOpen") == 0)
+		open_document(params);
+	else if (strcmp(method, "textDocument/didClose") == 0)
+		close_document(params);
+	else if (strcmp(method, "textDocument/didChange") == 0)
+	{
+		lsp_document* ld = find_document(params);
+		const json* changes = json_get(params, "contentChanges");
+		if (ld == NULL || changes == NULL)
+			return false;
+		bool was_too_long = ld->too_long;
+		for (const json* change = changes->child; change; change = change->next)
+			apply_change(ld, change);
+		if (ld->too_long && !was_too_long)
+			show_too_long(ld);
+		publish_diagnostics(ld);
+	}
+	else if (strncmp(method, "textDocument/", 13) == 0 && id)
+	{
+		// everything else we answer is about a document
+		lsp_document* ld = find_document(params);
+		const json* position = json_get(params, "position");
+		if (ld == NULL)
+			reply_null(id);
+		else if (ld->too_long)
+			reply_error(id, LSP_REQUEST_FAILED, "A line is too long for mipsze");
+		else if (strcmp(method, "textDocument/semanticTokens/full") == 0)
+			send_tokens(id, ld, NULL);
+		else if (strcmp(method, "textDocument/semanticTokens/full/delta") == 0)
+			send_tokens(id, ld, json_string(json_get(params, "previousResultId")));
+		else if (strcmp(method, "textDocument/definition") == 0)
+			find_definition(id, ld, position);
+		else if (strcmp(method, "textDocument/completion") == 0)
+			complete(id, ld, position);
+		else
+			reply_error(id, LSP_METHOD_NOT_FOUND, method);
+	}
+	else if (id)
+		reply_error(id, LSP_METHOD_NOT_FOUND, method);
+	return false;
+}
+
+static void initialize(const json* id)
+{
+	json_out out = { 0 };
+	reply_start(&out, id);
+	json_printf(&out, "{\"capabilities\":{"
+		"\"textDocumentSync\":{\"openClose\":true,\"change\":2},"
+		"\"definitionProvider\":true,"
+		"\"completionProvider\":{},"
+		"\"semanticTokensProvider\":{\"full\":{\"delta\":true},"
+		"\"legend\":{\"tokenModifiers\":[\"declaration\"],\"tokenTypes\":[");
+	for (size_t i = 0; i < sizeof(token_types) / sizeof(token_types[0]); ++i)
+		json_printf(&out, "%s\"%s\"", i ? "," : "", token_types[i]);
+	json_printf(&out, "]}}},\"serverInfo\":{\"name\":\"mipsze\",\"version\":\"%d.%d.%d\"}}}",
+		MAJOR_VERSION, MINOR_VERSION, BUILD_VERSION);
+	send(&out);
+}
+
+static lsp_document* find_document(const json* params)
+{
+	const char* uri = json_string(json_get(json_get(params, "textDocument"), "uri"));
+	if (uri == NULL)
+		return NULL;
+	for (int i = 0; i < num_documents; ++i)
+		if (strcmp(documents[i]->uri, uri) == 0)
+			return documents[i];
+	return NULL;
+}
+
+static void open_document(const json* params)
+{
+	const json* item = json_get(params, "textDocument");
+	const char* uri = json_string(json_get(item, "uri"));
+	const json* text = json_get(item, "text");
+	if (uri == NULL || text == NULL || text->type != JSON_STRING)
+		return;
+	lsp_document* ld = find_document(params);
+	if (ld == NULL)
+	{
+		if (num_documents == LSP_MAX_DOCUMENTS)
+		{
+			fprintf(stderr, "mipsze: too many open documents, ignoring %s\n", uri);
+			return;
+		}
+		ld = calloc(1, sizeof(lsp_document));
+		if (ld == NULL)
+			return;
+		ld->uri = strdup(uri);
+		documents[num_documents++] = ld;
+	}
+	set_text(ld, text->string, text->length);
+	if (ld->too_long)
+		show_too_long(ld);
+	publish_diagnostics(ld);
+}
+
+static void close_document(const json* params)
+{
+	lsp_document* ld = find_document(params);
+	if (ld == NULL)
+		return;
+	for (int i = 0; i < num_documents; ++i)
+	{
+		if (documents[i] != ld)
+			continue;
+		documents[i] = documents[--num_documents];
+		break;
+	}
+	free_document(ld);
+}
+
+static void free_document(lsp_document* ld)
+{
+	docline* line = ld->document.head;
+	while (line)
+	{
+		docline* next = line->nextline;
+		free(line->defs);
+		free(line->label_ref);
+		free(line);
+		line = next;
+	}
+	free_symbols(&ld->document);
+	free(ld->tokens);
+	free(ld->uri);
+	free(ld);
+}
+
+static void set_text(lsp_document* ld, const char* text, size_t length)
+{
+	// start document again from text, everything gets scanned
+	doc* document = &ld->document;
+	docline* line = document->head;
+	while (line)
+	{
+		docline* next = line->nextline;
+		free(line->defs);
+		free(line->label_ref);
+		free(line);
+		line = next;
+	}
+	line = calloc(1, sizeof(docline));
+	if (line == NULL)
+	{
+		document->head = document->tail = NULL;
+		return;
+	}
+	document->head = document->tail = line;
+	ld->too_long = false;
+	add_text(ld, line, text, length);
+	++document->version;
+	find_labels(document);
+}
+
+static void apply_change(lsp_document* ld, const json* change)
+{
+	// one edit from a didChange, text replaces a range of the document
+	// or all of it if there isn't a range
+	doc* document = &ld->document;
+	const json* text = json_get(change, "text");
+	const json* range = json_get(change, "range");
+	if (text == NULL || text->type != JSON_STRING || document->head == NULL)
+		return;
+	if (range == NULL)
+	{
+		set_text(ld, text->string, text->length);
+		return;
+	}
+	const json* start = json_get(range, "start");
+	const json* end = json_get(range, "end");
+	long start_line = json_long(json_get(start, "line"), -1);
+	long start_char = json_long(json_get(start, "character"), -1);
+	long end_line = json_long(json_get(end, "line"), -1);
+	long end_char = json_long(json_get(end, "character"), -1);
+	if (start_line < 0 || start_char < 0 || end_line < start_line || end_char < 0 ||
+		(end_line == start_line && end_char < start_char))
+		return;
+
+	docline* first = line_at(document, start_line);
+	docline* last = line_at(document, end_line);
+	if ((size_t)start_char > strlen(first->line))
+		start_char = strlen(first->line);
+	if ((size_t)end_char > strlen(last->line))
+		end_char = strlen(last->line);
+	char rest[LINE_LENGTH];
+	strcpy(rest, last->line + end_char);
+	while (first != last)
+	{
+		docline* gone = first->nextline;
+		if (gone == last)
+			last = first;
+		drop_line(document, gone);
+	}
+	first->line[start_char] = '\0';
+	last = add_text(ld, first, text->string, text->length);
+	add_text(ld, last, rest, strlen(rest));
+	++document->version;
+	lines_changed(document, first, last);
+}
+
+static docline* add_text(lsp_document* ld, docline* line, const char* text, size_t length)
+{
+	// put text on the end of line, starting a new line after it at each
+	// newline, and return the line the text ends on
+	doc* document = &ld->document;
+	size_t n = strlen(line->line);
+	for (size_t i = 0; i < length; ++i)
+	{
+		char c = text[i];
+		if (c == '\r' && i + 1 < length && text[i + 1] == '\n')
+			continue;
+		if (c == '\n' || c == '\r')
+		{
+			docline* next = calloc(1, sizeof(docline));
+			if (next == NULL)
+				break;
+			next->prevline = line;
+			next->nextline = line->nextline;
+			if (line->nextline)
+				line->nextline->prevline = next;
+			else
+				document->tail = next;
+			line->nextline = next;
+			line = next;
+			n = 0;
+			continue;
+		}
+		if (n < LINE_LENGTH - 1)
+		{
+			line->line[n++] = c;
+			line->line[n] = '\0';
+		}
+		else
+			ld->too_long = true;
+	}
+	return line;
+}
+
+static void show_too_long(lsp_document* ld)
+{
+	// tell the user once. diagnostics are cleared and requests refused
+	// until the client sends the whole document again and it fits
+	const char* name = strrchr(ld->uri, '/');
+	name = name ? name + 1 : ld->uri;
+	char msg[160];
+	snprintf(msg, sizeof(msg), "mipsze: %.64s has a line longer than %d characters, "
+		"close and reopen it once that's fixed", name, LINE_LENGTH - 1);
+	json_out out = { 0 };
+	json_printf(&out, "{\"jsonrpc\":\"2.0\",\"method\":\"window/showMessage\","
+		"\"params\":{\"type\":2,\"message\":");
+	json_write_string(&out, msg, strlen(msg));
+	json_printf(&out, "}}");
+	send(&out);
+	ld->result_id = 0;
+}
+
+static void drop_line(doc* document, docline* line)
+{
+	// never the only line, apply_change always keeps the first it touches
+	forget_line(document, line);
+	if (document->tail == line)
+		document->tail = line->prevline;
+	if (line->nextline)
+		line->nextline->prevline = line->prevline;
+	if (line->prevline)
+		line->prevline->nextline = line->nextline;
+	free(line->defs);
+	free(line->label_ref);
+	free(line);
+}
+
+static docline* line_at(doc* document, long number)
+{
+	// the last line if there aren't that many
+	docline* line = document->head;
+	while (number-- > 0 && line->nextline)
+		line = line->nextline;
+	return line;
+}
+
+static bool word_at(docline* line, long character, bool whole, char* word)
+{
+	// the word around character, or just the part of it before
+	// character unless whole. false if there's nothing there
+	long len = strlen(line->line);
+	long start = character < len ? character : len;
+	long end = start;
+	while (start > 0 && is_completion_char(line->line[start - 1]))
+		--start;
+	while (whole && end < len && is_completion_char(line->line[end]))
+		++end;
+	if (end - start >= MAX_SYMBOL_LENGTH)
+		return false;
+	memcpy(word, line->line + start, end - start);
+	word[end - start] = '\0';
+	return true;
+}
+
+static void publish_diagnostics(lsp_document* ld)
+{
+	// everything wrong with the document, the client replaces whatever
+	// we sent before with this so it always has to be all of it
+	doc* document = &ld->document;
+	diagnostics* diags = document->diags;
+	bool any = !ld->too_long && diags && (diags->undefined || diags->duplicates || diags->bad_operands);
+	if (!any && !ld->had_diagnostics)
+		return;
+	json_out out = { 0 };
+	json_printf(&out, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\","
+		"\"params\":{\"uri\":");
+	json_write_string(&out, ld->uri, strlen(ld->uri));
+	json_printf(&out, ",\"diagnostics\":[");
+	bool first = true;
+	long number = 0;
+	for (docline* line = any ? document->head : NULL; line; line = line->nextline, ++number)
+	{
+		char msg[MAX_DEBUG_MSG];
+		if (diag_line_flags(document, line) == 0)
+			continue;
+		diag_describe_line(document, line, msg, sizeof(msg));
+		if (msg[0] == '\0')
+			continue;
+		json_printf(&out, "%s{\"range\":{\"start\":{\"line\":%ld,\"character\":0},"
+			"\"end\":{\"line\":%ld,\"character\":%zu}},\"severity\":1,\"source\":\"mipsze\","
+			"\"message\":", first ? "" : ",", number, number, strlen(line->line));
+		json_write_string(&out, msg, strlen(msg));
+		json_printf(&out, "}");
+		first = false;
+	}
+	json_printf(&out, "]}}");
+	send(&out);
+	ld->had_diagnostics = any;
+}
+
+static size_t make_tokens(doc* document, unsigned int** tokens)
+{
+	// the whole document's semantic tokens, each relative to the one
+	// before it like the protocol wants. lines whose spans are still
+	// good aren't lexed again. (size_t)-1 if we ran out of memory
+	unsigned int* out = NULL;
+	size_t count = 0, capacity = 0;
+	unsigned int number = 0, last_number = 0, last_start = 0;
+	lex_state state = 0;
+	for (docline* line = document->head; line; line = line->nextline, ++number)
+	{
+		state = parse_line(document, line, state);
+		const hl_span* spans = hl_spans(document->highlights, line);
+		for (int i = 0; i < line->hl_count; ++i)
+		{
+			int type = token_type_of[spans[i].cls];
+			unsigned int modifiers = spans[i].cls == HL_LABEL_DEF ? LSP_DECLARATION : 0;
+			if (type < 0)
+				continue;
+			unsigned int* prev = count ? out + count - LSP_TOKEN_INTS : NULL;
+			if (prev && last_number == number && prev[3] == (unsigned int)type &&
+				prev[4] == modifiers && last_start + prev[2] == spans[i].start)
+			{
+				// the same kind of thing carries on, ie. the end of an open quote
+				prev[2] += spans[i].length;
+				continue;
+			}
+			if (count + LSP_TOKEN_INTS > capacity)
+			{
+				size_t size = capacity ? capacity * 2 : 1024;
+				unsigned int* bigger = realloc(out, size * sizeof(unsigned int));
+				if (bigger == NULL)
+				{
+					free(out);
+					return (size_t)-1;
+				}
+				out = bigger;
+				capacity = size;
+			}
+			out[count++] = number - last_number;
+			out[count++] = number == last_number ? spans[i].start - last_start : spans[i].start;
+			out[count++] = spans[i].length;
+			out[count++] = type;
+			out[count++] = modifiers;
+			last_number = number;
+			last_start = spans[i].start;
+		}
+	}
+	*tokens = out;
+	return count;
+}
+
+static void send_tokens(const json* id, lsp_document* ld, const char* previous)
+{
+	// all the tokens, or if the client still has the last ones we sent,
+	// the one run of them that changed. tokens are relative to each other
+	// so an edit only changes the ones on and just after the lines it touched
+	unsigned int* tokens;
+	size_t count = make_tokens(&ld->document, &tokens);
+	if (count == (size_t)-1)
+	{
+		reply_error(id, LSP_INTERNAL_ERROR, "Out of memory");
+		return;
+	}
+	char had[24];
+	snprintf(had, sizeof(had), "%lu", ld->result_id);
+	unsigned long result_id = next_result_id++;
+
+	json_out out = { 0 };
+	reply_start(&out, id);
+	json_printf(&out, "{\"resultId\":\"%lu\",", result_id);
+	if (previous && ld->result_id && strcmp(previous, had) == 0)
+	{
+		size_t old_count = ld->num_tokens;
+		size_t prefix = 0, suffix = 0;
+		while (prefix < count && prefix < old_count && tokens[prefix] == ld->tokens[prefix])
+			++prefix;
+		prefix -= prefix % LSP_TOKEN_INTS;
+		while (suffix < count - prefix && suffix < old_count - prefix &&
+			tokens[count - 1 - suffix] == ld->tokens[old_count - 1 - suffix])
+			++suffix;
+		suffix -= suffix % LSP_TOKEN_INTS;
+		json_printf(&out, "\"edits\":[");
+		if (prefix + suffix < count || prefix + suffix < old_count)
+		{
+			json_printf(&out, "{\"start\":%zu,\"deleteCount\":%zu,\"data\":",
+				prefix, old_count - prefix - suffix);
+			write_ints(&out, tokens + prefix, count - prefix - suffix);
+			json_printf(&out, "}");
+		}
+		json_printf(&out, "]}}");
+	}
+	else
+	{
+		json_printf(&out, "\"data\":");
+		write_ints(&out, tokens, count);
+		json_printf(&out, "}}");
+	}
+	send(&out);
+	free(ld->tokens);
+	ld->tokens = tokens;
+	ld->num_tokens = count;
+	ld->result_id = result_id;
+}
+
+static void write_ints(json_out* out, const unsigned int* ints, size_t count)
+{
+	json_printf(out, "[");
+	for (size_t i = 0; i < count; ++i)
+		json_printf(out, i ? ",%u" : "%u", ints[i]);
+	json_printf(out, "]");
+}
+
+static void find_definition(const json* id, lsp_document* ld, const json* position)
+{
+	// where the label (or macro) under the position is defined
+	doc* document = &ld->document;
+	docline* line = line_at(document, json_long(json_get(position, "line"), 0));
+	char word[MAX_SYMBOL_LENGTH];
+	if (!word_at(line, json_long(json_get(position, "character"), 0), true, word) ||
+		word[0] == '\0' ||
+		!(symtab_contains(document->labels, word) || symtab_contains(document->macros, word)))
+	{
+		reply_null(id);
+		return;
+	}
+	long number = 0;
+	for (line = document->head; line; line = line->nextline, ++number)
+	{
+		for (const char* p = line->defs; p && *p; p += strlen(p) + 1)
+		{
+			if (strcmp(p + 1, word) != 0)
+				continue;
+			const char* at = strstr(line->line, word);
+			long column = at ? at - line->line : 0;
+			json_out out = { 0 };
+			reply_start(&out, id);
+			json_printf(&out, "{\"uri\":");
+			json_write_string(&out, ld->uri, strlen(ld->uri));
+			json_printf(&out, ",\"range\":{\"start\":{\"line\":%ld,\"character\":%ld},"
+				"\"end\":{\"line\":%ld,\"character\":%ld}}}}",
+				number, column, number, column + (long)strlen(word));
+			send(&out);
+			return;
+		}
+	}
+	reply_null(id);
+}
+
+static void complete(const json* id, lsp_document* ld, const json* position)
+{
+	// every instruction, register, label and macro that starts with
+	// what's before the position, see complete_word
+	static const char* details[] =
+	{
+		[COMPLETE_LABEL] = "label",
+		[COMPLETE_MACRO] = "macro",
+		[COMPLETE_INSTRUCTION] = "instruction",
+		[COMPLETE_PSEUDO] = "pseudoinstruction",
+		[COMPLETE_REGISTER] = "register"
+	};
+	static const int kinds[] =
+	{
+		[COMPLETE_LABEL] = LSP_KIND_REFERENCE,
+		[COMPLETE_MACRO] = LSP_KIND_FUNCTION,
+		[COMPLETE_INSTRUCTION] = LSP_KIND_KEYWORD,
+		[COMPLETE_PSEUDO] = LSP_KIND_KEYWORD,
+		[COMPLETE_REGISTER] = LSP_KIND_VARIABLE
+	};
+	docline* line = line_at(&ld->document, json_long(json_get(position, "line"), 0));
+	char prefix[MAX_SYMBOL_LENGTH];
+	if (!word_at(line, json_long(json_get(position, "character"), 0), false, prefix))
+		prefix[0] = '\0';
+	trie_match* found = malloc(LSP_MAX_COMPLETIONS * sizeof(trie_match));
+	if (found == NULL)
+	{
+		reply_error(id, LSP_INTERNAL_ERROR, "Out of memory");
+		return;
+	}
+	int n = complete_word(&ld->document, prefix, found, LSP_MAX_COMPLETIONS);
+
+	json_out out = { 0 };
+	reply_start(&out, id);
+	json_printf(&out, "{\"isIncomplete\":%s,\"items\":[", n == LSP_MAX_COMPLETIONS ? "true" : "false");
+	for (int i = 0; i < n; ++i)
+		add_item(&out, i == 0, found[i].name, kinds[found[i].tag], details[found[i].tag]);
+	json_printf(&out, "]}}");
+	send(&out);
+	free(found);
+}
+
+static void add_item(json_out* out, bool first, const char* label, int kind, const char* detail)
+{
+	json_printf(out, "%s{\"label\":", first ? "" : ",");
+	json_write_string(out, label, strlen(label));
+	json_printf(out, ",\"kind\":%d,\"detail\":\"%s\"}", kind, detail);
+}
@@ -0,0 +1,609 @@
+// macro.c - expands mars style .macro/.end_macro definitions
+// the definitions are found again whenever the document has changed
+// since we last looked, which is only a look at the start of each line.
+// Each macro's version is a hash of its parameters and body mixed with
+// the versions of the macros it calls, so an expansion is cached by
+// (name, version, arguments) and stays good until one of those bodies is
+// edited. Labels defined in a body are local to each call, they get a
+// _M<call> suffix the way mars does it.
+#include "headers/main.h"
+#include "headers/util.h"
+#include "headers/symbols.h"
+#include "headers/macro.h"
+
+// where the call's number goes in a cached expansion
+#define LOCAL_MARK '\x01'
+// labels a single body can define
+#define MAX_LOCAL_LABELS 32
+
+typedef struct text_buf
+{
+	char* text;
+	size_t len;
+	size_t capacity;
+} text_buf;
+
+static macro_table* get_table(doc* document);
+static void find_defs(doc* document, macro_table* t);
+static bool parse_def(const char* text, macro_def* def);
+static uint32_t def_version(macro_table* t, macro_def* def);
+static macro_def* find_def(macro_table* t, const char* name);
+static const macro_memo* lookup(macro_table* t, macro_def* def, char** args, int nargs,
+	int depth, char* error, size_t size);
+static bool build(macro_table* t, macro_def* def, char** args, int nargs, int depth,
+	text_buf* out, int* lines, char* error, size_t size);
+static void clear_memo(macro_table* t);
+static const char* first_word(const char* text, char* word, size_t size);
+static int split_args(char* rest, char** args);
+static void strip_comment(const char* in, char* out, size_t size);
+static bool append(text_buf* b, const char* s, size_t n);
+static inline bool is_ident_char(char c);
+
+void macro_line_changed(doc* document)
+{
+	// the defs may have moved, or gone away, find them again before use
+	if (document->expansions)
+		document->expansions->dirty = true;
+}
+
+void macro_free(doc* document)
+{
+	macro_table* t = document->expansions;
+	if (t == NULL)
+		return;
+	clear_memo(t);
+	symtab_free(t->index);
+	free(t->defs);
+	free(t);
+	document->expansions = NULL;
+}
+
+uint32_t macro_call_version(doc* document, const char* text)
+{
+	// version of the macro text calls, 0 if it doesn't call one
+	char name[MAX_SYMBOL_LENGTH];
+	macro_table* t = get_table(document);
+	if (t == NULL)
+		return 0;
+	first_word(text, name, sizeof(name));
+	macro_def* def = find_def(t, name);
+	return def ? def->version : 0;
+}
+
+char* macro_expand(doc* document, const char* text, unsigned long call_id,
+	int* lines, char* error, size_t size)
+{
+	// expand the macro call in text (which can have labels and a comment),
+	// returns the lines it turns into separated by '\n', to be freed, or
+	// NULL with error set (error is "" if text isn't a macro call)
+	error[0] = '\0';
+	macro_table* t = get_table(document);
+	if (t == NULL)
+		return NULL;
+	char buf[LINE_LENGTH + 1];
+	char name[MAX_SYMBOL_LENGTH];
+	strip_comment(text, buf, sizeof(buf));
+	char* rest = (char*)first_word(buf, name, sizeof(name));
+	macro_def* def = find_def(t, name);
+	if (def == NULL)
+		return NULL;
+	char* args[MAX_MACRO_PARAMS];
+	int nargs = split_args(rest, args);
+	if (nargs < 0)
+	{
+		snprintf(error, size, "Too many arguments for %s", name);
+		return NULL;
+	}
+	const macro_memo* memo = lookup(t, def, args, nargs, 0, error, size);
+	if (memo == NULL)
+		return NULL;
+
+	// fill in the call's number
+	char id[24];
+	int id_len = snprintf(id, sizeof(id), "%lu", call_id);
+	size_t marks = 0;
+	for (const char* p = memo->expansion; *p; ++p)
+		marks += *p == LOCAL_MARK;
+	char* result = malloc(strlen(memo->expansion) + marks * id_len + 1);
+	if (result == NULL)
+		return NULL;
+	char* out = result;
+	for (const char* p = memo->expansion; *p; ++p)
+	{
+		if (*p == LOCAL_MARK)
+		{
+			memcpy(out, id, id_len);
+			out += id_len;
+		}
+		else
+			*out++ = *p;
+	}
+	*out = '\0';
+	*lines = memo->lines;
+	return result;
+}
+
+static macro_table* get_table(doc* document)
+{
+	macro_table* t = document->expansions;
+	if (t == NULL)
+	{
+		t = calloc(1, sizeof(macro_table));
+		if (t == NULL)
+			return NULL;
+		t->index = symtab_new();
+		t->dirty = true;
+		document->expansions = t;
+	}
+	if (t->dirty)
+		find_defs(document, t);
+	return t;
+}
+
+static void find_defs(doc* document, macro_table* t)
+{
+	char word[MAX_SYMBOL_LENGTH];
+	macro_def* def = NULL;
+	uint32_t hash = 0;
+	t->num_defs = 0;
+	symtab_clear(t->index);
+	for (docline* line = document->head; line; line = line->nextline)
+	{
+		first_word(line->line, word, sizeof(word));
+		if (strcmp(word, ".macro") == 0)
+		{
+			if (t->num_defs == t->capacity)
+			{
+				int capacity = max(t->capacity * 2, 16);
+				macro_def* defs = realloc(t->defs, capacity * sizeof(macro_def));
+				if (defs == NULL)
+					break;
+				t->defs = defs;
+				t->capacity = capacity;
+			}
+			def = &t->defs[t->num_defs];
+			if (!parse_def(line->line, def))
+			{
+				def = NULL;
+				continue;
+			}
+			def->body = line->nextline;
+			hash = FNV_OFFSET;
+			for (int i = 0; i < def->num_params; ++i)
+				hash = fnv_hash_bytes(hash, def->params[i], strlen(def->params[i]) + 1);
+		}
+		else if (strcmp(word, ".end_macro") == 0 && def)
+		{
+			def->body_hash = hash;
+			// the first definition wins, like labels
+			if (!symtab_contains(t->index, def->name))
+			{
+				symtab_set_value(t->index, def->name, t->num_defs);
+				++t->num_defs;
+			}
+			def = NULL;
+		}
+		else if (def)
+		{
+			hash = fnv_hash_bytes(hash, line->line, strlen(line->line) + 1);
+			++def->num_lines;
+		}
+	}
+	for (int i = 0; i < t->num_defs; ++i)
+		t->defs[i].version = 0;
+	for (int i = 0; i < t->num_defs; ++i)
+		def_version(t, &t->defs[i]);
+	t->dirty = false;
+}
+
+static bool parse_def(const char* text, macro_def* def)
+{
+	// .macro name, .macro name (%a, %b) or .macro name %a, %b
+	memset(def, 0, sizeof(macro_def));
+	const char* p = first_word(text, def->name, sizeof(def->name));
+	p = first_word(p, def->name, sizeof(def->name));
+	if (def->name[0] == '\0')
+		return false;
+	while (*p && *p != '#')
+	{
+		if (*p++ != '%')
+			continue;
+		if (def->num_params == MAX_MACRO_PARAMS)
+			return false;
+		char* param = def->params[def->num_params++];
+		int len = 0;
+		while (is_ident_char(*p) && len < MAX_SYMBOL_LENGTH - 1)
+			param[len++] = *p++;
+		param[len] = '\0';
+	}
+	return true;
+}
+
+static uint32_t def_version(macro_table* t, macro_def* def)
+{
+	// mix in the macros this one calls, so editing them invalidates us too
+	if (def->version)
+		return def->version;
+	if (def->visiting)
+		return def->body_hash;	// calls itself, expanding it will fail anyway
+	def->visiting = true;
+	uint32_t hash = def->body_hash;
+	char word[MAX_SYMBOL_LENGTH];
+	docline* line = def->body;
+	for (int i = 0; i < def->num_lines; ++i, line = line->nextline)
+	{
+		first_word(line->line, word, sizeof(word));
+		macro_def* callee = find_def(t, word);
+		if (callee && callee != def)
+			hash = (hash ^ def_version(t, callee)) * FNV_PRIME;
+	}
+	def->visiting = false;
+	def->version = hash ? hash : 1;
+	return def->version;
+}
+
+static macro_def* find_def(macro_table* t, const char* name)
+{
+	unsigned long index;
+	if (name[0] == '\0' || !symtab_value(t->index, name, &index))
+		return NULL;
+	return &t->defs[index];
+}
+
+static const macro_memo* lookup(macro_table* t, macro_def* def, char** args, int nargs,
+	int depth, char* error, size_t size)
+{
+	// the cached expansion of def with args, working it out if we must
+	text_buf key = {0};
+	append(&key, def->name, strlen(def->name) + 1);
+	for (int i = 0; i < nargs; ++i)
+		append(&key, args[i], strlen(args[i]) + 1);
+	if (key.text == NULL)
+		return NULL;
+	uint32_t hash = fnv_hash_bytes(FNV_OFFSET, key.text, key.len);
+	macro_memo** bucket = &t->memo[hash & (MACRO_MEMO_BUCKETS - 1)];
+	for (macro_memo* m = *bucket; m; m = m->next)
+	{
+		if (m->hash == hash && m->key_len == key.len && memcmp(m->key, key.text, key.len) == 0 &&
+			m->version == def->version)
+		{
+			++t->hits;
+			free(key.text);
+			return m;
+		}
+	}
+	++t->misses;
+
+	text_buf out = {0};
+	int lines = 0;
+	if (!build(t, def, args, nargs, depth, &out, &lines, error, size) || !append(&out, "", 1))
+	{
+		free(out.text);
+		free(key.text);
+		return NULL;
+	}
+
+	// building may have called us for other macros, look again
+	macro_memo* memo = NULL;
+	for (macro_memo* m = *bucket; m; m = m->next)
+	{
+		if (m->hash == hash && m->key_len == key.len && memcmp(m->key, key.text, key.len) == 0)
+		{
+			memo = m;
+			free(m->expansion);
+			free(key.text);
+			break;
+		}
+	}
+	if (memo == NULL)
+	{
+		if (t->memo_entries >= MAX_MACRO_MEMO)
+			clear_memo(t);
+		memo = calloc(1, sizeof(macro_memo));
+		if (memo == NULL)
+		{
+			free(out.text);
+			free(key.text);
+			return NULL;
+		}
+		memo->hash = hash;
+		memo->key = key.text;
+		memo->key_len = key.len;
+		memo->next = *bucket;
+		*bucket = memo;
+		++t->memo_entries;
+	}
+	memo->version = def->version;
+	memo->expansion = out.text;
+	memo->lines = lines;
+	return memo;
+}
+
+static bool build(macro_table* t, macro_def* def, char** args, int nargs, int depth,
+	text_buf* out, int* lines, char* error, size_t size)
+{
+	// append def's body to out with the arguments filled in and any
+	// calls to other macros expanded
+	if (depth >= MAX_MACRO_DEPTH)
+	{
+		snprintf(error, size, "Macros nested too deeply in %s", def->name);
+		return false;
+	}
+	if (nargs != def->num_params)
+	{
+		snprintf(error, size, "%s takes %d argument%s", def->name, def->num_params,
+			def->num_params == 1 ? "" : "s");
+		return false;
+	}
+
+	// labels defined in the body, these are local to each call
+	char locals[MAX_LOCAL_LABELS][MAX_SYMBOL_LENGTH];
+	int num_locals = 0;
+	docline* line = def->body;
+	for (int i = 0; i < def->num_lines; ++i, line = line->nextline)
+	{
+		const char* p = line->line;
+		for (;;)
+		{
+			while (*p == ' ' || *p == '\t')
+				++p;
+			const char* start = p;
+			while (is_ident_char(*p))
+				++p;
+			if (*p != ':' || p == start)
+				break;
+			if (num_locals == MAX_LOCAL_LABELS)
+			{
+				snprintf(error, size, "Too many labels in %s", def->name);
+				return false;
+			}
+			snprintf(locals[num_locals++], MAX_SYMBOL_LENGTH, "%.*s", (int)(p - start), start);
+			++p;
+		}
+	}
+
+	int nested = 0;
+	line = def->body;
+	for (int i = 0; i < def->num_lines; ++i, line = line->nextline)
+	{
+		char clean[LINE_LENGTH + 1];
+		text_buf sub = {0};
+		bool in_quotes = false;
+		strip_comment(line->line, clean, sizeof(clean));
+		for (const char* p = clean; *p; )
+		{
+			if (*p == '\"')
+				in_quotes = !in_quotes;
+			if (*p == '%' && is_ident_char(p[1]))
+			{
+				// a parameter
+				const char* start = ++p;
+				while (is_ident_char(*p))
+					++p;
+				int param = 0;
+				while (param < def->num_params &&
+					!(strlen(def->params[param]) == (size_t)(p - start) &&
+					strncmp(def->params[param], start, p - start) == 0))
+					++param;
+				if (param == def->num_params)
+				{
+					snprintf(error, size, "%s has no parameter %%%.*s", def->name, (int)(p - start), start);
+					free(sub.text);
+					return false;
+				}
+				append(&sub, args[param], strlen(args[param]));
+			}
+			else if (!in_quotes && (isalpha((unsigned char)*p) || *p == '_') &&
+				(p == clean || (!is_ident_char(p[-1]) && p[-1] != '$')))
+			{
+				// a word, which might be one of our labels
+				const char* start = p;
+				while (is_ident_char(*p))
+					++p;
+				append(&sub, start, p - start);
+				for (int l = 0; l < num_locals; ++l)
+				{
+					if (strlen(locals[l]) == (size_t)(p - start) && strncmp(locals[l], start, p - start) == 0)
+					{
+						append(&sub, "_M\x01", 3);
+						break;
+					}
+				}
+			}
+			else
+				append(&sub, p++, 1);
+		}
+		if (sub.text == NULL)
+			continue;
+		append(&sub, "", 1);
+		size_t len = strlen(sub.text);
+		while (len && (sub.text[len - 1] == ' ' || sub.text[len - 1] == '\t'))
+			sub.text[--len] = '\0';
+		char word[MAX_SYMBOL_LENGTH];
+		const char* rest = first_word(sub.text, word, sizeof(word));
+		macro_def* callee = len ? find_def(t, word) : NULL;
+		if (callee == NULL)
+		{
+			if (len)
+			{
+				append(out, sub.text, len);
+				append(out, "\n", 1);
+				++*lines;
+			}
+			free(sub.text);
+			continue;
+		}
+
+		// a call to another macro, keep its labels on a line of their own
+		const char* name_start = rest - strlen(word);
+		const char* colon = memchr(sub.text, ':', name_start - sub.text);
+		if (colon)
+		{
+			append(out, sub.text, name_start - sub.text);
+			append(out, "\n", 1);
+			++*lines;
+		}
+		char* inner_args[MAX_MACRO_PARAMS];
+		int inner_nargs = split_args((char*)rest, inner_args);
+		if (inner_nargs < 0)
+		{
+			snprintf(error, size, "Too many arguments for %s", callee->name);
+			free(sub.text);
+			return false;
+		}
+		const macro_memo* inner = lookup(t, callee, inner_args, inner_nargs, depth + 1, error, size);
+		free(sub.text);
+		if (inner == NULL)
+			return false;
+		// the inner call's labels need to be unique within ours
+		char suffix[16];
+		int suffix_len = snprintf(suffix, sizeof(suffix), "%c_%d", LOCAL_MARK, nested++);
+		for (const char* p = inner->expansion; *p; ++p)
+		{
+			if (*p == LOCAL_MARK)
+				append(out, suffix, suffix_len);
+			else
+				append(out, p, 1);
+		}
+		*lines += inner->lines;
+	}
+	return true;
+}
+
+static void clear_memo(macro_table* t)
+{
+	for (int i = 0; i < MACRO_MEMO_BUCKETS; ++i)
+	{
+		macro_memo* m = t->memo[i];
+		while (m)
+		{
+			macro_memo* next = m->next;
+			free(m->key);
+			free(m->expansion);
+			free(m);
+			m = next;
+		}
+		t->memo[i] = NULL;
+	}
+	t->memo_entries = 0;
+}
+
+static const char* first_word(const char* text, char* word, size_t size)
+{
+	// copy the first word after any "label:"s into word, returning where
+	// it ends
+	const char* p = text;
+	for (;;)
+	{
+		while (*p == ' ' || *p == '\t')
+			++p;
+		const char* start = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != ':' && *p != '(' && *p != '#' && *p != '\"')
+			++p;
+		if (*p == ':' && p != start)
+		{
+			++p;
+			continue;
+		}
+		size_t len = min((size_t)(p - start), size - 1);
+		memcpy(word, start, len);
+		word[len] = '\0';
+		return p;
+	}
+}
+
+static int split_args(char* rest, char** args)
+{
+	// "(a, b)" or "a, b" into args, returns how many or -1 if too many
+	while (*rest == ' ' || *rest == '\t')
+		++rest;
+	size_t len = strlen(rest);
+	while (len && (rest[len - 1] == ' ' || rest[len - 1] == '\t'))
+		rest[--len] = '\0';
+	if (rest[0] == '(' && len && rest[len - 1] == ')')
+	{
+		// only strip the parentheses if they go together
+		int depth = 0;
+		size_t i;
+		for (i = 0; i < len; ++i)
+		{
+			depth += rest[i] == '(' ? 1 : rest[i] == ')' ? -1 : 0;
+			if (depth == 0)
+				break;
+		}
+		if (i == len - 1)
+		{
+			rest[len - 1] = '\0';
+			++rest;
+		}
+	}
+	int n = 0;
+	int depth = 0;
+	bool in_quotes = false;
+	char* start = rest;
+	for (char* p = rest; ; ++p)
+	{
+		if (*p == '\"')
+			in_quotes = !in_quotes;
+		else if (!in_quotes && *p == '(')
+			++depth;
+		else if (!in_quotes && *p == ')')
+			--depth;
+		if (*p == '\0' || (*p == ',' && depth == 0 && !in_quotes))
+		{
+			bool last = *p == '\0';
+			*p = '\0';
+			while (*start == ' ' || *start == '\t')
+				++start;
+			char* end = p;
+			while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+				*--end = '\0';
+			if (*start || !last || n > 0)
+			{
+				if (n == MAX_MACRO_PARAMS)
+					return -1;
+				args[n++] = start;
+			}
+			if (last)
+				break;
+			start = p + 1;
+		}
+	}
+	return n;
+}
+
+static void strip_comment(const char* in, char* out, size_t size)
+{
+	bool in_quotes = false;
+	size_t i = 0;
+	for (; in[i] && i < size - 1; ++i)
+	{
+		if (in[i] == '\"')
+			in_quotes = !in_quotes;
+		else if (in[i] == '#' && !in_quotes)
+			break;
+		out[i] = in[i];
+	}
+	out[i] = '\0';
+}
+
+static bool append(text_buf* b, const char* s, size_t n)
+{
+	if (b->len + n + 1 > b->capacity)
+	{
+		size_t capacity = max(b->capacity * 2, b->len + n + 64);
+		char* text = realloc(b->text, capacity);
+		if (text == NULL)
+			return false;
+		b->text = text;
+		b->capacity = capacity;
+	}
+	memcpy(b->text + b->len, s, n);
+	b->len += n;
+	return true;
+}
+
+static inline bool is_ident_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
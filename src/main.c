@@ -52,21 +52,49 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "headers/util.h"
 #include "headers/fileio.h"
 #include "headers/parse.h"
+#include "headers/profile.h"
+#include "headers/trace.h"
+#include "headers/diag.h"
+#include "headers/highlight.h"
+#include "headers/asm.h"
+#include "headers/sim.h"
+#include "headers/pipeline.h"
+#include "headers/macro.h"
+#include "headers/journal.h"
+#include "headers/diff.h"
+#include "headers/watch.h"
+#include "headers/server.h"
+#include "headers/lsp.h"
+#include "headers/complete.h"
+#include "headers/find.h"
+#include "headers/fold.h"
+#include "headers/changes.h"
 
 static void initialize_terminal();
+static void configure_terminal();
 static void initialize_colors();
 static void initialize_display(display*);
+static void start_editor();
+static void show_banner();
+static void edit_loop();
 static bool check_for_version_flag(int argc, char** argv);
-static void parse_args(int argc, char* argv[], char ** filename);
+static int check_for_server_flag(int argc, char** argv);
+static void run_daemon(int argc, char** argv);
+static void attach_client(client* c);
+static bool parse_args(int argc, char* argv[], char ** filename);
+static void option_error(const char* msg);
 static bool get_string(char* prompt, char* default_text, char* response, size_t max_size);
 static void set_leading_zeros();
+static bool waiting_for_file();
 static void cleanup_and_end();
 static void show_version_msg();
 static inline void clear_status_bar();
+static inline int gutter_width();
 
 // document functions
 static void check_unsaved_changes();
 static void load_document();
+static void open_file(const char* filename);
 static void save_document();
 static void initialize_doc();
 
@@ -88,21 +116,69 @@ static void cursor_down(cursor_pos* cursor);
 
 // cursor actions
 static void remove_char(cursor_pos* cursor);
+static inline void line_edited(docline* line);
 static void insert_newline(cursor_pos* cursor);
 static void insert_tab(cursor_pos* cursor);
 static void insert_character(cursor_pos* cursor, char ch);
+static void insert_text(cursor_pos* cursor, const char* text, size_t len);
+static int read_escape_sequence();
+static char* read_paste(size_t* len);
+static void run_program();
+static void draw_macro_preview();
+static void open_journal(const char* filename);
+static bool finish_save();
+static void reload_document(const char* filename);
+static void drop_line(docline* line, docline* replacement);
+static void place_cursors();
+static void screen_rows(size_t rows, size_t* row);
+static bool follow_step();
+static void start_loading(const char* filename);
+static bool take_loaded();
+static size_t patch_document(char (*lines)[LINE_LENGTH], size_t count);
 static void extend_cursor_left(cursor_pos* cursor);
 static void extend_cursor_right(cursor_pos* cursor);
 
+// buffers
+static int new_buffer();
+static void close_buffer();
+static void switch_buffer(int index);
+static void stash_buffer();
+static void restore_buffer(int index);
+static void choose_buffer();
+static void check_all_unsaved_changes();
+static bool untitled_open();
+static void set_buffer_path(doc* document, const char* path);
+static const char* buffer_name(int index);
+
+// windows
+static void split_window(bool side_by_side);
+static void close_window();
+static void single_window();
+static void focus_window(int index);
+static void stash_window();
+static void load_window(int index);
+static void resize_windows();
+static void draw_windows();
+static void windows_forget_line(docline* line, docline* replacement);
+static void folds_changed();
+static chtype change_mark(docline* line);
+
+// completion
+static void update_completion(bool typing);
+static void take_completion();
+static void draw_completions();
+
+// fuzzy finding
+static void find_lines();
+static void draw_found(finder* f, int choice);
+
 char fname[MAX_FILE_NAME];
 char* current_filename = NULL;
 char* to_load = NULL;
 
-// for now, only allow a SINGLE doc to be loaded, that
-// we'll name (imaginatively) document, and a single
-// display window named d. Eventually, we could allow 
-// split windows, and have multiple ds, eah with their own
-// doc?
+// the document being edited and the display window showing it,
+// other open documents wait in buffers until they're switched to
+// and other views of this one wait in windows
 doc* main_document;
 display* d;
 
@@ -115,8 +191,22 @@ docline* cut_line = NULL;
 
 int leading_zeros = 0;
 
+// the save running in the background, if there is one
+save_job* saving = NULL;
+doc* saving_doc = NULL;		// what it's saving, might not be main_document any more
+
+// the end of the file we're reading as it grows, see --follow
+follow_state follower = { -1, NULL, 0 };
+bool follow_mode = false;
+
+// the file being read in the background, see start_loading
+load_job* loading = NULL;
+bool loading_placeholder = false;	// the document's still the empty line we started with
+
 // these will become command line options
 bool show_line_no = true;
+bool show_pipeline = false;
+bool show_macro_preview = false;
 bool syntax_highlighting = true;
 bool show_help = false;
 bool show_version = false;
@@ -131,6 +221,51 @@ int debug_countdown = 0;
 bool had_input = false;
 bool exitFlag = false;
 
+// the client whose terminal we're running on, see --daemon
+client* attached = NULL;
+
+// what the word before the cursor could be, see update_completion
+trie_match completions[MAX_COMPLETIONS];
+int num_completions = 0;
+int completion_choice = 0;
+size_t completion_start = 0;	// where the word starts on the cursor's line
+bool completion_taken = false;	// the word is completions[completion_choice] now
+
+// an open document, everything about it that the globals above
+// hold while it's the one being edited, see switch_buffer. the
+// keyword and opcode tables are shared, they never change
+typedef struct buffer
+{
+	doc* document;
+	display view;
+	cursor_pos cursors[MAX_CURSORS];
+	int num_cursors;
+	char* filename;
+	char* path;				// where it was loaded from or saved to
+	follow_state follower;
+	load_job* loading;
+	bool loading_placeholder;
+} buffer;
+
+buffer* buffers[MAX_BUFFERS];
+int num_buffers = 0;
+int active_buffer = 0;
+
+// a view of main_document, the one being edited is d and its cursors
+// are the globals, see focus_window. they all share the document's
+// highlight spans, so a line is only lexed again once it's changed
+typedef struct window
+{
+	display view;
+	cursor_pos cursors[MAX_CURSORS];
+	int num_cursors;
+	unsigned long version;		// what the document was when we left it
+} window;
+
+window* windows[MAX_WINDOWS];
+int num_windows = 0;
+int active_window = 0;
+
 int main(int argc, char** argv)
 {
  	// preinit, we should parse ALL arguments up here, in case
@@ -139,6 +274,21 @@ int main(int argc, char** argv)
 	if (check_for_version_flag(argc, argv))
 		show_version_msg();
 
+	int server_flag = check_for_server_flag(argc, argv);
+	if (server_flag == 'c')
+	{
+		// the daemon does the rest, all we need is what to open
+		const char* filename = NULL;
+		for (int i = 1; i < argc; ++i)
+			if (argv[i][0] != '-')
+				filename = argv[i];
+		return client_attach(argv[0], filename);
+	}
+	if (server_flag == 'D')
+		run_daemon(argc, argv);
+	if (server_flag == 'L')
+		return lsp_run();
+
 	initialize_terminal();
 
 
@@ -151,15 +301,6 @@ int main(int argc, char** argv)
 	}
 	initialize_colors();
 
-	d = calloc(1, sizeof(display));
-	initialize_display(d);
-
-	wchar_t ch;
-	double avg_cpu_mhz = 0.0;
-
-	bool screen_clean = true;
-	char changes;
-
 	if (argc > 1)
 		parse_args(argc, argv, &to_load);
 
@@ -173,47 +314,90 @@ int main(int argc, char** argv)
 				printw("Can't read keywords.dat\n");
 			if (parser_init == -2)
 				printw("Can't read pinstrs.dat\n");
+			if (parser_init == -3)
+				printw("Can't read operands.dat\n");
 			printw("Press a key to exit...");
 			getch();
 			cleanup_and_end();
 		}
 	}
 
-	mvprintw(0, 0, "mipze ver.%d.%d.%d - Tyler Weston - F12 exits - %s",
-	         MAJOR_VERSION, MINOR_VERSION, BUILD_VERSION, curses_version());
-	mvchgat(0, 0, -1, 0, BAR_PAIR, NULL);
-	refresh();
-
-	// Start our timer clock
-	clock_t now = clock();
-	main_document = calloc(1, sizeof(doc));
-
-	initialize_doc();
+	start_editor();
+	show_banner();
 
-	if (to_load != NULL && check_file_exists(to_load))
+	if (to_load != NULL && follow_mode)
+	{
+		// start from nothing and read the whole file as if it had
+		// just been written (below), then keep going as it grows
+		if (follow_open(&follower, to_load) != 0)
+			set_debug_msg("Can't follow %s", to_load);
+		set_buffer_path(main_document, to_load);
+	}
+	else if (to_load != NULL && check_file_exists(to_load))
+	{
+		// the rest comes in while we're already drawing, see take_loaded
+		start_loading(to_load);
+	}
+	// a followed file is already on disk, it doesn't need a journal
+	// or reloading, it only gets longer
+	else if (to_load && !follow_mode)
 	{
-		// we can move all this stuff to a load file function
-		// clear_doc(head);
-		load_doc(to_load, main_document);
-		cursors[0].currline = main_document->head;
-		find_labels(main_document->head);
-		free(to_load);
+		open_journal(to_load);
+		watch_file(to_load);
+		set_buffer_path(main_document, to_load);
 	}
+	else if (to_load == NULL)
+		open_journal(NULL);
+	free(to_load);
 
 	// set topline here in case we loaded a file above
 	d->topline = main_document->head;
+	if (follower.fd >= 0)
+		follow_step();
 
-	draw_lines(main_document->head);
+	draw_lines(d->topline);
 	draw_cursors();
 
+	edit_loop();
+	cleanup_and_end();
+}
+
+static void edit_loop()
+{
+	// take keys and draw until the user leaves
+	wchar_t ch;
+	double avg_cpu_mhz = 0.0;
+	bool screen_clean = true;
+	char changes;
+
+	// Start our timer clock
+	long long last_tick = monotonic_ms();
+	long long last_frame = 0;
+	int keys_this_frame = 0;
+	int last_journal_errno = 0;
+
 	while (!exitFlag)
 	{
-
-		screen_clean = true;
+		// sleep until there's a key, the next frame is allowed, or the
+		// status bar needs to tick over
+		long long now_ms = monotonic_ms();
+		if (!screen_clean)
+			timeout(max(0LL, last_frame + FRAME_INTERVAL_MS - now_ms));
+		else if (loading)
+			timeout(FRAME_INTERVAL_MS);
+		else
+			timeout(max(0LL, last_tick + STATUS_INTERVAL_MS - now_ms));
 		ch = getch();
+		bool typing = false;
 		if (ch != ERR) {
 			had_input = true;
+			// the first key since the last draw starts a new frame
+			if (screen_clean)
+				prof_frame_begin();
 			screen_clean = false;
+			++keys_this_frame;
+			prof_begin(PROF_INPUT);
+			TRACE_BEGIN(TR_KEY, ch);
 		}
 
 		switch (ch)
@@ -229,25 +413,70 @@ int main(int argc, char** argv)
 			break;
 		}
 
-		case CTRL('l'):		// load a file
+		case CTRL('l'):		// load a file into a buffer of its own
 		{
-			check_unsaved_changes();
 			load_document();
 			break;
 		}
 
-		case CTRL('n'):		// new document
+		case CTRL('n'):		// new document, in a new buffer
 		{
-			check_unsaved_changes();
-			clear_doc(main_document);
-			initialize_display(d);
-			initialize_doc();
+			if (new_buffer() >= 0 && !untitled_open())
+			{
+				journal_start(main_document, NULL, true);
+				changes_saved(main_document);
+			}
+			break;
+		}
+
+		case CTRL('w'):		// close this buffer
+		{
+			close_buffer();
+			break;
+		}
+
+		case CTRL('b'):		// pick a buffer from the list
+		{
+			choose_buffer();
+			break;
+		}
+
+		case KEY_F(9):		// next buffer
+		{
+			if (num_buffers > 1)
+				switch_buffer((active_buffer + 1) % num_buffers);
+			break;
+		}
+
+		case CTRL('t'):		// split this window, one above the other
+		{
+			split_window(false);
+			break;
+		}
+
+		case CTRL('r'):		// split this window, side by side
+		{
+			split_window(true);
+			break;
+		}
+
+		case CTRL('o'):		// go to the other window
+		{
+			focus_window((active_window + 1) % num_windows);
+			break;
+		}
+
+		case CTRL('d'):		// close this window
+		{
+			close_window();
 			break;
 		}
 
 		// Cut/paste
 		case CTRL('k'):		// cut line, we need to COPY the TEXT from the line
 		{
+			if (waiting_for_file())
+				break;
 			if (cut_line)
 				free(cut_line);
 			if (copy_line)
@@ -264,11 +493,14 @@ int main(int argc, char** argv)
 			copy_line = cursors[0].currline;
 			if (cut_line)
 				free(cut_line);
+			cut_line = NULL;
 			break;
 		}
 
 		case CTRL('v'):		// paste line
 		{
+			if (waiting_for_file())
+				break;
 			if (!(cut_line || copy_line))
 				break;
 			docline* newline = calloc(1, sizeof(docline));
@@ -284,9 +516,11 @@ int main(int argc, char** argv)
 			if (cursors[0].currline->prevline)
 				cursors[0].currline->prevline->nextline = newline;
 			cursors[0].currline->prevline = newline;
+			fold_line_added(main_document, newline);
 			if (cursors[0].currline == main_document->head)
 				main_document->head = newline;
 			cursors[0].currline = newline;
+			line_edited(newline);
 			break;
 		}
 
@@ -361,12 +595,14 @@ int main(int argc, char** argv)
 
 		case KEY_RESIZE:
 		{
-			getmaxyx(stdscr, d->height, d->width);
+			resize_windows();
 			break;
 		}
 
 		case '\n':
 		{	// ENTER key, KEY_ENTER doesn't work?
+			if (waiting_for_file())
+				break;
 			for (int i = 0; i < num_cursors; ++i)
 				insert_newline(&cursors[i]);
 			break;
@@ -418,16 +654,149 @@ int main(int argc, char** argv)
 			break;
 		}
 
-		case ESC:		// exit, check for unsaved changes
-		case KEY_F(12):
+		case KEY_F(3):		// frame profiler overlay
+		{
+			if (!prof_toggle())
+				clear_status_bar();
+			break;
+		}
+
+		case KEY_F(4):		// what's wrong with this line?
+		{
+			if (!syntax_highlighting || main_document->diags == NULL)
+				break;
+			char msg[MAX_DEBUG_MSG];
+			diagnostics* diags = main_document->diags;
+			diag_describe_line(main_document, cursors[0].currline, msg, sizeof(msg));
+			if (msg[0] == '\0')
+				asm_describe_line(cursors[0].currline, msg, sizeof(msg));
+			if (msg[0] == '\0' && show_pipeline)
+				pipe_describe_line(cursors[0].currline, msg, sizeof(msg));
+			if (msg[0] == '\0')
+				set_debug_msg("%lu problems in file", diags->undefined + diags->duplicates + diags->bad_operands);
+			else
+				set_debug_msg("%s", msg);
+			break;
+		}
+
+		case KEY_F(5):		// assemble, and keep assembling as we type
+		{
+			int errors = asm_assemble(main_document);
+			assembler* as = main_document->assembly;
+			if (errors < 0)
+			{
+				set_debug_msg("Can't read opcodes.dat");
+				break;
+			}
+			as->live = true;
+			if (errors > 0)
+			{
+				char msg[MAX_DEBUG_MSG];
+				asm_describe_line(as->first_error, msg, sizeof(msg));
+				set_debug_msg("%d errors, line %lu: %s", errors, as->first_error_line, msg);
+			}
+			else
+				set_debug_msg("Assembled %lu words, %lu bytes of data (%d lines encoded)",
+					as->text_words, as->data_size, as->reencoded);
+			break;
+		}
+
+		case KEY_F(6):		// assemble and run it
+		{
+			run_program();
+			break;
+		}
+
+		case KEY_F(7):		// cycle estimates in the gutter
+		{
+			show_pipeline = !show_pipeline;
+			if (!show_pipeline)
+				break;
+			if (pipe_analyze(main_document) < 0)
+			{
+				set_debug_msg("Can't read opcodes.dat");
+				show_pipeline = false;
+				break;
+			}
+			set_debug_msg("Estimating cycles for a %s pipeline, F4 explains a stall",
+				pipe_model()->name);
+			break;
+		}
+
+		case KEY_F(8):		// what the macro call on this line expands to
+		{
+			show_macro_preview = !show_macro_preview;
+			break;
+		}
+
+		case KEY_F(10):		// fold the macro or routine we're in, or open it
+		{
+			bool folded = cursors[0].currline->fold != NULL;
+			fold* f = fold_toggle(main_document, cursors[0].currline);
+			if (f)
+				set_debug_msg("Folded %lu lines", f->hidden);
+			else if (!folded)
+				set_debug_msg("Nothing to fold here");
+			folds_changed();
+			break;
+		}
+
+		case KEY_F(11):		// fold everything, or open everything up
+		{
+			if (main_document->folds)
+				unfold_all(main_document);
+			else
+				set_debug_msg("Folded %d blocks", fold_all(main_document));
+			folds_changed();
+			break;
+		}
+
+		case ESC:
 		{
-			check_unsaved_changes();
+			// bracketed paste arrives as ESC[200~ text ESC[201~, anything
+			// else starting with ESC[ is a key we don't know, ignore it.
+			// the [ can be a read behind, so give it time to turn up
+			timeout(ESCAPE_TIMEOUT_MS);
+			int next = getch();
+			if (next == '[')
+			{
+				if (read_escape_sequence() == PASTE_START)
+				{
+					size_t len;
+					char* text = read_paste(&len);
+					if (text == NULL)
+						break;
+					if (waiting_for_file())
+					{
+						free(text);
+						break;
+					}
+					TRACE_BEGIN(TR_PASTE, len);
+					for (int i = 0; i < num_cursors; ++i)
+						insert_text(&cursors[i], text, len);
+					TRACE_END(TR_PASTE, len);
+					free(text);
+				}
+				break;
+			}
+			if (next != ERR)
+				ungetch(next);
+			// a lone ESC exits
+		}
+		// fall through
+		case KEY_F(12):	// exit, check for unsaved changes
+		{
+			// leaving the daemon leaves everything open in it
+			if (!attached)
+				check_all_unsaved_changes();
 			exitFlag = true;
 			break;
 		}
 
 		case KEY_BACKSPACE:
 		{
+			if (waiting_for_file())
+				break;
 			for (int i = 0; i < num_cursors; ++i)
 			{
 				if (cursors[i].xpos == 0 && cursors[i].currline->prevline == NULL)
@@ -435,11 +804,14 @@ int main(int argc, char** argv)
 				cursor_left(&cursors[i]);
 				remove_char(&cursors[i]);
 			}
+			typing = true;
 			break;
 		}
 
 		case KEY_DC:
 		{
+			if (waiting_for_file())
+				break;
 			for (int i = 0; i < num_cursors; ++i)
 				remove_char(&cursors[i]);
 			break;
@@ -447,32 +819,62 @@ int main(int argc, char** argv)
 
 		case '\t':
 		{
+			if (waiting_for_file())
+				break;
 			for (int i = 0; i < num_cursors; ++i)
 				insert_tab(&cursors[i]);
 			break;
 		}
 
+		case CTRL('e'):		// complete the word, again for the next completion
+		{
+			if (waiting_for_file())
+				break;
+			take_completion();
+			break;
+		}
+
+		case CTRL('f'):		// fuzzy find a line, label or macro
+		{
+			find_lines();
+			break;
+		}
+
 		default:	// a typable character
 		{
+			if (waiting_for_file())
+				break;
 			for (int i = 0; i < num_cursors; ++i)
 				insert_character(&cursors[i], (char) ch);
+			typing = true;
 			break;
 		}
 		}
+		if (ch != ERR && ch != CTRL('e'))
+			update_completion(typing);
+		prof_end(PROF_INPUT);
+		if (ch != ERR)
+			TRACE_END(TR_KEY, ch);
 
-		if (!screen_clean)
+		if (loading && take_loaded())
+			screen_clean = false;
+
+		// apply every key that's already waiting before drawing once, and
+		// don't draw faster than the terminal can usefully show us
+		bool draw_now = !screen_clean
+			&& (ch == ERR || keys_this_frame >= MAX_KEYS_PER_FRAME)
+			&& monotonic_ms() - last_frame >= FRAME_INTERVAL_MS;
+		if (draw_now)
 		{
-			// this will go somewhere else!
-			if (syntax_highlighting)
-			{
-				clear_macros();
-				clear_labels();
-				find_labels(main_document->head);
-			}
-			// TODO: Do we need to clear the entire screen?
-			clear();
-			draw_lines(d->topline);
-			draw_cursors();
+			if (show_pipeline)
+				pipe_analyze(main_document);
+			else if (main_document->assembly && main_document->assembly->live
+				&& main_document->assembly->doc_version != main_document->version)
+				asm_assemble(main_document);	// only when something was edited
+			// erase rather than clear, so curses only sends the rows
+			// that changed in each window
+			erase();
+			draw_windows();
 
 			if (had_input)	// just so we can show the title bar until a key is pressed? find a better way.
 			{
@@ -481,49 +883,115 @@ int main(int argc, char** argv)
 				else
 					changes = ' ';
 				mvprintw(0 , 0, "%d, %d %c ", (cursors[0].xpos + 1), (d->absy + 1), changes);
-				mvprintw(0, d->width - 6, "%02d, %02d", d->height, d->width);
+				if (main_document->assembly && main_document->assembly->live)
+				{
+					if (main_document->assembly->errors)
+						printw("asm: %d errors", main_document->assembly->errors);
+					else
+						printw("asm: ok");
+				}
+				mvprintw(0, COLS - 6, "%02d, %02d", LINES, COLS);
 
 				if (current_filename)
-					mvprintw(0, (d->width - strlen(current_filename) - 6) / 2, "mipsze - %s", current_filename);
+					mvprintw(0, (COLS - strlen(current_filename) - 6) / 2, "mipsze - %s", current_filename);
 				else
-					mvprintw(0, (d->width - 5) / 2, "mipsze");
+					mvprintw(0, (COLS - 5) / 2, "mipsze");
+				if (num_buffers > 1)
+					printw(" [%d/%d]", active_buffer + 1, num_buffers);
 				mvchgat(0, 0, -1, A_BOLD, BAR_PAIR, NULL);
 			}
+			prof_frame_end();
+			last_frame = monotonic_ms();
+			keys_this_frame = 0;
+			screen_clean = true;
 		}
 
-		if (debug_countdown > 1)
+		if (prof_is_enabled())
 		{
-			mvprintw(d->height - 1, 0, "%s", debug_msg);
+			// the overlay takes over the whole status bar
+			if (draw_now)
+				prof_draw_overlay(LINES - 1, COLS);
 		}
-		else if (debug_countdown == 1)
+		else
 		{
-			clear_status_bar();
-		}
+			if (debug_countdown > 1)
+			{
+				mvprintw(LINES - 1, 0, "%s", debug_msg);
+			}
+			else if (debug_countdown == 1)
+			{
+				clear_status_bar();
+			}
 
-		mvprintw(d->height - 1, d->width - 15, "cpu: %.2fGHz", avg_cpu_mhz);
+			mvprintw(LINES - 1, COLS - 15, "cpu: %.2fGHz", avg_cpu_mhz);
+		}
 
 		// screen update
-		if (clock() - now > 250000)
+		if (monotonic_ms() - last_tick >= STATUS_INTERVAL_MS)
 		{
-			now = clock();
+			last_tick = monotonic_ms();
 			avg_cpu_mhz = cpu_info();
 			if (debug_countdown > 0)
 			{
 				--debug_countdown;
 			}
+			if (loading)
+				set_debug_msg("Loading %s %d%%", current_filename, loading->size ?
+					(int)(100 * __atomic_load_n(&loading->read, __ATOMIC_RELAXED) / loading->size) : 100);
+			else if (saving && save_done(saving))
+				finish_save();
+			else if (saving)
+				set_debug_msg("Saving %s %d%%", saving->filename, saving->len ?
+					(int)(100 * __atomic_load_n(&saving->written, __ATOMIC_RELAXED) / saving->len) : 100);
+			else if (follower.fd >= 0)
+			{
+				if (follow_step())
+					screen_clean = false;
+			}
+			else if (watch_changed())
+			{
+				reload_document(watch_path());
+				screen_clean = false;
+			}
+			if (attached)
+			{
+				// a client's terminal doesn't send us SIGWINCH, it tells us
+				int rows, cols;
+				enum server_event event = server_poll(attached);
+				if (event == SERVER_GONE)
+					exitFlag = true;
+				else if (event == SERVER_RESIZE && server_window_size(&rows, &cols))
+				{
+					resizeterm(rows, cols);
+					resize_windows();
+					screen_clean = false;
+				}
+			}
+			// the journal writer can't tell us itself
+			int journal_errno = journal_error(main_document);
+			if (journal_errno != last_journal_errno && journal_errno != 0)
+				set_debug_msg("Can't write the journal: %s", strerror(journal_errno));
+			last_journal_errno = journal_errno;
 		}
 	}
-	cleanup_and_end();
 }
 
 static void initialize_terminal()
 {
 	initscr();
+	configure_terminal();
+}
+
+static void configure_terminal()
+{
 	cbreak();
 	noecho();
 	nodelay(stdscr, TRUE);
 	keypad(stdscr, TRUE);
 	curs_set(0);
+	// ask the terminal to bracket pastes so we get them in one go
+	printf(BRACKETED_PASTE_ON);
+	fflush(stdout);
 }
 
 static void initialize_colors()
@@ -544,11 +1012,105 @@ static void initialize_colors()
 	init_pair(ERROR_BLOCK_PAIR, -1, COLOR_RED);
 	init_pair(LINE_NO_PAIR, COLOR_WHITE, COLOR_BLACK);
 	init_pair(MACRO_PARAM_PAIR, COLOR_YELLOW, -1);
+	init_pair(ADDED_PAIR, COLOR_GREEN, COLOR_BLACK);
+	init_pair(EDITED_PAIR, COLOR_YELLOW, COLOR_BLACK);
+	init_pair(REMOVED_PAIR, COLOR_RED, COLOR_BLACK);
+}
+
+static void start_editor()
+{
+	// one window onto an empty untitled buffer
+	windows[0] = calloc(1, sizeof(window));
+	num_windows = 1;
+	d = &windows[0]->view;
+	initialize_display(d);
+	new_buffer();
+}
+
+static void show_banner()
+{
+	// until the first key, see had_input
+	mvprintw(0, 0, "mipze ver.%d.%d.%d - Tyler Weston - F12 exits - %s",
+	         MAJOR_VERSION, MINOR_VERSION, BUILD_VERSION, curses_version());
+	mvchgat(0, 0, -1, 0, BAR_PAIR, NULL);
+	refresh();
+}
+
+static void run_daemon(int argc, char** argv)
+{
+	// hold the parser tables and every open document between clients,
+	// each client that attaches gets the editor on its own terminal.
+	// never returns. the options are read once we've forked so the
+	// trace writer is ours, and whoever started us hears about bad ones
+	int listener = server_start();
+	if (listener < 0)
+	{
+		fprintf(stderr, "mipsze: can't start the daemon: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	bool ok = parse_args(argc, argv, &to_load);
+	free(to_load);
+	to_load = NULL;
+	if (ok && syntax_highlighting && init_parser() < 0)
+	{
+		fprintf(stderr, "mipsze: error initializing parser, can't read the files in dat/\n");
+		ok = false;
+	}
+	server_ready(ok);
+	if (!ok)
+		exit(EXIT_FAILURE);
+	client c;
+	for (;;)
+	{
+		if (server_accept(listener, &c) != 0)
+			continue;
+		attach_client(&c);
+		server_detach(&c);
+	}
+}
+
+static void attach_client(client* c)
+{
+	// run the editor on the client's terminal, which is our stdin and
+	// stdout for now, until they leave. everything that's open stays
+	// open for the next client
+	SCREEN* screen = newterm(c->request.term, stdout, stdin);
+	if (screen == NULL)
+		return;
+	set_term(screen);
+	configure_terminal();
+	attached = c;
+	if (has_colors())
+	{
+		initialize_colors();
+		bool first = num_windows == 0;
+		if (first)
+			start_editor();
+		else
+			resize_windows();
+		if (c->request.path[0])
+			open_file(c->request.path);
+		else if (first)
+			open_journal(NULL);
+		had_input = false;
+		erase();
+		show_banner();
+		draw_windows();
+		edit_loop();
+	}
+	attached = NULL;
+	exitFlag = false;
+	endwin();
+	printf(BRACKETED_PASTE_OFF);
+	fflush(stdout);
+	delscreen(screen);
 }
 
 static void initialize_display(display* d)
 {
 	getmaxyx(stdscr, d->height, d->width);
+	d->screen_y = 1;
+	d->screen_x = 0;
 	d->top_line_number = 1;
 	d->left_char_number = 0;
 	d->absy = 0;
@@ -565,8 +1127,26 @@ static void show_version_msg()
 
 static void cleanup_and_end()
 {
-	clear_doc(main_document);
+	// we're ending on purpose, so the journals aren't needed
+	// unless the last save didn't make it
+	doc* unsaved = NULL;
+	if (saving)
+	{
+		doc* document = saving_doc;
+		if (!finish_save())
+			unsaved = document;
+	}
+	if (num_buffers > 0)
+		stash_buffer();
+	for (int i = 0; i < num_buffers; ++i)
+	{
+		journal_close(buffers[i]->document, buffers[i]->document != unsaved);
+		clear_doc(buffers[i]->document);
+	}
 	endwin();
+	printf(BRACKETED_PASTE_OFF);
+	fflush(stdout);
+	trace_stop();
 	if (show_version)
 		show_version_msg();
 	exit(EXIT_SUCCESS);
@@ -578,12 +1158,11 @@ void draw_cursors()
 	for (int i = 0; i < num_cursors; ++i)
 	{
 		absx = cursors[i].xpos;
-		if (show_line_no)
-			absx += leading_zeros + 3;
+		absx += gutter_width() + d->screen_x;
 		if (cursors[i].width > 0)
-			mvchgat(cursors[i].ypos + 1, absx, cursors[i].width, A_REVERSE, COLOR_PAIR(CUR_PAIR), NULL);
+			mvchgat(d->screen_y + cursors[i].ypos, absx, cursors[i].width, A_REVERSE, COLOR_PAIR(CUR_PAIR), NULL);
 		else if (cursors[i].width < 0)
-			mvchgat(cursors[i].ypos + 1, absx + cursors[i].width, -cursors[i].width + 1, A_REVERSE, COLOR_PAIR(CUR_PAIR), NULL);
+			mvchgat(d->screen_y + cursors[i].ypos, absx + cursors[i].width, -cursors[i].width + 1, A_REVERSE, COLOR_PAIR(CUR_PAIR), NULL);
 	}
 }
 
@@ -615,6 +1194,7 @@ void insert_tab(cursor_pos* cursor)
 		}
 		cursor->xpos += tab_target;
 		main_document->unsaved_changes = true;
+		line_edited(cursor->currline);
 	}
 }
 
@@ -635,87 +1215,391 @@ void insert_character(cursor_pos* cursor, char ch)
 	cursor->currline->line[cursor->xpos] = ch;
 	cursor->xpos++;
 	main_document->unsaved_changes = true;
+	line_edited(cursor->currline);
 }
 
-void insert_newline(cursor_pos* cursor)
+void insert_text(cursor_pos* cursor, const char* text, size_t len)
 {
-	docline* newline = calloc(1, sizeof(docline));
-	// Handle special case where we are at first character
-	// of the line, then we can just insert a new blank line before this
-	// one and not worry about the copy we're doing below.
-	if (cursor->xpos == 0)
+	// insert a block of text (ie. a paste) at cursor, building all the new
+	// lines off to the side then splicing them in once, so the symbol
+	// tables and lexer checkpoints only get updated a single time
+	char rest[LINE_LENGTH];
+	docline* first = cursor->currline;
+	docline* line = first;
+	docline* after = first->nextline;
+	size_t col = cursor->xpos;
+	size_t new_lines = 0;
+	// what's after the cursor might need a line of its own at the end,
+	// have it now so there's nothing to undo if we can't
+	docline* spare = calloc(1, sizeof(docline));
+	if (spare == NULL)
 	{
-		// insert before
-		if (main_document->head == cursor->currline)
+		set_debug_msg("Out of memory, nothing pasted");
+		return;
+	}
+
+	strcpy(rest, first->line + col);
+	first->line[col] = '\0';
+	for (size_t i = 0; i <= len; ++i)
+	{
+		char ch = i < len ? text[i] : '\0';
+		int spaces = 1;
+		if (ch == '\t')
 		{
-			if (d->topline == main_document->head)	// hmm, having to do this is obnoxious?
-				d->topline = newline;
-			main_document->head = newline;
+			ch = ' ';
+			spaces = TAB_DISTANCE - (col % TAB_DISTANCE);
 		}
-		newline->prevline = cursor->currline->prevline;
-		newline->nextline = cursor->currline;
-		if (cursor->currline->prevline)
-			cursor->currline->prevline->nextline = newline;
-		cursor->currline->prevline = newline;
-		goto finish_scroll_down;
+		else if (ch != '\n' && ch != '\0' && !(isalpha((unsigned char)ch) ||
+			isdigit((unsigned char)ch) || ispunct((unsigned char)ch) || ch == ' '))
+			continue;
+		// same wrapping as load_doc
+		if (ch == '\n' || col + spaces >= LINE_LENGTH)
+		{
+			docline* newline = calloc(1, sizeof(docline));
+			if (newline == NULL)
+			{
+				// keep what's in, the rest of the paste is lost
+				set_debug_msg("Out of memory, the paste was cut short");
+				break;
+			}
+			line->line[col] = '\0';
+			line->nextline = newline;
+			newline->prevline = line;
+			line = newline;
+			col = 0;
+			++new_lines;
+			if (ch == '\n')
+				continue;
+		}
+		if (ch == '\0')
+			break;
+		for (int j = 0; j < spaces; ++j)
+			line->line[col++] = ch;
+		main_document->number_of_chars += spaces;
 	}
+	line->line[col] = '\0';
+	cursor->currline = line;
+	cursor->xpos = col;
 
-	// if we get here, we aren't special case head of line, ie cursor->xpos!=0
-	// so we have to move some chars down to the next line.
-	int nindex = 0;
-	for (size_t i = cursor->xpos; i < strlen(cursor->currline->line); ++i)
+	// put back what was after the cursor, wrapping if we have to
+	size_t rest_len = strlen(rest);
+	if (col + rest_len >= LINE_LENGTH)
 	{
-		newline->line[nindex] = cursor->currline->line[i];
-		nindex++;
+		spare->prevline = line;
+		line->nextline = spare;
+		line = spare;
+		col = 0;
+		++new_lines;
 	}
-	newline->line[nindex] = '\0';
-	for (size_t i = strlen(cursor->currline->line); i >= cursor->xpos ; --i)
+	else
+		free(spare);
+	strcpy(line->line + col, rest);
+	line->nextline = after;
+	if (after)
+		after->prevline = line;
+	if (main_document->tail == first)
+		main_document->tail = line;
+	if (new_lines > 0)
+		fold_line_added(main_document, first->nextline);
+
+	asm_line_changed(first);
+	macro_line_changed(main_document);
+	for (docline* l = first; l != line->nextline; l = l->nextline)
 	{
-		cursor->currline->line[i] = '\0';
+		pipe_line_changed(l);
+		journal_line_edited(main_document, l);
+		changes_line_edited(main_document, l);
 	}
-	newline->prevline = cursor->currline;
-	newline->nextline = cursor->currline->nextline;
-	cursor->currline->nextline = newline;
-	if (main_document->tail == cursor->currline)
-		main_document->tail = newline;
-	cursor->currline = newline;
+	if (syntax_highlighting)
+		lines_changed(main_document, first, line);
+
+	for (docline* l = first; l != cursor->currline; l = l->nextline)
+	{
+		if (cursor->ypos != d->height - 3)
+			++cursor->ypos;
+		else
+			scroll_document_down();
+		++d->absy;
+	}
+	main_document->number_of_lines += new_lines;
+	main_document->unsaved_changes = true;
+	++main_document->version;
+	set_leading_zeros();
+}
+
+static int read_escape_sequence()
+{
+	// we've had ESC[, read the rest of a CSI sequence and return
+	// its number if it's the ESC[n~ kind, otherwise -1
+	int ch;
+	int num = 0;
+	timeout(ESCAPE_TIMEOUT_MS);
+	while ((ch = getch()) != ERR && isdigit(ch))
+		num = num * 10 + (ch - '0');
+	nodelay(stdscr, TRUE);
+	return ch == '~' ? num : -1;
+}
+
+static char* read_paste(size_t* len)
+{
+	// read everything up to the closing ESC[201~, or until the
+	// terminal goes quiet in case we never see it
+	size_t size = 4096;
+	char* text = malloc(size);
+	int ch;
+	bool last_cr = false;
+	*len = 0;
+	if (text == NULL)
+		return NULL;
+	for (;;)
+	{
+		timeout(PASTE_TIMEOUT_MS);
+		ch = getch();
+		nodelay(stdscr, TRUE);
+		if (ch == ERR)
+			break;
+		if (ch == ESC)
+		{
+			// wait for the rest, or [201~ ends up in the paste
+			timeout(ESCAPE_TIMEOUT_MS);
+			int next = getch();
+			nodelay(stdscr, TRUE);
+			if (next == '[' && read_escape_sequence() == PASTE_END)
+				break;
+			continue;
+		}
+		// terminals send newlines as \r, "\r\n" is still just one
+		if (ch == '\n' && last_cr)
+		{
+			last_cr = false;
+			continue;
+		}
+		last_cr = ch == '\r';
+		if (ch == '\r' || ch == KEY_ENTER)
+			ch = '\n';
+		else if (ch > 0xff)
+			continue;	// some other key sequence, doesn't belong in a paste
+		if (*len + 1 >= size)
+		{
+			char* bigger = realloc(text, size * 2);
+			if (bigger == NULL)
+				break;
+			text = bigger;
+			size *= 2;
+		}
+		text[(*len)++] = ch;
+	}
+	return text;
+}
+
+void insert_newline(cursor_pos* cursor)
+{
+	docline* newline = calloc(1, sizeof(docline));
+	// Handle special case where we are at first character
+	// of the line, then we can just insert a new blank line before this
+	// one and not worry about the copy we're doing below.
+	if (cursor->xpos == 0)
+	{
+		// insert before
+		if (main_document->head == cursor->currline)
+		{
+			if (d->topline == main_document->head)	// hmm, having to do this is obnoxious?
+				d->topline = newline;
+			main_document->head = newline;
+		}
+		newline->prevline = cursor->currline->prevline;
+		newline->nextline = cursor->currline;
+		if (cursor->currline->prevline)
+			cursor->currline->prevline->nextline = newline;
+		cursor->currline->prevline = newline;
+		line_edited(newline);
+		goto finish_scroll_down;
+	}
+
+	// if we get here, we aren't special case head of line, ie cursor->xpos!=0
+	// so we have to move some chars down to the next line.
+	int nindex = 0;
+	for (size_t i = cursor->xpos; i < strlen(cursor->currline->line); ++i)
+	{
+		newline->line[nindex] = cursor->currline->line[i];
+		nindex++;
+	}
+	newline->line[nindex] = '\0';
+	for (size_t i = strlen(cursor->currline->line); i >= cursor->xpos ; --i)
+	{
+		cursor->currline->line[i] = '\0';
+	}
+	newline->prevline = cursor->currline;
+	newline->nextline = cursor->currline->nextline;
+	cursor->currline->nextline = newline;
+	if (main_document->tail == cursor->currline)
+		main_document->tail = newline;
+	if (newline->nextline)
+		newline->nextline->prevline = newline;
+	fold_line_added(main_document, newline);
+	line_edited(cursor->currline);
+	journal_line_edited(main_document, newline);
+	changes_line_edited(main_document, newline);
+	cursor->currline = newline;
 	cursor->xpos = 0;
 
 finish_scroll_down:
 	// todo: scroll if we're at bottom of the screen!
 	if (cursor->ypos != d->height - 3)
-	{
 		++cursor->ypos;
-		++d->absy;
-	}
 	else
 	{
 		cursor->xpos = min(cursor->xpos, strlen(cursor->currline->line));
 		scroll_document_down();
 	}
+	++d->absy;
 	main_document->unsaved_changes = true;
 	++main_document->number_of_lines;
 	set_leading_zeros();
 }
 
+static void run_program()
+{
+	// hand the terminal over to the simulated program until it exits
+	int errors = asm_assemble(main_document);
+	assembler* as = main_document->assembly;
+	if (errors < 0)
+	{
+		set_debug_msg("Can't read opcodes.dat");
+		return;
+	}
+	if (errors > 0)
+	{
+		set_debug_msg("Can't run, %d errors (first on line %lu)", errors, as->first_error_line);
+		return;
+	}
+	if (as->text_words == 0)
+	{
+		set_debug_msg("Nothing to run");
+		return;
+	}
+
+	def_prog_mode();
+	endwin();
+	printf(BRACKETED_PASTE_OFF);
+	fflush(stdout);
+
+	sim_result result;
+	TRACE_BEGIN(TR_SIMULATE, as->text_words);
+	sim_run(as, &result);
+	TRACE_END(TR_SIMULATE, (long)result.executed);
+
+	double mips = result.elapsed_ms ? result.executed / (result.elapsed_ms * 1000.0) : 0;
+	size_t error_line = 0;
+	if (result.error)
+	{
+		// find the line the bad instruction came from
+		size_t index = (result.error_pc - TEXT_BASE) / 4;
+		docline* bad = index < as->text_words ? as->text_lines[index] : NULL;
+		size_t line_number = 1;
+		for (docline* line = main_document->head; bad && line; line = line->nextline, ++line_number)
+		{
+			if (line == bad)
+			{
+				error_line = line_number;
+				break;
+			}
+		}
+		printf("\n-- %s at 0x%08x", result.error, result.error_pc);
+		if (error_line)
+			printf(" (line %lu)", error_line);
+	}
+	else
+		printf("\n-- exited with %d", result.exit_code);
+	printf(", %llu instructions in %lld ms (%.1f MIPS)\n-- press enter to return\n",
+		result.executed, result.elapsed_ms, mips);
+	fflush(stdout);
+	int c;
+	while ((c = getchar()) != '\n' && c != EOF)
+		;
+
+	printf(BRACKETED_PASTE_ON);
+	fflush(stdout);
+	reset_prog_mode();
+	clearok(stdscr, TRUE);
+	refresh();
+	if (result.error)
+		set_debug_msg("%s at line %lu", result.error, error_line);
+	else
+		set_debug_msg("Exited with %d after %llu instructions", result.exit_code, result.executed);
+}
+
+static void draw_macro_preview()
+{
+	// the expansion of the macro called on the cursor's line, over the
+	// bottom of the text, or the top if the cursor is down there
+	char error[MAX_DEBUG_MSG];
+	int lines = 0;
+	macro_table* t = main_document->expansions;
+	unsigned long misses = t ? t->misses : 0;
+	char* text = macro_expand(main_document, cursors[0].currline->line, 0, &lines, error, sizeof(error));
+	t = main_document->expansions;
+	bool cached = t && t->misses == misses;
+
+	int text_rows = (int)d->height - 2;
+	int rows = min(max(lines, 1), text_rows / 2 - 1) + 1;
+	int top = (int)cursors[0].ypos + 1 >= text_rows + 1 - rows ? 1 : text_rows + 1 - rows;
+	int x0 = d->screen_x;
+	int width = d->width;
+	top += d->screen_y - 1;
+	mvhline(top, x0, ' ', width);
+	if (text == NULL)
+		mvaddnstr(top, x0 + 1, error[0] ? error : "No macro call on this line", width - 1);
+	else
+	{
+		char header[MAX_DEBUG_MSG];
+		snprintf(header, sizeof(header), "expands to %d line%s%s", lines, lines == 1 ? "" : "s",
+			cached ? " (cached)" : "");
+		mvaddnstr(top, x0 + 1, header, width - 1);
+	}
+	mvchgat(top, x0, width, A_BOLD, BAR_PAIR, NULL);
+	char* p = text;
+	int text_x = x0 + gutter_width();
+	int text_width = width - gutter_width();
+	for (int i = 1; i < rows; ++i)
+	{
+		mvhline(top + i, x0, ' ', width);
+		if (p == NULL || *p == '\0' || text_width <= 0)
+			continue;
+		char* end = strchr(p, '\n');
+		char more[MAX_DEBUG_MSG];
+		if (i == rows - 1 && i < lines)
+		{
+			snprintf(more, sizeof(more), "... %d more", lines - i + 1);
+			mvaddnstr(top + i, text_x, more, text_width);
+		}
+		else
+			mvaddnstr(top + i, text_x, p, min((int)(end - p), text_width));
+		p = end + 1;
+	}
+	free(text);
+}
+
 static void scroll_document_up()
 {
-	if (d->topline->prevline == NULL)
+	// a folded line counts for all of its lines, the cursor that
+	// moved us looks after absy
+	docline* prev = prev_visible(d->topline);
+	if (prev == NULL)
 		return;	// this should be an error!
-	d->topline = d->topline->prevline;
-	--d->absy;
-	--d->top_line_number;
+	d->topline = prev;
+	d->top_line_number -= fold_span(prev);
 }
 
 static void scroll_document_down()
 {
 	// todo: we'll need to move all cursors up?
 	// todo: we might have cursors that aren't visible?
-	if (d->topline->nextline == NULL)
+	docline* next = next_visible(d->topline);
+	if (next == NULL)
 		return;	// this should be an error!
-	d->topline = d->topline->nextline;
-	++d->absy;
-	++d->top_line_number;
+	d->top_line_number += fold_span(d->topline);
+	d->topline = next;
 }
 
 void remove_char(cursor_pos* cursor)
@@ -737,9 +1621,9 @@ void remove_char(cursor_pos* cursor)
 		docline* tmp;
 		if (cursor->currline == main_document->tail)
 		{
-			tmp = cursor->currline->prevline;
+			tmp = prev_visible(cursor->currline);
 			--cursor->ypos;
-			--d->absy;
+			d->absy -= fold_span(tmp);
 		}
 		else
 		{
@@ -750,6 +1634,9 @@ void remove_char(cursor_pos* cursor)
 	}
 	else if (cursor->xpos == strlen(cursor->currline->line) && cursor->currline->nextline != NULL)
 	{
+		// joining on the line after means opening what's folded here
+		if (cursor->currline->fold)
+			unfold(main_document, cursor->currline->fold);
 
 		int lineindex = strlen(cursor->currline->line);
 		for (size_t i = 0; i < strlen(cursor->currline->nextline->line); ++i)
@@ -759,6 +1646,7 @@ void remove_char(cursor_pos* cursor)
 			if (lineindex >= 80) lineindex = 80;
 		}
 		remove_line(main_document, cursor->currline->nextline);
+		line_edited(cursor->currline);
 	}
 	else
 	{
@@ -767,6 +1655,7 @@ void remove_char(cursor_pos* cursor)
 		{
 			cursor->currline->line[i] = cursor->currline->line[i + 1];
 		}
+		line_edited(cursor->currline);
 	}
 	main_document->unsaved_changes = true;
 }
@@ -779,16 +1668,22 @@ void cursor_left(cursor_pos* cursor)
 	}
 	else if (cursor->xpos == 0 && cursor->currline->prevline && d->left_char_number == 0)
 	{
+		// going sideways into a fold opens it, up and down step over
+		if (is_hidden(cursor->currline->prevline))
+		{
+			unfold(main_document, cursor->currline->prevline->fold);
+			folds_changed();
+		}
 		cursor->currline = cursor->currline->prevline;
 		if (cursor->ypos != 0)
 		{
 			--cursor->ypos;
-			--d->absy;
 		}
 		else
 		{
 			scroll_document_up();
 		}
+		--d->absy;
 		cursor->xpos = strlen(cursor->currline->line);
 	}
 	else if (cursor->xpos > 0)
@@ -802,7 +1697,7 @@ void cursor_right(cursor_pos* cursor)
 	// consider line numbers being used here
 	// -4 seems icky and arbitrary, fix this with a notion of "screen" struct
 	// that can track this stuff?
-	size_t scrolling_width = show_line_no ? d->width - leading_zeros - 4 : d->width;
+	size_t scrolling_width = show_line_no ? d->width - gutter_width() - 1 : d->width;
 	if (cursor->xpos == scrolling_width && cursor->xpos <= strlen(cursor->currline->line))
 	{
 		++d->left_char_number;
@@ -814,12 +1709,23 @@ void cursor_right(cursor_pos* cursor)
 	else if (cursor->xpos > strlen(cursor->currline->line) &&
 		cursor->currline->nextline && cursor->ypos == d->height - 3)
 	{
+		if (cursor->currline->fold)
+		{
+			unfold(main_document, cursor->currline->fold);
+			folds_changed();
+		}
 		cursor->currline = cursor->currline->nextline;
 		scroll_document_down();
+		++d->absy;
 		cursor->xpos = 0;
 	}
 	else if (cursor->xpos > strlen(cursor->currline->line) && cursor->currline->nextline)
 	{
+		if (cursor->currline->fold)
+		{
+			unfold(main_document, cursor->currline->fold);
+			folds_changed();
+		}
 		cursor->currline = cursor->currline->nextline;
 		++cursor->ypos;
 		++d->absy;
@@ -851,42 +1757,47 @@ void extend_cursor_left(cursor_pos* cursor)
 
 void cursor_down(cursor_pos* cursor)
 {
+	// over a fold in one step
+	docline* next = next_visible(cursor->currline);
 	if (cursor->ypos == d->height - 3)
 	{
-		if (cursor->currline->nextline)
+		if (next)
 		{
-			cursor->currline = cursor->currline->nextline;
+			d->absy += fold_span(cursor->currline);
+			cursor->currline = next;
 			cursor->xpos = min(cursor->xpos, strlen(cursor->currline->line));
 			scroll_document_down();
 		}
 	}
-	else if (cursor->currline->nextline)
+	else if (next)
 	{
-		cursor->currline = cursor->currline->nextline;
+		d->absy += fold_span(cursor->currline);
+		cursor->currline = next;
 		cursor->xpos = min(cursor->xpos, strlen(cursor->currline->line));
 		++cursor->ypos;
-		++d->absy;
 	}
 }
 
 void cursor_up(cursor_pos* cursor)
 {
+	docline* prev = prev_visible(cursor->currline);
 	if (cursor->ypos == 0)
 	{
-		if (cursor->currline->prevline)
+		if (prev)
 		{
-			cursor->currline = cursor->currline->prevline;
+			cursor->currline = prev;
 			cursor->xpos = min(cursor->xpos, strlen(cursor->currline->line));
+			d->absy -= fold_span(prev);
 			scroll_document_up();
 		}
 	}
-	else if (cursor->currline->prevline)
+	else if (prev)
 	{
-		cursor->currline = cursor->currline->prevline;
+		cursor->currline = prev;
 		cursor->xpos = min(cursor->xpos, strlen(cursor->currline->line));
 		if (cursor->ypos > 0)
 			--cursor->ypos;
-		--d->absy;
+		d->absy -= fold_span(prev);
 	}
 }
 
@@ -894,10 +1805,10 @@ void set_debug_msg(const char* msg, ...)
 {
 	va_list args;
 	va_start (args, msg);
-	vsprintf(debug_msg, msg, args);
+	vsnprintf(debug_msg, MAX_DEBUG_MSG, msg, args);
 	va_end (args);
 	debug_countdown = DISPLAY_DEBUG_TIME;
-	mvprintw(d->height - 1, 0, "%s", debug_msg);
+	mvprintw(LINES - 1, 0, "%s", debug_msg);
 	refresh();
 }
 
@@ -906,6 +1817,16 @@ void remove_line(doc* document, docline* line)
 {
 	if (document->head == document->tail && document->head == line)
 		return;
+	if (document == main_document)
+		windows_forget_line(line, line->nextline ? line->nextline : line->prevline);
+	fold_line_removed(document, line);
+	if (syntax_highlighting)
+		forget_line(document, line);
+	asm_forget_line(line);
+	macro_line_changed(document);
+	journal_line_removed(document, line);
+	changes_line_removed(document, line);
+	++document->version;
 	--document->number_of_lines;
 	set_leading_zeros();
 	if (document->head == line)
@@ -916,6 +1837,22 @@ void remove_line(doc* document, docline* line)
 		line->nextline->prevline = line->prevline;
 	if (line->prevline != NULL)
 		line->prevline->nextline = line->nextline;
+	// the lines after might lex differently now
+	if (syntax_highlighting && line->nextline != NULL)
+		line_changed(document, line->nextline);
+}
+
+static inline void line_edited(docline* line)
+{
+	// keep labels and macros up to date as we type
+	asm_line_changed(line);
+	macro_line_changed(main_document);
+	pipe_line_changed(line);
+	journal_line_edited(main_document, line);
+	changes_line_edited(main_document, line);
+	++main_document->version;
+	if (syntax_highlighting)
+		line_changed(main_document, line);
 }
 
 // this should take a document
@@ -924,54 +1861,135 @@ void draw_lines(docline* top)
 	int max_lines = d->height - 1;
 	docline* cur = top;
 	int yline = 1;
-	char ch;
+	int y0 = d->screen_y - 1;
+	int x0 = d->screen_x;
+	int width = d->width;
+	size_t number = d->top_line_number;
+	lex_state state = 0;
+	TRACE_BEGIN(TR_REDRAW, d->top_line_number);
+	prof_begin(PROF_DRAW);
+	if (syntax_highlighting)
+		state = lex_state_at(top);
+	if (show_line_no)
+		changes_update(main_document);
 	do
 	{
-		move(yline, 0);
-		clrtoeol();
-		int attr_val = 0;
+		// just our part of the row, there might be another window beside us
+		mvhline(y0 + yline, x0, ' ', width);
 		if (syntax_highlighting)
-			parse_line(cur);
-		bool first = true;
-		int absx = 0;
+		{
+			prof_begin(PROF_PARSE);
+			TRACE_BEGIN(TR_LEX, number);
+			state = parse_line(main_document, cur, state);
+			TRACE_END(TR_LEX, number);
+			prof_end(PROF_PARSE);
+		}
+		int number_x = 0;
+		if (show_line_no && show_pipeline)
+		{
+			// cycles at the top of each block, stalls on the lines that wait
+			number_x = PIPE_GUTTER;
+			attr_t attr = (cur->stalls || (cur->hazards & HAZ_DELAY_SLOT)) ?
+				COLOR_PAIR(ERROR_PAIR) | A_BOLD : COLOR_PAIR(LINE_NO_PAIR);
+			attron(attr);
+			if (cur->block_hash)
+				mvprintw(y0 + yline, x0, "%*u ", PIPE_GUTTER - 1, cur->block_cycles);
+			else if (cur->stalls)
+			{
+				char stalls[PIPE_GUTTER + 1];
+				snprintf(stalls, sizeof(stalls), "+%u", cur->stalls);
+				mvprintw(y0 + yline, x0, "%*s ", PIPE_GUTTER - 1, stalls);
+			}
+			else if (cur->hazards & HAZ_DELAY_SLOT)
+				mvprintw(y0 + yline, x0, "%*s ", PIPE_GUTTER - 1, "ds");
+			attroff(attr);
+		}
 		if (show_line_no)
 		{
 			attron(COLOR_PAIR(LINE_NO_PAIR));
-			mvprintw(yline, 0, "%*lu: ", (leading_zeros + 1), d->top_line_number + yline - 1);
+			mvprintw(y0 + yline, x0 + number_x, "%*lu: ", (leading_zeros + 1), number);
 			attroff(COLOR_PAIR(LINE_NO_PAIR));
+			// flag problems in place of the ':'
+			if (syntax_highlighting && diag_line_flags(main_document, cur))
+				mvaddch(y0 + yline, x0 + number_x + leading_zeros + 1, '!' | COLOR_PAIR(ERROR_BLOCK_PAIR) | A_BOLD);
+			// and what's changed since the last save in the space after it
+			chtype mark = change_mark(cur);
+			if (mark)
+				mvaddch(y0 + yline, x0 + number_x + leading_zeros + 2, mark);
 		}
-		for (size_t x = 0; x < strlen(cur->line); ++x)
+		int text_x = gutter_width();
+		int left = d->left_char_number;
+		if (syntax_highlighting)
 		{
-			ch = cur->line[x + d->left_char_number];
-			if (syntax_highlighting)
+			// one attribute switch per span rather than per character
+			const hl_span* span = hl_spans(main_document->highlights, cur);
+			for (int i = 0; i < cur->hl_count; ++i, ++span)
 			{
-				if (!first)
-				{
-					attroff(attr_val);
-				}
-				first = false;
-				attr_val = cur->formatting[x + d->left_char_number];
-				attron(attr_val);
+				int start = max((int)span->start, left);
+				int end = min((int)(span->start + span->length), left + width - text_x);
+				if (start >= end)
+					continue;
+				attr_t attr = hl_attr(span->cls);
+				attron(attr);
+				mvaddnstr(y0 + yline, x0 + text_x + start - left, cur->line + start, end - start);
+				attroff(attr);
+			}
+		}
+		else if ((int)strlen(cur->line) > left && width > text_x)
+		{
+			mvaddnstr(y0 + yline, x0 + text_x, cur->line + left, width - text_x);
+		}
+		if (cur->fold)
+		{
+			// what's tucked under this line, just past its end
+			char folded[32];
+			int n = snprintf(folded, sizeof(folded), " ... %lu lines", cur->fold->hidden);
+			int x = text_x + max((int)strlen(cur->line) - left, 0);
+			if (x < width)
+			{
+				attron(COLOR_PAIR(LINE_NO_PAIR) | A_BOLD);
+				mvaddnstr(y0 + yline, x0 + x, folded, min(n, width - x));
+				attroff(COLOR_PAIR(LINE_NO_PAIR) | A_BOLD);
 			}
-			if (show_line_no)
-				absx = x + leading_zeros + 3;
-			else
-				absx = x;
-			mvprintw(yline, absx, "%c", ch);
 		}
-		if (syntax_highlighting)
-			attroff(attr_val);
 		++yline;
-		cur = cur->nextline;
+		number += fold_span(cur);
+		if (cur->fold)
+		{
+			// the lexer picks up again after the hidden lines
+			cur = next_visible(cur);
+			if (syntax_highlighting && cur)
+				state = lex_state_at(cur);
+		}
+		else
+			cur = cur->nextline;
 	} while (cur != NULL && yline < max_lines);
+	prof_end(PROF_DRAW);
+	prof_begin(PROF_REFRESH);
 	refresh();
+	prof_end(PROF_REFRESH);
+	TRACE_END(TR_REDRAW, d->top_line_number);
 }
 
 // this should take a document
 void save_document()
 {
+	if (saving)
+	{
+		set_debug_msg("Still saving %s", saving->filename);
+		return;
+	}
+	if (loading)
+	{
+		set_debug_msg("Still loading %s", current_filename);
+		return;
+	}
 	memset(fname, 0, MAX_FILE_NAME);
-	if (!get_string("Save file", current_filename, fname, MAX_FILE_NAME))
+	// where it came from, rather than just its name, when it fits
+	const char* path = buffers[active_buffer]->path;
+	if (path == NULL || strlen(path) >= MAX_FILE_NAME)
+		path = current_filename;
+	if (!get_string("Save file", (char*)path, fname, MAX_FILE_NAME))
 		return;
 	// error check saving
 	if (check_file_exists(fname) != 0)
@@ -981,79 +1999,1253 @@ void save_document()
 		if (!(sure[0] == 'Y' || sure[0] == 'y'))
 			return;
 	}
+	// write it out on another thread, finish_save picks up the result
+	saving = save_doc_async(fname, main_document);
+	saving_doc = main_document;
+	if (saving == NULL)
+	{
+		set_debug_msg("Can't save %s", fname);
+		return;
+	}
 	set_debug_msg("Saving %s", fname);
-	save_doc(fname, main_document);
 	if (current_filename)
 		free(current_filename);
 	current_filename = strdup(fname);
-	set_debug_msg("Saved %s", fname);
-	main_document->unsaved_changes = false;
 }
 
-// hmmm, this will take a document and fill it int?
-void load_document()
+static bool finish_save()
 {
-	memset(fname, 0, MAX_FILE_NAME);
-	if (!get_string("Load file", NULL, fname, MAX_FILE_NAME))
-		return;
+	// the document only counts as saved if it hasn't been edited
+	// since the save took its copy
+	bool ok = false;
+	int error = save_finish(saving);
 	clear_status_bar();
-	set_debug_msg("Loading %s", fname);
+	if (error)
+		set_debug_msg("Error saving %s: %s", saving->filename, strerror(error));
+	else
+	{
+		// what's on disk is ours now, not something to reload
+		set_buffer_path(saving_doc, saving->filename);
+		if (saving_doc == main_document)
+			watch_file(saving->filename);
+		if (saving->version == saving_doc->version)
+		{
+			saving_doc->unsaved_changes = false;
+			journal_start(saving_doc, saving->filename, true);
+			changes_saved(saving_doc);
+			set_debug_msg("Saved %s", saving->filename);
+		}
+		else
+			set_debug_msg("Saved %s, it's changed since", saving->filename);
+		ok = true;
+	}
+	save_free(saving);
+	saving = NULL;
+	saving_doc = NULL;
+	return ok;
+}
 
-	if (check_file_exists(fname) == 0)
+static void reload_document(const char* filename)
+{
+	// something else changed the file, patch in what's on disk now
+	if (main_document->unsaved_changes)
 	{
-		set_debug_msg("File not found");
+		char sure[2];
+		get_string("File changed on disk, reload and lose your edits? (Y/n)", NULL, sure, 1);
+		if (!(sure[0] == 'Y' || sure[0] == 'y'))
+		{
+			watch_sync();
+			return;
+		}
+	}
+	watch_sync();
+	char (*lines)[LINE_LENGTH];
+	size_t count;
+	if (read_lines(filename, &lines, &count) != 0)
+	{
+		set_debug_msg("Can't reload %s", filename);
 		return;
 	}
-
-	// TODO: Don't clear doc until we know
-	// file has loaded succesfully?
-	// docline* tmp_head;
-
-	// need a different way to do this
-	clear_doc(main_document);
-	int load_return_value = load_doc(fname, main_document); 
-	if (load_return_value == -1)
+	size_t changed = patch_document(lines, count);
+	free(lines);
+	if (changed == (size_t)-1)
 	{
-		set_debug_msg("Error loading %s", fname);
-		main_document->number_of_lines = 1;
+		set_debug_msg("Can't reload %s", filename);
 		return;
 	}
-
-	cursors[0].currline = main_document->head;
-	cursors[0].xpos = 0;
-	cursors[0].ypos = 0;
-	num_cursors = 1;
-
-	d->topline = main_document->head;
+	// it's what's on disk now
 	main_document->unsaved_changes = false;
+	journal_start(main_document, filename, true);
+	changes_saved(main_document);
+	set_debug_msg("Reloaded %s, %zu lines changed", filename, changed);
+}
 
-	initialize_display(d);
+static size_t patch_document(char (*lines)[LINE_LENGTH], size_t count)
+{
+	// make the document read lines, changing just the lines that differ
+	// so the cursors, scrolling and highlighting on the rest stay put.
+	// returns how many lines changed, or -1 if we ran out of memory
+	size_t changed = (size_t)-1;
+	size_t old_count = 0;
+	for (docline* l = main_document->head; l != NULL; l = l->nextline)
+		++old_count;
+	const char** old_text = malloc(old_count * sizeof(char*));
+	const char** new_text = malloc(count * sizeof(char*));
+	diff_hunk* hunks = NULL;
+	int num_hunks = -1;
+	if (old_text && new_text)
+	{
+		size_t i = 0;
+		for (docline* l = main_document->head; l != NULL; l = l->nextline)
+			old_text[i++] = l->line;
+		for (i = 0; i < count; ++i)
+			new_text[i] = lines[i];
+		num_hunks = diff_lines(old_text, old_count, new_text, count, &hunks);
+	}
+	if (num_hunks < 0)
+		goto done;
+
+	docline* line = main_document->head;
+	size_t old_i = 0;
+	changed = 0;
+	for (int h = 0; h < num_hunks; ++h)
+	{
+		diff_hunk* hunk = &hunks[h];
+		for (; old_i < hunk->a_start; ++old_i)
+			line = line->nextline;
+		// lines on both sides are edited in place, then the rest are
+		// removed or inserted
+		size_t same = min(hunk->a_len, hunk->b_len);
+		for (size_t j = 0; j < same; ++j, ++old_i)
+		{
+			strcpy(line->line, lines[hunk->b_start + j]);
+			line_edited(line);
+			line = line->nextline;
+		}
+		for (size_t j = same; j < hunk->a_len; ++j, ++old_i)
+		{
+			docline* next = line->nextline;
+			drop_line(line, next ? next : line->prevline);
+			line = next;
+		}
+		docline* first = NULL;
+		docline* last = NULL;
+		for (size_t j = same; j < hunk->b_len; ++j)
+		{
+			docline* newline = calloc(1, sizeof(docline));
+			strcpy(newline->line, lines[hunk->b_start + j]);
+			// goes in before line, or at the end if we're past the last one
+			newline->nextline = line;
+			newline->prevline = line ? line->prevline : main_document->tail;
+			if (newline->prevline)
+				newline->prevline->nextline = newline;
+			else
+				main_document->head = newline;
+			if (line)
+				line->prevline = newline;
+			else
+				main_document->tail = newline;
+			fold_line_added(main_document, newline);
+			++main_document->number_of_lines;
+			if (first == NULL)
+				first = newline;
+			last = newline;
+		}
+		if (first)
+		{
+			macro_line_changed(main_document);
+			for (docline* l = first; l != last->nextline; l = l->nextline)
+			{
+				pipe_line_changed(l);
+				journal_line_edited(main_document, l);
+				changes_line_edited(main_document, l);
+			}
+			++main_document->version;
+			if (syntax_highlighting)
+				lines_changed(main_document, first, last);
+		}
+		changed += max(hunk->a_len, hunk->b_len);
+	}
 
-	find_labels(main_document->head);
+	main_document->number_of_chars = 0;
+	for (size_t i = 0; i < count; ++i)
+		main_document->number_of_chars += strlen(lines[i]);
 	set_leading_zeros();
-	draw_lines(main_document->head);
-	set_debug_msg("Loaded %s", fname);
+	place_cursors();
+done:
+	free(hunks);
+	free(old_text);
+	free(new_text);
+	return changed;
+}
 
+static bool follow_step()
+{
+	// take in whatever's been added to the file we're following,
+	// only the new lines get looked at, and if the first cursor
+	// was on the last line it goes along with the end of the file
+	docline* old_tail = main_document->tail;
+	bool at_bottom = cursors[0].currline == old_tail;
+	int new_lines;
+	ssize_t got = follow_read(&follower, main_document, &new_lines);
+	if (got < 0)
+	{
+		// truncated or replaced, empty the document and start
+		// over from the top of the new one
+		char* filename = strdup(follower.filename);
+		char empty[1][LINE_LENGTH] = { "" };
+		if (filename && follow_open(&follower, filename) == 0)
+		{
+			patch_document(empty, 1);
+			set_debug_msg("%s was truncated", filename);
+			got = follow_read(&follower, main_document, &new_lines);
+			old_tail = main_document->head;
+			at_bottom = true;
+			cursors[0].currline = old_tail;
+		}
+		free(filename);
+		if (got < 0)
+		{
+			follow_close(&follower);
+			set_debug_msg("Stopped following, can't read the file");
+			return true;
+		}
+	}
+	if (got == 0)
+		return false;
+	line_edited(old_tail);
+	if (new_lines > 0)
+	{
+		docline* first = old_tail->nextline;
+		macro_line_changed(main_document);
+		for (docline* l = first; l != NULL; l = l->nextline)
+		{
+			pipe_line_changed(l);
+			journal_line_edited(main_document, l);
+			changes_line_edited(main_document, l);
+		}
+		++main_document->version;
+		if (syntax_highlighting)
+			lines_changed(main_document, first, main_document->tail);
+		set_leading_zeros();
+	}
+	if (at_bottom)
+	{
+		for (int i = 0; i < new_lines; ++i)
+		{
+			if (cursors[0].ypos != d->height - 3)
+				++cursors[0].ypos;
+			else
+				scroll_document_down();
+		}
+		d->absy += new_lines;
+		cursors[0].currline = main_document->tail;
+		cursors[0].xpos = 0;
+	}
+	return true;
 }
 
-void wait_for_keypress()
+static void drop_line(docline* line, docline* replacement)
 {
-	wchar_t ch;
-	for (;;)
+	// take line out of the document for good, anything
+	// looking at it looks at replacement instead
+	for (int i = 0; i < num_cursors; ++i)
 	{
-		ch = getch();
-		if (ch != ERR)
-			break;
+		if (cursors[i].currline != line)
+			continue;
+		cursors[i].currline = replacement;
+		cursors[i].xpos = 0;
 	}
+	if (d->topline == line)
+		d->topline = replacement;
+	remove_line(main_document, line);
+	if (line == copy_line)
+		return;		// still needed for pasting
+	free(line->defs);
+	free(line->label_ref);
+	free(line);
 }
 
-// todo: move out of here?
-static bool get_string(char* prompt, char* default_text, char* response, size_t max_size)
+static void place_cursors()
 {
-	// display prompt, with default text, and store reponse
-	// in response. return false is user presses escape, ie. no input
-	// clear any existing debug message
-	wchar_t ch;
+	// lines came and went around the cursors, work out where everything
+	// is on the screen again, keeping the first cursor in view. anything
+	// a fold has swallowed goes to the line the fold shows as
+	size_t top = 0;
+	size_t at[MAX_CURSORS] = { 0 };
+	size_t n = 1;
+	size_t shown_at = 1;
+	for (docline* l = main_document->head; l != NULL; l = l->nextline, ++n)
+	{
+		if (!is_hidden(l))
+			shown_at = n;
+		if (l == d->topline)
+		{
+			top = shown_at;
+			d->topline = l->fold ? l->fold->first : l;
+		}
+		for (int i = 0; i < num_cursors; ++i)
+		{
+			if (cursors[i].currline != l)
+				continue;
+			at[i] = shown_at;
+			cursors[i].currline = l->fold ? l->fold->first : l;
+		}
+	}
+	size_t rows = d->height - 2;
+	// the window might have got smaller
+	cursors[0].ypos = min(cursors[0].ypos, rows - 1);
+	size_t row[MAX_CURSORS];
+	if (top != 0)
+		screen_rows(rows, row);
+	if (top == 0 || row[0] == rows)
+	{
+		top = at[0];
+		d->topline = cursors[0].currline;
+		for (size_t i = 0; i < cursors[0].ypos && prev_visible(d->topline); ++i)
+		{
+			d->topline = prev_visible(d->topline);
+			top -= fold_span(d->topline);
+		}
+		screen_rows(rows, row);
+	}
+	d->top_line_number = top;
+	d->absy = at[0] - 1;
+	for (int i = 0; i < num_cursors; ++i)
+	{
+		cursors[i].ypos = row[i] < rows ? row[i] : (at[i] >= top ? at[i] - top : 0);
+		cursors[i].xpos = min(cursors[i].xpos, strlen(cursors[i].currline->line));
+	}
+}
+
+static void screen_rows(size_t rows, size_t* row)
+{
+	// which of the first rows from the top each cursor's on, rows if
+	// it's not on any of them. a fold is only one row
+	docline* l = d->topline;
+	for (int i = 0; i < num_cursors; ++i)
+		row[i] = rows;
+	for (size_t r = 0; l != NULL && r < rows; ++r, l = next_visible(l))
+		for (int i = 0; i < num_cursors; ++i)
+			if (cursors[i].currline == l)
+				row[i] = r;
+}
+
+// hmmm, this will take a document and fill it int?
+void load_document()
+{
+	memset(fname, 0, MAX_FILE_NAME);
+	if (!get_string("Load file", NULL, fname, MAX_FILE_NAME))
+		return;
+	clear_status_bar();
+	set_debug_msg("Loading %s", fname);
+
+	if (check_file_exists(fname) == 0)
+	{
+		set_debug_msg("File not found");
+		return;
+	}
+	open_file(fname);
+	draw_lines(d->topline);
+
+}
+
+static void open_file(const char* filename)
+{
+	// show filename in a buffer, the one it's already in if it's open,
+	// otherwise a new one. a file that isn't there yet starts out empty
+	for (int i = 0; i < num_buffers; ++i)
+	{
+		if (buffers[i]->path && strcmp(buffers[i]->path, filename) == 0)
+		{
+			switch_buffer(i);
+			set_debug_msg("%s is already open", filename);
+			return;
+		}
+	}
+	// an empty buffer nobody's touched can just be reused
+	bool empty = current_filename == NULL && !main_document->unsaved_changes &&
+		main_document->number_of_lines <= 1 && main_document->head->line[0] == '\0' &&
+		follower.fd < 0 && !loading;
+	if (!empty && new_buffer() < 0)
+		return;
+	if (check_file_exists(filename))
+	{
+		start_loading(filename);
+		return;
+	}
+	const char* name = strrchr(filename, '/');
+	free(current_filename);
+	current_filename = strdup(name ? name + 1 : filename);
+	set_buffer_path(main_document, filename);
+	journal_close(main_document, true);
+	open_journal(filename);
+	watch_file(filename);
+}
+
+static void start_loading(const char* filename)
+{
+	// start over with an empty document and read filename into it in
+	// the background, so the first screenful can be drawn as soon as
+	// it's read. take_loaded adds the rest as it comes in
+	if (loading)
+		load_finish(loading);
+	// we're leaving whatever was here, its journal too
+	single_window();
+	journal_close(main_document, true);
+	watch_file(NULL);
+	clear_doc(main_document);
+	initialize_display(d);
+	initialize_doc();
+	loading = load_doc_async(filename);
+	loading_placeholder = loading != NULL;
+	set_buffer_path(main_document, loading ? filename : NULL);
+	if (loading == NULL)
+	{
+		set_debug_msg("Error loading %s", filename);
+		if (!untitled_open())
+			open_journal(NULL);
+	}
+}
+
+static bool waiting_for_file()
+{
+	// until the first lines of the file are in the document is just the
+	// empty line they'll replace, so there's nothing to edit yet
+	if (loading_placeholder)
+		set_debug_msg("Still loading %s", current_filename);
+	return loading_placeholder;
+}
+
+static bool take_loaded()
+{
+	// add the lines read since last time onto the end of the document,
+	// true if there were any. the lexer and labels only see the new ones
+	docline* last;
+	size_t count;
+	bool finished;
+	docline* first = load_take(loading, &last, &count, &finished);
+	if (first)
+	{
+		if (loading_placeholder)
+		{
+			// replace the empty line we've been showing
+			docline* placeholder = main_document->head;
+			main_document->head = first;
+			main_document->tail = last;
+			main_document->number_of_lines = count;
+			for (int i = 0; i < num_cursors; ++i)
+				cursors[i].currline = first;
+			d->topline = first;
+			windows_forget_line(placeholder, first);
+			if (syntax_highlighting)
+				forget_line(main_document, placeholder);
+			asm_forget_line(placeholder);
+			free(placeholder->defs);
+			free(placeholder->label_ref);
+			free(placeholder);
+			loading_placeholder = false;
+		}
+		else
+		{
+			first->prevline = main_document->tail;
+			main_document->tail->nextline = first;
+			main_document->tail = last;
+			main_document->number_of_lines += count;
+		}
+		for (docline* l = first; l != NULL; l = l->nextline)
+			main_document->number_of_chars += strlen(l->line);
+		if (syntax_highlighting)
+			lines_changed(main_document, first, last);
+		set_leading_zeros();
+	}
+	if (finished)
+	{
+		char* filename = strdup(loading->filename);
+		int error = load_finish(loading);
+		loading = NULL;
+		clear_status_bar();
+		if (error)
+			set_debug_msg("Error loading %s: %s", filename, strerror(error));
+		else
+			set_debug_msg("Loaded %s", filename);
+		open_journal(filename);
+		watch_file(filename);
+		free(filename);
+		return true;
+	}
+	return first != NULL;
+}
+
+static void open_journal(const char* filename)
+{
+	// if the last session on this file didn't end cleanly, offer
+	// to bring its edits back, then start a journal of our own
+	doc recovered = { 0 };
+	if (journal_exists(filename))
+	{
+		char sure[2];
+		get_string("Found unsaved edits from a session that crashed, recover? (Y/n)",
+			NULL, sure, 1);
+		if ((sure[0] == 'Y' || sure[0] == 'y') && journal_recover(filename, &recovered) == 0)
+		{
+			single_window();
+			clear_doc(main_document);
+			main_document->head = recovered.head;
+			main_document->tail = recovered.tail;
+			main_document->number_of_lines = recovered.number_of_lines;
+			main_document->number_of_chars = recovered.number_of_chars;
+			main_document->unsaved_changes = true;
+			cursors[0].currline = main_document->head;
+			cursors[0].xpos = 0;
+			cursors[0].ypos = 0;
+			num_cursors = 1;
+			initialize_display(d);
+			d->topline = main_document->head;
+			if (syntax_highlighting)
+				find_labels(main_document);
+			set_leading_zeros();
+			set_debug_msg("Recovered unsaved edits, save to keep them");
+		}
+	}
+	journal_start(main_document, filename, !main_document->unsaved_changes);
+	// the gutter marks what's changed since what's on disk
+	char (*lines)[LINE_LENGTH] = NULL;
+	size_t count = 0;
+	if (!main_document->unsaved_changes)
+		changes_saved(main_document);
+	else if (filename == NULL || read_lines(filename, &lines, &count) == 0)
+		changes_saved_lines(main_document, lines, count);
+	free(lines);
+}
+
+static int new_buffer()
+{
+	// open an empty untitled buffer and switch to it, returns
+	// which it is or -1 if we can't
+	if (num_buffers == MAX_BUFFERS)
+	{
+		set_debug_msg("Can't open more than %d buffers", MAX_BUFFERS);
+		return -1;
+	}
+	buffer* b = calloc(1, sizeof(buffer));
+	doc* document = calloc(1, sizeof(doc));
+	if (b == NULL || document == NULL)
+	{
+		free(b);
+		free(document);
+		set_debug_msg("Out of memory");
+		return -1;
+	}
+	if (num_buffers > 0)
+	{
+		stash_buffer();
+		drop_highlights(main_document);
+	}
+	b->document = document;
+	buffers[num_buffers] = b;
+	active_buffer = num_buffers++;
+	main_document = document;
+	current_filename = NULL;
+	follower = (follow_state){ -1, NULL, 0 };
+	loading = NULL;
+	loading_placeholder = false;
+	watch_file(NULL);
+	initialize_display(d);
+	initialize_doc();
+	clear();
+	return active_buffer;
+}
+
+static void close_buffer()
+{
+	// close the buffer we're in and go to the one before it,
+	// closing the last one leaves an empty untitled buffer
+	if (saving)
+		finish_save();
+	check_unsaved_changes();
+	single_window();
+	bool saved = true;
+	if (saving && saving_doc == main_document)
+		saved = finish_save();
+	journal_close(main_document, saved);
+	follow_close(&follower);
+	if (loading)
+		load_finish(loading);
+	loading = NULL;
+	loading_placeholder = false;
+	watch_file(NULL);
+	buffer* b = buffers[active_buffer];
+	free(b->path);
+	b->path = NULL;
+	clear_doc(main_document);
+	if (num_buffers == 1)
+	{
+		initialize_display(d);
+		initialize_doc();
+		journal_start(main_document, NULL, true);
+		changes_saved(main_document);
+		return;
+	}
+	free_symbols(main_document);
+	free(main_document);
+	free(current_filename);
+	free(b);
+	--num_buffers;
+	for (int i = active_buffer; i < num_buffers; ++i)
+		buffers[i] = buffers[i + 1];
+	restore_buffer(active_buffer > 0 ? active_buffer - 1 : 0);
+}
+
+static void switch_buffer(int index)
+{
+	// make buffers[index] the one being edited, the one we're leaving
+	// gives up its highlight spans, they're lexed again if it comes back
+	if (index == active_buffer || index < 0 || index >= num_buffers)
+		return;
+	stash_buffer();
+	drop_highlights(main_document);
+	restore_buffer(index);
+}
+
+static void stash_buffer()
+{
+	// copy the active buffer's state out of the globals, the
+	// windows are only for the buffer on the screen
+	single_window();
+	buffer* b = buffers[active_buffer];
+	b->document = main_document;
+	b->view = *d;
+	memcpy(b->cursors, cursors, sizeof(cursors));
+	b->num_cursors = num_cursors;
+	b->filename = current_filename;
+	b->follower = follower;
+	b->loading = loading;
+	b->loading_placeholder = loading_placeholder;
+}
+
+static void restore_buffer(int index)
+{
+	// and back into them, for buffers[index]
+	buffer* b = buffers[index];
+	active_buffer = index;
+	main_document = b->document;
+	*d = b->view;
+	// the terminal might have changed size while we were away
+	getmaxyx(stdscr, d->height, d->width);
+	memcpy(cursors, b->cursors, sizeof(cursors));
+	num_cursors = b->num_cursors;
+	current_filename = b->filename;
+	follower = b->follower;
+	loading = b->loading;
+	loading_placeholder = b->loading_placeholder;
+	set_leading_zeros();
+	// only the buffer on screen is watched, a followed or loading
+	// file is being read anyway
+	watch_file(follower.fd < 0 && !loading ? b->path : NULL);
+	clear();
+}
+
+static void choose_buffer()
+{
+	// list the open buffers over the text and ask which one we want,
+	// by number or the start of its name
+	char response[MAX_FILE_NAME];
+	int rows = min(num_buffers, LINES - 3);
+	for (int i = 0; i < rows; ++i)
+	{
+		move(i + 1, 0);
+		clrtoeol();
+		mvprintw(i + 1, 0, "%c%2d %c %s", i == active_buffer ? '>' : ' ', i + 1,
+			buffers[i]->document->unsaved_changes ? 'U' : ' ', buffer_name(i));
+	}
+	if (rows < num_buffers)
+	{
+		move(rows + 1, 0);
+		clrtoeol();
+		printw("     ... %d more", num_buffers - rows);
+	}
+	refresh();
+	if (!get_string("Switch to buffer", NULL, response, MAX_FILE_NAME - 1) || response[0] == '\0')
+		return;
+	int index = -1;
+	char* end;
+	long number = strtol(response, &end, 10);
+	if (*end == '\0')
+		index = number - 1;
+	else
+	{
+		for (int i = 0; i < num_buffers && index < 0; ++i)
+			if (strncmp(buffer_name(i), response, strlen(response)) == 0)
+				index = i;
+	}
+	if (index < 0 || index >= num_buffers)
+	{
+		set_debug_msg("No buffer %s", response);
+		return;
+	}
+	switch_buffer(index);
+}
+
+static void check_all_unsaved_changes()
+{
+	// offer to save every buffer with changes, showing each one first
+	for (int i = 0; i < num_buffers; ++i)
+	{
+		if (!buffers[i]->document->unsaved_changes)
+			continue;
+		// one save at a time
+		if (saving)
+			finish_save();
+		switch_buffer(i);
+		draw_lines(d->topline);
+		check_unsaved_changes();
+	}
+}
+
+static bool untitled_open()
+{
+	// every untitled buffer would journal to the same file, so
+	// only the first one gets a journal
+	for (int i = 0; i < num_buffers; ++i)
+		if (i != active_buffer && buffers[i]->path == NULL && buffers[i]->document->journal)
+			return true;
+	return false;
+}
+
+static void set_buffer_path(doc* document, const char* path)
+{
+	// remember where document's buffer lives on disk
+	for (int i = 0; i < num_buffers; ++i)
+	{
+		if (buffers[i]->document != document)
+			continue;
+		char* copy = path ? strdup(path) : NULL;
+		free(buffers[i]->path);
+		buffers[i]->path = copy;
+	}
+}
+
+static const char* buffer_name(int index)
+{
+	const char* name = index == active_buffer ? current_filename : buffers[index]->filename;
+	return name ? name : "untitled";
+}
+
+static void split_window(bool side_by_side)
+{
+	// cut the window we're in in two, with a line between them, both
+	// looking at the same place. we stay in the top or left one
+	size_t rows = d->height - 2;
+	if (num_windows == MAX_WINDOWS ||
+		(side_by_side && d->width < 2 * MIN_WINDOW_COLS + 1) ||
+		(!side_by_side && rows < 2 * MIN_WINDOW_ROWS + 1))
+	{
+		set_debug_msg("No room to split");
+		return;
+	}
+	window* w = malloc(sizeof(window));
+	if (w == NULL)
+		return;
+	stash_window();
+	*w = *windows[active_window];
+	if (side_by_side)
+	{
+		size_t left = (d->width - 1) / 2;
+		w->view.screen_x = d->screen_x + left + 1;
+		w->view.width = d->width - left - 1;
+		d->width = left;
+	}
+	else
+	{
+		size_t top = (rows - 1) / 2;
+		w->view.screen_y = d->screen_y + top + 1;
+		w->view.height = rows - top - 1 + 2;
+		d->height = top + 2;
+	}
+	// the cursor might not fit in the new window, put it in view
+	// when it's first drawn
+	w->version = main_document->version - 1;
+	for (int i = num_windows; i > active_window + 1; --i)
+		windows[i] = windows[i - 1];
+	windows[active_window + 1] = w;
+	++num_windows;
+	place_cursors();
+}
+
+static void close_window()
+{
+	// give the window we're in to the ones next to it, whichever
+	// side has windows that exactly cover the edge they share
+	if (num_windows == 1)
+		return;
+	display gone = *d;
+	size_t gone_rows = gone.height - 2;
+	for (int side = 0; side < 4; ++side)
+	{
+		// 0 left of it, 1 right of it, 2 above it, 3 below it
+		bool across = side < 2;
+		size_t covered = 0;
+		int count = 0;
+		for (int i = 0; i < num_windows; ++i)
+		{
+			display* v = &windows[i]->view;
+			size_t rows = v->height - 2;
+			bool next_to;
+			if (across)
+				next_to = (side == 0 ? v->screen_x + v->width + 1 == gone.screen_x :
+					gone.screen_x + gone.width + 1 == v->screen_x) &&
+					v->screen_y >= gone.screen_y && v->screen_y + rows <= gone.screen_y + gone_rows;
+			else
+				next_to = (side == 2 ? v->screen_y + rows + 1 == gone.screen_y :
+					gone.screen_y + gone_rows + 1 == v->screen_y) &&
+					v->screen_x >= gone.screen_x && v->screen_x + v->width <= gone.screen_x + gone.width;
+			if (!next_to)
+				continue;
+			covered += across ? rows : v->width;
+			++count;
+		}
+		if (count == 0 || covered + count - 1 != (across ? gone_rows : gone.width))
+			continue;
+
+		int closing = active_window;
+		int next = -1;
+		for (int i = 0; i < num_windows; ++i)
+		{
+			display* v = &windows[i]->view;
+			if (i == closing)
+				continue;
+			size_t rows = v->height - 2;
+			if (across && v->screen_y >= gone.screen_y && v->screen_y + rows <= gone.screen_y + gone_rows &&
+				(v->screen_x + v->width + 1 == gone.screen_x || gone.screen_x + gone.width + 1 == v->screen_x))
+			{
+				if (side == 1)
+					v->screen_x = gone.screen_x;
+				v->width += gone.width + 1;
+			}
+			else if (!across && v->screen_x >= gone.screen_x && v->screen_x + v->width <= gone.screen_x + gone.width &&
+				(v->screen_y + rows + 1 == gone.screen_y || gone.screen_y + gone_rows + 1 == v->screen_y))
+			{
+				if (side == 3)
+					v->screen_y = gone.screen_y;
+				v->height += gone_rows + 1;
+			}
+			else
+				continue;
+			windows[i]->version = main_document->version - 1;
+			if (next < 0)
+				next = i;
+		}
+		free(windows[closing]);
+		--num_windows;
+		for (int i = closing; i < num_windows; ++i)
+			windows[i] = windows[i + 1];
+		load_window(next > closing ? next - 1 : next);
+		return;
+	}
+}
+
+static void single_window()
+{
+	// close every window but the one we're in, it gets the whole screen
+	for (int i = 0; i < num_windows; ++i)
+		if (i != active_window)
+			free(windows[i]);
+	windows[0] = windows[active_window];
+	num_windows = 1;
+	active_window = 0;
+	d = &windows[0]->view;
+	getmaxyx(stdscr, d->height, d->width);
+	d->screen_y = 1;
+	d->screen_x = 0;
+}
+
+static void focus_window(int index)
+{
+	// make windows[index] the one being edited
+	if (index == active_window)
+		return;
+	stash_window();
+	load_window(index);
+}
+
+static void stash_window()
+{
+	// copy the active window's cursors out of the globals
+	window* w = windows[active_window];
+	memcpy(w->cursors, cursors, sizeof(cursors));
+	w->num_cursors = num_cursors;
+	w->version = main_document->version;
+}
+
+static void load_window(int index)
+{
+	// and windows[index]'s back in, its display becomes d
+	window* w = windows[index];
+	active_window = index;
+	d = &w->view;
+	memcpy(cursors, w->cursors, sizeof(cursors));
+	num_cursors = w->num_cursors;
+	// lines came and went while it wasn't the one being edited
+	if (w->version != main_document->version)
+		place_cursors();
+}
+
+static void resize_windows()
+{
+	// the terminal changed size, move every window's edges in proportion.
+	// a window's top edge is the line above it, which is the bottom edge
+	// of the one above, so windows that met still do
+	size_t old_rows = 0;
+	size_t old_cols = 0;
+	for (int i = 0; i < num_windows; ++i)
+	{
+		display* v = &windows[i]->view;
+		old_rows = max(old_rows, v->screen_y - 1 + v->height - 2);
+		old_cols = max(old_cols, v->screen_x + v->width);
+	}
+	size_t lines, cols;
+	getmaxyx(stdscr, lines, cols);
+	size_t rows = lines > 2 ? lines - 2 : 0;
+	bool fits = true;
+	for (int i = 0; i < num_windows; ++i)
+	{
+		display* v = &windows[i]->view;
+		size_t top = v->screen_y - 1;
+		size_t bottom = top + v->height - 2;
+		size_t left = v->screen_x;
+		size_t right = left + v->width;
+		top = top ? (top - 1) * rows / old_rows + 1 : 0;
+		bottom = bottom == old_rows ? rows : bottom * rows / old_rows;
+		left = left ? (left - 1) * cols / old_cols + 1 : 0;
+		right = right == old_cols ? cols : right * cols / old_cols;
+		if (bottom <= top || right <= left)
+			fits = false;
+		else
+		{
+			v->screen_y = top + 1;
+			v->height = bottom - top + 2;
+			v->screen_x = left;
+			v->width = right - left;
+		}
+		windows[i]->version = main_document->version - 1;
+	}
+	if (!fits)
+		single_window();
+	place_cursors();
+	windows[active_window]->version = main_document->version;
+}
+
+static void draw_windows()
+{
+	// every window onto the document, the one being edited last so its
+	// cursors and the macro preview go on top. the others find their
+	// lines' spans already made, unless the line changed
+	int editing = active_window;
+	for (int i = 0; i < num_windows; ++i)
+	{
+		if (i == editing)
+			continue;
+		focus_window(i);
+		draw_lines(d->topline);
+	}
+	focus_window(editing);
+	draw_lines(d->topline);
+	if (show_macro_preview)
+		draw_macro_preview();
+	draw_completions();
+	draw_cursors();
+	// the lines between them, each window draws the one below and right of it
+	attron(COLOR_PAIR(LINE_NO_PAIR));
+	for (int i = 0; i < num_windows && num_windows > 1; ++i)
+	{
+		display* v = &windows[i]->view;
+		size_t rows = v->height - 2;
+		bool right = v->screen_x + v->width < (size_t)COLS;
+		bool below = v->screen_y + rows < (size_t)LINES - 1;
+		if (right)
+			mvvline(v->screen_y, v->screen_x + v->width, ACS_VLINE, rows + below);
+		if (below)
+			mvhline(v->screen_y + rows, v->screen_x, ACS_HLINE, v->width + right);
+	}
+	attroff(COLOR_PAIR(LINE_NO_PAIR));
+	refresh();
+}
+
+static void windows_forget_line(docline* line, docline* replacement)
+{
+	// line's going, the other windows look at replacement instead
+	for (int i = 0; i < num_windows; ++i)
+	{
+		if (i == active_window)
+			continue;
+		window* w = windows[i];
+		if (w->view.topline == line)
+			w->view.topline = replacement;
+		for (int c = 0; c < w->num_cursors; ++c)
+		{
+			if (w->cursors[c].currline != line)
+				continue;
+			w->cursors[c].currline = replacement;
+			w->cursors[c].xpos = 0;
+		}
+	}
+}
+
+static chtype change_mark(docline* line)
+{
+	// + added, ~ edited, - saved lines gone from just above (or below
+	// the last line), nothing if it's as saved
+	if (line->change & CHANGE_ADDED)
+		return '+' | COLOR_PAIR(ADDED_PAIR) | A_BOLD;
+	if (line->change & CHANGE_EDITED)
+		return '~' | COLOR_PAIR(EDITED_PAIR) | A_BOLD;
+	if (line->change & CHANGE_REMOVED)
+		return '-' | COLOR_PAIR(REMOVED_PAIR) | A_BOLD;
+	if (line == main_document->tail && main_document->changes &&
+		main_document->changes->removed_at_end)
+		return '-' | COLOR_PAIR(REMOVED_PAIR) | A_BOLD;
+	return 0;
+}
+
+static void folds_changed()
+{
+	// lines went out of sight or came back, every window onto
+	// the document has to work out what's where again
+	place_cursors();
+	for (int i = 0; i < num_windows; ++i)
+		if (i != active_window)
+			windows[i]->version = main_document->version - 1;
+}
+
+static void update_completion(bool typing)
+{
+	// look up the word before the cursor after a key that typed or
+	// deleted a character, any other key puts the list away
+	num_completions = 0;
+	completion_choice = 0;
+	completion_taken = false;
+	if (!typing || !syntax_highlighting || num_cursors != 1)
+		return;
+	docline* line = cursors[0].currline;
+	size_t end = cursors[0].xpos;
+	size_t start = end;
+	if (end > strlen(line->line) || is_completion_char(line->line[end]))
+		return;
+	while (start > 0 && is_completion_char(line->line[start - 1]))
+		--start;
+	// nothing in a comment or a number needs completing
+	if (start == end || end - start >= MAX_SYMBOL_LENGTH || isdigit((unsigned char)line->line[start]) ||
+		memchr(line->line, '#', start))
+		return;
+	char prefix[MAX_SYMBOL_LENGTH];
+	memcpy(prefix, line->line + start, end - start);
+	prefix[end - start] = '\0';
+	num_completions = complete_word(main_document, prefix, completions, MAX_COMPLETIONS);
+	// already the only thing it could be
+	if (num_completions == 1 && strcmp(completions[0].name, prefix) == 0)
+		num_completions = 0;
+	completion_start = start;
+}
+
+static void take_completion()
+{
+	// swap the word before the cursor for the chosen completion, pressing
+	// it again straight away swaps in the one after that
+	docline* line = cursors[0].currline;
+	size_t end = cursors[0].xpos;
+	if (num_completions == 0 || end < completion_start || end > strlen(line->line))
+		return;
+	if (completion_taken)
+		completion_choice = (completion_choice + 1) % num_completions;
+	const char* word = completions[completion_choice].name;
+	size_t len = strlen(word);
+	size_t rest = strlen(line->line + end);
+	if (completion_start + len + rest >= LINE_LENGTH)
+	{
+		set_debug_msg("No room for %s on this line", word);
+		return;
+	}
+	memmove(line->line + completion_start + len, line->line + end, rest + 1);
+	memcpy(line->line + completion_start, word, len);
+	main_document->number_of_chars += len;
+	main_document->number_of_chars -= end - completion_start;
+	cursors[0].xpos = completion_start + len;
+	completion_taken = true;
+	main_document->unsaved_changes = true;
+	line_edited(line);
+}
+
+static void draw_completions()
+{
+	// the list under the word being typed, or over it if there's more
+	// room there, with the one CTRL-e gives (or gave) picked out
+	if (num_completions == 0)
+		return;
+	int text_rows = (int)d->height - 2;
+	int below = text_rows - (int)cursors[0].ypos - 1;
+	int above = (int)cursors[0].ypos;
+	int rows = min(num_completions, max(below, above));
+	if (rows <= 0)
+		return;
+	int y = d->screen_y + (rows <= below ? (int)cursors[0].ypos + 1 : (int)cursors[0].ypos - rows);
+	int width = 0;
+	for (int i = 0; i < num_completions; ++i)
+		width = max(width, (int)strlen(completions[i].name));
+	width = min(width + 2, (int)d->width);
+	int x = d->screen_x + gutter_width() + completion_start;
+	x = max((int)d->screen_x, min(x, (int)(d->screen_x + d->width) - width));
+	// keep the chosen one in view if they don't all fit
+	int first = max(0, completion_choice - rows + 1);
+	for (int i = 0; i < rows; ++i)
+	{
+		mvhline(y + i, x, ' ', width);
+		mvaddnstr(y + i, x + 1, completions[first + i].name, width - 1);
+		mvchgat(y + i, x, width, first + i == completion_choice ? A_REVERSE : A_NORMAL, BAR_PAIR, NULL);
+	}
+}
+
+static void find_lines()
+{
+	// look for a line as the query's typed, up and down pick one of the
+	// best, enter goes to it and escape leaves things as they were
+	finder* f = find_start(main_document);
+	if (f == NULL)
+	{
+		set_debug_msg("Not enough memory to search");
+		return;
+	}
+	char query[FIND_MAX_QUERY + 1] = { 0 };
+	size_t len = 0;
+	int choice = 0;
+	bool done = false, go = false;
+	timeout(STATUS_INTERVAL_MS);
+	set_debug_msg("");
+	while (!done)
+	{
+		long long started = monotonic_ms();
+		if (find_query(f, query) < 0)
+			set_debug_msg("Not enough memory to search");
+		long long took = monotonic_ms() - started;
+		choice = min(choice, max(f->num_top - 1, 0));
+		erase();
+		draw_windows();
+		draw_found(f, choice);
+		clear_status_bar();
+		mvprintw(LINES - 1, 0, "Find: %s_", query);
+		if (len > 0)
+			printw("   %u matching lines, %lldms", f->num_survivors[f->levels],
+				took);
+		refresh();
+
+		bool changed = false;
+		while (!changed && !done)
+		{
+			int ch = getch();
+			switch (ch)
+			{
+			case ERR:
+				break;
+			case '\n':
+				go = f->num_top > 0;
+				done = true;
+				break;
+			case ESC:
+				done = true;
+				break;
+			case KEY_UP:
+				choice = max(choice - 1, 0);
+				changed = true;
+				break;
+			case KEY_DOWN:
+				choice = min(choice + 1, max(f->num_top - 1, 0));
+				changed = true;
+				break;
+			case KEY_BACKSPACE:
+				if (len > 0)
+					query[--len] = '\0';
+				choice = 0;
+				changed = true;
+				break;
+			default:
+				if (len == FIND_MAX_QUERY || !(isalnum(ch) || ispunct(ch) || ch == ' '))
+					break;
+				query[len++] = ch;
+				query[len] = '\0';
+				choice = 0;
+				changed = true;
+				break;
+			}
+		}
+	}
+
+	if (go)
+	{
+		// the first character that matched, in the middle of the window
+		// unless it's already showing
+		const find_hit* hit = &f->top[choice];
+		int column = 0;
+		while (!(hit->columns[column >> 6] >> (column & 63) & 1))
+			++column;
+		num_cursors = 1;
+		cursors[0].currline = f->lines[hit->index];
+		if (is_hidden(cursors[0].currline))
+			unfold(main_document, cursors[0].currline->fold);
+		cursors[0].xpos = column;
+		cursors[0].width = 1;
+		cursors[0].ypos = (d->height - 2) / 2;
+		folds_changed();
+	}
+	find_end(f);
+	clear_status_bar();
+}
+
+static void draw_found(finder* f, int choice)
+{
+	// the best lines over the top of the screen, line number and text,
+	// with the characters that matched picked out
+	int rows = min(f->num_top, LINES - 2);
+	int number_width = snprintf(NULL, 0, "%u", f->num_lines);
+	for (int i = 0; i < rows; ++i)
+	{
+		const find_hit* hit = &f->top[i];
+		const char* text = f->lines[hit->index]->line;
+		int y = i + 1;
+		move(y, 0);
+		clrtoeol();
+		attron(COLOR_PAIR(LINE_NO_PAIR));
+		mvprintw(y, 0, "%*u ", number_width, hit->index + 1);
+		attroff(COLOR_PAIR(LINE_NO_PAIR));
+		int x0 = number_width + 1;
+		for (int col = 0; text[col] && col < LINE_LENGTH && x0 + col < COLS; ++col)
+		{
+			bool matched = hit->columns[col >> 6] >> (col & 63) & 1;
+			mvaddch(y, x0 + col, (unsigned char)text[col] |
+				(matched ? A_BOLD | COLOR_PAIR(KEYWORD_PAIR) : 0));
+		}
+		if (i == choice)
+			mvchgat(y, 0, -1, A_REVERSE, BAR_PAIR, NULL);
+	}
+}
+
+void wait_for_keypress()
+{
+	wchar_t ch;
+	for (;;)
+	{
+		ch = getch();
+		if (ch != ERR)
+			break;
+	}
+}
+
+// todo: move out of here?
+static bool get_string(char* prompt, char* default_text, char* response, size_t max_size)
+{
+	// display prompt, with default text, and store reponse
+	// in response. return false is user presses escape, ie. no input
+	// clear any existing debug message
+	wchar_t ch;
 	size_t resp_index;
 	bool done_flag = false;
 	bool display = true;
@@ -1078,7 +3270,7 @@ static bool get_string(char* prompt, char* default_text, char* response, size_t
 	{
 		if (display)
 		{
-			move(d->height - 1, strlen(prompt) + 2);
+			move(LINES - 1, strlen(prompt) + 2);
 			clrtoeol();
 			printw("%s_", resp);
 			display = false;
@@ -1125,9 +3317,6 @@ static void initialize_doc()
 	// create a new empty document
 	exitFlag = false;
 
-	copy_line = NULL;
-	cut_line = NULL;
-
 	// we just call create_new_doc here
 	// create a single empty line to begin with
 	// document lines doubly linked list
@@ -1151,6 +3340,7 @@ static void initialize_doc()
 	main_document->number_of_lines = 0;
 	main_document->number_of_chars = 0;
 	main_document->unsaved_changes = false;
+	init_symbols(main_document);
 
 	set_leading_zeros();
 }
@@ -1158,21 +3348,27 @@ static void initialize_doc()
 // this should take a doc type instead
 static void clear_doc(doc* document)
 {
-	// free all memory used by a document
+	// free all memory used by a document, the clipboard
+	// outlives it unless it's one of its lines
 	docline* tmp = document->head;
 	docline* tmp2;
-	if (cut_line)
-		free(cut_line);
-	if (copy_line)
-		free(copy_line);
-	cut_line = NULL;
-	copy_line = NULL;
+	unfold_all(document);
+	changes_free(document);
 	while (tmp != NULL)
 	{
 		tmp2 = tmp->nextline;
+		if (tmp == copy_line)
+			copy_line = NULL;
+		free(tmp->defs);
+		free(tmp->label_ref);
+		asm_forget_line(tmp);
 		free(tmp);
 		tmp = tmp2;
 	}
+	asm_free(document);
+	macro_free(document);
+	// so a save that's still going doesn't count for whatever's loaded next
+	++document->version;
 	num_cursors = 0;
 }
 
@@ -1192,16 +3388,23 @@ static void set_leading_zeros()
 	// if we really want to? Tackle later.
 }
 
-static void parse_args(int argc, char* argv[], char ** filename)
+static bool parse_args(int argc, char* argv[], char ** filename)
 {
+	// false if an option was no good, we've said which
+	bool ok = true;
 	int opt;
 	int option_index = 0;
-	static const char* arg_flags = "hvns";
+	static const char* arg_flags = "hvnst:p:fc";
 	static struct option long_options[] =
 	{
 		{"help",					no_argument,		0, 'h'},
 		{"no-line-numbers",			no_argument,		0, 'n'},
 		{"no-syntax-highlighting",	no_argument,		0, 's'},
+		{"trace",					required_argument,	0, 't'},
+		{"pipeline",				required_argument,	0, 'p'},
+		{"follow",					no_argument,		0, 'f'},
+		{"client",					no_argument,		0, 'c'},
+		{"daemon",					no_argument,		0, 'D'},
 		{0,							0,					0,	0}
 	};
 
@@ -1224,15 +3427,43 @@ static void parse_args(int argc, char* argv[], char ** filename)
 		case 'h':
 			show_help = true;
 			break;
+		case 't':
+			if (trace_start(optarg) != 0)
+			{
+				option_error("Can't open trace file");
+				ok = false;
+			}
+			break;
+		case 'f':
+			follow_mode = true;
+			break;
+		case 'p':
+			if (pipe_set_model(optarg) != 0)
+			{
+				option_error("Unknown pipeline, try forwarding, stalling or delayed");
+				ok = false;
+			}
+			break;
 		default:
 			break;
 		}
 	}
 
-	*filename = strdup(argv[argc - 1]);
-	if (filename == NULL || *filename[0] == '\0' ||
-		*filename[0] == '-')
-		filename = NULL;
+	// whatever's left after the options
+	if (optind < argc && argv[optind][0] != '\0')
+		*filename = strdup(argv[optind]);
+	else
+		*filename = NULL;
+	return ok;
+}
+
+static void option_error(const char* msg)
+{
+	// on the status line, or stderr if there's no screen yet (the daemon)
+	if (stdscr == NULL)
+		fprintf(stderr, "mipsze: %s\n", msg);
+	else
+		set_debug_msg("%s", msg);
 }
 
 static bool check_for_version_flag(int argc, char* argv[])
@@ -1245,8 +3476,32 @@ static bool check_for_version_flag(int argc, char* argv[])
 	return false;
 }
 
+static int check_for_server_flag(int argc, char* argv[])
+{
+	// 'c' to attach to the daemon, 'D' to be it, 'L' to be a language
+	// server on stdin and stdout, before curses starts
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--client") == 0)
+			return 'c';
+		if (strcmp(argv[i], "--daemon") == 0)
+			return 'D';
+		if (strcmp(argv[i], "--lsp") == 0)
+			return 'L';
+	}
+	return 0;
+}
+
+static inline int gutter_width()
+{
+	// line numbers, plus the cycle estimates if they're showing
+	if (!show_line_no)
+		return 0;
+	return leading_zeros + 3 + (show_pipeline ? PIPE_GUTTER : 0);
+}
+
 static inline void clear_status_bar()
 {
-	move(d->height - 1, 0);
+	move(LINES - 1, 0);
 	clrtoeol();	
 }
\ No newline at end of file
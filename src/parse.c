@@ -1,6 +1,13 @@
 //parse - syntax parse
 #include "headers/main.h"
 #include "headers/parse.h"
+#include "headers/trace.h"
+#include "headers/lexmask.h"
+#include "headers/symbols.h"
+#include "headers/profile.h"
+#include "headers/diag.h"
+#include "headers/highlight.h"
+#include "headers/complete.h"
 #include <stdio.h>
 #include <ctype.h>
 
@@ -8,19 +15,9 @@
 #define NUM_KEYWORDS 500
 #define NUM_PSEUDOINSTRUCTIONS 20
 
-#define MAX_LABEL_LENGTH 36
-#define MAX_LABELS 100
-
-#define MAX_MACRO_LENGTH 36
-#define MAX_MACROS 100
-
-// for storing macro names
-char seen_macros[MAX_MACROS][MAX_MACRO_LENGTH] = {0};
-int macros_seen = 0;
-
-// for storing labels
-char seen_labels[MAX_LABELS][MAX_LABEL_LENGTH] = {0};
-int labels_seen = 0;
+// room for every label/macro a single line could define, each
+// stored as a kind character, the name, and a '\0'
+#define MAX_LINE_DEFS (LINE_LENGTH * 2 + 2)
 
 // note that kwords and pinstrs are alphabetized so that
 // we can use binary search to speed up token discovery
@@ -28,14 +25,15 @@ char kwords[NUM_KEYWORDS][MAX_TOKEN_LENGTH] = {0};
 char pinstrs[NUM_PSEUDOINSTRUCTIONS][MAX_TOKEN_LENGTH] = {0};
 int num_kwords = 0, num_pinstrs = 0;
 
-static bool is_keyword(const char* token);
-static bool is_pseudoinstruction(const char* token);
+static inline bool to_upper_token(const char* token, char* uppertoken);
+static lex_state color_token(doc* document, docline* line, unsigned char* fmt,
+	const line_masks* m, int start, int end, lex_state state);
+static lex_state scan_line(docline* line, lex_state state, char* defs, size_t* defs_len);
+static lex_state state_below_checkpoint(docline* line, int* distance);
+static inline lex_state advance_state(const char* token, lex_state state);
+static void set_line_defs(doc* document, docline* line, const char* defs, size_t defs_len);
 static int read_dat_file(const char* filename, char arr[][MAX_TOKEN_LENGTH]);
 static inline bool is_num(const char* token);
-static inline void add_label(const char* token);
-static inline void add_macro(const char* token);
-static bool is_label(const char* token);
-static bool is_macro(const char* token);
 static bool binarySearch(const char* search_token, char arr[][MAX_TOKEN_LENGTH], int arr_size);
 
 int init_parser()
@@ -47,6 +45,10 @@ int init_parser()
 	num_pinstrs = read_dat_file("dat/pinstrs.dat", pinstrs);
 	if (num_pinstrs == -1)
 		return -2;
+	if (init_diagnostics() == -1)
+		return -3;
+	// without it we can still complete labels and macros
+	init_completion();
 	return 0;
 }
 
@@ -71,305 +73,475 @@ static int read_dat_file(const char* filename, char arr[][MAX_TOKEN_LENGTH])
 	return line_count;
 }
 
-void clear_labels()
+void init_symbols(doc* document)
+{
+	// give a document empty label and macro tables
+	if (document->labels == NULL)
+	{
+		document->labels = symtab_new();
+		symtab_index_prefixes(document->labels);
+	}
+	else
+		symtab_clear(document->labels);
+	if (document->macros == NULL)
+	{
+		document->macros = symtab_new();
+		symtab_index_prefixes(document->macros);
+	}
+	else
+		symtab_clear(document->macros);
+	if (document->highlights == NULL)
+		document->highlights = hl_arena_new();
+	else
+		hl_invalidate(document->highlights);
+	diag_reset(document);
+}
+
+void free_symbols(doc* document)
+{
+	symtab_free(document->labels);
+	symtab_free(document->macros);
+	document->labels = NULL;
+	document->macros = NULL;
+	hl_arena_free(document->highlights);
+	document->highlights = NULL;
+	diag_free(document);
+}
+
+void drop_highlights(doc* document)
+{
+	// free the spans of a document that isn't being shown, parse_line
+	// makes a new arena the next time it's drawn
+	hl_arena_free(document->highlights);
+	document->highlights = NULL;
+}
+
+void find_labels(doc* document)
+{
+	// rebuild every line's definitions and checkpoints from scratch,
+	// only needed when a whole document is (re)loaded
+	char defs[MAX_LINE_DEFS];
+	size_t defs_len;
+	lex_state state = 0;
+	int since_checkpoint = 0;
+	prof_begin(PROF_LABELS);
+	TRACE_BEGIN(TR_LABELS, 0);
+	init_symbols(document);
+	for (docline* line = document->head; line; line = line->nextline)
+	{
+		free(line->defs);
+		line->defs = NULL;
+		if (since_checkpoint == 0)
+			line->checkpoint = state | LEX_CHECKPOINT;
+		else
+			line->checkpoint = 0;
+		since_checkpoint = (since_checkpoint + 1) % CHECKPOINT_INTERVAL;
+		state = scan_line(line, state, defs, &defs_len);
+		set_line_defs(document, line, defs, defs_len);
+		diag_line_changed(document, line);
+	}
+	TRACE_END(TR_LABELS, document->labels->live);
+	prof_end(PROF_LABELS);
+}
+
+lex_state lex_state_at(docline* line)
+{
+	int distance;
+	return state_below_checkpoint(line, &distance);
+}
+
+static lex_state state_below_checkpoint(docline* line, int* distance)
 {
-	labels_seen = 0;
+	// the lexer state at the start of line, lexed forwards from
+	// the closest checkpoint above it, which is distance lines up
+	docline* start = line;
+	*distance = 0;
+	while (!(start->checkpoint & LEX_CHECKPOINT) && start->prevline)
+	{
+		start = start->prevline;
+		++*distance;
+	}
+	lex_state state = (start->checkpoint & LEX_CHECKPOINT) ?
+		(start->checkpoint & ~LEX_CHECKPOINT) : 0;
+	for (; start != line; start = start->nextline)
+		state = scan_line(start, state, NULL, NULL);
+	return state;
 }
 
-void clear_macros()
+void line_changed(doc* document, docline* line)
 {
-	macros_seen = 0;
+	lines_changed(document, line, line);
 }
 
-void find_labels(docline* line)
+void lines_changed(doc* document, docline* first, docline* last)
 {
-	// should we clear here?
-	bool grab_macro_name = false;
-	char maybe_label[MAX_LABEL_LENGTH] = {0};
-	while (line)
+	// the text of first..last changed (or they were just inserted), redo
+	// their definitions and carry the lexer state forward, stopping at
+	// the first checkpoint past last that already agrees with us
+	char defs[MAX_LINE_DEFS];
+	size_t defs_len;
+	int since_checkpoint;
+	int rescanned = 0;
+	bool past_last = false;
+	prof_begin(PROF_LABELS);
+	TRACE_BEGIN(TR_LABELS, 1);
+	// counting from the checkpoint above, so lines going in between
+	// two checkpoints still get one every CHECKPOINT_INTERVAL
+	lex_state state = state_below_checkpoint(first, &since_checkpoint);
+	for (docline* cur = first; cur; cur = cur->nextline)
 	{
-		maybe_label[0] = '\0';
-		size_t curindex = 0;
-		char ch;
-		for (size_t i = 0; i < strlen(line->line); ++i)
+		if (!past_last)
+		{
+			diag_line_changed(document, cur);
+			cur->hl_generation = 0;
+		}
+		if (cur != first)
 		{
-			ch = line->line[i];
-			if (ch == ' ' || ch == '\n' ||
-			        ch == '\t' || ch == '(' ||
-			        ch == ')' ||
-			        ch == '\0')
+			if (cur->checkpoint & LEX_CHECKPOINT)
 			{
-				// twice, clean it
-				if (maybe_label[curindex] != '\0')
-					maybe_label[curindex] = '\0';
-				if (maybe_label[curindex - 1] == ':')
-				{
-					add_label(maybe_label);
-				}
-				if (grab_macro_name)
-				{
-					add_macro(maybe_label);
-					grab_macro_name = false;
-				}
-				if (strcmp(maybe_label, ".macro") == 0)
-				{
-					grab_macro_name = true;
-				}
-				curindex = 0;
-				maybe_label[0] = '\0';
+				if (past_last && (cur->checkpoint & ~LEX_CHECKPOINT) == state)
+					break;
+				since_checkpoint = 0;
+				cur->checkpoint = state | LEX_CHECKPOINT;
 			}
-			else
+			else if (++since_checkpoint >= CHECKPOINT_INTERVAL)
 			{
-				maybe_label[curindex++] = ch;
+				// deleted lines took a checkpoint with them, or lines
+				// went in, put one back
+				since_checkpoint = 0;
+				cur->checkpoint = state | LEX_CHECKPOINT;
 			}
 		}
-		// twice, clean it
-		if (maybe_label[curindex] != '\0')
-			maybe_label[curindex] = '\0';
-		if (maybe_label[curindex - 1] == ':')
-		{
-			add_label(maybe_label);
-		}
-		if (grab_macro_name && maybe_label[0] != '\0')
-		{
-			add_macro(maybe_label);
-			grab_macro_name = false;
-		}
-		line = line->nextline;
+		state = scan_line(cur, state, defs, &defs_len);
+		set_line_defs(document, cur, defs, defs_len);
+		++rescanned;
+		if (cur == last)
+			past_last = true;
 	}
+	TRACE_END(TR_LABELS, rescanned);
+	prof_end(PROF_LABELS);
 }
 
-void parse_line(docline* line)
+void forget_line(doc* document, docline* line)
 {
-	char token[80];
-	int start_index = -1, char_index = 0;
-	char ch;
-	bool in_quotes = false;
-	bool in_single_quotes = false;
-	bool in_comment = false;
-	bool in_register = false;
-	bool in_section = false;
-	bool in_macro_param = false;
-	attr_t to_assign;
-	for (size_t i = 0; i <= strlen(line->line); ++i)
+	// line is about to leave the document, drop what it defined
+	set_line_defs(document, line, "", 1);
+	diag_forget_line(document, line);
+	line->checkpoint = 0;
+}
+
+static lex_state scan_line(docline* line, lex_state state, char* defs, size_t* defs_len)
+{
+	// pull the labels and macro names a line defines into defs (packed as
+	// kind, name, '\0' ... with a final '\0'), if defs isn't NULL, and
+	// return the lexer state at the end of the line
+	char maybe_label[MAX_SYMBOL_LENGTH];
+	line_masks m;
+	uint64_t quoted[MASK_WORDS], skip[MASK_WORDS];
+	bool unterminated;
+	size_t n = 0;
+	classify_line(line->line, &m);
+	// labels can't be inside quotes or after a comment starts
+	int end = mask_quotes(&m, line->line, quoted, &unterminated);
+	for (int w = 0; w < MASK_WORDS; ++w)
+		skip[w] = m.space[w] | m.paren[w] | m.comma[w] | quoted[w];
+	int pos = mask_next_clear(skip, 0, end);
+	while (pos < end)
 	{
-		line->formatting[i] = COLOR_PAIR(ERROR_PAIR);	// line formatting 1 = error
-		ch = line->line[i];
-		// comments take precedence
-		if (ch == '#')
+		int stop = mask_next_set(skip, pos, end);
+		int len = min(stop - pos, MAX_SYMBOL_LENGTH - 1);
+		memcpy(maybe_label, line->line + pos, len);
+		maybe_label[len] = '\0';
+		if (defs && maybe_label[len - 1] == ':' && len > 1)
 		{
-			in_comment = true;
+			defs[n++] = DEF_LABEL;
+			memcpy(defs + n, maybe_label, len - 1);
+			n += len - 1;
+			defs[n++] = '\0';
 		}
-		if (in_comment)
+		if (state & LEX_GRAB_MACRO_NAME)
 		{
-			line->formatting[i] = COLOR_PAIR(COMMENT_PAIR);
-			continue;
+			if (defs)
+			{
+				defs[n++] = DEF_MACRO;
+				memcpy(defs + n, maybe_label, len + 1);
+				n += len + 1;
+			}
+			state &= ~LEX_GRAB_MACRO_NAME;
 		}
+		state = advance_state(maybe_label, state);
+		pos = mask_next_clear(skip, stop, end);
+	}
+	if (defs)
+	{
+		defs[n++] = '\0';
+		*defs_len = n;
+	}
+	return state;
+}
 
-		// this area is quoted
-		if (ch == '\"' && !in_quotes)
-		{
-			in_quotes = true;
-		}
-		else if (ch == '\"' && in_quotes)
+static inline lex_state advance_state(const char* token, lex_state state)
+{
+	if (strcmp(token, ".macro") == 0)
+		return state | LEX_IN_MACRO | LEX_GRAB_MACRO_NAME;
+	if (strcmp(token, ".end_macro") == 0)
+		return state & ~(LEX_IN_MACRO | LEX_GRAB_MACRO_NAME);
+	return state;
+}
+
+static void set_line_defs(doc* document, docline* line, const char* defs, size_t defs_len)
+{
+	// swap a line's definitions for new ones, only touching the
+	// symbol tables if something actually changed
+	const char* old = line->defs ? line->defs : "";
+	size_t old_len = 1;
+	for (const char* p = old; *p; p += strlen(p) + 1)
+		old_len += strlen(p) + 1;
+	if (old_len == defs_len && memcmp(old, defs, defs_len) == 0)
+		return;
+
+	for (const char* p = old; *p; p += strlen(p) + 1)
+	{
+		if (p[0] == DEF_LABEL)
 		{
-			line->formatting[i] = COLOR_PAIR(QUOTE_PAIR);
-			in_quotes = false;
+			int before = symtab_count(document->labels, p + 1);
+			symtab_remove(document->labels, p + 1);
+			diag_label_changed(document, p + 1, before, symtab_count(document->labels, p + 1));
 		}
-
-		// this are single quotes
-		// todo, maybe check that we only have a single char in here
-		// othewise, signal an error?
-		// give double quotes priority so we can use single quotes
-		// inside double quotes
-		if (ch == '\'' && !in_quotes && !in_single_quotes)
+		else
 		{
-			in_single_quotes = true;
+			symtab_remove(document->macros, p + 1);
 		}
-		else if (ch == '\'' && !in_quotes && in_single_quotes)
+	}
+	for (const char* p = defs; *p; p += strlen(p) + 1)
+	{
+		if (p[0] == DEF_LABEL)
 		{
-			line->formatting[i] = COLOR_PAIR(QUOTE_PAIR);
-			in_single_quotes = false;
+			int before = symtab_count(document->labels, p + 1);
+			symtab_add(document->labels, p + 1);
+			diag_label_changed(document, p + 1, before, symtab_count(document->labels, p + 1));
 		}
-
-		if (in_quotes || in_single_quotes)
+		else
 		{
-			if (i == strlen(line->line) - 1)
-			{
-				line->formatting[i] = COLOR_PAIR(ERROR_BLOCK_PAIR);
-			}
-			else
-			{
-				line->formatting[i] = COLOR_PAIR(QUOTE_PAIR);
-			}
-			continue;
+			symtab_add(document->macros, p + 1);
 		}
+	}
 
-		if (ch == '.' && start_index == -1)
-			in_section = true;
-
-		if (ch == '$')
-			in_register = true;
+	free(line->defs);
+	line->defs = NULL;
+	if (defs_len > 1)
+	{
+		line->defs = malloc(defs_len);
+		if (line->defs)
+			memcpy(line->defs, defs, defs_len);
+	}
+}
 
-		if (ch == '%')
-			in_macro_param = true;
+lex_state parse_line(doc* document, docline* line, lex_state state)
+{
+	// colour a line, starting in state, and return the state
+	// the next line starts in. If the line already has spans from
+	// the same starting state and symbols we keep them
+	line_masks m;
+	unsigned char fmt[LINE_LENGTH];
+	uint64_t delim[MASK_WORDS], quoted[MASK_WORDS];
+	bool unterminated;
+	if (document->highlights == NULL)
+		document->highlights = hl_arena_new();
+	hl_arena* arena = document->highlights;
+	unsigned long symbols_version = document->labels->version + document->macros->version;
+	if (arena->symbols_version != symbols_version)
+	{
+		// a name appeared or went away, any line could colour differently
+		hl_invalidate(arena);
+		arena->symbols_version = symbols_version;
+	}
+	if (hl_valid(arena, line) && line->hl_state == state)
+		return line->hl_end_state;
+	line->hl_state = state;
 
-		if (ch == ' ' || ch == '\t' || ch == '\0' || ch == '\n')
-		{
-			line->formatting[i] = 0;
-			in_register = false;
-			in_section = false;
-			goto got_token;
-		}
+	classify_line(line->line, &m);
+	int len = m.length;
 
-		if (ch == ',' || ch == '(' || ch == ')')
-		{
-			line->formatting[i] = COLOR_PAIR(PUNC_PAIR);
-			in_register = false;
-			in_section = false;
-			goto got_token;
-		}
+	// the comment starts at the first # that isn't quoted, the same
+	// rule the assembler goes by
+	int end = mask_quotes(&m, line->line, quoted, &unterminated);
+	for (int i = end; i < len; ++i)
+		fmt[i] = HL_COMMENT;
 
-		if (in_macro_param)
-		{
-			line->formatting[i] = COLOR_PAIR(MACRO_PARAM_PAIR);
-			continue;
-		}
+	for (int w = 0; w < MASK_WORDS; ++w)
+		delim[w] = (m.space[w] | m.paren[w] | m.comma[w]) & ~quoted[w];
 
-		if (in_section)
+	int pos = 0;
+	while (pos < end)
+	{
+		if (mask_test(delim, pos))
 		{
-			line->formatting[i] = COLOR_PAIR(SECTION_PAIR);
+			fmt[pos] = mask_test(m.space, pos) ? HL_PLAIN : HL_PUNC;
+			++pos;
 			continue;
 		}
-
-		if (in_register)
+		int stop = mask_next_set(delim, pos, end);
+		int q = mask_next_set(quoted, pos, stop);
+		if (q > pos)
+			state = color_token(document, line, fmt, &m, pos, q, state);
+		if (q == stop)
 		{
-			line->formatting[i] = COLOR_PAIR(REG_PAIR) | A_BOLD;
+			pos = stop;
 			continue;
 		}
 
-		if (start_index == - 1)
-			start_index = i;
-
-		// sometimes we need to pick out a token
-		token[char_index++] = ch;
-		continue;
+		// quoted area, whichever kind of quote opened it
+		// todo, maybe check that we only have a single char in
+		// single quotes, othewise, signal an error?
+		int close = mask_next_clear(quoted, q, end);
+		for (int i = q; i < close; ++i)
+			fmt[i] = HL_QUOTE;
+		pos = close;
+	}
+	if (unterminated)
+		fmt[len - 1] = HL_UNTERMINATED;
+	hl_store(arena, line, fmt, len);
+	line->hl_end_state = state;
+	return state;
+}
 
-got_token:
-		token[char_index] = '\0';
-		to_assign = 0;
-		if (char_index > 0 && token[char_index - 1] == ':')
-		{
-			to_assign = COLOR_PAIR(LABEL_PAIR) | A_BOLD;;
-		}
-		else if (is_pseudoinstruction(token))
-		{
-			to_assign = A_BOLD /*| A_UNDERLINE*/;
-		}
-		else if (is_keyword(token))
-		{
-			to_assign = COLOR_PAIR(KEYWORD_PAIR);
-		}
-		else if (is_num(token))
-		{
-			to_assign = COLOR_PAIR(NUM_PAIR);
-		}
-		else if (is_label(token))
-		{
-			to_assign = COLOR_PAIR(LABEL_PAIR);
-		}
-		else if (is_macro(token))
-		{
-			to_assign = COLOR_PAIR(MACRO_PARAM_PAIR);
-		}
+static lex_state color_token(doc* document, docline* line, unsigned char* fmt,
+	const line_masks* m, int start, int end, lex_state state)
+{
+	// colour a single token that sits between two delimiters
+	char token[LINE_LENGTH + 1];
+	int char_index = 0, start_index = -1;
+	bool in_register = false;
+	bool in_section = false;
+	bool in_macro_param = false;
+	enum hl_class to_assign;
+	for (int i = start; i < end; ++i)
+	{
+		if (mask_test(m->dot, i) && start_index == -1)
+			in_section = true;
+		if (mask_test(m->dollar, i))
+			in_register = true;
+		if (mask_test(m->percent, i))
+			in_macro_param = true;
 
-		if (to_assign != 0)
+		if (in_macro_param)
 		{
-			for (size_t j = start_index; j < i; ++j)
-			{
-				line->formatting[j] = to_assign;
-			}
+			// parameters only mean something inside a macro body
+			if (state & LEX_IN_MACRO)
+				fmt[i] = HL_MACRO_PARAM;
+			else
+				fmt[i] = HL_ERROR;
 		}
-		// reset everything
-		start_index = -1;
-		char_index = 0;
-		// token will now contain our word
-		int s = strlen(token);
-		for (int j = s; j > 0; --j)
+		else if (in_section)
+			fmt[i] = HL_SECTION;
+		else if (in_register)
+			fmt[i] = HL_REGISTER;
+		else
 		{
-			// memclear or whatever?
-			token[j] = '\0';
+			// error until we know what the token is
+			fmt[i] = HL_ERROR;
+			if (start_index == -1)
+				start_index = i;
+			token[char_index++] = line->line[i];
 		}
 	}
-}
 
-static inline void add_label(const char* token)
-{
-	strncpy( seen_labels[labels_seen], token, strlen(token) - 1);
-	labels_seen++;
-}
+	if (state & LEX_GRAB_MACRO_NAME)
+	{
+		// the name in a .macro line, possibly on a line of its own
+		for (int i = start; i < end; ++i)
+			fmt[i] = HL_MACRO;
+		state &= ~LEX_GRAB_MACRO_NAME;
+		return state;
+	}
+	if (in_section)
+	{
+		memcpy(token, line->line + start, end - start);
+		token[end - start] = '\0';
+		state = advance_state(token, state);
+	}
+	if (char_index == 0)
+		return state;
+	token[char_index] = '\0';
 
-static inline void add_macro(const char* token)
-{
-	strncpy( seen_macros[macros_seen], token, strlen(token));
-	macros_seen++;
-}
+	to_assign = HL_PLAIN;
+	if (token[char_index - 1] == ':')
+	{
+		to_assign = HL_LABEL_DEF;
+	}
+	else if (is_pseudoinstruction(token))
+	{
+		to_assign = HL_PSEUDO;
+	}
+	else if (is_keyword(token))
+	{
+		to_assign = HL_KEYWORD;
+	}
+	else if (is_num(token))
+	{
+		to_assign = HL_NUM;
+	}
+	else if (symtab_contains(document->labels, token))
+	{
+		to_assign = HL_LABEL;
+	}
+	else if (symtab_contains(document->macros, token))
+	{
+		to_assign = HL_MACRO;
+	}
 
-static bool is_label(const char* token)
-{
-	for (int i = 0; i < labels_seen; ++i)
+	if (to_assign != HL_PLAIN)
 	{
-		// segfault is here
-		if (strcmp(token, seen_labels[i]) == 0)
+		for (int j = start_index; j < end; ++j)
 		{
-			return true;
+			fmt[j] = to_assign;
 		}
 	}
-	return false;
+	return state;
 }
 
-static bool is_macro(const char* token)
+bool is_keyword(const char* token)
 {
-	for (int i = 0; i < macros_seen; ++i)
-	{
-		// segfault is here
-		if (strcmp(token, seen_macros[i]) == 0)
-		{
-			return true;
-		}
-	}
-	return false;
+	char uppertoken[MAX_TOKEN_LENGTH];
+	if (!to_upper_token(token, uppertoken))
+		return false;
+	return binarySearch(uppertoken, kwords, num_kwords);
 }
 
-static bool is_keyword(const char* token)
+bool is_pseudoinstruction(const char* token)
 {
-	// make char is upper function
-	char* uppertoken = strdup(token);
-	char ch;
-	for (size_t i = 0; i < strlen(uppertoken); ++i)
-	{
-		ch = uppertoken[i];
-		if (isalpha(ch))
-			uppertoken[i] = toupper(ch);
-	}
-	bool results = binarySearch(uppertoken, kwords, num_kwords);
-	free(uppertoken);
-	return results;
+	char uppertoken[MAX_TOKEN_LENGTH];
+	if (!to_upper_token(token, uppertoken))
+		return false;
+	return binarySearch(uppertoken, pinstrs, num_pinstrs);
+}
+
+const char* parser_word(int index, bool* pseudo)
+{
+	// the index'th word we know, keywords then pseudoinstructions,
+	// NULL once we're past the last of them
+	*pseudo = index >= num_kwords;
+	if (index < num_kwords)
+		return kwords[index];
+	if (index - num_kwords < num_pinstrs)
+		return pinstrs[index - num_kwords];
+	return NULL;
 }
 
-static bool is_pseudoinstruction(const char* token)
+static inline bool to_upper_token(const char* token, char* uppertoken)
 {
-	char* uppertoken = strdup(token);
-	char ch;
-	for (size_t i = 0; i < strlen(uppertoken); ++i)
+	// copy token into uppertoken (MAX_TOKEN_LENGTH long) in upper case,
+	// false if it's too long to be in any of our tables
+	size_t i;
+	for (i = 0; token[i] != '\0'; ++i)
 	{
-		ch = uppertoken[i];
-		if (isalpha(ch))
-			uppertoken[i] = toupper(ch);
+		if (i == MAX_TOKEN_LENGTH - 1)
+			return false;
+		uppertoken[i] = toupper((unsigned char)token[i]);
 	}
-	bool results = binarySearch(uppertoken, pinstrs, num_pinstrs);
-	free(uppertoken);
-	return results;
+	uppertoken[i] = '\0';
+	return true;
 }
 
 static inline bool is_num(const char* token)
@@ -0,0 +1,391 @@
+// pipeline.c - static cycle and hazard estimates for the assembled text
+// the text image is cut into basic blocks at labels and after branches
+// and jumps, then each block is stepped through a model of the classic
+// five stage pipeline to count stalls. A block remembers a hash of its
+// words (and whatever falls through into it) on its first line, so
+// after an edit only the blocks whose words changed are worked out again.
+// Blocks are estimated on their own, a conditional branch is assumed taken.
+#include "headers/main.h"
+#include "headers/util.h"
+#include "headers/parse.h"
+#include "headers/symbols.h"
+#include "headers/asm.h"
+#include "headers/pipeline.h"
+
+// instructions before a block we replay so hazards carry across fall through
+#define PIPE_LOOKBEHIND 3
+
+// what an instruction does, as far as the pipeline cares
+#define OP_LOAD 0x01
+#define OP_STORE 0x02
+#define OP_BRANCH 0x04			// compares (or reads its target) in ID
+#define OP_ENDS_BLOCK 0x08
+#define OP_READS_HI_LO 0x10
+#define OP_WRITES_HI_LO 0x20
+#define OP_MULT 0x40
+#define OP_DIV 0x80
+
+typedef struct pipe_op
+{
+	unsigned char flags;
+	unsigned char dst;			// 0 if nothing is written
+	unsigned char src[2];		// 0 if unused, src[1] is the stored value for stores
+} pipe_op;
+
+typedef struct pipe_state
+{
+	int ex;						// cycle the last instruction was in EX
+	int ready_ex[32];			// first cycle a reader's EX can have the value
+	int ready_id[32];			// first cycle a branch's ID can have it
+	bool loaded[32];			// written by a load
+	int hi_lo_ready;
+	int mul_div_free;			// the unit isn't pipelined
+} pipe_state;
+
+typedef struct pipe_step
+{
+	int stalls;
+	unsigned char hazards;
+	unsigned char reg;			// register the longest wait was for
+} pipe_step;
+
+static const pipeline_model models[] = {
+	// name			forwarding	delay slot	taken	mult	div
+	{ "forwarding",	true,		false,		1,		12,		35 },
+	{ "stalling",	false,		false,		1,		12,		35 },
+	{ "delayed",	true,		true,		0,		12,		35 }
+};
+static int model_index = 0;
+
+static void decode(uint32_t word, pipe_op* op);
+static void issue(pipe_state* state, uint32_t word, pipe_step* step);
+static inline void wait_for(int* need, int ready, unsigned char hazard, int reg, pipe_step* step);
+static bool starts_block(docline* line, docline* prev);
+static inline uint32_t hash_word(uint32_t hash, uint32_t word);
+
+int pipe_set_model(const char* name)
+{
+	for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); ++i)
+	{
+		if (strcmp(models[i].name, name) == 0)
+		{
+			model_index = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const pipeline_model* pipe_model()
+{
+	return &models[model_index];
+}
+
+int pipe_analyze(doc* document)
+{
+	// bring the estimates on the lines up to date with the text, returns
+	// the number of blocks we had to work out again, or -1 if we can't
+	// assemble at all
+	if (asm_assemble(document) < 0)
+		return -1;
+	assembler* as = document->assembly;
+	const pipeline_model* model = pipe_model();
+	size_t n = as->text_words;
+	int reanalyzed = 0;
+	size_t start = 0;
+	while (start < n)
+	{
+		// find the end of this block
+		size_t end = start;
+		while (end < n)
+		{
+			pipe_op op;
+			decode(as->text[end++], &op);
+			if (op.flags & OP_ENDS_BLOCK)
+				break;
+			if (end < n && starts_block(as->text_lines[end], as->text_lines[end - 1]))
+				break;
+		}
+		pipe_op last;
+		decode(as->text[end - 1], &last);
+		bool branches = last.flags & OP_ENDS_BLOCK;
+
+		// hash everything the estimate depends on
+		size_t context = 0;
+		if (start > 0)
+		{
+			pipe_op before;
+			decode(as->text[start - 1], &before);
+			if (!(before.flags & OP_ENDS_BLOCK))
+				context = min((size_t)PIPE_LOOKBEHIND, start);
+		}
+		uint32_t hash = hash_word(FNV_OFFSET, model_index);
+		bool stale = false;
+		for (size_t i = start - context; i < end; ++i)
+		{
+			hash = hash_word(hash, as->text[i]);
+			hash = hash_word(hash, (uint32_t)(uintptr_t)as->text_lines[i]);
+			stale |= i >= start && (as->text_lines[i]->hazards & HAZ_STALE);
+		}
+		if (branches && end < n)
+			hash = hash_word(hash, as->text[end]);
+		hash = hash ? hash : 1;
+
+		docline* leader = as->text_lines[start];
+		if (leader->block_hash != hash || stale)
+		{
+			pipe_state state = {0};
+			pipe_step step;
+			for (size_t i = start - context; i < start; ++i)
+				issue(&state, as->text[i], &step);
+			int first_ex = state.ex;
+			docline* line = NULL;
+			for (size_t i = start; i < end; ++i)
+			{
+				if (as->text_lines[i] != line)
+				{
+					line = as->text_lines[i];
+					line->stalls = 0;
+					line->hazards = 0;
+					line->hazard_reg = 0;
+					line->block_cycles = 0;
+					line->block_hash = 0;
+				}
+				issue(&state, as->text[i], &step);
+				line->stalls = min(line->stalls + step.stalls, 255);
+				if (step.hazards && !line->hazards)
+					line->hazard_reg = step.reg;
+				line->hazards |= step.hazards;
+			}
+			int cycles = state.ex - first_ex;
+			if (branches)
+			{
+				cycles += model->taken_penalty;
+				// code written for spim doesn't expect the next line to run
+				if (model->delay_slot && end < n && as->text[end] != 0)
+					line->hazards |= HAZ_DELAY_SLOT;
+			}
+			leader->block_cycles = min(cycles, 65535);
+			leader->block_hash = hash;
+			++reanalyzed;
+		}
+		start = end;
+	}
+	return reanalyzed;
+}
+
+void pipe_line_changed(docline* line)
+{
+	// whatever we said about this line may not hold any more
+	line->stalls = 0;
+	line->hazards = HAZ_STALE;
+	line->hazard_reg = 0;
+	line->block_cycles = 0;
+	line->block_hash = 0;
+}
+
+void pipe_describe_line(docline* line, char* msg, size_t size)
+{
+	// why this line stalls, or "" if it doesn't
+	const char* why = NULL;
+	msg[0] = '\0';
+	if (line->hazards & HAZ_LOAD_USE)
+		why = "load-use hazard on";
+	else if (line->hazards & HAZ_BRANCH_DATA)
+		why = "branch waits on";
+	else if (line->hazards & HAZ_DATA)
+		why = "data hazard on";
+	if (why)
+		snprintf(msg, size, "%s $%s, %d stall%s", why, register_names[line->hazard_reg],
+			line->stalls, line->stalls == 1 ? "" : "s");
+	else if (line->hazards & HAZ_HI_LO)
+		snprintf(msg, size, "waits %d cycles for the multiply/divide unit", line->stalls);
+	else if (line->hazards & HAZ_DELAY_SLOT)
+		snprintf(msg, size, "the next instruction runs in this branch's delay slot");
+	else if (line->block_hash)
+		snprintf(msg, size, "block takes about %d cycles (%s pipeline)",
+			line->block_cycles, pipe_model()->name);
+}
+
+static void decode(uint32_t word, pipe_op* op)
+{
+	unsigned rs = (word >> 21) & 31, rt = (word >> 16) & 31, rd = (word >> 11) & 31;
+	unsigned funct = word & 63;
+	memset(op, 0, sizeof(pipe_op));
+	switch (word >> 26)
+	{
+	case 0x00:		// SPECIAL
+		op->dst = rd;
+		op->src[0] = rs;
+		op->src[1] = rt;
+		if (funct <= 0x03)				// sll srl sra
+			op->src[0] = 0;
+		else if (funct == 0x08 || funct == 0x09)	// jr jalr
+		{
+			op->src[1] = 0;
+			op->flags = OP_BRANCH | OP_ENDS_BLOCK;
+		}
+		else if (funct == 0x0c)			// syscall reads v0 and a0
+		{
+			op->dst = 2;
+			op->src[0] = 2;
+			op->src[1] = 4;
+		}
+		else if (funct == 0x10 || funct == 0x12)	// mfhi mflo
+		{
+			op->src[0] = op->src[1] = 0;
+			op->flags = OP_READS_HI_LO;
+		}
+		else if (funct == 0x11 || funct == 0x13)	// mthi mtlo
+		{
+			op->dst = 0;
+			op->src[1] = 0;
+			op->flags = OP_WRITES_HI_LO;
+		}
+		else if (funct >= 0x18 && funct <= 0x1b)	// mult multu div divu
+		{
+			op->dst = 0;
+			op->flags = OP_WRITES_HI_LO | (funct >= 0x1a ? OP_DIV : OP_MULT);
+		}
+		else if (funct == 0x34 || funct == 0x0d)	// teq break
+			op->dst = 0;
+		break;
+	case 0x01:		// REGIMM branches
+		op->src[0] = rs;
+		op->dst = (rt & 0x10) ? 31 : 0;
+		op->flags = OP_BRANCH | OP_ENDS_BLOCK;
+		break;
+	case 0x02:		// j
+		op->flags = OP_ENDS_BLOCK;
+		break;
+	case 0x03:		// jal
+		op->dst = 31;
+		op->flags = OP_ENDS_BLOCK;
+		break;
+	case 0x04:		// beq bne
+	case 0x05:
+		op->src[1] = rt;
+		// fall through
+	case 0x06:		// blez bgtz
+	case 0x07:
+		op->src[0] = rs;
+		op->flags = OP_BRANCH | OP_ENDS_BLOCK;
+		break;
+	case 0x1c:		// SPECIAL2
+		op->src[0] = rs;
+		op->src[1] = rt;
+		if (funct == 0x02)							// mul
+			op->dst = rd;
+		else if (funct == 0x20 || funct == 0x21)	// clz clo
+		{
+			op->dst = rd;
+			op->src[1] = 0;
+		}
+		else								// madd maddu msub msubu
+			op->flags = OP_MULT | OP_READS_HI_LO | OP_WRITES_HI_LO;
+		break;
+	default:
+		if ((word >> 26) >= 0x28)			// stores
+		{
+			op->src[0] = rs;
+			op->src[1] = rt;
+			op->flags = OP_STORE;
+		}
+		else								// loads and immediates
+		{
+			op->dst = rt;
+			op->src[0] = (word >> 26) == 0x0f ? 0 : rs;	// lui
+			if ((word >> 26) >= 0x20)
+				op->flags = OP_LOAD;
+		}
+		break;
+	}
+}
+
+static void issue(pipe_state* state, uint32_t word, pipe_step* step)
+{
+	// send the next instruction down the pipeline, after whatever stalls
+	// it needs, and note what it leaves for the ones after it
+	const pipeline_model* model = pipe_model();
+	pipe_op op;
+	decode(word, &op);
+	step->stalls = 0;
+	step->hazards = 0;
+	step->reg = 0;
+	int ex = state->ex + 1;
+	int need = ex;
+	for (int i = 0; i < 2; ++i)
+	{
+		int s = op.src[i];
+		if (s == 0)
+			continue;
+		if (op.flags & OP_BRANCH)
+			wait_for(&need, state->ready_id[s] + 1, HAZ_BRANCH_DATA, s, step);
+		else if (i == 1 && (op.flags & OP_STORE) && model->forwarding)
+			// the stored value isn't needed until MEM
+			wait_for(&need, state->ready_ex[s] - 1, state->loaded[s] ? HAZ_LOAD_USE : HAZ_DATA, s, step);
+		else
+			wait_for(&need, state->ready_ex[s], state->loaded[s] ? HAZ_LOAD_USE : HAZ_DATA, s, step);
+	}
+	if (op.flags & OP_READS_HI_LO)
+		wait_for(&need, state->hi_lo_ready, HAZ_HI_LO, 0, step);
+	if (op.flags & (OP_MULT | OP_DIV))
+		wait_for(&need, state->mul_div_free, HAZ_HI_LO, 0, step);
+	state->ex = need;
+
+	if (op.dst)
+	{
+		bool load = op.flags & OP_LOAD;
+		if (model->forwarding)
+		{
+			state->ready_ex[op.dst] = need + (load ? 2 : 1);
+			state->ready_id[op.dst] = need + (load ? 2 : 1);
+		}
+		else
+		{
+			// written in the first half of WB, read in the second half of ID
+			state->ready_ex[op.dst] = need + 3;
+			state->ready_id[op.dst] = need + 2;
+		}
+		state->loaded[op.dst] = load;
+	}
+	if (op.flags & (OP_MULT | OP_DIV))
+	{
+		int latency = (op.flags & OP_DIV) ? model->div_latency : model->mult_latency;
+		state->hi_lo_ready = need + latency;
+		state->mul_div_free = need + latency;
+	}
+	else if (op.flags & OP_WRITES_HI_LO)
+		state->hi_lo_ready = need + 1;
+}
+
+static inline void wait_for(int* need, int ready, unsigned char hazard, int reg, pipe_step* step)
+{
+	if (ready <= *need)
+		return;
+	int stalls = ready - (*need - step->stalls);
+	// keep the register behind the longest wait
+	if (stalls > step->stalls)
+		step->reg = reg;
+	step->stalls = stalls;
+	step->hazards |= hazard;
+	*need = ready;
+}
+
+static bool starts_block(docline* line, docline* prev)
+{
+	// something can jump to the start of any line with a label on it
+	if (line == prev)
+		return false;
+	for (const char* p = line->defs; p && *p; p += strlen(p) + 1)
+	{
+		if (p[0] == DEF_LABEL)
+			return true;
+	}
+	return false;
+}
+
+static inline uint32_t hash_word(uint32_t hash, uint32_t word)
+{
+	return fnv_hash_bytes(hash, &word, sizeof(word));
+}
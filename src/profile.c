@@ -0,0 +1,151 @@
+// profile.c - per frame timings for the F3 overlay
+#include "headers/main.h"
+#include "headers/profile.h"
+
+// how many frames we keep around to compute percentiles over
+#define PROF_WINDOW 128
+// deepest we expect stages to nest (ie. parse inside draw)
+#define PROF_MAX_DEPTH 8
+
+static const char* stage_names[PROF_NUM_STAGES] = {
+	"inp", "lbl", "prs", "drw", "ref"
+};
+
+static bool prof_enabled = false;
+
+// time spent in each stage during the current frame, in nanoseconds
+static long long frame_ns[PROF_NUM_STAGES];
+
+// rolling window of previous frames
+static long long samples[PROF_NUM_STAGES][PROF_WINDOW];
+static int sample_index = 0;
+static int sample_count = 0;
+
+// stages can nest, time is only charged to the innermost stage
+// so the numbers on the overlay add up to the frame time
+static enum prof_stage stage_stack[PROF_MAX_DEPTH];
+static int stack_depth = 0;
+static long long stage_started = 0;
+
+static long long now_ns();
+static int compare_ll(const void* a, const void* b);
+static long long percentile(long long* sorted, int n, int pct);
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+bool prof_toggle()
+{
+	prof_enabled = !prof_enabled;
+	sample_index = 0;
+	sample_count = 0;
+	stack_depth = 0;
+	return prof_enabled;
+}
+
+bool prof_is_enabled()
+{
+	return prof_enabled;
+}
+
+void prof_frame_begin()
+{
+	if (!prof_enabled)
+		return;
+	memset(frame_ns, 0, sizeof(frame_ns));
+	stack_depth = 0;
+}
+
+void prof_begin(enum prof_stage stage)
+{
+	if (!prof_enabled || stack_depth == PROF_MAX_DEPTH)
+		return;
+	long long now = now_ns();
+	// pause whatever stage we're nested inside of
+	if (stack_depth > 0)
+		frame_ns[stage_stack[stack_depth - 1]] += now - stage_started;
+	stage_stack[stack_depth++] = stage;
+	stage_started = now;
+}
+
+void prof_end(enum prof_stage stage)
+{
+	if (!prof_enabled || stack_depth == 0)
+		return;
+	// mismatched begin/end, just drop this sample
+	if (stage_stack[stack_depth - 1] != stage)
+		return;
+	long long now = now_ns();
+	frame_ns[stage] += now - stage_started;
+	--stack_depth;
+	stage_started = now;
+}
+
+void prof_frame_end()
+{
+	// frames get drawn without a key too (loading, following, resizing),
+	// so start the next one from nothing rather than waiting for
+	// prof_frame_begin, or it gets this one's times all over again
+	if (!prof_enabled)
+		return;
+	for (int i = 0; i < PROF_NUM_STAGES; ++i)
+		samples[i][sample_index] = frame_ns[i];
+	memset(frame_ns, 0, sizeof(frame_ns));
+	sample_index = (sample_index + 1) % PROF_WINDOW;
+	if (sample_count < PROF_WINDOW)
+		++sample_count;
+}
+
+void prof_draw_overlay(int y, int width)
+{
+	// shows p50/p95 of each stage in microseconds
+	if (!prof_enabled)
+		return;
+	long long sorted[PROF_WINDOW];
+	move(y, 0);
+	clrtoeol();
+	attron(COLOR_PAIR(BAR_PAIR));
+	if (sample_count == 0)
+	{
+		mvprintw(y, 0, "profiler: waiting for frames...");
+		attroff(COLOR_PAIR(BAR_PAIR));
+		return;
+	}
+	int x = 0;
+	for (int i = 0; i < PROF_NUM_STAGES; ++i)
+	{
+		memcpy(sorted, samples[i], sample_count * sizeof(long long));
+		qsort(sorted, sample_count, sizeof(long long), compare_ll);
+		char buf[32];
+		int len = snprintf(buf, sizeof(buf), "%s %lld/%lld ", stage_names[i],
+			percentile(sorted, sample_count, 50) / 1000,
+			percentile(sorted, sample_count, 95) / 1000);
+		if (x + len >= width)
+			break;
+		mvprintw(y, x, "%s", buf);
+		x += len;
+	}
+	if (x + 15 < width)
+		mvprintw(y, x, "us p50/p95 n=%d", sample_count);
+	attroff(COLOR_PAIR(BAR_PAIR));
+}
+
+static int compare_ll(const void* a, const void* b)
+{
+	long long la = *(const long long*)a;
+	long long lb = *(const long long*)b;
+	return (la > lb) - (la < lb);
+}
+
+static long long percentile(long long* sorted, int n, int pct)
+{
+	// nearest rank
+	int rank = (pct * n + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+	return sorted[rank - 1];
+}
@@ -0,0 +1,442 @@
+// server.c - the daemon that keeps documents and parser tables warm,
+// and the client that hands it a terminal. a client connects over a
+// unix socket and passes its stdin and stdout along with what to open,
+// the daemon makes them its own stdin and stdout and runs the editor
+// until the user leaves, then hangs up so the client can exit. the
+// daemon only ever has one client, any other that connects meanwhile is
+// told it's busy. the socket lives in a directory only we can get into,
+// and each end checks the other is us before a terminal changes hands
+#define _GNU_SOURCE		// struct ucred, for SO_PEERCRED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "headers/server.h"
+
+#define SERVER_BACKLOG 8
+#define SERVER_WINCH 'W'		// client to daemon, your terminal changed size
+#define SERVER_BUSY 'B'			// daemon to client, someone else is attached
+
+static volatile sig_atomic_t resized = 0;
+static int ready_fd = -1;		// tells whoever started the daemon how it went
+
+static int socket_dir(char* dir, size_t size);
+static int socket_address(struct sockaddr_un* addr);
+static bool peer_is_us(int sock);
+static int connect_daemon();
+static void turn_away(int listener);
+static void use_null_stdio();
+static void on_winch(int sig);
+
+static int socket_dir(char* dir, size_t size)
+{
+	// the runtime directory, or one of our own under /tmp. either way
+	// it has to be a real directory that's ours and nobody else's, or
+	// anyone could put a socket there and have our terminal
+	const char* runtime = getenv("XDG_RUNTIME_DIR");
+	int len;
+	if (runtime && runtime[0])
+		len = snprintf(dir, size, "%s", runtime);
+	else
+	{
+		len = snprintf(dir, size, "/tmp/mipsze-%d", (int)getuid());
+		if (len > 0 && (size_t)len < size && mkdir(dir, 0700) != 0 && errno != EEXIST)
+			return -1;
+	}
+	if (len < 0 || (size_t)len >= size)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	struct stat st;
+	if (lstat(dir, &st) != 0)
+		return -1;
+	if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0)
+	{
+		errno = EACCES;
+		return -1;
+	}
+	return 0;
+}
+
+static int socket_address(struct sockaddr_un* addr)
+{
+	// one daemon per user
+	char dir[sizeof(addr->sun_path)];
+	if (socket_dir(dir, sizeof(dir)) != 0)
+		return -1;
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	int len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", dir, SERVER_SOCKET_NAME);
+	if (len < 0 || (size_t)len >= sizeof(addr->sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+static bool peer_is_us(int sock)
+{
+	// is the other end of sock running as the same user we are?
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || len != sizeof(cred))
+		return false;
+	return cred.uid == getuid();
+}
+
+static int connect_daemon()
+{
+	struct sockaddr_un addr;
+	if (socket_address(&addr) != 0)
+		return -1;
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		int saved = errno;
+		close(sock);
+		errno = saved;
+		return -1;
+	}
+	if (!peer_is_us(sock))
+	{
+		close(sock);
+		errno = EACCES;
+		return -1;
+	}
+	return sock;
+}
+
+int server_start()
+{
+	// listen on our socket and go into the background, only the daemon
+	// returns (with the socket), the process that started it waits for
+	// server_ready then exits, successfully if clients can connect.
+	// -1 with errno if we can't
+	struct sockaddr_un addr;
+	if (socket_address(&addr) != 0)
+		return -1;
+	int sock = connect_daemon();
+	if (sock >= 0)
+	{
+		close(sock);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	// nobody's listening, anything there is left from a daemon that died
+	unlink(addr.sun_path);
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+		return -1;
+	mode_t mask = umask(077);
+	int bound = bind(listener, (struct sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+	if (bound != 0 || listen(listener, SERVER_BACKLOG) != 0)
+	{
+		int saved = errno;
+		close(listener);
+		errno = saved;
+		return -1;
+	}
+
+	int ready[2];
+	if (pipe2(ready, O_CLOEXEC) != 0)
+	{
+		int saved = errno;
+		close(listener);
+		errno = saved;
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		int saved = errno;
+		close(listener);
+		close(ready[0]);
+		close(ready[1]);
+		errno = saved;
+		return -1;
+	}
+	if (pid > 0)
+	{
+		// nothing comes back if the daemon died getting ready
+		char ok = 0;
+		close(ready[1]);
+		if (read(ready[0], &ok, 1) != 1 || !ok)
+			_exit(EXIT_FAILURE);
+		printf("mipsze daemon listening on %s\n", addr.sun_path);
+		fflush(stdout);
+		_exit(EXIT_SUCCESS);
+	}
+	close(ready[0]);
+	ready_fd = ready[1];
+	setsid();
+	// stderr stays until server_ready, so whoever started us
+	// hears why we couldn't get going
+	use_null_stdio();
+	// a client going away mid-write shouldn't take us with it
+	signal(SIGPIPE, SIG_IGN);
+	return listener;
+}
+
+void server_ready(bool ok)
+{
+	// the daemon's set up (or not), let the process that started it go
+	char byte = ok;
+	if (ready_fd < 0)
+		return;
+	// if it's gone already there's nobody to tell
+	ssize_t sent = write(ready_fd, &byte, 1);
+	(void)sent;
+	close(ready_fd);
+	ready_fd = -1;
+	dup2(STDOUT_FILENO, STDERR_FILENO);
+}
+
+int server_accept(int listener, client* c)
+{
+	// wait for a client, 0 once we have one with its terminal
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct iovec iov = { &c->request, sizeof(c->request) };
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	c->sock = accept(listener, NULL, NULL);
+	if (c->sock < 0)
+		return -1;
+	fcntl(c->sock, F_SETFD, FD_CLOEXEC);
+	if (!peer_is_us(c->sock))
+	{
+		close(c->sock);
+		return -1;
+	}
+	c->listener = listener;
+	int fds[2] = { -1, -1 };
+	ssize_t len = recvmsg(c->sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (len > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	bool ok = len == sizeof(c->request) && fds[0] >= 0 &&
+		dup2(fds[0], STDIN_FILENO) >= 0 && dup2(fds[1], STDOUT_FILENO) >= 0;
+	if (fds[0] >= 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+	}
+	if (!ok)
+	{
+		use_null_stdio();
+		close(c->sock);
+		return -1;
+	}
+	// whatever the last client left unread isn't for this one
+	clearerr(stdin);
+	c->request.term[SERVER_TERM_LENGTH - 1] = '\0';
+	c->request.path[PATH_MAX - 1] = '\0';
+	return 0;
+}
+
+enum server_event server_poll(client* c)
+{
+	// never blocks, has the client's terminal changed or has it gone?
+	// anyone else trying to attach meanwhile is sent away
+	struct pollfd p = { c->sock, POLLIN, 0 };
+	enum server_event event = SERVER_QUIET;
+	turn_away(c->listener);
+	while (poll(&p, 1, 0) > 0)
+	{
+		char msg;
+		if (read(c->sock, &msg, 1) != 1)
+			return SERVER_GONE;
+		if (msg == SERVER_WINCH)
+			event = SERVER_RESIZE;
+	}
+	return event;
+}
+
+bool server_window_size(int* rows, int* cols)
+{
+	// how big the client's terminal is now
+	struct winsize size;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row == 0 || size.ws_col == 0)
+		return false;
+	*rows = size.ws_row;
+	*cols = size.ws_col;
+	return true;
+}
+
+static void turn_away(int listener)
+{
+	// we've already got a client, tell any waiting that we're busy
+	struct pollfd p = { listener, POLLIN, 0 };
+	while (poll(&p, 1, 0) > 0)
+	{
+		int sock = accept(listener, NULL, NULL);
+		if (sock < 0)
+			return;
+		// closing it throws away the terminal they sent
+		char busy = SERVER_BUSY;
+		ssize_t sent = write(sock, &busy, 1);
+		(void)sent;
+		close(sock);
+	}
+}
+
+void server_detach(client* c)
+{
+	// let the client go, its terminal is back to normal by now.
+	// it only waits for us to hang up
+	fflush(stdout);
+	use_null_stdio();
+	close(c->sock);
+	c->sock = -1;
+}
+
+static void use_null_stdio()
+{
+	// nobody's terminal is ours
+	int null = open("/dev/null", O_RDWR);
+	if (null < 0)
+		return;
+	dup2(null, STDIN_FILENO);
+	dup2(null, STDOUT_FILENO);
+	if (null > STDERR_FILENO)
+		close(null);
+}
+
+static void on_winch(int sig)
+{
+	(void)sig;
+	resized = 1;
+}
+
+int client_attach(const char* self, const char* filename)
+{
+	// hand our terminal to the daemon, starting one if there isn't one,
+	// and wait until it's done with it. returns our exit status
+	server_request request = { { 0 }, { 0 } };
+	const char* term = getenv("TERM");
+	snprintf(request.term, sizeof(request.term), "%s", term ? term : "xterm");
+	if (filename && filename[0] == '/')
+		snprintf(request.path, sizeof(request.path), "%s", filename);
+	else if (filename)
+	{
+		char cwd[PATH_MAX];
+		if (getcwd(cwd, sizeof(cwd)) == NULL)
+		{
+			perror("mipsze");
+			return EXIT_FAILURE;
+		}
+		if (snprintf(request.path, sizeof(request.path), "%s/%s", cwd, filename) >= (int)sizeof(request.path))
+		{
+			fprintf(stderr, "mipsze: %s: path too long\n", filename);
+			return EXIT_FAILURE;
+		}
+	}
+
+	int sock = connect_daemon();
+	if (sock < 0)
+	{
+		// start one, it's ready once the process we run has exited
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			execlp(self, self, "--daemon", (char*)NULL);
+			_exit(EXIT_FAILURE);
+		}
+		int status;
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0 || (sock = connect_daemon()) < 0)
+		{
+			fprintf(stderr, "mipsze: can't start the daemon\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	int fds[2] = { STDIN_FILENO, STDOUT_FILENO };
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov = { &request, sizeof(request) };
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(sock, &msg, 0) != sizeof(request))
+	{
+		perror("mipsze");
+		close(sock);
+		return EXIT_FAILURE;
+	}
+
+	// the keys are for the daemon now, and if it dies it can't put
+	// the terminal back how it found it, so we do
+	struct termios saved;
+	bool have_termios = tcgetattr(STDIN_FILENO, &saved) == 0;
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+	signal(SIGTSTP, SIG_IGN);
+	struct sigaction winch = { 0 };
+	winch.sa_handler = on_winch;
+	sigaction(SIGWINCH, &winch, NULL);
+
+	struct pollfd p = { sock, POLLIN, 0 };
+	bool busy = false;
+	for (;;)
+	{
+		if (resized)
+		{
+			char notice = SERVER_WINCH;
+			resized = 0;
+			if (write(sock, &notice, 1) != 1)
+				break;
+		}
+		int ready = poll(&p, 1, SERVER_POLL_MS);
+		if (ready < 0 && errno != EINTR)
+			break;
+		if (ready > 0)
+		{
+			// the daemon's done with us, or it's gone, or it's got
+			// someone else's terminal already
+			char reply;
+			if (read(sock, &reply, 1) != 1)
+				break;
+			if (reply == SERVER_BUSY)
+			{
+				busy = true;
+				break;
+			}
+		}
+	}
+	close(sock);
+	if (have_termios)
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+	if (busy)
+	{
+		fprintf(stderr, "mipsze: the daemon is busy with another terminal, try again once it's free\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
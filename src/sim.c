@@ -0,0 +1,693 @@
+// sim.c - runs the assembled document, with spim style syscalls
+// instructions are decoded once, the first time their basic block runs,
+// into sim_ops that hold the address of their handler, so executing a
+// block is just jumping from handler to handler (computed goto). Blocks
+// end at the first branch, jump or syscall and are cached by address.
+#include <signal.h>
+#include "headers/main.h"
+#include "headers/util.h"
+#include "headers/symbols.h"
+#include "headers/asm.h"
+#include "headers/sim.h"
+
+// every instruction we can run, X(name) for each
+#define SIM_OPS(X) \
+	X(ILLEGAL) X(NOP) X(SLL) X(SRL) X(SRA) X(SLLV) X(SRLV) X(SRAV) \
+	X(JR) X(JALR) X(MOVZ) X(MOVN) X(SYSCALL) X(BREAK) X(MFHI) X(MTHI) \
+	X(MFLO) X(MTLO) X(MULT) X(MULTU) X(DIV) X(DIVU) X(ADD) X(ADDU) \
+	X(SUB) X(SUBU) X(AND) X(OR) X(XOR) X(NOR) X(SLT) X(SLTU) X(TEQ) \
+	X(BLTZ) X(BGEZ) X(BLTZAL) X(BGEZAL) X(J) X(JAL) X(BEQ) X(BNE) \
+	X(BLEZ) X(BGTZ) X(ADDI) X(ADDIU) X(SLTI) X(SLTIU) X(ANDI) X(ORI) \
+	X(XORI) X(LUI) X(MADD) X(MADDU) X(MUL) X(MSUB) X(MSUBU) X(CLZ) \
+	X(CLO) X(LB) X(LH) X(LW) X(LBU) X(LHU) X(SB) X(SH) X(SW) X(FALLTHROUGH)
+
+enum sim_opcode
+{
+#define X(name) OP_##name,
+	SIM_OPS(X)
+#undef X
+	OP_COUNT
+};
+
+// register writes to $zero go here instead, so handlers never check
+#define REG_SINK 32
+
+typedef struct sim_op
+{
+	const void* handler;
+	unsigned char rd;
+	unsigned char rs;
+	unsigned char rt;
+	unsigned char sa;
+	int32_t imm;				// immediate, or branch/jump target
+} sim_op;
+
+typedef struct sim_block
+{
+	uint32_t start;
+	uint32_t end;				// address after the last instruction
+	int count;
+	sim_op ops[];
+} sim_block;
+
+typedef struct sim_cpu
+{
+	uint32_t regs[33];			// plus REG_SINK
+	uint32_t hi, lo;
+	uint32_t pc;
+	uint32_t brk;				// end of the heap
+	unsigned char* data;
+	unsigned char* stack;
+	const uint32_t* text;
+	size_t text_words;
+	sim_block** blocks;			// by word index of the first instruction
+	long long waited_ms;		// blocked reading input, not running
+} sim_cpu;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int sig);
+static sim_block* decode_block(sim_cpu* cpu, uint32_t pc, const void* const* handlers);
+static bool decode_op(uint32_t word, uint32_t pc, sim_op* op);
+static int do_syscall(sim_cpu* cpu, sim_result* result);
+static inline unsigned char* sim_addr(sim_cpu* cpu, uint32_t addr, uint32_t size);
+static void free_cpu(sim_cpu* cpu);
+
+int sim_run(assembler* as, sim_result* result)
+{
+	// run the program in as until it exits, faults or is interrupted,
+	// returns 0 if it exited by itself
+	static const void* const handlers[OP_COUNT] = {
+#define X(name) &&op_##name,
+		SIM_OPS(X)
+#undef X
+	};
+	sim_cpu cpu = {0};
+	memset(result, 0, sizeof(sim_result));
+	cpu.text = as->text;
+	cpu.text_words = as->text_words;
+	cpu.data = calloc(1, SIM_DATA_SIZE);
+	cpu.stack = calloc(1, SIM_STACK_SIZE);
+	cpu.blocks = calloc(as->text_words + 1, sizeof(sim_block*));
+	if (!cpu.data || !cpu.stack || !cpu.blocks)
+	{
+		free_cpu(&cpu);
+		result->error = "Out of memory";
+		return -1;
+	}
+	if (as->data_size)
+		memcpy(cpu.data, as->data, min(as->data_size, (size_t)SIM_DATA_SIZE));
+	cpu.brk = DATA_BASE + ((as->data_size + 7) & ~7);
+	cpu.regs[29] = SIM_INITIAL_SP;
+	cpu.regs[28] = SIM_INITIAL_GP;
+	cpu.pc = as->entry;
+
+	struct sigaction action = {0}, old_action;
+	action.sa_handler = on_interrupt;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, &old_action);
+	interrupted = 0;
+	long long started = monotonic_ms();
+
+	uint32_t* r = cpu.regs;
+	uint32_t pc = cpu.pc;
+	sim_block* block;
+	const sim_op* op;
+	unsigned long long executed = 0;
+	unsigned char* p;
+
+// move on to the next predecoded instruction
+#define NEXT() do { ++op; goto *op->handler; } while (0)
+// leave the block, pc already says where to
+#define LEAVE() goto dispatch
+// the block was counted when we entered it, take back op and the ones
+// after it, none of them retired
+#define FAULT(msg) do { result->error = (msg); \
+	result->error_pc = block->start + 4 * (op - block->ops); \
+	executed -= block->count - (op - block->ops); goto stop; } while (0)
+#define LOAD(size) do { p = sim_addr(&cpu, r[op->rs] + op->imm, (size)); \
+	if (p == NULL) FAULT("Bad address"); \
+	if ((r[op->rs] + op->imm) & ((size) - 1)) FAULT("Unaligned address"); } while (0)
+
+dispatch:
+	if (interrupted)
+	{
+		result->error = "Interrupted";
+		result->error_pc = pc;
+		goto stop;
+	}
+	{
+		uint32_t index = (pc - TEXT_BASE) >> 2;
+		if (pc == TEXT_BASE + 4 * cpu.text_words)
+			goto stop;		// ran off the end, same as exiting
+		if ((pc & 3) || pc < TEXT_BASE || index >= cpu.text_words)
+		{
+			result->error = "Jumped outside of .text";
+			result->error_pc = pc;
+			goto stop;
+		}
+		block = cpu.blocks[index];
+		if (block == NULL)
+		{
+			block = decode_block(&cpu, pc, handlers);
+			if (block == NULL)
+			{
+				result->error = "Out of memory";
+				goto stop;
+			}
+			cpu.blocks[index] = block;
+		}
+	}
+	executed += block->count;	// up front, FAULT takes back what didn't run
+	op = block->ops;
+	goto *op->handler;
+
+op_ILLEGAL:
+	FAULT("Illegal instruction");
+op_NOP:
+	NEXT();
+op_SLL:
+	r[op->rd] = r[op->rt] << op->sa;
+	NEXT();
+op_SRL:
+	r[op->rd] = r[op->rt] >> op->sa;
+	NEXT();
+op_SRA:
+	r[op->rd] = (int32_t)r[op->rt] >> op->sa;
+	NEXT();
+op_SLLV:
+	r[op->rd] = r[op->rt] << (r[op->rs] & 31);
+	NEXT();
+op_SRLV:
+	r[op->rd] = r[op->rt] >> (r[op->rs] & 31);
+	NEXT();
+op_SRAV:
+	r[op->rd] = (int32_t)r[op->rt] >> (r[op->rs] & 31);
+	NEXT();
+op_JR:
+	pc = r[op->rs];
+	LEAVE();
+op_JALR:
+	pc = r[op->rs];
+	r[op->rd] = block->end;
+	LEAVE();
+op_MOVZ:
+	if (r[op->rt] == 0)
+		r[op->rd] = r[op->rs];
+	NEXT();
+op_MOVN:
+	if (r[op->rt] != 0)
+		r[op->rd] = r[op->rs];
+	NEXT();
+op_SYSCALL:
+	r[0] = 0;
+	cpu.pc = pc = block->end;
+	if (do_syscall(&cpu, result) != 0)
+	{
+		if (result->error)
+		{
+			// a syscall that failed didn't retire either
+			result->error_pc = block->end - 4;
+			--executed;
+		}
+		goto stop;
+	}
+	LEAVE();
+op_BREAK:
+	FAULT("Break");
+op_MFHI:
+	r[op->rd] = cpu.hi;
+	NEXT();
+op_MTHI:
+	cpu.hi = r[op->rs];
+	NEXT();
+op_MFLO:
+	r[op->rd] = cpu.lo;
+	NEXT();
+op_MTLO:
+	cpu.lo = r[op->rs];
+	NEXT();
+op_MULT:
+{
+	int64_t product = (int64_t)(int32_t)r[op->rs] * (int32_t)r[op->rt];
+	cpu.hi = (uint64_t)product >> 32;
+	cpu.lo = product;
+	NEXT();
+}
+op_MULTU:
+{
+	uint64_t product = (uint64_t)r[op->rs] * r[op->rt];
+	cpu.hi = product >> 32;
+	cpu.lo = product;
+	NEXT();
+}
+op_DIV:
+	// dividing by zero leaves hi and lo alone, like the hardware
+	if (r[op->rt] != 0)
+	{
+		int32_t a = r[op->rs], b = r[op->rt];
+		if (a == INT32_MIN && b == -1)
+		{
+			cpu.lo = a;
+			cpu.hi = 0;
+		}
+		else
+		{
+			cpu.lo = a / b;
+			cpu.hi = a % b;
+		}
+	}
+	NEXT();
+op_DIVU:
+	if (r[op->rt] != 0)
+	{
+		cpu.lo = r[op->rs] / r[op->rt];
+		cpu.hi = r[op->rs] % r[op->rt];
+	}
+	NEXT();
+op_ADD:
+{
+	int32_t sum;
+	if (__builtin_add_overflow((int32_t)r[op->rs], (int32_t)r[op->rt], &sum))
+		FAULT("Arithmetic overflow");
+	r[op->rd] = sum;
+	NEXT();
+}
+op_ADDU:
+	r[op->rd] = r[op->rs] + r[op->rt];
+	NEXT();
+op_SUB:
+{
+	int32_t difference;
+	if (__builtin_sub_overflow((int32_t)r[op->rs], (int32_t)r[op->rt], &difference))
+		FAULT("Arithmetic overflow");
+	r[op->rd] = difference;
+	NEXT();
+}
+op_SUBU:
+	r[op->rd] = r[op->rs] - r[op->rt];
+	NEXT();
+op_AND:
+	r[op->rd] = r[op->rs] & r[op->rt];
+	NEXT();
+op_OR:
+	r[op->rd] = r[op->rs] | r[op->rt];
+	NEXT();
+op_XOR:
+	r[op->rd] = r[op->rs] ^ r[op->rt];
+	NEXT();
+op_NOR:
+	r[op->rd] = ~(r[op->rs] | r[op->rt]);
+	NEXT();
+op_SLT:
+	r[op->rd] = (int32_t)r[op->rs] < (int32_t)r[op->rt];
+	NEXT();
+op_SLTU:
+	r[op->rd] = r[op->rs] < r[op->rt];
+	NEXT();
+op_TEQ:
+	if (r[op->rs] == r[op->rt])
+		FAULT("Trap");
+	NEXT();
+op_BLTZ:
+	pc = (int32_t)r[op->rs] < 0 ? (uint32_t)op->imm : block->end;
+	LEAVE();
+op_BGEZ:
+	pc = (int32_t)r[op->rs] >= 0 ? (uint32_t)op->imm : block->end;
+	LEAVE();
+op_BLTZAL:
+	pc = (int32_t)r[op->rs] < 0 ? (uint32_t)op->imm : block->end;
+	r[31] = block->end;
+	LEAVE();
+op_BGEZAL:
+	pc = (int32_t)r[op->rs] >= 0 ? (uint32_t)op->imm : block->end;
+	r[31] = block->end;
+	LEAVE();
+op_J:
+	pc = op->imm;
+	LEAVE();
+op_JAL:
+	pc = op->imm;
+	r[31] = block->end;
+	LEAVE();
+op_BEQ:
+	pc = r[op->rs] == r[op->rt] ? (uint32_t)op->imm : block->end;
+	LEAVE();
+op_BNE:
+	pc = r[op->rs] != r[op->rt] ? (uint32_t)op->imm : block->end;
+	LEAVE();
+op_BLEZ:
+	pc = (int32_t)r[op->rs] <= 0 ? (uint32_t)op->imm : block->end;
+	LEAVE();
+op_BGTZ:
+	pc = (int32_t)r[op->rs] > 0 ? (uint32_t)op->imm : block->end;
+	LEAVE();
+op_ADDI:
+{
+	int32_t sum;
+	if (__builtin_add_overflow((int32_t)r[op->rs], op->imm, &sum))
+		FAULT("Arithmetic overflow");
+	r[op->rt] = sum;
+	NEXT();
+}
+op_ADDIU:
+	r[op->rt] = r[op->rs] + op->imm;
+	NEXT();
+op_SLTI:
+	r[op->rt] = (int32_t)r[op->rs] < op->imm;
+	NEXT();
+op_SLTIU:
+	r[op->rt] = r[op->rs] < (uint32_t)op->imm;
+	NEXT();
+op_ANDI:
+	r[op->rt] = r[op->rs] & op->imm;
+	NEXT();
+op_ORI:
+	r[op->rt] = r[op->rs] | op->imm;
+	NEXT();
+op_XORI:
+	r[op->rt] = r[op->rs] ^ op->imm;
+	NEXT();
+op_LUI:
+	r[op->rt] = op->imm;
+	NEXT();
+op_MADD:
+op_MADDU:
+op_MSUB:
+op_MSUBU:
+{
+	bool is_signed = op->handler == &&op_MADD || op->handler == &&op_MSUB;
+	uint64_t acc = (uint64_t)cpu.hi << 32 | cpu.lo;
+	uint64_t product = is_signed ? (uint64_t)((int64_t)(int32_t)r[op->rs] * (int32_t)r[op->rt]) :
+		(uint64_t)r[op->rs] * r[op->rt];
+	if (op->handler == &&op_MADD || op->handler == &&op_MADDU)
+		acc += product;
+	else
+		acc -= product;
+	cpu.hi = acc >> 32;
+	cpu.lo = acc;
+	NEXT();
+}
+op_MUL:
+	r[op->rd] = (int32_t)r[op->rs] * (int32_t)r[op->rt];
+	NEXT();
+op_CLZ:
+	r[op->rd] = r[op->rs] ? __builtin_clz(r[op->rs]) : 32;
+	NEXT();
+op_CLO:
+	r[op->rd] = ~r[op->rs] ? __builtin_clz(~r[op->rs]) : 32;
+	NEXT();
+op_LB:
+	LOAD(1);
+	r[op->rt] = (int8_t)p[0];
+	NEXT();
+op_LBU:
+	LOAD(1);
+	r[op->rt] = p[0];
+	NEXT();
+op_LH:
+{
+	int16_t half;
+	LOAD(2);
+	memcpy(&half, p, 2);
+	r[op->rt] = half;
+	NEXT();
+}
+op_LHU:
+{
+	uint16_t half;
+	LOAD(2);
+	memcpy(&half, p, 2);
+	r[op->rt] = half;
+	NEXT();
+}
+op_LW:
+	LOAD(4);
+	memcpy(&r[op->rt], p, 4);
+	NEXT();
+op_SB:
+	LOAD(1);
+	p[0] = r[op->rt];
+	NEXT();
+op_SH:
+{
+	uint16_t half = r[op->rt];
+	LOAD(2);
+	memcpy(p, &half, 2);
+	NEXT();
+}
+op_SW:
+	LOAD(4);
+	memcpy(p, &r[op->rt], 4);
+	NEXT();
+op_FALLTHROUGH:
+	// block got too long, carry on with the next one
+	pc = block->end;
+	LEAVE();
+
+#undef NEXT
+#undef LEAVE
+#undef FAULT
+#undef LOAD
+
+stop:
+	result->elapsed_ms = monotonic_ms() - started - cpu.waited_ms;
+	result->executed = executed;
+	if (result->error == NULL)
+		result->exit_code = cpu.regs[4];
+	fflush(stdout);
+	sigaction(SIGINT, &old_action, NULL);
+	free_cpu(&cpu);
+	return result->error ? -1 : 0;
+}
+
+static void on_interrupt(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+static sim_block* decode_block(sim_cpu* cpu, uint32_t pc, const void* const* handlers)
+{
+	// predecode from pc up to and including the next instruction that
+	// leaves the block
+	uint32_t index = (pc - TEXT_BASE) >> 2;
+	int count = 0;
+	sim_op ops[SIM_MAX_BLOCK + 1];
+	bool ends_block = false;
+	while (!ends_block && count < SIM_MAX_BLOCK && index + count < cpu->text_words)
+	{
+		sim_op* op = &ops[count];
+		ends_block = decode_op(cpu->text[index + count], pc + 4 * count, op);
+		op->handler = handlers[(uintptr_t)op->handler];
+		++count;
+	}
+	if (!ends_block)
+	{
+		memset(&ops[count], 0, sizeof(sim_op));
+		ops[count].handler = handlers[OP_FALLTHROUGH];
+	}
+	sim_block* block = malloc(sizeof(sim_block) + (count + 1) * sizeof(sim_op));
+	if (block == NULL)
+		return NULL;
+	block->start = pc;
+	block->end = pc + 4 * count;
+	block->count = count;
+	memcpy(block->ops, ops, (count + !ends_block) * sizeof(sim_op));
+	return block;
+}
+
+static bool decode_op(uint32_t word, uint32_t pc, sim_op* op)
+{
+	// fill in op from an instruction word, op->handler is set to the
+	// opcode for now, returns true if op ends a block
+	int opcode = OP_ILLEGAL;
+	unsigned rs = (word >> 21) & 31, rt = (word >> 16) & 31, rd = (word >> 11) & 31;
+	int32_t simm = (int16_t)(word & 0xffff);
+	uint32_t branch = pc + 4 + ((uint32_t)simm << 2);
+	bool ends_block = false;
+
+	op->rs = rs;
+	op->rt = rt;
+	op->rd = rd ? rd : REG_SINK;
+	op->sa = (word >> 6) & 31;
+	op->imm = simm;
+	switch (word >> 26)
+	{
+	case 0x00:
+	{
+		static const unsigned char special[64] = {
+			[0x00] = OP_SLL, [0x02] = OP_SRL, [0x03] = OP_SRA, [0x04] = OP_SLLV,
+			[0x06] = OP_SRLV, [0x07] = OP_SRAV, [0x08] = OP_JR, [0x09] = OP_JALR,
+			[0x0a] = OP_MOVZ, [0x0b] = OP_MOVN, [0x0c] = OP_SYSCALL, [0x0d] = OP_BREAK,
+			[0x10] = OP_MFHI, [0x11] = OP_MTHI, [0x12] = OP_MFLO, [0x13] = OP_MTLO,
+			[0x18] = OP_MULT, [0x19] = OP_MULTU, [0x1a] = OP_DIV, [0x1b] = OP_DIVU,
+			[0x20] = OP_ADD, [0x21] = OP_ADDU, [0x22] = OP_SUB, [0x23] = OP_SUBU,
+			[0x24] = OP_AND, [0x25] = OP_OR, [0x26] = OP_XOR, [0x27] = OP_NOR,
+			[0x2a] = OP_SLT, [0x2b] = OP_SLTU, [0x34] = OP_TEQ
+		};
+		opcode = special[word & 63];
+		if (word == 0)
+			opcode = OP_NOP;
+		ends_block = opcode == OP_JR || opcode == OP_JALR || opcode == OP_SYSCALL;
+		break;
+	}
+	case 0x01:
+		if (rt == 0x00)
+			opcode = OP_BLTZ;
+		else if (rt == 0x01)
+			opcode = OP_BGEZ;
+		else if (rt == 0x10)
+			opcode = OP_BLTZAL;
+		else if (rt == 0x11)
+			opcode = OP_BGEZAL;
+		op->imm = branch;
+		ends_block = true;
+		break;
+	case 0x02:
+	case 0x03:
+		opcode = (word >> 26) == 0x02 ? OP_J : OP_JAL;
+		op->imm = ((pc + 4) & 0xf0000000) | ((word & 0x03ffffff) << 2);
+		ends_block = true;
+		break;
+	case 0x04: opcode = OP_BEQ; op->imm = branch; ends_block = true; break;
+	case 0x05: opcode = OP_BNE; op->imm = branch; ends_block = true; break;
+	case 0x06: opcode = OP_BLEZ; op->imm = branch; ends_block = true; break;
+	case 0x07: opcode = OP_BGTZ; op->imm = branch; ends_block = true; break;
+	case 0x08: opcode = OP_ADDI; break;
+	case 0x09: opcode = OP_ADDIU; break;
+	case 0x0a: opcode = OP_SLTI; break;
+	case 0x0b: opcode = OP_SLTIU; break;
+	case 0x0c: opcode = OP_ANDI; op->imm = word & 0xffff; break;
+	case 0x0d: opcode = OP_ORI; op->imm = word & 0xffff; break;
+	case 0x0e: opcode = OP_XORI; op->imm = word & 0xffff; break;
+	case 0x0f: opcode = OP_LUI; op->imm = word << 16; break;
+	case 0x1c:
+		switch (word & 63)
+		{
+		case 0x00: opcode = OP_MADD; break;
+		case 0x01: opcode = OP_MADDU; break;
+		case 0x02: opcode = OP_MUL; break;
+		case 0x04: opcode = OP_MSUB; break;
+		case 0x05: opcode = OP_MSUBU; break;
+		case 0x20: opcode = OP_CLZ; break;
+		case 0x21: opcode = OP_CLO; break;
+		}
+		break;
+	case 0x20: opcode = OP_LB; break;
+	case 0x21: opcode = OP_LH; break;
+	case 0x23: opcode = OP_LW; break;
+	case 0x24: opcode = OP_LBU; break;
+	case 0x25: opcode = OP_LHU; break;
+	case 0x28: opcode = OP_SB; break;
+	case 0x29: opcode = OP_SH; break;
+	case 0x2b: opcode = OP_SW; break;
+	}
+	// i-type instructions write rt, never let them write $zero either
+	if (opcode >= OP_ADDI && opcode <= OP_LUI)
+		op->rt = rt ? rt : REG_SINK;
+	if (opcode >= OP_LB && opcode <= OP_LHU)
+		op->rt = rt ? rt : REG_SINK;
+	if (opcode == OP_ILLEGAL)
+		ends_block = true;
+	op->handler = (const void*)(uintptr_t)opcode;
+	return ends_block;
+}
+
+static int do_syscall(sim_cpu* cpu, sim_result* result)
+{
+	// spim's syscalls, returns non-zero if the program should stop
+	uint32_t* r = cpu->regs;
+	char buf[LINE_LENGTH];
+	unsigned char* p;
+	long long started = monotonic_ms();
+	switch (r[2])
+	{
+	case 1:		// print_int
+		printf("%d", (int32_t)r[4]);
+		break;
+	case 4:		// print_string
+		for (uint32_t addr = r[4]; (p = sim_addr(cpu, addr, 1)) && *p; ++addr)
+			putchar(*p);
+		break;
+	case 5:		// read_int
+		fflush(stdout);
+		r[2] = fgets(buf, sizeof(buf), stdin) ? strtol(buf, NULL, 0) : 0;
+		cpu->waited_ms += monotonic_ms() - started;
+		break;
+	case 8:		// read_string
+	{
+		fflush(stdout);
+		uint32_t len = r[5];
+		p = len ? sim_addr(cpu, r[4], len) : NULL;
+		if (p == NULL)
+		{
+			result->error = "Bad address";
+			return -1;
+		}
+		if (fgets((char*)p, len, stdin) == NULL)
+			p[0] = '\0';
+		cpu->waited_ms += monotonic_ms() - started;
+		break;
+	}
+	case 9:		// sbrk
+	{
+		uint32_t old = cpu->brk;
+		uint32_t grown = old + ((r[4] + 7) & ~7u);
+		if (grown > DATA_BASE + SIM_DATA_SIZE || grown < old)
+		{
+			result->error = "Out of heap";
+			return -1;
+		}
+		cpu->brk = grown;
+		r[2] = old;
+		break;
+	}
+	case 10:	// exit
+		r[4] = 0;
+		return 1;
+	case 11:	// print_char
+		putchar(r[4]);
+		break;
+	case 12:	// read_char
+		fflush(stdout);
+		r[2] = getchar();
+		cpu->waited_ms += monotonic_ms() - started;
+		break;
+	case 17:	// exit2
+		return 1;
+	case 34:	// print_int_hex
+		printf("0x%08x", r[4]);
+		break;
+	case 36:	// print_int_unsigned
+		printf("%u", r[4]);
+		break;
+	default:
+		result->error = "Unknown syscall";
+		return -1;
+	}
+	return 0;
+}
+
+static inline unsigned char* sim_addr(sim_cpu* cpu, uint32_t addr, uint32_t size)
+{
+	// where size bytes at addr live, NULL if that's not memory we have
+	uint64_t end = (uint64_t)addr + size;
+	if (addr >= DATA_BASE && end <= DATA_BASE + (uint64_t)SIM_DATA_SIZE)
+		return cpu->data + (addr - DATA_BASE);
+	if (addr >= SIM_STACK_BASE && end <= SIM_STACK_TOP)
+		return cpu->stack + (addr - SIM_STACK_BASE);
+	return NULL;
+}
+
+static void free_cpu(sim_cpu* cpu)
+{
+	if (cpu->blocks)
+	{
+		for (size_t i = 0; i < cpu->text_words; ++i)
+			free(cpu->blocks[i]);
+	}
+	free(cpu->blocks);
+	free(cpu->data);
+	free(cpu->stack);
+}
@@ -0,0 +1,172 @@
+// symbols.c - reference counted name sets for labels and macros
+// open addressing with linear probing, names with a count of zero
+// stay in their slot as tombstones until the next rehash.
+#include <stdlib.h>
+#include <string.h>
+#include "headers/util.h"
+#include "headers/symbols.h"
+#include "headers/trie.h"
+
+#define SYMTAB_INITIAL_CAPACITY 64
+
+static uint32_t hash_name(const char* name);
+static symbol* find_slot(const symtab* table, const char* name);
+static void rehash(symtab* table, size_t capacity);
+
+symtab* symtab_new()
+{
+	symtab* table = calloc(1, sizeof(symtab));
+	if (table == NULL)
+		return NULL;
+	table->slots = calloc(SYMTAB_INITIAL_CAPACITY, sizeof(symbol));
+	if (table->slots == NULL)
+	{
+		free(table);
+		return NULL;
+	}
+	table->capacity = SYMTAB_INITIAL_CAPACITY;
+	return table;
+}
+
+void symtab_free(symtab* table)
+{
+	if (table == NULL)
+		return;
+	free(table->slots);
+	trie_free(table->prefixes);
+	free(table);
+}
+
+void symtab_clear(symtab* table)
+{
+	memset(table->slots, 0, table->capacity * sizeof(symbol));
+	table->used = 0;
+	table->live = 0;
+	++table->version;
+	if (table->prefixes)
+		trie_clear(table->prefixes);
+}
+
+void symtab_add(symtab* table, const char* name)
+{
+	if (name[0] == '\0')
+		return;
+	// keep the load factor (tombstones included) under 3/4
+	if ((table->used + 1) * 4 > table->capacity * 3)
+		rehash(table, table->live * 2 >= table->capacity / 2 ? table->capacity * 2 : table->capacity);
+	symbol* slot = find_slot(table, name);
+	if (slot->name[0] == '\0')
+	{
+		// couldn't grow, never fill the last empty slot
+		if (table->used + 1 >= table->capacity)
+			return;
+		strncpy(slot->name, name, MAX_SYMBOL_LENGTH - 1);
+		++table->used;
+	}
+	if (slot->count++ == 0)
+	{
+		++table->live;
+		++table->version;
+		if (table->prefixes)
+			trie_add(table->prefixes, slot->name, 0);
+	}
+}
+
+void symtab_remove(symtab* table, const char* name)
+{
+	symbol* slot = find_slot(table, name);
+	if (slot->name[0] == '\0' || slot->count == 0)
+		return;
+	if (--slot->count == 0)
+	{
+		--table->live;
+		++table->version;
+		if (table->prefixes)
+			trie_remove(table->prefixes, slot->name);
+	}
+}
+
+int symtab_count(const symtab* table, const char* name)
+{
+	if (name[0] == '\0')
+		return 0;
+	return find_slot(table, name)->count;
+}
+
+void symtab_set_value(symtab* table, const char* name, unsigned long value)
+{
+	// give name a value, adding it first if it isn't there
+	if (!symtab_contains(table, name))
+		symtab_add(table, name);
+	symbol* slot = find_slot(table, name);
+	if (slot->count > 0)
+		slot->value = value;
+}
+
+bool symtab_value(const symtab* table, const char* name, unsigned long* value)
+{
+	if (name[0] == '\0')
+		return false;
+	symbol* slot = find_slot(table, name);
+	if (slot->count == 0)
+		return false;
+	*value = slot->value;
+	return true;
+}
+
+int symtab_index_prefixes(symtab* table)
+{
+	// keep a trie of the live names as they come and go, so they can
+	// be looked up by prefix, see complete.c
+	if (table->prefixes)
+		return 0;
+	table->prefixes = trie_new();
+	if (table->prefixes == NULL)
+		return -1;
+	for (size_t i = 0; i < table->capacity; ++i)
+		if (table->slots[i].count > 0)
+			trie_add(table->prefixes, table->slots[i].name, 0);
+	return 0;
+}
+
+static uint32_t hash_name(const char* name)
+{
+	// only looks at as much of the name as we store
+	return fnv_hash_bytes(FNV_OFFSET, name, strnlen(name, MAX_SYMBOL_LENGTH - 1));
+}
+
+static symbol* find_slot(const symtab* table, const char* name)
+{
+	// the slot holding name, or the empty slot it would go in
+	size_t mask = table->capacity - 1;
+	size_t i = hash_name(name) & mask;
+	for (;;)
+	{
+		symbol* slot = &table->slots[i];
+		if (slot->name[0] == '\0' ||
+		        strncmp(slot->name, name, MAX_SYMBOL_LENGTH - 1) == 0)
+			return slot;
+		i = (i + 1) & mask;
+	}
+}
+
+static void rehash(symtab* table, size_t capacity)
+{
+	symbol* old = table->slots;
+	size_t old_capacity = table->capacity;
+	symbol* slots = calloc(capacity, sizeof(symbol));
+	if (slots == NULL)
+		return;		// keep probing the old table, it still has room
+	table->slots = slots;
+	table->capacity = capacity;
+	table->used = 0;
+	for (size_t i = 0; i < old_capacity; ++i)
+	{
+		if (old[i].count == 0)
+			continue;
+		symbol* slot = find_slot(table, old[i].name);
+		*slot = old[i];
+		++table->used;
+	}
+	free(old);
+}
@@ -0,0 +1,146 @@
+// trace.c - opt-in event tracing, see --trace=file
+// events go into a fixed size ring buffer that a background thread
+// drains into a chrome trace-event json file (load it in chrome://tracing
+// or perfetto). recording an event never blocks or allocates, if the
+// writer falls behind events are dropped and counted instead.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "headers/trace.h"
+
+// must be a power of two
+#define TRACE_RING_SIZE 65536
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+// how long the writer sleeps between drains
+#define TRACE_FLUSH_NS 20000000L
+
+typedef struct trace_slot
+{
+	unsigned long seq;		// index + 1 once the slot is published
+	long long ts;			// CLOCK_MONOTONIC nanoseconds
+	long arg;
+	unsigned char ev;
+	char phase;
+	unsigned short tid;
+} trace_slot;
+
+bool trace_enabled = false;
+
+static const char* event_names[TR_NUM_EVENTS] = {
+	"key", "lex", "labels", "load", "save", "redraw", "paste", "assemble", "simulate", "journal"
+};
+
+static trace_slot ring[TRACE_RING_SIZE];
+static unsigned long ring_head = 0;		// next slot a producer claims
+static unsigned long ring_tail = 0;		// next slot the writer reads
+static unsigned long dropped = 0;
+static unsigned short next_tid = 0;
+static __thread unsigned short my_tid = 0;
+
+static FILE* trace_file = NULL;
+static bool first_event = true;
+static bool writer_running = false;
+static pthread_t writer_thread;
+
+static void* writer_main(void* arg);
+static void drain_ring();
+
+static inline long long trace_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int trace_start(const char* filename)
+{
+	if (trace_enabled)
+		return 0;
+	trace_file = fopen(filename, "w");
+	if (!trace_file)
+		return -1;
+	fprintf(trace_file, "{\"traceEvents\":[\n");
+	first_event = true;
+	ring_head = ring_tail = dropped = 0;
+	__atomic_store_n(&writer_running, true, __ATOMIC_RELEASE);
+	if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0)
+	{
+		fclose(trace_file);
+		trace_file = NULL;
+		return -1;
+	}
+	trace_enabled = true;
+	return 0;
+}
+
+void trace_stop()
+{
+	if (!trace_enabled)
+		return;
+	trace_enabled = false;
+	__atomic_store_n(&writer_running, false, __ATOMIC_RELEASE);
+	pthread_join(writer_thread, NULL);
+	drain_ring();
+	fprintf(trace_file, "%s{\"name\":\"dropped\",\"ph\":\"M\",\"pid\":1,\"args\":{\"n\":%lu}}\n]}\n",
+		first_event ? "" : ",", __atomic_load_n(&dropped, __ATOMIC_RELAXED));
+	fclose(trace_file);
+	trace_file = NULL;
+}
+
+void trace_record(enum trace_event ev, char phase, long arg)
+{
+	if (my_tid == 0)
+		my_tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+	unsigned long head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	do
+	{
+		// full, don't wait on the writer
+		if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE)
+		{
+			__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&ring_head, &head, head + 1, true,
+		__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	trace_slot* slot = &ring[head & TRACE_RING_MASK];
+	slot->ts = trace_now();
+	slot->arg = arg;
+	slot->ev = ev;
+	slot->phase = phase;
+	slot->tid = my_tid;
+	__atomic_store_n(&slot->seq, head + 1, __ATOMIC_RELEASE);
+}
+
+static void drain_ring()
+{
+	unsigned long tail = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		trace_slot* slot = &ring[tail & TRACE_RING_MASK];
+		// not published yet (or claimed and still being filled)
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1)
+			break;
+		fprintf(trace_file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03lld,"
+			"\"pid\":1,\"tid\":%u,\"s\":\"t\",\"args\":{\"n\":%ld}}\n",
+			first_event ? "" : ",", event_names[slot->ev], slot->phase,
+			slot->ts / 1000, slot->ts % 1000, slot->tid, slot->arg);
+		first_event = false;
+		++tail;
+		__atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+	}
+	fflush(trace_file);
+}
+
+static void* writer_main(void* arg)
+{
+	(void)arg;
+	struct timespec delay = { 0, TRACE_FLUSH_NS };
+	while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
+	{
+		drain_ring();
+		nanosleep(&delay, NULL);
+	}
+	return NULL;
+}
@@ -0,0 +1,182 @@
+// trie.c - prefix trees over sets of names, see trie_complete
+// children hang off their parent as a sorted list of siblings, which
+// keeps nodes small and means a walk finds names in alphabetical order
+#include <stdlib.h>
+#include <string.h>
+#include "headers/trie.h"
+
+#define TRIE_INITIAL_NODES 256
+
+static bool grow(trie* t);
+static unsigned int find_child(const trie* t, unsigned int node, char c);
+static unsigned int add_child(trie* t, unsigned int node, char c);
+static int find_path(const trie* t, const char* name, unsigned int* path);
+static void collect(const trie* t, unsigned int node, char* name, int depth,
+	trie_match* out, int* found, int max);
+
+trie* trie_new()
+{
+	trie* t = calloc(1, sizeof(trie));
+	if (t == NULL)
+		return NULL;
+	t->nodes = calloc(TRIE_INITIAL_NODES, sizeof(trie_node));
+	if (t->nodes == NULL)
+	{
+		free(t);
+		return NULL;
+	}
+	t->capacity = TRIE_INITIAL_NODES;
+	t->used = 1;	// the root
+	return t;
+}
+
+void trie_free(trie* t)
+{
+	if (t == NULL)
+		return;
+	free(t->nodes);
+	free(t);
+}
+
+void trie_clear(trie* t)
+{
+	memset(t->nodes, 0, t->used * sizeof(trie_node));
+	t->used = 1;
+}
+
+bool trie_add(trie* t, const char* name, unsigned char tag)
+{
+	// add name (again), false if there wasn't room for it
+	unsigned int path[MAX_SYMBOL_LENGTH];
+	unsigned int node = 0;
+	int depth = 0;
+	path[0] = 0;
+	for (; name[depth] && depth < MAX_SYMBOL_LENGTH - 1; ++depth)
+	{
+		node = add_child(t, node, name[depth]);
+		if (node == 0)
+			return false;
+		path[depth + 1] = node;
+	}
+	if (node == 0)
+		return false;
+	t->nodes[node].tag = tag;
+	if (t->nodes[node].ends++ == 0)
+	{
+		for (int i = 0; i <= depth; ++i)
+			++t->nodes[path[i]].live;
+	}
+	return true;
+}
+
+void trie_remove(trie* t, const char* name)
+{
+	unsigned int path[MAX_SYMBOL_LENGTH];
+	int depth = find_path(t, name, path);
+	if (depth <= 0 || t->nodes[path[depth]].ends == 0)
+		return;
+	if (--t->nodes[path[depth]].ends == 0)
+	{
+		for (int i = 0; i <= depth; ++i)
+			--t->nodes[path[i]].live;
+	}
+}
+
+int trie_complete(const trie* t, const char* prefix, trie_match* out, int max)
+{
+	// up to max names that start with prefix, alphabetically, and
+	// how many there were
+	unsigned int path[MAX_SYMBOL_LENGTH];
+	char name[MAX_SYMBOL_LENGTH];
+	int depth = find_path(t, prefix, path);
+	if (depth < 0)
+		return 0;
+	memcpy(name, prefix, depth);
+	int found = 0;
+	collect(t, path[depth], name, depth, out, &found, max);
+	return found;
+}
+
+static bool grow(trie* t)
+{
+	size_t capacity = t->capacity * 2;
+	trie_node* bigger = realloc(t->nodes, capacity * sizeof(trie_node));
+	if (bigger == NULL)
+		return false;
+	memset(bigger + t->capacity, 0, (capacity - t->capacity) * sizeof(trie_node));
+	t->nodes = bigger;
+	t->capacity = capacity;
+	return true;
+}
+
+static unsigned int find_child(const trie* t, unsigned int node, char c)
+{
+	// node's child for c, 0 if it hasn't got one
+	for (unsigned int i = t->nodes[node].child; i; i = t->nodes[i].sibling)
+	{
+		if (t->nodes[i].c == c)
+			return i;
+		if ((unsigned char)t->nodes[i].c > (unsigned char)c)
+			break;
+	}
+	return 0;
+}
+
+static unsigned int add_child(trie* t, unsigned int node, char c)
+{
+	// node's child for c, made if it isn't there, 0 if we're out of
+	// memory. grow first, the link we follow points into the block
+	if (t->used == t->capacity && !grow(t))
+		return 0;
+	unsigned int* link = &t->nodes[node].child;
+	while (*link && (unsigned char)t->nodes[*link].c < (unsigned char)c)
+		link = &t->nodes[*link].sibling;
+	if (*link && t->nodes[*link].c == c)
+		return *link;
+	unsigned int added = t->used++;
+	t->nodes[added].c = c;
+	t->nodes[added].sibling = *link;
+	*link = added;
+	return added;
+}
+
+static int find_path(const trie* t, const char* name, unsigned int* path)
+{
+	// the nodes from the root down to the end of name, returns how
+	// deep that is or -1 if name isn't in the trie
+	int depth = 0;
+	path[0] = 0;
+	for (; name[depth]; ++depth)
+	{
+		if (depth == MAX_SYMBOL_LENGTH - 1)
+			return -1;
+		unsigned int node = find_child(t, path[depth], name[depth]);
+		if (node == 0)
+			return -1;
+		path[depth + 1] = node;
+	}
+	return depth;
+}
+
+static void collect(const trie* t, unsigned int node, char* name, int depth,
+	trie_match* out, int* found, int max)
+{
+	// every live name at or below node, name holds the path to it
+	const trie_node* n = &t->nodes[node];
+	if (n->live == 0 || *found == max)
+		return;
+	if (n->ends)
+	{
+		memcpy(out[*found].name, name, depth);
+		out[*found].name[depth] = '\0';
+		out[*found].tag = n->tag;
+		++*found;
+	}
+	if (depth == MAX_SYMBOL_LENGTH - 1)
+		return;
+	for (unsigned int i = n->child; i && *found < max; i = t->nodes[i].sibling)
+	{
+		name[depth] = t->nodes[i].c;
+		collect(t, i, name, depth + 1, out, found, max);
+	}
+}
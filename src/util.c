@@ -4,11 +4,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "headers/util.h"
 
+const char* const register_names[32] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
 
 // show info from /proc/version maybe?
 
+long long monotonic_ms()
+{
+	// wall clock milliseconds that never jump, unlike clock() this
+	// keeps counting while we're asleep in getch
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 double cpu_info()
 {
 	// calculate avg mhz used by cpus currently
@@ -32,3 +48,21 @@ double cpu_info()
 	fclose(fptr);
 	return total ? avg_mhz / total : 0;
 }
+
+uint32_t fnv_hash(const char* s)
+{
+	// of a whole string, without the terminator
+	uint32_t hash = FNV_OFFSET;
+	for (; *s; ++s)
+		hash = (hash ^ (unsigned char)*s) * FNV_PRIME;
+	return hash;
+}
+
+uint32_t fnv_hash_bytes(uint32_t hash, const void* data, size_t len)
+{
+	// carry on hashing from hash, start from FNV_OFFSET
+	const unsigned char* p = data;
+	for (size_t i = 0; i < len; ++i)
+		hash = (hash ^ p[i]) * FNV_PRIME;
+	return hash;
+}
@@ -0,0 +1,94 @@
+// watch.c - notices when something else changes the file we have open
+// we watch the file's directory rather than the file itself, so tools
+// that write a new file and rename it over ours are seen as well. events
+// are only a hint, whether the file really changed is down to comparing
+// it with how it was the last time we were in step with it.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "headers/watch.h"
+
+static int watch_fd = -1;
+static int watch_wd = -1;
+static char* watched = NULL;
+static const char* watched_name = NULL;	// the part after the last /
+static struct stat known;
+static bool known_valid = false;
+
+int watch_file(const char* filename)
+{
+	// watch filename instead of whatever we were, NULL just stops
+	if (watch_wd >= 0)
+		inotify_rm_watch(watch_fd, watch_wd);
+	watch_wd = -1;
+	free(watched);
+	watched = NULL;
+	known_valid = false;
+	if (filename == NULL)
+		return 0;
+	if (watch_fd < 0)
+		watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd < 0)
+		return -1;
+
+	watched = strdup(filename);
+	if (watched == NULL)
+		return -1;
+	char dir[PATH_MAX];
+	char* slash = strrchr(watched, '/');
+	if (slash == NULL)
+	{
+		strcpy(dir, ".");
+		watched_name = watched;
+	}
+	else
+	{
+		snprintf(dir, sizeof(dir), "%.*s", slash == watched ? 1 : (int)(slash - watched), watched);
+		watched_name = slash + 1;
+	}
+	watch_wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+	watch_sync();
+	return watch_wd < 0 ? -1 : 0;
+}
+
+bool watch_changed()
+{
+	// never blocks, true if the file isn't how it was at the last watch_sync
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool touched = false;
+	ssize_t len;
+	if (watch_wd < 0)
+		return false;
+	while ((len = read(watch_fd, buf, sizeof(buf))) > 0)
+	{
+		for (char* p = buf; p < buf + len; )
+		{
+			struct inotify_event* ev = (struct inotify_event*)p;
+			if (ev->len && strcmp(ev->name, watched_name) == 0)
+				touched = true;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if (!touched)
+		return false;
+	struct stat now;
+	if (stat(watched, &now) != 0)
+		return false;
+	return !known_valid || now.st_ino != known.st_ino || now.st_size != known.st_size ||
+		now.st_mtim.tv_sec != known.st_mtim.tv_sec || now.st_mtim.tv_nsec != known.st_mtim.tv_nsec;
+}
+
+void watch_sync()
+{
+	// what's on disk now is what we have
+	known_valid = watched && stat(watched, &known) == 0;
+}
+
+const char* watch_path()
+{
+	return watched;
+}
@@ -0,0 +1,222 @@
+// checks the assembler's encodings against words from llvm-mc
+// (-triple=mips -mcpu=mips32r2, jump targets filled in for TEXT_BASE),
+// run from the top of the tree with make check
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/headers/main.h"
+#include "../src/headers/parse.h"
+#include "../src/headers/asm.h"
+
+typedef struct encoding
+{
+	const char* source;
+	uint32_t word;
+} encoding;
+
+static const encoding encodings[] =
+{
+	{ "main: add $t0, $t1, $t2", 0x012a4020 },
+	{ "main: addi $t0, $t1, -5", 0x2128fffb },
+	{ "main: addiu $t0, $t1, -5", 0x2528fffb },
+	{ "main: addu $t0, $t1, $t2", 0x012a4021 },
+	{ "main: and $t0, $t1, $t2", 0x012a4024 },
+	{ "main: andi $t0, $t1, 0x1234", 0x31281234 },
+	{ "main: beq $t0, $t1, main", 0x1109ffff },
+	{ "main: bgez $t0, main", 0x0501ffff },
+	{ "main: bgezal $t0, main", 0x0511ffff },
+	{ "main: bgtz $t0, main", 0x1d00ffff },
+	{ "main: blez $t0, main", 0x1900ffff },
+	{ "main: bltz $t0, main", 0x0500ffff },
+	{ "main: bltzal $t0, main", 0x0510ffff },
+	{ "main: bne $t0, $t1, main", 0x1509ffff },
+	{ "main: break", 0x0000000d },
+	{ "main: clo $t0, $t1", 0x71284021 },
+	{ "main: clz $t0, $t1", 0x71284020 },
+	{ "main: div $t0, $t1", 0x0109001a },
+	{ "main: divu $t0, $t1", 0x0109001b },
+	{ "main: j main", 0x08100000 },
+	{ "main: jal main", 0x0c100000 },
+	{ "main: jalr $t1", 0x0120f809 },
+	{ "main: jr $t1", 0x01200008 },
+	{ "main: lb $t0, -8($sp)", 0x83a8fff8 },
+	{ "main: lbu $t0, -8($sp)", 0x93a8fff8 },
+	{ "main: lh $t0, -8($sp)", 0x87a8fff8 },
+	{ "main: lhu $t0, -8($sp)", 0x97a8fff8 },
+	{ "main: lui $t0, 0x1234", 0x3c081234 },
+	{ "main: lw $t0, -8($sp)", 0x8fa8fff8 },
+	{ "main: madd $t0, $t1", 0x71090000 },
+	{ "main: maddu $t0, $t1", 0x71090001 },
+	{ "main: mfhi $t0", 0x00004010 },
+	{ "main: mflo $t0", 0x00004012 },
+	{ "main: movn $t0, $t1, $t2", 0x012a400b },
+	{ "main: movz $t0, $t1, $t2", 0x012a400a },
+	{ "main: msub $t0, $t1", 0x71090004 },
+	{ "main: msubu $t0, $t1", 0x71090005 },
+	{ "main: mthi $t1", 0x01200011 },
+	{ "main: mtlo $t1", 0x01200013 },
+	{ "main: mul $t0, $t1, $t2", 0x712a4002 },
+	{ "main: mult $t0, $t1", 0x01090018 },
+	{ "main: multu $t0, $t1", 0x01090019 },
+	{ "main: nop", 0x00000000 },
+	{ "main: nor $t0, $t1, $t2", 0x012a4027 },
+	{ "main: or $t0, $t1, $t2", 0x012a4025 },
+	{ "main: ori $t0, $t1, 0x1234", 0x35281234 },
+	{ "main: sb $t0, -8($sp)", 0xa3a8fff8 },
+	{ "main: sh $t0, -8($sp)", 0xa7a8fff8 },
+	{ "main: sll $t0, $t1, 3", 0x000940c0 },
+	{ "main: sllv $t0, $t1, $t2", 0x01494004 },
+	{ "main: slt $t0, $t1, $t2", 0x012a402a },
+	{ "main: slti $t0, $t1, -5", 0x2928fffb },
+	{ "main: sltiu $t0, $t1, -5", 0x2d28fffb },
+	{ "main: sltu $t0, $t1, $t2", 0x012a402b },
+	{ "main: sra $t0, $t1, 3", 0x000940c3 },
+	{ "main: srav $t0, $t1, $t2", 0x01494007 },
+	{ "main: srl $t0, $t1, 3", 0x000940c2 },
+	{ "main: srlv $t0, $t1, $t2", 0x01494006 },
+	{ "main: sub $t0, $t1, $t2", 0x012a4022 },
+	{ "main: subu $t0, $t1, $t2", 0x012a4023 },
+	{ "main: sw $t0, -8($sp)", 0xafa8fff8 },
+	{ "main: syscall", 0x0000000c },
+	{ "main: teq $t0, $t1", 0x01090034 },
+	{ "main: xor $t0, $t1, $t2", 0x012a4026 },
+	{ "main: xori $t0, $t1, 0x1234", 0x39281234 },
+};
+
+static int failures = 0;
+
+static void load(doc* document, const char* text);
+static void unload(doc* document);
+static void check_encoding(const encoding* e);
+static void check_align_in_text();
+static void check_data_ranges();
+static void fail(const char* what, const char* source);
+
+int main()
+{
+	if (init_parser() < 0)
+	{
+		fprintf(stderr, "asm_check: can't read the tables in dat/\n");
+		return EXIT_FAILURE;
+	}
+	size_t count = sizeof(encodings) / sizeof(encodings[0]);
+	for (size_t i = 0; i < count; ++i)
+		check_encoding(&encodings[i]);
+	check_align_in_text();
+	check_data_ranges();
+	if (failures)
+	{
+		printf("asm_check: %d failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("asm_check: %zu encodings ok\n", count);
+	return EXIT_SUCCESS;
+}
+
+static void load(doc* document, const char* text)
+{
+	// one docline per line of text, assembled
+	memset(document, 0, sizeof(doc));
+	init_symbols(document);
+	docline* prev = NULL;
+	for (const char* s = text; *s; )
+	{
+		size_t len = strcspn(s, "\n");
+		docline* line = calloc(1, sizeof(docline));
+		if (line == NULL)
+			exit(EXIT_FAILURE);
+		memcpy(line->line, s, len < LINE_LENGTH - 1 ? len : LINE_LENGTH - 1);
+		line->prevline = prev;
+		if (prev)
+			prev->nextline = line;
+		else
+			document->head = line;
+		document->tail = prev = line;
+		++document->number_of_lines;
+		s += len + (s[len] == '\n');
+	}
+	find_labels(document);
+	asm_assemble(document);
+}
+
+static void unload(doc* document)
+{
+	docline* line = document->head;
+	while (line)
+	{
+		docline* next = line->nextline;
+		asm_forget_line(line);
+		free(line->defs);
+		free(line->label_ref);
+		free(line);
+		line = next;
+	}
+	asm_free(document);
+	free_symbols(document);
+}
+
+static void check_encoding(const encoding* e)
+{
+	doc document;
+	load(&document, e->source);
+	assembler* as = document.assembly;
+	if (as->errors)
+		fail("doesn't assemble", e->source);
+	else if (as->text_words != 1 || as->text[0] != e->word)
+	{
+		printf("  got 0x%08x, want 0x%08x\n", as->text_words ? as->text[0] : 0, e->word);
+		fail("wrong encoding", e->source);
+	}
+	unload(&document);
+}
+
+static void check_align_in_text()
+{
+	// text[(pc - TEXT_BASE) / 4] has to stay the word at pc, so the gap
+	// .align leaves is filled with nops from the .align line
+	const char* source = ".text\nnop\n.align 3\nsyscall\n";
+	doc document;
+	load(&document, source);
+	assembler* as = document.assembly;
+	docline* align = document.head->nextline->nextline;
+	if (as->errors || as->text_words != 3)
+		fail("wrong size", source);
+	else if (as->text[1] != 0 || as->text_lines[1] != align)
+		fail("no nop from the .align", source);
+	else if (as->text[2] != 0x0000000c || align->nextline->asm_info->addr != TEXT_BASE + 8)
+		fail("syscall not at its address", source);
+	unload(&document);
+}
+
+static void check_data_ranges()
+{
+	static const struct
+	{
+		const char* source;
+		bool ok;
+	} cases[] =
+	{
+		{ ".data\n.byte -128, 255\n", true },
+		{ ".data\n.byte 256\n", false },
+		{ ".data\n.byte -129\n", false },
+		{ ".data\n.half -32768, 65535\n", true },
+		{ ".data\n.half 65536\n", false },
+		{ ".data\n.half -32769\n", false },
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		doc document;
+		load(&document, cases[i].source);
+		if ((document.assembly->errors == 0) != cases[i].ok)
+			fail(cases[i].ok ? "should assemble" : "should be out of range", cases[i].source);
+		unload(&document);
+	}
+}
+
+static void fail(const char* what, const char* source)
+{
+	printf("asm_check: %s: %s\n", what, source);
+	++failures;
+}